@@ -0,0 +1,38 @@
+#!/bin/sh
+# Compares pinned and unpinned throughput of epoll_server and tcp_server.
+# Each server runs once without placement and once with --cpus, under the
+# same bench_client load; the pinned runs print the CPUs they used.
+#
+# Usage: bench/compare_affinity.sh [threads] [seconds] [cpus] [conns]
+# cpus is a CPU list (e.g. 0-3) or auto / auto:IFNAME (default auto).
+# Run from the repository root after `make`. On a multi-socket machine, run
+# the client on the other node (e.g. with taskset) so it does not compete
+# with the pinned threads.
+
+THREADS=${1:-4}
+SECONDS_=${2:-5}
+CPUS=${3:-auto}
+CONNS=${4:-64}
+TCP_PORT=19996
+SINK_PORT=15144
+
+run() {
+    label=$1
+    server=$2
+    shift 2
+    echo "=== $server: $label ($THREADS threads, $CONNS connections) ==="
+    (sleep $((SECONDS_ + 3)); echo quit) |
+        "./bin/$server" "$@" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/${server}_affinity.log" 2>&1 &
+    sleep 1
+    ./bin/bench_client throughput 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c "$CONNS" -T 4 -d "$SECONDS_" -s 128
+    wait
+    grep '^Thread placement' "/tmp/${server}_affinity.log"
+    echo
+}
+
+run "unpinned" epoll_server -t "$THREADS"
+run "pinned to $CPUS" epoll_server -t "$THREADS" --cpus "$CPUS"
+run "unpinned" tcp_server -w "$THREADS"
+run "pinned to $CPUS" tcp_server -w "$THREADS" --cpus "$CPUS"
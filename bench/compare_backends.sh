@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs the same loopback workload against epoll_server's epoll and io_uring
+# backends and prints bench_client's results next to each server's own
+# syscall statistics.
+#
+# Usage: bench/compare_backends.sh [conns] [seconds] [record_size] [reactors]
+# Run from the repository root after `make`.
+
+CONNS=${1:-256}
+SECONDS_=${2:-5}
+SIZE=${3:-128}
+REACTORS=${4:-1}
+TCP_PORT=19999
+SINK_PORT=15141
+
+for backend in epoll uring; do
+    echo "=== backend: $backend ($REACTORS reactor(s), $CONNS connections, ${SIZE}B records) ==="
+    # The server quits on its own after the benchmark window plus drain time
+    (sleep $((SECONDS_ + 3)); echo quit) |
+        ./bin/epoll_server -t "$REACTORS" -B "$backend" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/epoll_server_$backend.log" 2>&1 &
+    sleep 1
+    ./bin/bench_client throughput 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c "$CONNS" -T 4 -d "$SECONDS_" -s "$SIZE"
+    wait
+    grep '^Reactor' "/tmp/epoll_server_$backend.log"
+    echo
+done
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compares per-thread connected UDP egress sockets with one shared,
+# unconnected socket. tcp_server runs with one worker per sender and
+# epoll_server with one reactor per sender, each in both modes, under the
+# same bench_client load.
+#
+# Usage: bench/compare_udp_egress.sh [senders] [seconds] [record_size] [sndbuf]
+# Run from the repository root after `make`. sndbuf 0 keeps the system default.
+
+SENDERS=${1:-64}
+SECONDS_=${2:-5}
+SIZE=${3:-128}
+SNDBUF=${4:-0}
+TCP_PORT=19997
+SINK_PORT=15143
+
+run() {
+    label=$1
+    server=$2
+    shift 2
+    echo "=== $server: $label ($SENDERS senders, ${SIZE}B records) ==="
+    (sleep $((SECONDS_ + 3)); echo quit) |
+        "./bin/$server" "$@" -o "$SNDBUF" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/${server}_egress.log" 2>&1 &
+    sleep 1
+    ./bin/bench_client throughput 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c "$SENDERS" -T 4 -d "$SECONDS_" -s "$SIZE"
+    wait
+    grep '^Egress' "/tmp/${server}_egress.log"
+    echo
+}
+
+run "connected per worker" tcp_server -w "$SENDERS"
+run "shared socket" tcp_server -w "$SENDERS" --shared-udp
+run "connected per reactor" epoll_server -t "$SENDERS"
+run "shared socket" epoll_server -t "$SENDERS" --shared-udp
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Hot-upgrade check under load. For tcp_server and epoll_server, in both
+# upgrade modes ('upgrade' drains, 'upgrade clients' hands the connections
+# over): a throughput run with the upgrade halfway through, which must still
+# deliver 100% of the sent bytes, and a reconnect storm with the upgrade a
+# moment after it starts, in which no connection may fail.
+#
+# Usage: bench/hot_upgrade.sh [conns] [seconds] [storm_conns]
+# Run from the repository root after `make`. The servers re-execute
+# ./bin/<server>, so the binaries can be rebuilt while this runs.
+
+CONNS=${1:-64}
+SECONDS_=${2:-6}
+STORM=${3:-10000}
+TCP_PORT=19996
+SINK_PORT=15144
+FIFO=/tmp/hot_upgrade_console.$$
+
+# Every generation of the server reads its console from the same FIFO
+mkfifo "$FIFO" || exit 1
+exec 3<>"$FIFO"
+trap 'rm -f "$FIFO"' EXIT
+
+run() {
+    server=$1
+    command=$2
+    load=$3
+    shift 3
+    echo "=== $server: '$command' during $load ==="
+    "./bin/$server" "$@" $TCP_PORT 127.0.0.1 $SINK_PORT < "$FIFO" > "/tmp/${server}_upgrade.log" 2>&1 &
+    sleep 1
+    if [ "$load" = throughput ]; then
+        (sleep $((SECONDS_ / 2)); echo "$command" >&3) &
+        ./bin/bench_client throughput 127.0.0.1 $TCP_PORT $SINK_PORT -c "$CONNS" -T 4 -d "$SECONDS_"
+    else
+        (sleep 0.2; echo "$command" >&3) &
+        ./bin/bench_client storm 127.0.0.1 $TCP_PORT $SINK_PORT -c "$STORM" -T 8 -d 20
+    fi
+    wait
+    sleep 1
+    echo quit >&3  # Stops the new process (the old one has exited or is draining)
+    sleep 1
+    grep -i 'upgrade\|drain' "/tmp/${server}_upgrade.log"
+    echo
+}
+
+for command in upgrade "upgrade clients"; do
+    run tcp_server "$command" throughput -w 4
+    run tcp_server "$command" storm -w 4
+    run epoll_server "$command" throughput -t 4
+    run epoll_server "$command" storm -t 4
+done
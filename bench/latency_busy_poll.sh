@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compares epoll_server's end-to-end forwarding latency with and without
+# busy polling. bench_client sends timestamped records at a fixed, low rate
+# over loopback and reports p50/p99/p99.9 of the delay until each record
+# reaches its UDP sink.
+#
+# Usage: bench/latency_busy_poll.sh [rate] [seconds] [busy_poll_us] [spin_us]
+# Run from the repository root after `make`. SO_BUSY_POLL above
+# net.core.busy_read needs root (CAP_NET_ADMIN).
+
+RATE=${1:-2000}
+SECONDS_=${2:-5}
+BUSY_POLL=${3:-50}
+SPIN=${4:-200}
+TCP_PORT=19998
+SINK_PORT=15142
+
+run() {
+    label=$1
+    shift
+    echo "=== $label ==="
+    (sleep $((SECONDS_ + 2)); echo quit) |
+        ./bin/epoll_server "$@" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/epoll_server_latency.log" 2>&1 &
+    sleep 1
+    ./bin/bench_client latency 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c 1 -r "$RATE" -d "$SECONDS_" -s 64
+    wait
+    grep 'busy-poll' "/tmp/epoll_server_latency.log"
+    echo
+}
+
+run "blocking (default)"
+run "busy-poll ${BUSY_POLL}us, spin ${SPIN}us" --busy-poll "$BUSY_POLL" --spin "$SPIN"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Per-client rate limiting check. bench_client's connections all come from
+# 127.0.0.1, so they share one client budget: with --ip-bytes the rate that
+# reaches the sink must drop to about the budget (plus one burst spread over
+# the run), and the servers must report throttled connections instead of
+# dropped data. A run with --ip-conns shows connections refused at accept.
+#
+# Usage: bench/rate_limit.sh [bytes_per_s] [seconds] [conns]
+# Run from the repository root after `make`.
+
+RATE=${1:-2000000}
+SECONDS_=${2:-5}
+CONNS=${3:-32}
+TCP_PORT=19996
+SINK_PORT=15144
+
+run() {
+    label=$1
+    server=$2
+    shift 2
+    echo "=== $server: $label ==="
+    (sleep $((SECONDS_ + 3)); echo quit) |
+        "./bin/$server" "$@" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/${server}_rate_limit.log" 2>&1 &
+    sleep 1
+    ./bin/bench_client throughput 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c "$CONNS" -T 4 -d "$SECONDS_" 2>&1 | grep -v '^send_all\|^connect'
+    wait
+    grep 'rate limiting\|^Rate limiting' "/tmp/${server}_rate_limit.log"
+    echo
+}
+
+run "unlimited" epoll_server -t 2
+run "--ip-bytes $RATE" epoll_server -t 2 --ip-bytes "$RATE"
+run "--ip-conns $((CONNS / 2))" epoll_server -t 2 --ip-conns $((CONNS / 2))
+run "unlimited" tcp_server -w 2
+run "--ip-bytes $RATE" tcp_server -w 2 --ip-bytes "$RATE"
+run "--ip-conns $((CONNS / 2))" tcp_server -w 2 --ip-conns $((CONNS / 2))
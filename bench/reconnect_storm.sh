@@ -0,0 +1,33 @@
+#!/bin/sh
+# Reconnect-storm benchmark: opens CONNS connections as fast as possible, each
+# sending one record, and reports how long epoll_server takes to accept and
+# forward all of them. Runs once with the old accept path settings (backlog 10,
+# one accept per wake-up) and once with the defaults.
+#
+# Usage: bench/reconnect_storm.sh [conns] [timeout_seconds] [extra epoll_server options]
+# Run from the repository root after `make`. Both processes need CONNS file
+# descriptors, so raise `ulimit -n` first if necessary.
+
+CONNS=${1:-10000}
+TIMEOUT=${2:-30}
+shift 2 2>/dev/null
+EXTRA="$*"
+TCP_PORT=19999
+SINK_PORT=15141
+
+run() {
+    label=$1
+    shift
+    echo "=== $label ==="
+    (sleep $((TIMEOUT + 3)); echo quit) |
+        ./bin/epoll_server "$@" $EXTRA $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > /tmp/epoll_server_storm.log 2>&1 &
+    sleep 1
+    ./bin/bench_client storm 127.0.0.1 $TCP_PORT $SINK_PORT -c "$CONNS" -T 8 -d "$TIMEOUT"
+    wait
+    grep 'accept:' /tmp/epoll_server_storm.log
+    echo
+}
+
+run "backlog 10, one accept per wake-up" -l 10 -a 1
+run "default backlog and accept budget"
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Append cost of udp_server's log sinks under large bursts. sink_bench plays
+# a receive thread and appends bursts of records through stdio (fwrite() and
+# fflush() per record, the original udp_server), the writev() log writer, the
+# memory-mapped log writer and the io_uring log writer, and prints the time per append (what a
+# receive thread loses per datagram) and the total time until the data is in
+# the file. Logs go to LOG_DIR (default /tmp), which should be on the disk
+# you want to measure; SYNC_MS adds fdatasync()/msync() every SYNC_MS ms to
+# the writer sinks, DEPTH sets the io_uring writes in flight (default 8),
+# ROTATE makes the writer sinks rotate the log every ROTATE bytes.
+#
+# Usage: bench/sink_burst.sh [records_per_burst] [bursts] [size] [gap_ms]
+# Run from the repository root after `make`.
+
+RECORDS=${1:-200000}
+BURSTS=${2:-10}
+SIZE=${3:-256}
+GAP_MS=${4:-100}
+LOG_DIR=${LOG_DIR:-/tmp}
+SYNC_MS=${SYNC_MS:-0}
+DEPTH=${DEPTH:-8}
+ROTATE=${ROTATE:-0}
+
+for sink in stdio write mmap uring; do
+    echo "=== $sink ==="
+    rotate=
+    if [ "$ROTATE" -gt 0 ] && [ "$sink" != stdio ]; then
+        rotate="-R $ROTATE"
+    fi
+    ./bin/sink_bench -n "$RECORDS" -r "$BURSTS" -z "$SIZE" -g "$GAP_MS" -y "$SYNC_MS" -d "$DEPTH" \
+        $rotate "$sink" "$LOG_DIR/sink_burst.log"
+    echo
+done
+rm -f "$LOG_DIR"/sink_burst.log*
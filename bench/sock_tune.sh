@@ -0,0 +1,43 @@
+#!/bin/sh
+# Wake-ups per message with and without a socket-tuning profile. Two device-
+# like workloads run against each server and profile:
+#   - storm: conns connections open, stay silent for think_ms, then send one
+#     record each, written in 4 segments (TCP_DEFER_ACCEPT, SO_RCVLOWAT);
+#   - latency: records at a low rate over 50 connections, again in 4 segments
+#     (SO_RCVLOWAT), with the delay each record takes to reach the sink.
+# bench_client -p reports the server's voluntary context switches per
+# delivered record.
+#
+# Usage: bench/sock_tune.sh [conns] [think_ms] [record_size] [profile]
+# profile defaults to devices with SO_RCVLOWAT at the record size. Run from
+# the repository root after `make`.
+
+CONNS=${1:-1000}
+THINK=${2:-1000}
+SIZE=${3:-128}
+PROFILE=${4:-devices,lowat=$SIZE}
+TCP_PORT=19996
+SINK_PORT=15144
+
+run() {
+    label=$1
+    server=$2
+    shift 2
+    echo "=== $server: $label ==="
+    (sleep 12; echo quit) | "./bin/$server" "$@" $TCP_PORT 127.0.0.1 $SINK_PORT \
+        > "/tmp/${server}_sock_tune.log" 2>&1 &
+    sleep 1
+    pid=$(pgrep -n "$server")
+    ./bin/bench_client storm 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c "$CONNS" -T 2 -s "$SIZE" -w "$THINK" -g 4 -d 8 -p "$pid" | grep 'storm\|wake-ups'
+    ./bin/bench_client latency 127.0.0.1 $TCP_PORT $SINK_PORT \
+        -c 50 -r 500 -d 3 -s "$SIZE" -g 4 -p "$pid" | grep 'latency\|wake-ups'
+    wait
+    grep 'socket profile' "/tmp/${server}_sock_tune.log"
+    echo
+}
+
+run "default" epoll_server
+run "$PROFILE" epoll_server --tune "$PROFILE"
+run "default" tcp_server -w 1
+run "$PROFILE" tcp_server -w 1 --tune "$PROFILE"
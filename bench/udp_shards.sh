@@ -0,0 +1,45 @@
+#!/bin/sh
+# Ingest rate of udp_server with 1..N SO_REUSEPORT receive shards, with the
+# shared log writer and with one log file per shard. bench_client floods the
+# port from many UDP sockets (so the kernel can spread them over the shards)
+# and reports what it sent; udp_server's exit report gives what it received
+# per shard and how the writers kept up. Logs go to LOG_DIR (default /tmp),
+# which should be on the disk you want to measure. Set CPUS to a CPU list
+# (or auto) to pin the shards and writers with -C.
+#
+# Usage: bench/udp_shards.sh [max_shards] [seconds] [sockets] [size]
+# Run from the repository root after `make`. Sender threads compete with
+# the shards for CPUs: on a 16-core machine, e.g. bench/udp_shards.sh 8.
+
+MAX=${1:-4}
+SECONDS_=${2:-5}
+SOCKETS=${3:-64}
+SIZE=${4:-64}
+UDP_PORT=15140
+LOG_DIR=${LOG_DIR:-/tmp}
+CPUS=${CPUS:-}
+
+run() {
+    shards=$1
+    output=$2
+    echo "=== udp_server -t $shards -O $output ($SOCKETS sockets, $SIZE-byte datagrams) ==="
+    rm -f "$LOG_DIR"/udp_shards.log*
+    (sleep $((SECONDS_ + 2)); echo quit) |
+        ./bin/udp_server -t "$shards" -O "$output" ${CPUS:+-C "$CPUS"} $UDP_PORT \
+        "$LOG_DIR/udp_shards.log" > /tmp/udp_shards_server.log 2>&1 &
+    sleep 1
+    ./bin/bench_client flood 127.0.0.1 $UDP_PORT -c "$SOCKETS" -T 4 -d "$SECONDS_" -s "$SIZE"
+    wait
+    grep '^Receive:\|^Datagrams per shard\|dropped' /tmp/udp_shards_server.log
+    echo
+}
+
+shards=1
+while [ "$shards" -le "$MAX" ]; do
+    run "$shards" shared
+    if [ "$shards" -gt 1 ]; then
+        run "$shards" split
+    fi
+    shards=$((shards * 2))
+done
+rm -f "$LOG_DIR"/udp_shards.log*
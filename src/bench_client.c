@@ -0,0 +1,929 @@
+/**
+ * @file bench_client.c
+ * @brief Load generator for benchmarking the TCP-to-UDP forwarders on loopback.
+ *
+ * The benchmark plays both ends of the pipeline:
+ *   - Sender threads open many TCP connections to the forwarder under test
+ *     and write fixed-size newline-terminated records as fast as they can.
+ *   - A sink thread binds the UDP port the forwarder sends to and counts
+ *     every datagram and byte that arrives.
+ *
+ * Usage:
+ *   ./bench_client throughput <host> <tcp_port> <sink_port> [options]
+ *   ./bench_client storm <host> <tcp_port> <sink_port> [options]
+ *   ./bench_client latency <host> <tcp_port> <sink_port> [options]
+ *   ./bench_client flood <host> <udp_port> [options]
+ *
+ * `throughput` measures sustained forwarding rate. `storm` models a reconnect
+ * storm: every connection is opened as fast as possible and sends a single
+ * record, and the benchmark reports how long it takes until the forwarder has
+ * accepted all of them (a record can only reach the sink once its connection
+ * was accepted).
+ *
+ * `latency` sends records at a fixed rate (`-r`), each carrying its send time,
+ * and the sink computes the end-to-end delay of every record it receives. The
+ * report gives p50/p99/p99.9 in microseconds; the rate is kept low enough that
+ * the forwarder is idle between records, so the numbers are dominated by how
+ * fast it wakes up.
+ *
+ * Slow devices are modelled by `-w` (storm: connect, stay silent for that
+ * many milliseconds, then send) and `-g` (storm and latency: write every
+ * record in that many separate segments, PIECE_GAP_US apart). With `-p PID`
+ * the benchmark reads the forwarder's voluntary context switches from
+ * /proc before and after the run and reports them per delivered record:
+ * every time a server thread blocks and is woken up counts once, so this is
+ * the number of wake-ups one message costs.
+ *
+ * `flood` benchmarks udp_server instead of a forwarder: `-c` UDP sockets,
+ * each with its own source port so SO_REUSEPORT spreads them over the
+ * server's shards, send `-s`-byte lines with sendmmsg() as fast as they can.
+ * It reports the send rate; what arrived is in udp_server's exit report.
+ *
+ * Example (forwarder started as `epoll_server -t 4 9999 127.0.0.1 5141`):
+ *   ./bench_client throughput 127.0.0.1 9999 5141 -c 256 -T 4 -d 10
+ *   ./bench_client storm 127.0.0.1 9999 5141 -c 10000 -T 8 -d 30
+ *   ./bench_client latency 127.0.0.1 9999 5141 -c 1 -r 2000 -d 10 -s 64
+ *   ./bench_client flood 127.0.0.1 5140 -c 64 -T 8 -d 10 -s 64   (udp_server on 5140)
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include "send_all.h"
+
+#define BUFFER_SIZE 65536  ///< Size of the sink receive buffer (largest UDP datagram)
+#define STAMP_DIGITS 20    ///< Width of the send timestamp at the start of a latency record
+#define PIECE_GAP_US 200   ///< Pause between the segments of a record with -g
+#define FLOOD_BATCH 64     ///< Datagrams per sendmmsg() call in flood mode
+
+static volatile int sending = 1;  ///< Cleared when the measurement window ends
+static volatile int sinking = 1;  ///< Cleared once in-flight datagrams had time to drain
+static pthread_barrier_t connected;  ///< Senders and main meet here once every connection is up
+
+// Benchmark parameters shared by all threads (set once in main)
+static struct sockaddr_in target_addr;
+static int num_conns = 64;
+static int num_threads = 4;
+static int duration_sec = 5;
+static int msg_size = 128;
+static int sink_port = 0;
+static int send_rate = 1000;  ///< Records per second in latency mode
+static int pieces = 1;        ///< Segments each storm/latency record is written in (-g)
+static int think_ms = 0;      ///< Storm: silence between connect and the record (-w)
+static int server_pid = 0;    ///< Forwarder whose wake-ups are reported (-p), 0 = none
+
+// Results of the sink thread (read by main after join)
+static volatile unsigned long long sink_datagrams = 0;
+static volatile unsigned long long sink_bytes = 0;
+static double sink_last = 0;  ///< Arrival time of the last datagram (now_sec() clock)
+static uint64_t* latencies = NULL;  ///< Per-record delays in ns (latency mode only)
+static size_t num_latencies = 0;    ///< Entries used in latencies
+static size_t latencies_cap = 0;    ///< Capacity of latencies
+
+// Per-sender-thread state
+typedef struct {
+    int conn_count;               ///< Number of connections this thread owns
+    unsigned long long messages;  ///< Records sent by this thread
+    unsigned long long failed;    ///< Flood: sendmmsg() calls refused by the kernel
+} sender_t;
+
+// Per-storm-thread state
+typedef struct {
+    int conn_count;       ///< Connections this thread opens
+    int connected;        ///< Connections that completed connect() and sent their record
+    int failed;           ///< Connections that failed
+    double max_connect;   ///< Slowest connect() in seconds
+} storm_t;
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in seconds.
+ */
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the voluntary context switches of all threads of server_pid.
+ *
+ * Summed over /proc/PID/task/<tid>/status; 0 without -p or if the process is gone.
+ */
+static unsigned long long server_wakeups(void) {
+    if (server_pid <= 0) {
+        return 0;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", server_pid);
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    unsigned long long total = 0;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char status[300];
+        snprintf(status, sizeof(status), "/proc/%d/task/%s/status", server_pid, de->d_name);
+        FILE* f = fopen(status, "r");
+        if (!f) {
+            continue;  // The thread exited in between
+        }
+        char line[128];
+        unsigned long long n;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &n) == 1) {
+                total += n;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return total;
+}
+
+/**
+ * @brief Prints the forwarder's wake-ups during a run, per delivered record.
+ *
+ * @param before   server_wakeups() at the start of the run.
+ * @param records  Records that reached the sink.
+ */
+static void print_wakeups(unsigned long long before, unsigned long long records) {
+    if (server_pid <= 0) {
+        return;
+    }
+    unsigned long long wakeups = server_wakeups() - before;
+    printf("server wake-ups: %llu (%.2f per delivered record)\n",
+           wakeups, records ? (double)wakeups / (double)records : 0.0);
+}
+
+/**
+ * @brief Writes one record, split into `pieces` segments when -g asks for it.
+ *
+ * @param fd  Connected socket (TCP_NODELAY when pieces > 1).
+ * @param msg Record.
+ * @return 0 on success, -1 on error.
+ */
+static int send_record(int fd, const char* msg) {
+    int off = 0;
+    for (int i = 0; i < pieces; i++) {
+        int end = msg_size * (i + 1) / pieces;
+        if (end > off && send_all(fd, msg + off, (size_t)(end - off)) != 0) {
+            return -1;
+        }
+        off = end;
+        if (i + 1 < pieces) {
+            usleep(PIECE_GAP_US);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets TCP_NODELAY so each segment of a split record leaves on its own.
+ */
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * @brief Records the delay of every timestamped record in a datagram.
+ *
+ * A datagram may carry several newline-terminated records when the forwarder
+ * packs them; each starts with its send time in nanoseconds. Fragments
+ * without a stamp (the tail of a torn record) are skipped.
+ *
+ * @param data    Datagram payload.
+ * @param len     Payload length.
+ * @param arrival Time the datagram was received (now_ns() clock).
+ */
+static void record_latencies(const char* data, size_t len, uint64_t arrival) {
+    size_t off = 0;
+    while (off + STAMP_DIGITS <= len && num_latencies < latencies_cap) {
+        uint64_t sent = 0;
+        int i = 0;
+        for (; i < STAMP_DIGITS && data[off + i] >= '0' && data[off + i] <= '9'; i++) {
+            sent = sent * 10 + (uint64_t)(data[off + i] - '0');
+        }
+        // A raw forwarder tears records sent with -g: only the first piece carries the stamp
+        if (i == STAMP_DIGITS && sent <= arrival) {
+            latencies[num_latencies++] = arrival - sent;
+        }
+        const char* nl = memchr(data + off, '\n', len - off);
+        if (!nl) {
+            break;
+        }
+        off = (size_t)(nl - data) + 1;
+    }
+}
+
+/**
+ * @brief UDP sink thread: counts everything the forwarder delivers.
+ *
+ * @param arg Unused.
+ * @return NULL (thread exit value unused).
+ */
+void* sink_thread(void* arg) {
+    (void)arg;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("sink socket");
+        return NULL;
+    }
+
+    // Large receive buffer so the sink itself is not the bottleneck
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // Short timeout to periodically check the sinking flag
+    struct timeval tv = {0, 200 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(sink_port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("sink bind");
+        close(fd);
+        return NULL;
+    }
+
+    static char buffer[BUFFER_SIZE];
+    while (sinking) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            perror("sink recv");
+            break;
+        }
+        if (latencies) {
+            record_latencies(buffer, (size_t)n, now_ns());
+        }
+        sink_datagrams++;
+        sink_bytes += (unsigned long long)n;
+        sink_last = now_sec();
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Sender thread: writes records round-robin over its connections.
+ *
+ * @param arg Pointer to this thread's sender_t.
+ * @return NULL (thread exit value unused).
+ */
+void* sender_thread(void* arg) {
+    sender_t* s = (sender_t*)arg;
+    int* fds = malloc(sizeof(int) * s->conn_count);
+    char* msg = malloc(msg_size);
+    if (!fds || !msg) {
+        perror("malloc");
+        free(fds);
+        free(msg);
+        return NULL;
+    }
+
+    // Each record is a printable line so the framed forwarding modes can split it
+    memset(msg, 'x', msg_size);
+    msg[msg_size - 1] = '\n';
+
+    int open_conns = 0;
+    for (; open_conns < s->conn_count; open_conns++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("TCP socket");
+            break;
+        }
+        if (connect(fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
+            perror("connect");
+            close(fd);
+            break;
+        }
+        // Bound every send so a stalled forwarder cannot hang the benchmark
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof tv);
+        fds[open_conns] = fd;
+    }
+
+    // Start the measurement window only after every connection is established
+    pthread_barrier_wait(&connected);
+
+    int i = 0;
+    while (sending && open_conns > 0) {
+        if (send_all(fds[i], msg, msg_size) != 0) {
+            break;
+        }
+        s->messages++;
+        i = (i + 1) % open_conns;
+    }
+
+    for (int j = 0; j < open_conns; j++) {
+        close(fds[j]);
+    }
+    free(fds);
+    free(msg);
+    return NULL;
+}
+
+/**
+ * @brief Storm thread: opens its connections back to back, one record each.
+ *
+ * Connections stay open until the benchmark ends so the forwarder has to hold
+ * all of them at once. With -w every connection is opened first and the
+ * records follow after think_ms of silence.
+ *
+ * @param arg Pointer to this thread's storm_t.
+ * @return NULL (thread exit value unused).
+ */
+void* storm_thread(void* arg) {
+    storm_t* st = (storm_t*)arg;
+    int* fds = malloc(sizeof(int) * st->conn_count);
+    char* msg = malloc(msg_size);
+    if (!fds || !msg) {
+        perror("malloc");
+        free(fds);
+        free(msg);
+        return NULL;
+    }
+    memset(msg, 'x', msg_size);
+    msg[msg_size - 1] = '\n';
+
+    int open_conns = 0;
+    for (int i = 0; i < st->conn_count; i++) {
+        double t0 = now_sec();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("TCP socket");
+            st->failed++;
+            continue;
+        }
+        if (pieces > 1) {
+            set_nodelay(fd);
+        }
+        if (connect(fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0 ||
+            (think_ms == 0 && send_record(fd, msg) != 0)) {
+            close(fd);
+            st->failed++;
+            continue;
+        }
+        double t = now_sec() - t0;
+        if (t > st->max_connect) {
+            st->max_connect = t;
+        }
+        fds[open_conns++] = fd;
+    }
+    if (think_ms > 0) {
+        usleep((useconds_t)think_ms * 1000);
+        int sent = 0;
+        for (int j = 0; j < open_conns; j++) {
+            if (send_record(fds[j], msg) != 0) {
+                close(fds[j]);
+                st->failed++;
+                continue;
+            }
+            fds[sent++] = fds[j];
+        }
+        open_conns = sent;
+    }
+    st->connected = open_conns;
+
+    // Hold the connections until main has its answer
+    while (sending) {
+        usleep(10 * 1000);
+    }
+    for (int j = 0; j < open_conns; j++) {
+        close(fds[j]);
+    }
+    free(fds);
+    free(msg);
+    return NULL;
+}
+
+/**
+ * @brief Latency sender thread: one timestamped record every 1/send_rate seconds.
+ *
+ * Records go round-robin over the connections. Sends are scheduled on an
+ * absolute clock, so a slow send does not shift the records after it.
+ *
+ * @param arg Pointer to this thread's sender_t.
+ * @return NULL (thread exit value unused).
+ */
+void* latency_thread(void* arg) {
+    sender_t* s = (sender_t*)arg;
+    int* fds = malloc(sizeof(int) * s->conn_count);
+    char* msg = malloc(msg_size + 1);
+    if (!fds || !msg) {
+        perror("malloc");
+        free(fds);
+        free(msg);
+        return NULL;
+    }
+    memset(msg, 'x', msg_size);
+    msg[msg_size - 1] = '\n';
+
+    int open_conns = 0;
+    for (; open_conns < s->conn_count; open_conns++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("TCP socket");
+            break;
+        }
+        if (connect(fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
+            perror("connect");
+            close(fd);
+            break;
+        }
+        // Every record must leave at once, not wait for Nagle to coalesce it
+        set_nodelay(fd);
+        fds[open_conns] = fd;
+    }
+    pthread_barrier_wait(&connected);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = 1000000000L / send_rate;
+    int i = 0;
+    while (sending && open_conns > 0) {
+        next.tv_nsec += interval_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        // The stamp is written last so it includes nothing but the send itself
+        char stamp[STAMP_DIGITS + 1];
+        snprintf(stamp, sizeof(stamp), "%0*llu", STAMP_DIGITS, (unsigned long long)now_ns());
+        memcpy(msg, stamp, STAMP_DIGITS);
+        if (send_record(fds[i], msg) != 0) {
+            break;
+        }
+        s->messages++;
+        i = (i + 1) % open_conns;
+    }
+
+    for (int j = 0; j < open_conns; j++) {
+        close(fds[j]);
+    }
+    free(fds);
+    free(msg);
+    return NULL;
+}
+
+/**
+ * @brief Ascending comparison for qsort() over uint64_t.
+ */
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Flood thread: sends datagrams over its UDP sockets, a sendmmsg() batch per socket in turn.
+ *
+ * @param arg Pointer to this thread's sender_t (conn_count = sockets).
+ * @return NULL (thread exit value unused).
+ */
+void* flood_thread(void* arg) {
+    sender_t* s = (sender_t*)arg;
+    int* fds = malloc(sizeof(int) * s->conn_count);
+    char* msg = malloc(msg_size);
+    if (!fds || !msg) {
+        perror("malloc");
+        free(fds);
+        free(msg);
+        pthread_barrier_wait(&connected);
+        return NULL;
+    }
+    memset(msg, 'x', msg_size);
+    msg[msg_size - 1] = '\n';
+
+    // Every datagram of a batch points at the same line
+    struct iovec iov = {msg, (size_t)msg_size};
+    struct mmsghdr msgs[FLOOD_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < FLOOD_BATCH; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int open_socks = 0;
+    for (; open_socks < s->conn_count; open_socks++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            perror("UDP socket");
+            break;
+        }
+        // Connected: each socket keeps one source port, so it always reaches the same shard
+        if (connect(fd, (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
+            perror("connect");
+            close(fd);
+            break;
+        }
+        fds[open_socks] = fd;
+    }
+
+    pthread_barrier_wait(&connected);
+
+    int i = 0;
+    while (sending && open_socks > 0) {
+        int n = sendmmsg(fds[i], msgs, FLOOD_BATCH, 0);
+        if (n < 0) {
+            // Loopback reports a full receiver with ECONNREFUSED/ENOBUFS now and then: keep going
+            if (errno != ECONNREFUSED && errno != ENOBUFS && errno != EAGAIN) {
+                perror("sendmmsg");
+                break;
+            }
+            s->failed++;
+        } else {
+            s->messages += (unsigned long long)n;
+        }
+        i = (i + 1) % open_socks;
+    }
+
+    for (int j = 0; j < open_socks; j++) {
+        close(fds[j]);
+    }
+    free(fds);
+    free(msg);
+    return NULL;
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage:\n"
+            "  %s throughput <host> <tcp_port> <sink_port> [options]\n"
+            "  %s storm <host> <tcp_port> <sink_port> [options]\n"
+            "  %s latency <host> <tcp_port> <sink_port> [options]\n"
+            "  %s flood <host> <udp_port> [options]\n"
+            "Options:\n"
+            "  -c, --conns N      TCP connections (flood: UDP sockets) in total (default 64)\n"
+            "  -T, --threads N    Sender threads (default 4)\n"
+            "  -d, --duration S   Measurement window, or storm timeout, in seconds (default 5)\n"
+            "  -s, --size B       Record size in bytes including the newline (default 128,\n"
+            "                     at least %d in latency mode)\n"
+            "  -r, --rate N       Records per second in latency mode (default 1000)\n"
+            "  -g, --pieces N     Storm/latency: write each record in N segments, %d us apart\n"
+            "  -w, --think MS     Storm: connect everything, wait MS, then send the records\n"
+            "  -p, --server-pid PID  Report the forwarder's wake-ups (voluntary context\n"
+            "                     switches) per delivered record\n",
+            prog, prog, prog, prog, STAMP_DIGITS + 1, PIECE_GAP_US);
+}
+
+/**
+ * @brief Runs the throughput benchmark and prints the results.
+ *
+ * @return Exit status.
+ */
+int run_throughput(void) {
+    pthread_t sink_tid;
+    if (pthread_create(&sink_tid, NULL, sink_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to create sink thread\n");
+        return 1;
+    }
+
+    sender_t* senders = calloc(num_threads, sizeof(sender_t));
+    pthread_t* tids = calloc(num_threads, sizeof(pthread_t));
+    if (!senders || !tids) {
+        perror("calloc");
+        return 1;
+    }
+
+    pthread_barrier_init(&connected, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        senders[i].conn_count = num_conns * (i + 1) / num_threads - num_conns * i / num_threads;
+        if (pthread_create(&tids[i], NULL, sender_thread, &senders[i]) != 0) {
+            fprintf(stderr, "Failed to create sender thread\n");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&connected);
+    unsigned long long wakeups = server_wakeups();
+    double start = now_sec();
+    sleep(duration_sec);
+    sending = 0;
+
+    unsigned long long messages = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        messages += senders[i].messages;
+    }
+    double elapsed = now_sec() - start;
+
+    // Give the forwarder a moment to flush what is still in flight
+    sleep(1);
+    sinking = 0;
+    pthread_join(sink_tid, NULL);
+
+    unsigned long long bytes = messages * (unsigned long long)msg_size;
+    printf("sent: %llu records, %llu bytes in %.2f s over %d connections\n",
+           messages, bytes, elapsed, num_conns);
+    printf("rate: %.0f records/s, %.1f MB/s\n",
+           messages / elapsed, bytes / elapsed / 1e6);
+    printf("sink: %llu datagrams, %llu bytes (%.1f%% of sent bytes)\n",
+           sink_datagrams, sink_bytes, bytes ? 100.0 * sink_bytes / bytes : 0.0);
+    // Delivered rate: what actually crossed the forwarder, up to the last arrival
+    double delivery = sink_last > start ? sink_last - start : elapsed;
+    printf("delivered: %.0f records/s, %.1f MB/s\n",
+           sink_bytes / (double)msg_size / delivery, sink_bytes / delivery / 1e6);
+    print_wakeups(wakeups, sink_bytes / (unsigned long long)msg_size);
+
+    pthread_barrier_destroy(&connected);
+    free(senders);
+    free(tids);
+    return 0;
+}
+
+/**
+ * @brief Runs the reconnect-storm benchmark and prints the results.
+ *
+ * @return Exit status.
+ */
+int run_storm(void) {
+    // One descriptor per connection: lift the soft limit as far as allowed
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    pthread_t sink_tid;
+    if (pthread_create(&sink_tid, NULL, sink_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to create sink thread\n");
+        return 1;
+    }
+    usleep(100 * 1000);  // Let the sink bind before the first record can arrive
+
+    storm_t* storms = calloc(num_threads, sizeof(storm_t));
+    pthread_t* tids = calloc(num_threads, sizeof(pthread_t));
+    if (!storms || !tids) {
+        perror("calloc");
+        return 1;
+    }
+
+    unsigned long long wakeups = server_wakeups();
+    double start = now_sec();
+    for (int i = 0; i < num_threads; i++) {
+        storms[i].conn_count = num_conns * (i + 1) / num_threads - num_conns * i / num_threads;
+        if (pthread_create(&tids[i], NULL, storm_thread, &storms[i]) != 0) {
+            fprintf(stderr, "Failed to create storm thread\n");
+            exit(1);
+        }
+    }
+
+    // Every accepted connection delivers exactly one record to the sink
+    double done = 0;
+    while (now_sec() - start < duration_sec) {
+        if (sink_bytes / (unsigned long long)msg_size >= (unsigned long long)num_conns) {
+            done = now_sec() - start;
+            break;
+        }
+        usleep(1000);
+    }
+    unsigned long long delivered = sink_bytes / (unsigned long long)msg_size;
+
+    sending = 0;
+    int connected = 0, failed = 0;
+    double max_connect = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        connected += storms[i].connected;
+        failed += storms[i].failed;
+        if (storms[i].max_connect > max_connect) {
+            max_connect = storms[i].max_connect;
+        }
+    }
+    sinking = 0;
+    pthread_join(sink_tid, NULL);
+
+    printf("storm: %d/%d connections established (%d failed), slowest connect+send %.1f ms\n",
+           connected, num_conns, failed, max_connect * 1e3);
+    if (done > 0) {
+        printf("time-to-accept: all %d connections accepted and forwarded in %.1f ms\n",
+               num_conns, done * 1e3);
+    } else {
+        printf("time-to-accept: only %llu/%d connections forwarded within %d s\n",
+               delivered, num_conns, duration_sec);
+    }
+    print_wakeups(wakeups, delivered);
+
+    free(storms);
+    free(tids);
+    return 0;
+}
+
+/**
+ * @brief Runs the latency benchmark and prints the delay percentiles.
+ *
+ * @return Exit status.
+ */
+int run_latency(void) {
+    if (msg_size < STAMP_DIGITS + 1) {
+        fprintf(stderr, "latency mode needs records of at least %d bytes\n", STAMP_DIGITS + 1);
+        return 1;
+    }
+    latencies_cap = (size_t)send_rate * (size_t)duration_sec + 1024;
+    latencies = malloc(sizeof(uint64_t) * latencies_cap);
+    if (!latencies) {
+        perror("malloc");
+        return 1;
+    }
+
+    pthread_t sink_tid;
+    if (pthread_create(&sink_tid, NULL, sink_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to create sink thread\n");
+        return 1;
+    }
+    usleep(100 * 1000);  // Let the sink bind before the first record can arrive
+
+    sender_t sender = {num_conns, 0, 0};
+    pthread_t tid;
+    pthread_barrier_init(&connected, NULL, 2);
+    if (pthread_create(&tid, NULL, latency_thread, &sender) != 0) {
+        fprintf(stderr, "Failed to create sender thread\n");
+        return 1;
+    }
+    pthread_barrier_wait(&connected);
+    unsigned long long wakeups = server_wakeups();
+    sleep(duration_sec);
+    sending = 0;
+    pthread_join(tid, NULL);
+
+    usleep(500 * 1000);
+    sinking = 0;
+    pthread_join(sink_tid, NULL);
+    pthread_barrier_destroy(&connected);
+
+    printf("sent: %llu records at %d/s over %d connection(s), %zu delivered\n",
+           sender.messages, send_rate, num_conns, num_latencies);
+    if (num_latencies > 0) {
+        qsort(latencies, num_latencies, sizeof(uint64_t), compare_u64);
+        size_t n = num_latencies;
+        printf("latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+               latencies[(n - 1) / 2] / 1e3, latencies[(n - 1) * 99 / 100] / 1e3,
+               latencies[(n - 1) * 999 / 1000] / 1e3, latencies[n - 1] / 1e3);
+    }
+    print_wakeups(wakeups, sink_bytes / (unsigned long long)msg_size);
+    free(latencies);
+    return 0;
+}
+
+/**
+ * @brief Runs the UDP flood against udp_server and prints the send rate.
+ *
+ * @return Exit status.
+ */
+int run_flood(void) {
+    sender_t* senders = calloc(num_threads, sizeof(sender_t));
+    pthread_t* tids = calloc(num_threads, sizeof(pthread_t));
+    if (!senders || !tids) {
+        perror("calloc");
+        return 1;
+    }
+
+    pthread_barrier_init(&connected, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        senders[i].conn_count = num_conns * (i + 1) / num_threads - num_conns * i / num_threads;
+        if (pthread_create(&tids[i], NULL, flood_thread, &senders[i]) != 0) {
+            fprintf(stderr, "Failed to create sender thread\n");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&connected);
+    double start = now_sec();
+    sleep(duration_sec);
+    sending = 0;
+
+    unsigned long long messages = 0;
+    unsigned long long failed = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        messages += senders[i].messages;
+        failed += senders[i].failed;
+    }
+    double elapsed = now_sec() - start;
+
+    unsigned long long bytes = messages * (unsigned long long)msg_size;
+    printf("sent: %llu datagrams, %llu bytes in %.2f s over %d sockets (%llu sendmmsg calls refused)\n",
+           messages, bytes, elapsed, num_conns, failed);
+    printf("rate: %.0f datagrams/s, %.1f MB/s\n", messages / elapsed, bytes / elapsed / 1e6);
+    pthread_barrier_destroy(&connected);
+    free(senders);
+    free(tids);
+    return 0;
+}
+
+/**
+ * @brief Main function: parses arguments and runs the selected benchmark.
+ *
+ * @param argc Argument count.
+ * @param argv Arguments: [prog, mode, host, tcp_port, sink_port, options...]
+ *             (flood: [prog, mode, host, udp_port, options...])
+ * @return Exit code (0 on success, 1 on error).
+ */
+int main(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"conns",    required_argument, NULL, 'c'},
+        {"threads",  required_argument, NULL, 'T'},
+        {"duration", required_argument, NULL, 'd'},
+        {"size",     required_argument, NULL, 's'},
+        {"rate",     required_argument, NULL, 'r'},
+        {"pieces",   required_argument, NULL, 'g'},
+        {"think",    required_argument, NULL, 'w'},
+        {"server-pid", required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "c:T:d:s:r:g:w:p:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'c': num_conns = atoi(optarg); break;
+        case 'T': num_threads = atoi(optarg); break;
+        case 'd': duration_sec = atoi(optarg); break;
+        case 's': msg_size = atoi(optarg); break;
+        case 'r': send_rate = atoi(optarg); break;
+        case 'g': pieces = atoi(optarg); break;
+        case 'w': think_ms = atoi(optarg); break;
+        case 'p': server_pid = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int flood = argc - optind >= 1 && strcmp(argv[optind], "flood") == 0;
+    if (argc - optind != (flood ? 3 : 4) || num_conns < 1 || num_threads < 1 ||
+        duration_sec < 1 || msg_size < 1 || send_rate < 1 || send_rate > 1000000 ||
+        pieces < 1 || pieces > msg_size || think_ms < 0 || server_pid < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (num_threads > num_conns) {
+        num_threads = num_conns;
+    }
+
+    const char* mode = argv[optind];
+    const char* host = argv[optind + 1];
+    target_addr.sin_family = AF_INET;
+    target_addr.sin_port = htons(atoi(argv[optind + 2]));
+    sink_port = flood ? 0 : atoi(argv[optind + 3]);
+    if (inet_pton(AF_INET, host, &target_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid host\n");
+        return 1;
+    }
+
+    if (strcmp(mode, "throughput") == 0) {
+        return run_throughput();
+    }
+    if (strcmp(mode, "storm") == 0) {
+        return run_storm();
+    }
+    if (strcmp(mode, "latency") == 0) {
+        return run_latency();
+    }
+    if (flood) {
+        return run_flood();
+    }
+
+    fprintf(stderr, "Invalid mode: %s\n", mode);
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file conn_table.c
+ * @brief Implementation of the connection table and buffer pool declared in `conn_table.h`.
+ */
+
+#define _GNU_SOURCE
+
+#include "conn_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONN_SLAB 256         ///< Entries per connection slab (16 KB)
+#define CONN_INDEX_MIN 1024   ///< Initial length of the fd index
+
+_Static_assert(sizeof(conn_t) == CONN_CACHE_LINE, "conn_t must fill exactly one cache line");
+
+/**
+ * @brief Appends a pointer to a growable array of slabs.
+ *
+ * @param slabs Array to grow.
+ * @param n     In/out: entries used.
+ * @param cap   In/out: capacity.
+ * @param slab  Pointer to append.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int slab_list_push(void*** slabs, int* n, int* cap, void* slab) {
+    if (*n == *cap) {
+        int grown_cap = *cap ? *cap * 2 : 16;
+        void** grown = realloc(*slabs, sizeof(void*) * grown_cap);
+        if (!grown) {
+            return -1;
+        }
+        *slabs = grown;
+        *cap = grown_cap;
+    }
+    (*slabs)[(*n)++] = slab;
+    return 0;
+}
+
+void conn_table_init(conn_table_t* t) {
+    memset(t, 0, sizeof(*t));
+}
+
+void conn_table_free(conn_table_t* t) {
+    for (int i = 0; i < t->nslabs; i++) {
+        free(t->slabs[i]);
+    }
+    free(t->slabs);
+    free(t->by_fd);
+    memset(t, 0, sizeof(*t));
+}
+
+/**
+ * @brief Makes sure by_fd has an entry for fd.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int conn_index_reserve(conn_table_t* t, int fd) {
+    if (fd < t->by_fd_len) {
+        return 0;
+    }
+    int len = t->by_fd_len ? t->by_fd_len : CONN_INDEX_MIN;
+    while (len <= fd) {
+        len *= 2;
+    }
+    conn_t** grown = realloc(t->by_fd, sizeof(conn_t*) * len);
+    if (!grown) {
+        return -1;
+    }
+    memset(grown + t->by_fd_len, 0, sizeof(conn_t*) * (len - t->by_fd_len));
+    t->by_fd = grown;
+    t->by_fd_len = len;
+    return 0;
+}
+
+/**
+ * @brief Adds one slab of entries to the free list.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int conn_slab_grow(conn_table_t* t) {
+    conn_t* slab = aligned_alloc(CONN_CACHE_LINE, sizeof(conn_t) * CONN_SLAB);
+    if (!slab) {
+        return -1;
+    }
+    if (slab_list_push((void***)&t->slabs, &t->nslabs, &t->slabs_cap, slab) == -1) {
+        free(slab);
+        return -1;
+    }
+    // Push in reverse so entries are handed out in address order
+    for (int i = CONN_SLAB - 1; i >= 0; i--) {
+        slab[i].fd = -1;
+        slab[i].next_free = t->free_list;
+        t->free_list = &slab[i];
+    }
+    return 0;
+}
+
+conn_t* conn_open(conn_table_t* t, int fd) {
+    if (conn_index_reserve(t, fd) == -1 || (!t->free_list && conn_slab_grow(t) == -1)) {
+        perror("conn_open");
+        return NULL;
+    }
+    conn_t* c = t->free_list;
+    t->free_list = c->next_free;
+
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->opened_ms = (uint32_t)conn_now_ms();
+    c->active_ms = c->opened_ms;
+    c->partial_ms = c->opened_ms;
+    t->by_fd[fd] = c;
+
+    t->live++;
+    if (t->live > t->peak) {
+        t->peak = t->live;
+    }
+    return c;
+}
+
+void conn_release(conn_table_t* t, conn_t* c) {
+    if (c->fd >= 0 && c->fd < t->by_fd_len) {
+        t->by_fd[c->fd] = NULL;
+    }
+    c->fd = -1;
+    c->rx = NULL;
+    c->next_free = t->free_list;
+    t->free_list = c;
+    t->live--;
+}
+
+size_t conn_table_memory(const conn_table_t* t) {
+    return sizeof(conn_t*) * (size_t)t->by_fd_len +
+           sizeof(conn_t) * CONN_SLAB * (size_t)t->nslabs;
+}
+
+void buf_pool_init(buf_pool_t* p, size_t buf_size, int per_slab) {
+    memset(p, 0, sizeof(*p));
+    p->buf_size = buf_size;
+    p->per_slab = per_slab;
+}
+
+void buf_pool_free(buf_pool_t* p) {
+    for (int i = 0; i < p->nslabs; i++) {
+        free(p->slabs[i]);
+    }
+    free(p->slabs);
+    p->slabs = NULL;
+    p->nslabs = 0;
+    p->slabs_cap = 0;
+    p->free_list = NULL;
+}
+
+/**
+ * @brief Adds one slab of buffers to the free list.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int buf_pool_grow(buf_pool_t* p) {
+    char* slab = aligned_alloc(CONN_CACHE_LINE, p->buf_size * (size_t)p->per_slab);
+    if (!slab) {
+        return -1;
+    }
+    if (slab_list_push((void***)&p->slabs, &p->nslabs, &p->slabs_cap, slab) == -1) {
+        free(slab);
+        return -1;
+    }
+    for (int i = p->per_slab - 1; i >= 0; i--) {
+        char* buf = slab + (size_t)i * p->buf_size;
+        memcpy(buf, &p->free_list, sizeof(char*));
+        p->free_list = buf;
+    }
+    p->total += (unsigned long long)p->per_slab;
+    return 0;
+}
+
+char* buf_pool_get(buf_pool_t* p) {
+    if (!p->free_list && buf_pool_grow(p) == -1) {
+        perror("buf_pool_get");
+        return NULL;
+    }
+    char* buf = p->free_list;
+    memcpy(&p->free_list, buf, sizeof(char*));
+    p->in_use++;
+    if (p->in_use > p->peak) {
+        p->peak = p->in_use;
+    }
+    return buf;
+}
+
+void buf_pool_put(buf_pool_t* p, char* buf) {
+    memcpy(buf, &p->free_list, sizeof(char*));
+    p->free_list = buf;
+    p->in_use--;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file conn_table.h
+ * @brief Per-connection state for the event-driven servers, plus a shared buffer pool.
+ *
+ * A connection table maps a file descriptor to a cache-line sized `conn_t`.
+ * Entries are carved out of fixed-size slabs and recycled through a free list,
+ * so opening and closing connections never touches malloc() after warm-up and
+ * memory grows with the peak number of connections, not with the fd numbers.
+ *
+ * Receive buffers are not part of a connection. They come from a `buf_pool_t`
+ * shared by all connections of one thread and are only attached to a
+ * connection while it holds data that has not been forwarded yet, which keeps
+ * idle connections at one cache line each.
+ *
+ * Neither structure is thread-safe; each event loop owns its own.
+ */
+
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "timer_wheel.h"
+
+#define CONN_CACHE_LINE 64  ///< Alignment and size of one conn_t
+
+/**
+ * @brief State of one connected client; exactly one cache line.
+ */
+typedef struct conn {
+    int fd;                    ///< Socket, or -1 while the entry is free
+    uint32_t rx_len;           ///< Bytes held in rx (a partial record)
+    uint32_t peer_addr;        ///< Peer IPv4 address, network byte order
+    uint16_t peer_port;        ///< Peer port, network byte order
+    uint16_t flags;            ///< Reserved for per-connection modes
+    char* rx;                  ///< Pool buffer attached while data is pending, else NULL
+    union {
+        struct conn* next_free; ///< Free-list link (only meaningful while free)
+        timer_node_t timer;     ///< Timeout wheel link (only meaningful while open)
+    };
+    uint64_t bytes_in;         ///< Bytes received
+    uint32_t records_out;      ///< Records forwarded (raw mode: one per recv() chunk)
+    uint32_t opened_ms;        ///< Monotonic time the connection was accepted (wraps; compare by difference)
+    uint32_t active_ms;        ///< Monotonic time data was last received (wraps)
+    uint32_t partial_ms;       ///< Monotonic time the record held in rx was started (wraps)
+} __attribute__((aligned(CONN_CACHE_LINE))) conn_t;
+
+/**
+ * @brief fd-indexed table of connections backed by a slab allocator.
+ */
+typedef struct {
+    conn_t** by_fd;            ///< Entry for each fd, NULL if not a connection
+    int by_fd_len;             ///< Length of by_fd (grows on demand)
+    conn_t* free_list;         ///< Recycled entries
+    conn_t** slabs;            ///< Every slab allocated so far
+    int nslabs;                ///< Entries used in slabs
+    int slabs_cap;             ///< Capacity of slabs
+    unsigned long long live;   ///< Connections currently open
+    unsigned long long peak;   ///< Highest value of live
+} conn_table_t;
+
+/**
+ * @brief Fixed-size buffers recycled through an intrusive free list.
+ */
+typedef struct {
+    char* free_list;           ///< First free buffer; each free buffer stores the next one
+    char** slabs;              ///< Every slab allocated so far
+    int nslabs;                ///< Entries used in slabs
+    int slabs_cap;             ///< Capacity of slabs
+    size_t buf_size;           ///< Size of each buffer
+    int per_slab;              ///< Buffers carved from one slab
+    unsigned long long total;  ///< Buffers allocated
+    unsigned long long in_use; ///< Buffers handed out
+    unsigned long long peak;   ///< Highest value of in_use
+} buf_pool_t;
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC_COARSE time in milliseconds.
+ *
+ * The coarse clock is read from the vDSO without a syscall, which makes it
+ * cheap enough to stamp every receive.
+ */
+static inline uint64_t conn_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Initialises an empty connection table.
+ *
+ * @param t Table to initialise.
+ */
+void conn_table_init(conn_table_t* t);
+
+/**
+ * @brief Releases every slab and the index. Sockets are not closed.
+ *
+ * @param t Table to destroy.
+ */
+void conn_table_free(conn_table_t* t);
+
+/**
+ * @brief Creates the entry for a newly accepted socket.
+ *
+ * @param t  The table.
+ * @param fd Connected socket (must not already have an entry).
+ * @return Zeroed entry with fd and timestamps set, or NULL on allocation failure.
+ */
+conn_t* conn_open(conn_table_t* t, int fd);
+
+/**
+ * @brief Removes a connection from the table and recycles its entry.
+ *
+ * An attached rx buffer must have been returned to its pool first. The socket
+ * itself is left to the caller.
+ *
+ * @param t The table.
+ * @param c Entry returned by conn_open().
+ */
+void conn_release(conn_table_t* t, conn_t* c);
+
+/**
+ * @brief Returns the entry of fd, or NULL if fd is not a connection in this table.
+ *
+ * @param t  The table.
+ * @param fd Descriptor to look up.
+ */
+static inline conn_t* conn_lookup(const conn_table_t* t, int fd) {
+    return (fd >= 0 && fd < t->by_fd_len) ? t->by_fd[fd] : NULL;
+}
+
+/**
+ * @brief Bytes of memory held by the table (index and slabs).
+ *
+ * @param t The table.
+ */
+size_t conn_table_memory(const conn_table_t* t);
+
+/**
+ * @brief Initialises an empty buffer pool.
+ *
+ * @param p        Pool to initialise.
+ * @param buf_size Size of each buffer (at least sizeof(char*)).
+ * @param per_slab Buffers allocated at once when the pool runs dry.
+ */
+void buf_pool_init(buf_pool_t* p, size_t buf_size, int per_slab);
+
+/**
+ * @brief Releases every slab. Buffers still handed out become invalid.
+ *
+ * @param p Pool to destroy.
+ */
+void buf_pool_free(buf_pool_t* p);
+
+/**
+ * @brief Takes a buffer from the pool, growing it by one slab if it is empty.
+ *
+ * @param p The pool.
+ * @return A buffer of p->buf_size bytes, or NULL on allocation failure.
+ */
+char* buf_pool_get(buf_pool_t* p);
+
+/**
+ * @brief Returns a buffer obtained from buf_pool_get().
+ *
+ * @param p   The pool.
+ * @param buf Buffer to recycle.
+ */
+void buf_pool_put(buf_pool_t* p, char* buf);
+
+#endif // CONN_TABLE_H
@@ -0,0 +1,260 @@
+/**
+ * @file cpu_affinity.c
+ * @brief Implementation of the thread placement plans declared in `cpu_affinity.h`.
+ */
+
+#define _GNU_SOURCE
+
+#include "cpu_affinity.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Reads the first line of a sysfs file.
+ *
+ * @return 0 on success, -1 if the file does not exist or is empty.
+ */
+static int read_sysfs(const char* path, char* buf, size_t len) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    int ok = fgets(buf, (int)len, fp) != NULL;
+    fclose(fp);
+    if (!ok) {
+        return -1;
+    }
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Appends one CPU to the plan.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int plan_add(cpu_plan_t* p, int cpu) {
+    int* grown = realloc(p->cpus, sizeof(int) * (size_t)(p->ncpus + 1));
+    if (!grown) {
+        perror("realloc cpu plan");
+        return -1;
+    }
+    p->cpus = grown;
+    p->cpus[p->ncpus++] = cpu;
+    return 0;
+}
+
+/**
+ * @brief Parses a CPU list such as `0-3,8` into the plan.
+ *
+ * @param p       Plan to append to.
+ * @param list    The list.
+ * @param allowed CPUs the process may run on.
+ * @param strict  Reject CPUs outside allowed (1) or silently skip them (0).
+ * @return 0 on success, -1 on a malformed list or a rejected CPU.
+ */
+static int parse_cpu_list(cpu_plan_t* p, const char* list, const cpu_set_t* allowed, int strict) {
+    const char* s = list;
+    while (*s) {
+        char* end;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (end == s || first < 0) {
+            fprintf(stderr, "Invalid CPU list: %s\n", list);
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                fprintf(stderr, "Invalid CPU range in: %s\n", list);
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET((int)cpu, allowed)) {
+                if (strict) {
+                    fprintf(stderr, "CPU %ld is not available to this process\n", cpu);
+                    return -1;
+                }
+                continue;
+            }
+            if (plan_add(p, (int)cpu) == -1) {
+                return -1;
+            }
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            fprintf(stderr, "Invalid CPU list: %s\n", list);
+            return -1;
+        }
+        s = end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the NUMA node of an interface's device, or -1 if it has none.
+ */
+static int interface_node(const char* ifname) {
+    char path[320];
+    char buf[32];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+    if (read_sysfs(path, buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    return atoi(buf);
+}
+
+/**
+ * @brief Picks the network card for `auto`: the first one with a NUMA node.
+ *
+ * Virtual interfaces (loopback, bridges, tunnels) have no device directory
+ * and are skipped. On success p->ifname is set and the node is returned.
+ *
+ * @return NUMA node, or -1 if no interface reports one.
+ */
+static int find_nic_node(cpu_plan_t* p) {
+    DIR* dir = opendir("/sys/class/net");
+    if (!dir) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        node = interface_node(de->d_name);
+        if (node >= 0) {
+            snprintf(p->ifname, sizeof(p->ifname), "%.*s", IF_NAMESIZE - 1, de->d_name);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * @brief Fills the plan for `auto` or `auto:IFNAME`.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int plan_auto(cpu_plan_t* p, const char* spec, const cpu_set_t* allowed) {
+    if (spec[4] == ':') {
+        char path[256];
+        char buf[32];
+        snprintf(p->ifname, sizeof(p->ifname), "%s", spec + 5);
+        snprintf(path, sizeof(path), "/sys/class/net/%s/ifindex", p->ifname);
+        if (read_sysfs(path, buf, sizeof(buf)) == -1) {
+            fprintf(stderr, "Unknown interface: %s\n", p->ifname);
+            return -1;
+        }
+        p->node = interface_node(p->ifname);
+    } else if (spec[4] == '\0') {
+        p->node = find_nic_node(p);
+    } else {
+        fprintf(stderr, "Invalid CPU placement: %s\n", spec);
+        return -1;
+    }
+
+    if (p->node >= 0) {
+        char path[128];
+        char cpulist[1024];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", p->node);
+        if (read_sysfs(path, cpulist, sizeof(cpulist)) == -1 ||
+            parse_cpu_list(p, cpulist, allowed, 0) == -1) {
+            fprintf(stderr, "Cannot read the CPUs of NUMA node %d\n", p->node);
+            return -1;
+        }
+        if (p->ncpus == 0) {
+            fprintf(stderr, "None of the CPUs of NUMA node %d is available to this process\n",
+                    p->node);
+            return -1;
+        }
+        return 0;
+    }
+
+    // No NUMA information (single node or virtual NIC): spread over every usable CPU
+    p->node = -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && plan_add(p, cpu) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cpu_plan_parse(cpu_plan_t* p, const char* spec) {
+    memset(p, 0, sizeof(*p));
+    p->node = -1;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(p->saved), &p->saved) != 0) {
+        perror("pthread_getaffinity_np");
+        return -1;
+    }
+    if (!spec) {
+        return 0;
+    }
+
+    int rc = strncmp(spec, "auto", 4) == 0 ? plan_auto(p, spec, &p->saved)
+                                            : parse_cpu_list(p, spec, &p->saved, 1);
+    if (rc == -1 || p->ncpus == 0) {
+        if (rc == 0) {
+            fprintf(stderr, "Empty CPU list: %s\n", spec);
+        }
+        cpu_plan_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+void cpu_plan_free(cpu_plan_t* p) {
+    free(p->cpus);
+    p->cpus = NULL;
+    p->ncpus = 0;
+}
+
+int cpu_plan_cpu(const cpu_plan_t* p, int slot) {
+    return p->ncpus > 0 ? p->cpus[slot % p->ncpus] : -1;
+}
+
+int cpu_plan_pin(const cpu_plan_t* p, int slot) {
+    if (p->ncpus == 0) {
+        return 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_plan_cpu(p, slot), &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "pthread_setaffinity_np (CPU %d): %s\n", cpu_plan_cpu(p, slot), strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+void cpu_plan_restore(const cpu_plan_t* p) {
+    if (p->ncpus > 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(p->saved), &p->saved);
+    }
+}
+
+void cpu_plan_print(const cpu_plan_t* p) {
+    if (p->ncpus == 0) {
+        return;
+    }
+    printf("Thread placement: CPUs");
+    for (int i = 0; i < p->ncpus; i++) {
+        printf("%s%d", i ? "," : " ", p->cpus[i]);
+    }
+    if (p->node >= 0) {
+        printf(" (NUMA node %d of %s)", p->node, p->ifname);
+    } else if (p->ifname[0]) {
+        printf(" (%s reports no NUMA node)", p->ifname);
+    }
+    printf("\n");
+}
@@ -0,0 +1,90 @@
+/**
+ * @file cpu_affinity.h
+ * @brief Thread placement: pins server threads to a list of CPUs.
+ *
+ * A placement plan is an ordered list of CPUs. The servers number their
+ * threads (reactors, workers, egress threads, receive threads) and thread k
+ * runs on the k-th CPU of the plan, wrapping around when there are more
+ * threads than CPUs. The plan comes either from an explicit list such as
+ * `0-3,8` or from `auto`, which picks the CPUs of the NUMA node the network
+ * card is attached to, so packet processing stays on the node that takes the
+ * card's interrupts and DMA.
+ *
+ * Threads inherit the affinity of the thread that creates them, and Linux
+ * places a page on the node of the CPU that first touches it. The servers
+ * therefore pin the creating thread to a slot before they allocate and
+ * initialise that slot's buffers and before they start its thread, which
+ * makes both the thread and its memory node-local without any NUMA library.
+ */
+
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <sched.h>
+#include <net/if.h>
+
+/**
+ * @brief Ordered list of CPUs to pin threads to.
+ */
+typedef struct {
+    int* cpus;                ///< CPU of each slot
+    int ncpus;                ///< Number of slots; 0 means no pinning
+    int node;                 ///< NUMA node chosen by `auto`, -1 otherwise
+    char ifname[IF_NAMESIZE]; ///< Interface `auto` looked at, empty otherwise
+    cpu_set_t saved;          ///< Affinity of the thread that parsed the plan
+} cpu_plan_t;
+
+/**
+ * @brief Builds a plan from a command-line specification.
+ *
+ * Accepted forms are a CPU list (`0-3,8,10-11`), `auto` (the NUMA node of the
+ * first network card that reports one) and `auto:IFNAME`. With `auto` on a
+ * machine without NUMA information every CPU the process may use is taken.
+ * CPUs outside the process's current affinity mask are rejected. The calling
+ * thread's affinity is saved for cpu_plan_restore().
+ *
+ * @param p    Plan to fill.
+ * @param spec Specification; NULL yields an empty plan that pins nothing.
+ * @return 0 on success, -1 on a malformed or unusable specification.
+ */
+int cpu_plan_parse(cpu_plan_t* p, const char* spec);
+
+/**
+ * @brief Releases the CPU list.
+ *
+ * @param p The plan.
+ */
+void cpu_plan_free(cpu_plan_t* p);
+
+/**
+ * @brief Returns the CPU of a slot, or -1 if the plan is empty.
+ *
+ * @param p    The plan.
+ * @param slot Thread number (wraps around the list).
+ */
+int cpu_plan_cpu(const cpu_plan_t* p, int slot);
+
+/**
+ * @brief Pins the calling thread to the CPU of a slot; does nothing for an empty plan.
+ *
+ * @param p    The plan.
+ * @param slot Thread number (wraps around the list).
+ * @return 0 on success, -1 on error.
+ */
+int cpu_plan_pin(const cpu_plan_t* p, int slot);
+
+/**
+ * @brief Gives the calling thread back the affinity saved by cpu_plan_parse().
+ *
+ * @param p The plan.
+ */
+void cpu_plan_restore(const cpu_plan_t* p);
+
+/**
+ * @brief Prints the plan on one line (nothing for an empty plan).
+ *
+ * @param p The plan.
+ */
+void cpu_plan_print(const cpu_plan_t* p);
+
+#endif // CPU_AFFINITY_H
@@ -5,36 +5,379 @@
  * This program acts as a bridge:
  *   - Uses epoll to efficiently handle multiple TCP connections.
  *   - Each connected TCP client's data is forwarded to a preconfigured UDP server.
- *   - Supports graceful shutdown by typing 'quit' in the console.
+ *   - Supports graceful shutdown by typing 'quit' in the console or sending SIGTERM.
  *
  * This implementation is more efficient than the multi-threaded approach for handling
  * many concurrent connections, as it uses a single-threaded event loop.
+ *
+ * With `-t N` the server runs N independent reactors. Each reactor owns its own
+ * SO_REUSEPORT listening socket, epoll instance and UDP egress socket, so the kernel
+ * spreads incoming connections across them and no state is shared on the hot path.
+ * Reactor 0 runs on the main thread; reactors 1..N-1 get their own threads.
+ *
+ * Each reactor's UDP socket is connect()ed to the target, so sends carry no
+ * address and the kernel skips the per-datagram route and neighbour lookup;
+ * `--shared-udp` instead makes every reactor send through one unconnected
+ * socket, the old behaviour kept as a baseline. `--sndbuf` sizes the egress
+ * socket buffers.
+ *
+ * Egress is batched: every recv() lands directly in a slot of the reactor's
+ * egress batch, and the batch is flushed with sendmmsg() once per epoll_wait
+ * iteration (or earlier when it fills up), so one syscall carries the data of
+ * all connections that were ready in that iteration.
+ *
+ * `-B uring` swaps the epoll loop for an io_uring one: a multishot accept per
+ * listener, a multishot recv per connection drawing from a provided buffer ring,
+ * and UDP sends linked into one ordered chain per iteration. Buffers go back to
+ * the ring when their send completes, so data is never copied and one
+ * io_uring_enter() call covers a whole batch of receives and sends.
+ *
+ * The listening socket is edge-triggered, so every readiness edge drains the
+ * accept queue with accept4() until EAGAIN, up to a per-iteration budget; a
+ * reactor that hits the budget comes back to the queue on its next iteration
+ * instead of waiting for an edge that will never come. When the process runs
+ * out of descriptors, a reserved spare fd is used to accept and immediately
+ * close (shed) pending connections rather than leaving them stranded.
+ *
+ * Control traffic never costs the data path a syscall: shutdown signals
+ * (signalfd), console commands (stdin) and an optional Unix-domain admin
+ * socket (`-A PATH`) are descriptors in reactor 0's own event set, and a
+ * shared eventfd in every reactor's set wakes them all for shutdown. The loops
+ * therefore block indefinitely and only wake up when there is work.
+ *
+ * Each reactor keeps an fd-indexed table of cache-line sized connection
+ * entries (see conn_table.h) and one shared pool of receive buffers. A buffer
+ * is taken from the pool only for the duration of a receive and returned once
+ * its datagram has been sent, so an idle connection costs one cache line of
+ * user-space memory no matter how many of them there are.
+ *
+ * By default every recv() chunk becomes one datagram, so a log line can be
+ * torn across datagrams or glued to its neighbours. `--framing line` (newline
+ * terminated) and `--framing len` (4-byte big-endian length prefix) make the
+ * reactor cut the stream into whole records instead: an incomplete record stays
+ * in a pool buffer attached to its connection until the rest arrives, and
+ * complete records, prefix or newline included, are packed back to back into
+ * datagrams of at most `--mtu` bytes. A datagram therefore always carries
+ * whole records, and small records share packets.
+ *
+ * By default a datagram the kernel refuses is dropped and counted. With
+ * `--backpressure` the UDP socket is non-blocking and a refused batch is kept
+ * instead: the reactor stops reading (connections that become readable are
+ * parked with EPOLL_CTL_MOD and no events), waits for EPOLLOUT on the UDP
+ * socket, and resumes every parked connection once the batch has drained. TCP
+ * flow control then slows the producers down instead of losing their data.
+ *
+ * `--idle-timeout`, `--read-timeout` and `--handshake-timeout` evict clients
+ * that send nothing for too long, leave a record unfinished for too long, or
+ * never send anything after connecting. Each connection has exactly one timer
+ * in its reactor's hashed timer wheel (see timer_wheel.h). Receiving data only
+ * updates timestamps in the connection entry; the timer is re-armed when it
+ * fires early, so the data path never touches the wheel. Each loop iteration
+ * advances the wheel by the ticks that have passed and closes every connection
+ * that is due, and the loop's poll timeout is set to the next occupied tick.
+ *
+ * `--busy-poll US` trades CPU for wake-up latency: every socket gets
+ * SO_BUSY_POLL and SO_PREFER_BUSY_POLL, and with `--spin US` an idle reactor
+ * keeps calling epoll_wait() with a zero timeout for that long before it
+ * falls back to blocking, so data that arrives shortly after the last event is
+ * picked up without a sleep and wake-up.
+ *
+ * `upgrade` (console, admin socket or SIGUSR2) replaces the running binary
+ * without refusing a single connection: the server re-executes its own
+ * command line and passes the new process its listening and UDP sockets over
+ * a Unix socket (see fd_handoff.h). Once the new process reports that it is
+ * accepting, this one closes its listeners and drains: it keeps serving the
+ * clients it has until they disconnect or `--drain-timeout` expires.
+ * `upgrade clients` moves the established connections as well, together with
+ * any partial record they hold, and exits right away. Upgrades need the epoll
+ * backend.
+ *
+ * `--conn-limit`, `--ip-conns`, `--ip-bytes` and `--ip-records` keep one
+ * client from starving the others (see rate_limit.h). Connections over a cap
+ * are closed right after accept. A client that has used up its byte or record
+ * budget has its connections parked, like under backpressure but one at a
+ * time: EPOLLIN is removed until its token buckets refill, so its data waits
+ * in the kernel and TCP flow control slows it down. Nothing is read and
+ * dropped. The table of client addresses is shared by all reactors and its
+ * size is fixed.
+ *
+ * `--tune SPEC` applies a socket-tuning profile to the listeners (see
+ * sock_tune.h): TCP_DEFER_ACCEPT, SO_RCVLOWAT, buffer sizes and TCP_QUICKACK,
+ * so a client that connects, idles and then trickles in a short record costs
+ * fewer wake-ups. Given several times, the i-th profile applies to reactor
+ * i's listener and the last one to every reactor after it, so profiles can
+ * be compared side by side within one SO_REUSEPORT group.
+ *
+ * `--cpus LIST|auto` pins reactor i to the i-th CPU of the list (see
+ * cpu_affinity.h). The main thread moves to a reactor's CPU before setting it
+ * up and before starting its thread, so the reactor's rings and buffers are
+ * first touched, and therefore allocated, on that CPU's NUMA node.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+#include "uring.h"
+#include "conn_table.h"
+#include "cpu_affinity.h"
+#include "fd_handoff.h"
+#include "rate_limit.h"
+#include "sock_tune.h"
 
-#define BUFFER_SIZE 4096  ///< Size of the per-client receive buffer
+#define BUFFER_SIZE 4096  ///< Size of one pooled receive buffer (and the largest datagram)
+#define POOL_SLAB 64      ///< Buffers added to a reactor's pool when it runs dry
 #define MAX_EVENTS 64     ///< Maximum number of events to return from epoll_wait
+#define MAX_REACTORS 256  ///< Upper bound for the -t option
+#define DEFAULT_BATCH 64  ///< Default number of datagrams per sendmmsg() call
+#define MAX_BATCH 1024    ///< Upper bound for the -b option (UIO_MAXIOV)
+#define BATCH_HIST 11     ///< Histogram buckets: 1, 2-3, 4-7, ... , 1024
+#define DEFAULT_ACCEPT_BUDGET 64  ///< Default connections accepted per reactor iteration
+#define URING_ENTRIES 4096  ///< Submission queue size of each io_uring reactor
+#define URING_BUFFERS 1024  ///< Provided receive buffers per io_uring reactor (power of two)
+#define MAX_ADMIN_CLIENTS 8  ///< Concurrent admin socket connections
+#define CONTROL_LINE 256     ///< Longest control command line
+#define DEFAULT_MTU 1472     ///< Default datagram budget: 1500-byte MTU minus IPv4 and UDP headers
+#define LEN_PREFIX 4         ///< Size of the big-endian length prefix of --framing len
+#define CONN_PAUSED 0x1      ///< conn_t.flags: reads parked until egress drains
+#define CONN_THROTTLED 0x2   ///< conn_t.flags: reads parked until the client's token buckets refill
+#define CONN_ADMITTED 0x4    ///< conn_t.flags: counted by the rate limiter
+#define TIMER_TICK_MS 100    ///< Resolution of the connection timeouts
+#define TIMER_SLOTS 1024     ///< Timer wheel slots (one revolution is about 100 s)
+#define DEFAULT_DRAIN_TIMEOUT_MS 30000  ///< Default --drain-timeout after an upgrade
+#define HANDOFF_TIMEOUT_MS 10000  ///< Longest wait for the other process during an upgrade
+
+// io_uring user_data tags: operation in the upper 32 bits, fd or buffer id below
+#define UD_ACCEPT 1ULL
+#define UD_RECV   2ULL
+#define UD_SEND   3ULL
+#define UD_CONTROL 4ULL
+#define UD_MAKE(op, val) (((op) << 32) | (unsigned)(val))
+
+/**
+ * @brief Datagrams collected during one event-loop iteration, flushed with sendmmsg().
+ *
+ * Each filled slot points at a pool buffer that recv() wrote into, so batching
+ * adds no copy; the buffers go back to the pool when the batch is flushed.
+ */
+typedef struct {
+    struct mmsghdr* msgs;  ///< sendmmsg() descriptors, one per slot
+    struct iovec* iovs;    ///< One iovec per slot; iov_base is a pool buffer while filled
+    buf_pool_t* pool;      ///< Pool the slot buffers are returned to
+    int count;             ///< Slots filled since the last flush
+    int open;              ///< Non-zero while slot `count` is being packed with records
+    int capacity;          ///< Number of slots
+
+    // Statistics (owned by the reactor thread)
+    unsigned long long datagrams;  ///< Datagrams handed to the kernel
+    unsigned long long syscalls;   ///< sendmmsg() calls made
+    unsigned long long flushes;    ///< Non-empty batches flushed
+    unsigned long long dropped;    ///< Datagrams dropped because sendmmsg() failed
+    unsigned long long hist[BATCH_HIST];  ///< Flushed batch sizes, log2 buckets
+    int max_batch;                 ///< Largest batch flushed
+} egress_batch_t;
+
+/**
+ * @brief A connection parked by the rate limiter and when it may read again.
+ */
+typedef struct {
+    int fd;             ///< The connection
+    uint64_t until_ms;  ///< Monotonic time its client's buckets are out of debt
+} throttle_t;
+
+/**
+ * @brief Per-thread event loop state.
+ *
+ * Every reactor is fully independent: connections accepted on its listening
+ * socket are only ever registered with its own epoll instance and forwarded
+ * through its own UDP socket.
+ */
+typedef struct {
+    int id;          ///< Reactor index (0 runs on the main thread)
+    int listen_fd;   ///< Listening socket file descriptor
+    const sock_tune_t* tune;  ///< Socket profile of the listener and its connections, NULL = untuned
+    int epoll_fd;    ///< Epoll file descriptor
+    int udp_socket;  ///< UDP egress socket
+    egress_batch_t batch;  ///< Pending datagrams for udp_socket
+    pthread_t tid;   ///< Thread running this reactor (unused for reactor 0)
+
+    // Connection state
+    conn_table_t conns;              ///< Open connections, indexed by fd
+    buf_pool_t pool;                 ///< Receive buffers shared by all connections (epoll only)
+
+    // Accept path state
+    int spare_fd;                    ///< Reserved descriptor released to shed on EMFILE
+    int accept_pending;              ///< Budget ran out with connections still queued
+    unsigned long long accepted;     ///< Connections accepted
+    unsigned long long deferred;     ///< Iterations that stopped at the accept budget
+    unsigned long long shed;         ///< Connections closed right away for lack of fds
+
+    // Framing counters (--framing line|len)
+    unsigned long long records;      ///< Whole records forwarded
+    unsigned long long oversize;     ///< Lines longer than a buffer, forwarded in pieces
+    unsigned long long frame_errors; ///< Bad length prefixes and records cut off by a close
 
-// Global variables for epoll and sockets
-static int running = 1;      ///< Flag to control server shutdown
-static int listen_fd = -1;   ///< Listening socket file descriptor
-static int epoll_fd = -1;    ///< Epoll file descriptor
+    // Backpressure state (--backpressure)
+    int congested;                   ///< 0, or the errno (EAGAIN/ENOBUFS) that stalled egress
+    int out_watched;                 ///< Non-zero while udp_socket is registered for EPOLLOUT
+    uint64_t stall_start_ms;         ///< When the current stall began
+    int* paused;                     ///< Connections parked during the stall, by fd
+    int npaused;                     ///< Entries used in paused
+    int paused_cap;                  ///< Capacity of paused
+    unsigned long long stalls;       ///< Times egress stalled
+    unsigned long long stall_ms;     ///< Total time spent stalled
+    unsigned long long max_stall_ms; ///< Longest single stall
+    unsigned long long pauses;       ///< Connections parked, summed over all stalls
 
-// Global UDP forwarding destination (set once at startup)
-static int udp_socket;
+    // Rate limiting state (--conn-limit, --ip-conns, --ip-bytes, --ip-records)
+    throttle_t* throttled;           ///< Connections parked until their client's buckets refill
+    int nthrottled;                  ///< Entries used in throttled
+    int throttled_cap;               ///< Capacity of throttled
+    uint64_t throttle_next_ms;       ///< Earliest until_ms in throttled
+    unsigned long long throttles;    ///< Connections parked by the rate limiter
+    unsigned long long refused;      ///< Connections closed at accept by the rate limiter
+
+    // Timeout state (--idle-timeout, --read-timeout, --handshake-timeout)
+    timer_wheel_t timers;            ///< One timer per connection, re-armed lazily
+    uint64_t sweep_ms;               ///< Time of the wheel advance in progress
+    unsigned long long expired[3];   ///< Connections closed, indexed by timeout_kind_t
+    unsigned long long rearmed;      ///< Timers that fired early and were re-armed
+    unsigned long long max_sweep;    ///< Most connections closed by one advance
+
+    // Upgrade state
+    int draining;                    ///< Listener closed after an upgrade; serving what is left
+    int drained;                     ///< Every remaining client has gone
+
+    // Busy-poll counters (--spin)
+    unsigned long long spin_polls;   ///< Zero-timeout epoll_wait() calls that found nothing
+    unsigned long long spin_hits;    ///< Waits satisfied while spinning
+    unsigned long long blocks;       ///< Waits that used up the spin budget and blocked
+
+    // io_uring backend state (-B uring only)
+    uring_t ring;                    ///< Submission and completion queues
+    uring_buf_ring_t bufs;           ///< Provided receive buffers
+    struct msghdr* send_msgs;        ///< sendmsg() header per buffer id
+    struct iovec* send_iovs;         ///< iovec per buffer id
+    unsigned short* pending;         ///< Buffer ids received this iteration, in order
+    int npending;                    ///< Entries used in pending
+    int* starved;                    ///< Connections whose recv ran out of buffers
+    int nstarved;                    ///< Entries used in starved
+    int starved_cap;                 ///< Capacity of starved
+    int inflight;                    ///< Sends queued or running, each holding one buffer
+    unsigned long long recvs;        ///< Receive completions carrying data
+    unsigned long long sends;        ///< UDP sends completed successfully
+    unsigned long long send_errors;  ///< UDP sends that failed or were cancelled
+} reactor_t;
+
+static volatile int running = 1;  ///< Flag to control server shutdown
+static int batch_size = DEFAULT_BATCH;  ///< Slots per egress batch (-b)
+static int use_uring = 0;  ///< Non-zero when the io_uring backend is selected (-B)
+static int listen_backlog = SOMAXCONN;  ///< listen() backlog (-l)
+static int accept_budget = DEFAULT_ACCEPT_BUDGET;  ///< Accepts per iteration (-a)
+
+/**
+ * @brief How the TCP byte stream is cut into datagrams (--framing).
+ */
+typedef enum {
+    FRAMING_RAW,   ///< One datagram per recv() chunk
+    FRAMING_LINE,  ///< Newline-terminated records
+    FRAMING_LEN    ///< Records with a 4-byte big-endian length prefix
+} framing_t;
+
+static framing_t framing = FRAMING_RAW;  ///< Record boundaries (--framing)
+static int mtu = DEFAULT_MTU;            ///< Datagram size budget when packing records (--mtu)
+static int backpressure = 0;             ///< Keep refused datagrams and stop reading (--backpressure)
+
+/**
+ * @brief Which timeout closed a connection.
+ */
+typedef enum {
+    TIMEOUT_IDLE,       ///< No data for --idle-timeout
+    TIMEOUT_READ,       ///< A partial record older than --read-timeout
+    TIMEOUT_HANDSHAKE   ///< No first byte within --handshake-timeout
+} timeout_kind_t;
+
+static const char* const timeout_names[] = {"idle", "read", "handshake"};
+
+static int idle_timeout_ms = 0;       ///< Close after this long without data, 0 = never
+static int read_timeout_ms = 0;       ///< Close when a partial record is older than this, 0 = never
+static int handshake_timeout_ms = 0;  ///< Close when no data arrives this long after accept, 0 = never
+static int timeout_recheck_ms = 0;    ///< Longest configured timeout; 0 disables the timer wheel
+
+static int busy_poll_us = 0;  ///< SO_BUSY_POLL value for every socket (--busy-poll), 0 = off
+static int spin_us = 0;       ///< Time an idle reactor polls before blocking (--spin), 0 = never
+
+static int shared_udp = 0;      ///< All reactors send through one unconnected socket (--shared-udp)
+static int shared_udp_fd = -1;  ///< That socket, or -1 with per-reactor connected sockets
+static int udp_sndbuf = 0;      ///< SO_SNDBUF of each egress socket (--sndbuf), 0 = system default
+
+static cpu_plan_t cpu_plan;     ///< CPU of each reactor (--cpus), empty = not pinned
+
+static rate_limiter_t limiter;  ///< Per-client caps and token buckets shared by all reactors
+static int rate_limits = 0;     ///< Non-zero when any of them is configured
+
+static sock_tune_set_t tunes;   ///< Socket profile of each listener (--tune)
+
+/**
+ * @brief Upgrade state, on both sides of a hand-off.
+ */
+typedef struct {
+    char** argv;                      ///< Command line the upgrade re-executes
+    int sock;                         ///< Hand-off socket while talking to the other process, else -1
+    int send_clients;                 ///< Old side: pass connections to the new process at exit
+    int drain_fd;                     ///< eventfd in every reactor's set, written when draining starts
+    volatile int draining;            ///< Old side: listeners handed over, waiting for clients to leave
+    uint64_t drain_deadline_ms;       ///< When the remaining clients are closed anyway
+    int drain_timeout_ms;             ///< --drain-timeout
+    int drained_reactors;             ///< Reactors without clients left (atomic)
+    int listeners[MAX_REACTORS];      ///< New side: inherited listener per reactor, -1 if none
+    int udp[MAX_REACTORS];            ///< New side: inherited egress socket per reactor, -1 if none
+    int udp_shared;                   ///< New side: udp[0] is the old process's shared socket
+} upgrade_t;
+
+static upgrade_t upgrade = {NULL, -1, 0, -1, 0, 0, DEFAULT_DRAIN_TIMEOUT_MS, 0, {0}, {0}, 0};
+
+// Global UDP forwarding destination (set once at startup, read-only afterwards)
 static struct sockaddr_in udp_addr;
 
+static reactor_t* reactors = NULL;  ///< All reactors; reactor 0 runs on the main thread
+static int num_reactors = 1;        ///< Number of reactors (-t)
+static int shutdown_fd = -1;        ///< eventfd in every reactor's set, written once on shutdown
+
+/**
+ * @brief Control channel owned by reactor 0.
+ *
+ * Every descriptor here is watched by reactor 0's event loop, so commands and
+ * signals arrive as ordinary events instead of being polled for.
+ */
+typedef struct {
+    int signal_fd;                         ///< signalfd for SIGINT/SIGTERM/SIGUSR2
+    int admin_fd;                          ///< Listening Unix socket, -1 if disabled
+    const char* admin_path;                ///< Filesystem path of admin_fd (-A)
+    int admin_clients[MAX_ADMIN_CLIENTS];  ///< Connected admin sessions, -1 if free
+    int stdin_watched;                     ///< Non-zero while stdin is in the event set
+    char stdin_line[CONTROL_LINE];         ///< Partial console line
+    size_t stdin_len;                      ///< Bytes used in stdin_line
+} control_t;
+
+static control_t control = {-1, -1, NULL, {-1, -1, -1, -1, -1, -1, -1, -1}, 0, {0}, 0};
+
 /**
  * @brief Set a socket to non-blocking mode.
  *
@@ -55,14 +398,42 @@ int set_nonblocking(int fd) {
 }
 
 /**
- * @brief Adds a file descriptor to the epoll instance.
+ * @brief Enables busy polling on a socket when --busy-poll is set.
+ *
+ * SO_BUSY_POLL makes blocking receives and polls spin on the device queue for
+ * up to busy_poll_us microseconds; SO_PREFER_BUSY_POLL additionally keeps the
+ * NIC interrupt deferred while user space is polling. Raising SO_BUSY_POLL
+ * above net.core.busy_read needs CAP_NET_ADMIN.
+ *
+ * @param fd Socket to configure.
+ * @return 0 on success (or when busy polling is off), -1 on error.
+ */
+int set_busy_poll(int fd) {
+    if (busy_poll_us == 0) {
+        return 0;
+    }
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) == -1) {
+        perror("setsockopt SO_BUSY_POLL");
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) == -1) {
+        perror("setsockopt SO_PREFER_BUSY_POLL");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds a file descriptor to an epoll instance.
  *
+ * @param epoll_fd The epoll instance.
  * @param fd The file descriptor to add.
  * @return 0 on success, -1 on error.
  */
-int add_to_epoll(int fd) {
+int add_to_epoll(int epoll_fd, int fd) {
     struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLET;  // Level-triggered read events
+    ev.events = EPOLLIN | EPOLLET;  // Edge-triggered read events
     ev.data.fd = fd;
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
         perror("epoll_ctl: add fd");
@@ -72,12 +443,13 @@ int add_to_epoll(int fd) {
 }
 
 /**
- * @brief Removes a file descriptor from the epoll instance.
+ * @brief Removes a file descriptor from an epoll instance.
  *
+ * @param epoll_fd The epoll instance.
  * @param fd The file descriptor to remove.
  * @return 0 on success, -1 on error.
  */
-int remove_from_epoll(int fd) {
+int remove_from_epoll(int epoll_fd, int fd) {
     if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
         perror("epoll_ctl: remove fd");
         return -1;
@@ -86,232 +458,2770 @@ int remove_from_epoll(int fd) {
 }
 
 /**
- * @brief Handles incoming data from a TCP client.
- *
- * Reads data from the client socket and forwards it to the UDP destination.
- * If an error occurs or the client disconnects, cleans up the connection.
+ * @brief Creates a non-blocking TCP listening socket bound to INADDR_ANY:port.
  *
- * @param client_fd The client socket file descriptor.
- * @return 0 on success, -1 on error.
+ * @param port      Port in network byte order.
+ * @param reuseport Non-zero to set SO_REUSEPORT so several reactors can bind the same port.
+ * @param tune      Socket profile applied before listen(), or NULL.
+ * @return The listening socket, or -1 on error.
  */
-int handle_client_data(int client_fd) {
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
+int create_listener(in_port_t port, int reuseport, const sock_tune_t* tune) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("TCP socket");
+        return -1;
+    }
 
-    while (1) {
-        bytes_read = recv(client_fd, buffer, sizeof(buffer), 0);
+    // Set socket options
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEADDR");
+        close(fd);
+        return -1;
+    }
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
+    if (sock_tune_listener(tune, fd) == -1) {
+        close(fd);
+        return -1;
+    }
 
-        if (bytes_read == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // We've read all available data
-                break;
-            } else {
-                // Actual error occurred
-                perror("recv from client");
-                return -1;
-            }
-        } else if (bytes_read == 0) {
-            // Client disconnected
-            printf("Client disconnected (fd: %d)\n", client_fd);
-            return -1;
-        }
+    struct sockaddr_in serv_addr = {0};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = port;
 
-        // Forward the exact received bytes to the UDP server
-        if (sendto(udp_socket, buffer, bytes_read, 0,
-                   (struct sockaddr*)&udp_addr, sizeof(udp_addr)) < 0) {
-            perror("sendto (UDP forward)");
-            // Continue anyway; don't break TCP connection due to UDP issue
-        }
+    if (bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
     }
-    return 0;
+
+    if (listen(fd, listen_backlog) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+
+    // Set listening socket to non-blocking mode
+    if (set_nonblocking(fd) == -1 || set_busy_poll(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
 /**
- * @brief Main function: sets up UDP target, starts TCP listener using epoll, handles clients.
+ * @brief Creates a UDP egress socket for udp_addr.
  *
- * Usage: ./epoll_server <tcp_listen_port> <udp_target_host> <udp_target_port>
+ * Unless --shared-udp is set the socket is connected, which fixes its route
+ * and peer once so that every send skips the lookup and needs no address.
  *
- * @param argc Must be 4.
- * @param argv [prog, tcp_port, udp_host, udp_port]
- * @return Exit status.
+ * @return The socket, or -1 on error.
  */
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <tcp_port> <udp_host> <udp_port>\n", argv[0]);
-        return 1;
-    }
-
-    // === Step 1: Set up UDP forwarding socket ===
-    udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_socket < 0) {
+int open_udp_egress(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
         perror("UDP socket");
-        return 1;
+        return -1;
     }
-
-    memset(&udp_addr, 0, sizeof(udp_addr));
-    udp_addr.sin_family = AF_INET;
-    udp_addr.sin_port = htons(atoi(argv[3]));
-    if (inet_pton(AF_INET, argv[2], &udp_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Invalid UDP host\n");
-        close(udp_socket);
-        return 1;
+    if (udp_sndbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &udp_sndbuf, sizeof(udp_sndbuf)) == -1) {
+        perror("setsockopt SO_SNDBUF");
+        close(fd);
+        return -1;
     }
-
-    // === Step 2: Create epoll instance ===
-    epoll_fd = epoll_create1(0);
-    if (epoll_fd == -1) {
-        perror("epoll_create1");
-        close(udp_socket);
-        return 1;
+    if (!shared_udp && connect(fd, (struct sockaddr*)&udp_addr, sizeof(udp_addr)) == -1) {
+        perror("connect UDP");
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    // === Step 3: Create and configure TCP listening socket ===
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("TCP socket");
-        close(udp_socket);
-        close(epoll_fd);
-        return 1;
+/**
+ * @brief Allocates the slots of an egress batch.
+ *
+ * Messages carry udp_addr only with --shared-udp; a connected socket needs none.
+ *
+ * @param b        Batch to initialise.
+ * @param capacity Number of datagrams per sendmmsg() call.
+ * @param pool     Pool that supplies (and takes back) the payload buffers.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int batch_init(egress_batch_t* b, int capacity, buf_pool_t* pool) {
+    memset(b, 0, sizeof(*b));
+    b->msgs = calloc(capacity, sizeof(struct mmsghdr));
+    b->iovs = calloc(capacity, sizeof(struct iovec));
+    if (!b->msgs || !b->iovs) {
+        perror("malloc egress batch");
+        free(b->msgs);
+        free(b->iovs);
+        b->msgs = NULL;
+        b->iovs = NULL;
+        return -1;
     }
+    b->capacity = capacity;
+    b->pool = pool;
 
-    // Set socket options
-    int opt = 1;
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt SO_REUSEADDR");
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+    // Everything except the iovec contents is constant, so set it up once
+    for (int i = 0; i < capacity; i++) {
+        b->msgs[i].msg_hdr.msg_name = shared_udp ? &udp_addr : NULL;
+        b->msgs[i].msg_hdr.msg_namelen = shared_udp ? sizeof(udp_addr) : 0;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
     }
+    return 0;
+}
 
-    struct sockaddr_in serv_addr = {0};
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(atoi(argv[1]));
+/**
+ * @brief Releases the storage of an egress batch.
+ *
+ * @param b Batch to free.
+ */
+void batch_free(egress_batch_t* b) {
+    free(b->msgs);
+    free(b->iovs);
+    b->msgs = NULL;
+    b->iovs = NULL;
+}
 
-    if (serv_addr.sin_port == 0) {
-        fprintf(stderr, "Usage: %s <tcp_port> <udp_host> <udp_port>\n", argv[0]);
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+/**
+ * @brief Sends every pending datagram with as few sendmmsg() calls as possible.
+ *
+ * A failed datagram is dropped (and counted) rather than retried, matching the
+ * original sendto() behaviour of never breaking a TCP connection over a UDP error.
+ * In backpressure mode EAGAIN and ENOBUFS are not failures: flushing stops and
+ * the unsent datagrams move to the front of the batch for a later attempt.
+ *
+ * @param b         Batch to flush.
+ * @param udp_socket Socket to send on.
+ * @return 0 if the batch is empty on return, -1 if egress is congested (errno set).
+ */
+int batch_flush(egress_batch_t* b, int udp_socket) {
+    if (b->open) {
+        b->open = 0;
+        b->count++;
     }
-
-    if (bind(listen_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("bind");
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+    if (b->count == 0) {
+        return 0;
     }
 
-    if (listen(listen_fd, 10) < 0) {
-        perror("listen");
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+    int sent = 0;
+    int congested = 0;
+    while (sent < b->count) {
+        int n = sendmmsg(udp_socket, b->msgs + sent, b->count - sent, 0);
+        b->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (backpressure && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+                congested = errno;
+                break;
+            }
+            perror("sendmmsg (UDP forward)");
+            // Skip the datagram the kernel rejected and carry on with the rest
+            b->dropped++;
+            sent++;
+            continue;
+        }
+        sent += n;
     }
 
-    // Set listening socket to non-blocking mode
-    if (set_nonblocking(listen_fd) == -1) {
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+    if (sent > 0) {
+        int bucket = 0;
+        while ((2 << bucket) <= sent && bucket < BATCH_HIST - 1) {
+            bucket++;
+        }
+        b->hist[bucket]++;
+        if (sent > b->max_batch) {
+            b->max_batch = sent;
+        }
+        b->datagrams += (unsigned long long)sent;
+        b->flushes++;
     }
 
-    // Add listening socket to epoll
-    if (add_to_epoll(listen_fd) == -1) {
-        close(udp_socket);
-        close(epoll_fd);
-        close(listen_fd);
-        return 1;
+    // The data is in the kernel now; the buffers can take the next receives
+    for (int i = 0; i < sent; i++) {
+        buf_pool_put(b->pool, b->iovs[i].iov_base);
     }
+    b->count -= sent;
+    memmove(b->iovs, b->iovs + sent, sizeof(struct iovec) * b->count);
 
-    printf("Epoll-based TCP server listening on port %s, forwarding to UDP %s:%s\n",
-           argv[1], argv[2], argv[3]);
-    printf("Type 'quit' and press Enter to exit the server gracefully.\n");
-
-    // === Step 4: Main event loop ===
-    struct epoll_event events[MAX_EVENTS];
-    char input[10];  // For reading user input
-
-    // Set up stdin for epoll in case we want to handle it asynchronously
-    fd_set stdin_set;
-    FD_ZERO(&stdin_set);
-    FD_SET(STDIN_FILENO, &stdin_set);
+    if (congested) {
+        errno = congested;
+        return -1;
+    }
+    return 0;
+}
 
-    while (running) {
-        // Check for user input without blocking the entire server
-        FD_ZERO(&stdin_set);
-        FD_SET(STDIN_FILENO, &stdin_set);
-
-        struct timeval tv = {0, 0}; // No timeout - just check if data is available
-        if (select(STDIN_FILENO + 1, &stdin_set, NULL, NULL, &tv) > 0) {
-            if (FD_ISSET(STDIN_FILENO, &stdin_set)) {
-                if (fgets(input, sizeof(input), stdin)) {
-                    if (strncmp(input, "quit", 4) == 0) {
-                        running = 0;
-                        printf("Shutting down epoll TCP server...\n");
-                        break;
-                    }
-                }
-            }
+/**
+ * @brief Prints the egress batching statistics of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose batch statistics are printed.
+ */
+void print_batch_stats(FILE* out, const reactor_t* r) {
+    const egress_batch_t* b = &r->batch;
+    fprintf(out, "Reactor %d egress: %llu datagrams in %llu sendmmsg calls "
+                 "(%.2f per call, max batch %d, %llu dropped)\n",
+                 r->id, b->datagrams, b->syscalls,
+                 b->syscalls ? (double)b->datagrams / b->syscalls : 0.0,
+                 b->max_batch, b->dropped);
+    fprintf(out, "Reactor %d batch sizes:", r->id);
+    for (int i = 0; i < BATCH_HIST; i++) {
+        if (b->hist[i]) {
+            fprintf(out, " [%d-%d]=%llu", 1 << i, (2 << i) - 1, b->hist[i]);
         }
+    }
+    fprintf(out, "\n");
+}
 
-        // Wait for events from epoll
-        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 100); // 100ms timeout
-        if (nfds == -1) {
-            if (errno == EINTR) {
-                continue;  // Signal interrupted, continue loop
-            }
-            perror("epoll_wait");
-            break;
+/**
+ * @brief Parks a connection until egress drains: its epoll registration keeps no events.
+ *
+ * The connection's data stays in its TCP receive buffer, so once that fills
+ * up the peer's window closes and the producer is throttled. epoll still
+ * reports EPOLLERR/EPOLLHUP for it, and handle_client_data() closes it then.
+ *
+ * @param r The reactor owning the connection.
+ * @param c The connection to park.
+ * @return 0 on success, -1 if the connection could not be parked.
+ */
+int reactor_pause_conn(reactor_t* r, conn_t* c) {
+    if (c->flags & CONN_PAUSED) {
+        return 0;
+    }
+    if (r->npaused == r->paused_cap) {
+        int cap = r->paused_cap ? r->paused_cap * 2 : 64;
+        int* grown = realloc(r->paused, sizeof(int) * cap);
+        if (!grown) {
+            perror("realloc paused list");
+            return -1;
         }
+        r->paused = grown;
+        r->paused_cap = cap;
+    }
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.fd = c->fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+        perror("epoll_ctl: pause fd");
+        return -1;
+    }
+    c->flags |= CONN_PAUSED;
+    r->paused[r->npaused++] = c->fd;
+    r->pauses++;
+    return 0;
+}
 
-        for (int i = 0; i < nfds; i++) {
-            if (events[i].data.fd == listen_fd) {
-                // New connection
-                struct sockaddr_in client_addr;
-                socklen_t client_len = sizeof(client_addr);
-                int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_len);
-                
-                if (client_fd == -1) {
-                    perror("accept");
-                    continue;
-                }
+/**
+ * @brief Ends a stall: stops watching for EPOLLOUT and re-enables every parked connection.
+ *
+ * Re-arming an edge-triggered registration with EPOLL_CTL_MOD reports data
+ * that is already waiting in the socket. A connection whose only pending data
+ * is records left in its rx buffer also gets EPOLLOUT, which an idle TCP
+ * socket always reports, so it is woken once as well.
+ *
+ * @param r The reactor whose egress drained.
+ */
+void reactor_resume(reactor_t* r) {
+    uint64_t stalled = conn_now_ms() - r->stall_start_ms;
+    r->stall_ms += stalled;
+    if (stalled > r->max_stall_ms) {
+        r->max_stall_ms = stalled;
+    }
+    r->congested = 0;
+    if (r->out_watched) {
+        remove_from_epoll(r->epoll_fd, r->udp_socket);
+        r->out_watched = 0;
+    }
 
-                // Set client socket to non-blocking mode
-                if (set_nonblocking(client_fd) == -1) {
-                    close(client_fd);
-                    continue;
-                }
+    for (int i = 0; i < r->npaused; i++) {
+        conn_t* c = conn_lookup(&r->conns, r->paused[i]);
+        if (!c || !(c->flags & CONN_PAUSED)) {
+            continue;  // Closed (and maybe reused) while parked
+        }
+        c->flags &= ~CONN_PAUSED;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | (c->rx_len > 0 ? EPOLLOUT : 0);
+        ev.data.fd = c->fd;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+            perror("epoll_ctl: resume fd");
+        }
+    }
+    r->npaused = 0;
+}
 
-                // Add client socket to epoll
-                if (add_to_epoll(client_fd) == -1) {
-                    close(client_fd);
-                    continue;
-                }
+/**
+ * @brief Parks one connection whose client has used up its token buckets.
+ *
+ * Like reactor_pause_conn() the registration keeps no events, but the
+ * connection comes back on its own deadline through reactor_unthrottle().
+ *
+ * @param r       The reactor owning the connection.
+ * @param c       The connection to park.
+ * @param wait_ms Time until the client's buckets are out of debt.
+ * @return 0 on success, -1 if the connection could not be parked.
+ */
+int reactor_throttle_conn(reactor_t* r, conn_t* c, int wait_ms) {
+    if (r->nthrottled == r->throttled_cap) {
+        int cap = r->throttled_cap ? r->throttled_cap * 2 : 64;
+        throttle_t* grown = realloc(r->throttled, sizeof(throttle_t) * cap);
+        if (!grown) {
+            perror("realloc throttled list");
+            return -1;
+        }
+        r->throttled = grown;
+        r->throttled_cap = cap;
+    }
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.fd = c->fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+        perror("epoll_ctl: throttle fd");
+        return -1;
+    }
+    uint64_t until = conn_now_ms() + (uint64_t)wait_ms;
+    c->flags |= CONN_THROTTLED;
+    r->throttled[r->nthrottled].fd = c->fd;
+    r->throttled[r->nthrottled].until_ms = until;
+    if (r->nthrottled++ == 0 || until < r->throttle_next_ms) {
+        r->throttle_next_ms = until;
+    }
+    r->throttles++;
+    return 0;
+}
 
-                printf("New client connected (fd: %d)\n", client_fd);
-            } else {
-                // Data from existing client
-                int client_fd = events[i].data.fd;
-                if (handle_client_data(client_fd) == -1) {
-                    // Client disconnected or error occurred, remove from epoll and close
-                    remove_from_epoll(client_fd);
-                    close(client_fd);
-                }
+/**
+ * @brief Re-enables every throttled connection whose wait is over.
+ *
+ * An entry whose connection was closed, or closed and its fd reused, at worst
+ * resumes the new connection early; it is charged and parked again after its
+ * first read.
+ *
+ * @param r   The reactor.
+ * @param now Current time.
+ */
+void reactor_unthrottle(reactor_t* r, uint64_t now) {
+    if (now < r->throttle_next_ms) {
+        return;
+    }
+    uint64_t next = UINT64_MAX;
+    int kept = 0;
+    for (int i = 0; i < r->nthrottled; i++) {
+        throttle_t t = r->throttled[i];
+        conn_t* c = conn_lookup(&r->conns, t.fd);
+        if (!c || !(c->flags & CONN_THROTTLED)) {
+            continue;
+        }
+        if (t.until_ms > now) {
+            r->throttled[kept++] = t;
+            if (t.until_ms < next) {
+                next = t.until_ms;
             }
+            continue;
+        }
+        c->flags &= ~CONN_THROTTLED;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | (c->rx_len > 0 ? EPOLLOUT : 0);
+        ev.data.fd = c->fd;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+            perror("epoll_ctl: unthrottle fd");
         }
     }
+    r->nthrottled = kept;
+    r->throttle_next_ms = next;
+}
 
-    // Cleanup
-    close(listen_fd);
-    close(udp_socket);
-    close(epoll_fd);
+/**
+ * @brief Flushes the reactor's egress batch and tracks congestion.
+ *
+ * On EAGAIN the UDP socket is watched for EPOLLOUT. ENOBUFS comes from the
+ * device queue rather than the socket buffer and produces no wake-up, so the
+ * loop retries it on a 1 ms timeout instead.
+ *
+ * @param r The reactor.
+ */
+void reactor_flush(reactor_t* r) {
+    if (batch_flush(&r->batch, r->udp_socket) == 0) {
+        if (r->congested) {
+            reactor_resume(r);
+        }
+        return;
+    }
+    if (!r->congested) {
+        r->stall_start_ms = conn_now_ms();
+        r->stalls++;
+    }
+    r->congested = errno;
+    if (errno != ENOBUFS && !r->out_watched) {
+        struct epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.fd = r->udp_socket;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->udp_socket, &ev) == -1) {
+            perror("epoll_ctl: watch UDP socket");
+        } else {
+            r->out_watched = 1;
+        }
+    }
+}
+
+/**
+ * @brief Returns non-zero if the batch has no free slot even after trying to flush it.
+ *
+ * While egress is stalled on EAGAIN no flush is attempted; the EPOLLOUT
+ * wake-up does that.
+ *
+ * @param r The reactor.
+ */
+int reactor_batch_full(reactor_t* r) {
+    egress_batch_t* b = &r->batch;
+    if (b->count < b->capacity) {
+        return 0;
+    }
+    if (!r->out_watched) {
+        reactor_flush(r);
+    }
+    return b->count == b->capacity;
+}
+
+/**
+ * @brief Prints the backpressure counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_backpressure_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d backpressure: %llu stalls, %llu ms stalled (longest %llu ms), "
+                 "%llu connection pauses\n",
+                 r->id, r->stalls, r->stall_ms, r->max_stall_ms, r->pauses);
+}
+
+/**
+ * @brief Prints the busy-poll counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_spin_stats(FILE* out, const reactor_t* r) {
+    unsigned long long waits = r->spin_hits + r->blocks;
+    fprintf(out, "Reactor %d busy-poll: %llu of %llu waits ended while spinning (%.1f%%), "
+                 "%llu empty polls\n",
+                 r->id, r->spin_hits, waits, waits ? 100.0 * r->spin_hits / waits : 0.0,
+                 r->spin_polls);
+}
+
+/**
+ * @brief Appends one whole record to the datagram being packed.
+ *
+ * The record joins the open datagram if it still fits in the MTU budget;
+ * otherwise that datagram is sealed and a new one is started with a fresh
+ * pool buffer. A record longer than the budget travels alone.
+ *
+ * @param r    The reactor.
+ * @param data Record bytes, including its newline or length prefix.
+ * @param len  Record length (at most BUFFER_SIZE).
+ * @return 0 on success, 1 if the batch is full and egress is stalled (the record
+ *         was not taken), -1 if no buffer could be allocated.
+ */
+int batch_add_record(reactor_t* r, const char* data, size_t len) {
+    egress_batch_t* b = &r->batch;
+    if (b->open && b->iovs[b->count].iov_len + len > (size_t)mtu) {
+        b->open = 0;
+        b->count++;
+    }
+    if (!b->open) {
+        if (reactor_batch_full(r)) {
+            return 1;
+        }
+        char* buf = buf_pool_get(&r->pool);
+        if (!buf) {
+            return -1;
+        }
+        b->iovs[b->count].iov_base = buf;
+        b->iovs[b->count].iov_len = 0;
+        b->open = 1;
+    }
+    struct iovec* slot = &b->iovs[b->count];
+    memcpy((char*)slot->iov_base + slot->iov_len, data, len);
+    slot->iov_len += len;
+    r->records++;
+    return 0;
+}
+
+/**
+ * @brief Returns the length of the first complete record in data, or 0 if there is none yet.
+ *
+ * @param data  Buffered bytes of one connection, starting at a record boundary.
+ * @param len   Number of buffered bytes.
+ * @param from  Offset to resume the newline search at (bytes before it hold none).
+ * @return Record length, 0 if incomplete, or -1 for an invalid length prefix.
+ */
+ssize_t frame_record_len(const char* data, size_t len, size_t from) {
+    if (framing == FRAMING_LINE) {
+        const char* nl = memchr(data + from, '\n', len - from);
+        return nl ? (ssize_t)(nl - data + 1) : 0;
+    }
+    if (len < LEN_PREFIX) {
+        return 0;
+    }
+    uint32_t payload;
+    memcpy(&payload, data, LEN_PREFIX);
+    payload = ntohl(payload);
+    if (payload > BUFFER_SIZE - LEN_PREFIX) {
+        return -1;
+    }
+    return len >= LEN_PREFIX + payload ? (ssize_t)(LEN_PREFIX + payload) : 0;
+}
+
+/**
+ * @brief Forwards every complete record in a connection's rx buffer and keeps the partial tail.
+ *
+ * Stops early, leaving the remaining records in rx, if the egress batch is
+ * full while egress is stalled.
+ *
+ * @param r       The reactor owning the connection.
+ * @param c       The connection.
+ * @param scanned Bytes at the start of rx already known to hold no record end.
+ * @return 0 on success, -1 if the connection must be closed.
+ */
+int reactor_forward_records(reactor_t* r, conn_t* c, size_t scanned) {
+    size_t off = 0;
+    int ret = 0;
+    while (off < c->rx_len) {
+        ssize_t len = frame_record_len(c->rx + off, c->rx_len - off,
+                                       scanned > off ? scanned - off : 0);
+        if (len < 0) {
+            fprintf(stderr, "Invalid record length from fd %d, closing\n", c->fd);
+            r->frame_errors++;
+            return -1;
+        }
+        if (len == 0) {
+            break;
+        }
+        ret = batch_add_record(r, c->rx + off, (size_t)len);
+        if (ret != 0) {
+            break;
+        }
+        c->records_out++;
+        off += (size_t)len;
+    }
+    if (ret == 0 && off == 0 && c->rx_len == BUFFER_SIZE) {
+        // A line that does not fit in a buffer: forward it in buffer-sized pieces
+        ret = batch_add_record(r, c->rx, BUFFER_SIZE);
+        if (ret == 0) {
+            r->oversize++;
+            off = BUFFER_SIZE;
+        }
+    }
+    if (ret == -1) {
+        return -1;
+    }
+    c->rx_len -= (uint32_t)off;
+    if (c->rx_len > 0 && off > 0) {
+        memmove(c->rx, c->rx + off, c->rx_len);
+        c->partial_ms = c->active_ms;  // The tail came with the latest receive
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives data from a framed connection and forwards every complete record.
+ *
+ * Data is read into the connection's rx buffer, which is taken from the pool
+ * on demand and given back as soon as no partial record is left in it. When
+ * egress stalls, unforwarded records stay in rx and the connection is parked.
+ *
+ * @param r The reactor owning the connection.
+ * @param c The connection that became readable.
+ * @return 0 on success, -1 if the connection must be closed.
+ */
+int handle_client_records(reactor_t* r, conn_t* c) {
+    // Records held back by an earlier stall go first
+    if (c->rx_len > 0 && !r->congested && reactor_forward_records(r, c, 0) == -1) {
+        return -1;
+    }
+
+    int stalled = 0;
+    while (!stalled) {
+        if (r->congested || c->rx_len == BUFFER_SIZE) {
+            // Egress is stalled, or rx is still full of records it refused
+            stalled = 1;
+            break;
+        }
+        if (!c->rx) {
+            c->rx = buf_pool_get(&r->pool);
+            if (!c->rx) {
+                return -1;
+            }
+        }
+        if (c->rx_len == 0) {
+            c->partial_ms = c->active_ms;  // Whatever arrives now starts a new record
+        }
+        size_t scanned = c->rx_len;
+        ssize_t n = recv(c->fd, c->rx + c->rx_len, BUFFER_SIZE - c->rx_len, 0);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            if (n == -1) {
+                perror("recv from client");
+            } else if (c->rx_len > 0 && framing == FRAMING_LINE &&
+                       batch_add_record(r, c->rx, c->rx_len) == 0) {
+                // A final line without newline is still a record
+                c->records_out++;
+            } else if (c->rx_len > 0) {
+                r->frame_errors++;
+            }
+            c->rx_len = 0;
+            if (n == 0) {
+                printf("Client disconnected (fd: %d, %llu bytes in %llu records, %llu ms)\n",
+                       c->fd, (unsigned long long)c->bytes_in,
+                       (unsigned long long)c->records_out,
+                       (unsigned long long)(c->active_ms - c->opened_ms));
+            }
+            return -1;
+        }
+        c->rx_len += (uint32_t)n;
+        c->bytes_in += (uint64_t)n;
+        uint32_t records_before = c->records_out;
+        if (reactor_forward_records(r, c, scanned) == -1) {
+            return -1;
+        }
+        if (rate_limits) {
+            int wait = rate_limit_charge(&limiter, c->peer_addr, (uint64_t)n,
+                                         c->records_out - records_before, conn_now_ms());
+            if (wait > 0) {
+                return reactor_throttle_conn(r, c, wait);
+            }
+        }
+        stalled = r->congested != 0;
+    }
+    if (stalled) {
+        return reactor_pause_conn(r, c);
+    }
+
+    // Detach the buffer unless a partial record is waiting for more data
+    if (c->rx_len == 0) {
+        buf_pool_put(&r->pool, c->rx);
+        c->rx = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the framing counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_framing_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d framing: %llu records in %llu datagrams (%.2f per datagram), "
+                 "%llu oversize lines, %llu framing errors\n",
+                 r->id, r->records, r->batch.datagrams,
+                 r->batch.datagrams ? (double)r->records / r->batch.datagrams : 0.0,
+                 r->oversize, r->frame_errors);
+}
+
+/**
+ * @brief Prints the connection table and buffer pool footprint of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose memory use is printed.
+ */
+void print_conn_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d connections: %llu open (peak %llu), table %zu KB; "
+                 "buffer pool: %llu of %llu in use (peak %llu), %llu KB\n",
+                 r->id, r->conns.live, r->conns.peak, conn_table_memory(&r->conns) / 1024,
+                 r->pool.in_use, r->pool.total, r->pool.peak,
+                 r->pool.total * BUFFER_SIZE / 1024);
+}
+
+/**
+ * @brief Milliseconds left before the nearest timeout of a connection.
+ *
+ * @param c    The connection.
+ * @param now  Current time, truncated to 32 bits like the conn_t timestamps.
+ * @param kind Out: the timeout that is nearest (unchanged if none applies).
+ * @return Time left (zero or negative once due), or INT64_MAX if no timeout applies.
+ */
+int64_t conn_time_left(const conn_t* c, uint32_t now, timeout_kind_t* kind) {
+    int64_t left = INT64_MAX;
+    if (handshake_timeout_ms && c->bytes_in == 0) {
+        left = (int64_t)handshake_timeout_ms - (uint32_t)(now - c->opened_ms);
+        *kind = TIMEOUT_HANDSHAKE;
+    }
+    if (idle_timeout_ms) {
+        int64_t idle = (int64_t)idle_timeout_ms - (uint32_t)(now - c->active_ms);
+        if (idle < left) {
+            left = idle;
+            *kind = TIMEOUT_IDLE;
+        }
+    }
+    if (read_timeout_ms && c->rx_len > 0) {
+        int64_t partial = (int64_t)read_timeout_ms - (uint32_t)(now - c->partial_ms);
+        if (partial < left) {
+            left = partial;
+            *kind = TIMEOUT_READ;
+        }
+    }
+    return left;
+}
+
+/**
+ * @brief Puts a connection's timer in the wheel slot of its nearest deadline.
+ *
+ * When no timeout applies yet (say only --read-timeout is set and no record is
+ * pending), the timer still fires after the longest timeout so that a record
+ * started in the meantime is noticed.
+ *
+ * @param r    The reactor owning the connection.
+ * @param c    The connection.
+ * @param now  Current time.
+ * @param left Result of conn_time_left().
+ */
+void reactor_arm_timer(reactor_t* r, conn_t* c, uint64_t now, int64_t left) {
+    if (left <= 0 || left > timeout_recheck_ms) {
+        left = timeout_recheck_ms;
+    }
+    timer_wheel_add(&r->timers, &c->timer, now + (uint64_t)left);
+}
+
+/**
+ * @brief Registers a newly accepted socket in the reactor's connection table.
+ *
+ * @param r    The reactor that accepted the connection.
+ * @param fd   Connected socket.
+ * @param peer Peer address, or NULL if unknown.
+ * @return The new entry, or NULL on allocation failure (fd is left open).
+ */
+conn_t* reactor_open_conn(reactor_t* r, int fd, const struct sockaddr_in* peer) {
+    conn_t* c = conn_open(&r->conns, fd);
+    if (c && peer) {
+        c->peer_addr = peer->sin_addr.s_addr;
+        c->peer_port = peer->sin_port;
+    }
+    if (c && timeout_recheck_ms) {
+        timeout_kind_t kind;
+        reactor_arm_timer(r, c, c->opened_ms, conn_time_left(c, c->opened_ms, &kind));
+    }
+    return c;
+}
+
+/**
+ * @brief Closes a client connection and recycles its table entry and buffer.
+ *
+ * @param r The reactor owning the connection.
+ * @param c The connection to close.
+ */
+void reactor_close_conn(reactor_t* r, conn_t* c) {
+    int fd = c->fd;
+    if (!use_uring) {
+        remove_from_epoll(r->epoll_fd, fd);
+    }
+    if (c->rx) {
+        buf_pool_put(&r->pool, c->rx);
+    }
+    if (c->flags & CONN_ADMITTED) {
+        rate_limit_release(&limiter, c->peer_addr);
+    }
+    timer_wheel_del(&r->timers, &c->timer);  // Before release: the link shares space with next_free
+    conn_release(&r->conns, c);
+    close(fd);
+}
+
+/**
+ * @brief Closes a client by descriptor; see reactor_close_conn().
+ *
+ * @param r  The reactor owning the connection.
+ * @param fd Client socket (closed even if it has no table entry).
+ */
+void reactor_close_fd(reactor_t* r, int fd) {
+    conn_t* c = conn_lookup(&r->conns, fd);
+    if (c) {
+        reactor_close_conn(r, c);
+    } else {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Timer wheel callback: closes a connection whose timeout has passed.
+ *
+ * Most timers fire early because data arrived after they were armed; those are
+ * simply re-armed for the new deadline. A connection parked by backpressure or
+ * the rate limiter is not read from, so its timestamps are stale and it is
+ * never evicted.
+ *
+ * With io_uring the socket is only shut down: the pending multishot recv then
+ * completes with end-of-file and closes the connection the usual way.
+ *
+ * @param node Timer of the connection.
+ * @param ctx  The reactor owning the wheel.
+ */
+void reactor_conn_timer(timer_node_t* node, void* ctx) {
+    reactor_t* r = (reactor_t*)ctx;
+    conn_t* c = (conn_t*)((char*)node - offsetof(conn_t, timer));
+    timeout_kind_t kind = TIMEOUT_IDLE;
+    int64_t left = conn_time_left(c, (uint32_t)r->sweep_ms, &kind);
+
+    if (left > 0 || (c->flags & (CONN_PAUSED | CONN_THROTTLED))) {
+        r->rearmed++;
+        reactor_arm_timer(r, c, r->sweep_ms, left);
+        return;
+    }
+    r->expired[kind]++;
+    printf("Client timed out (fd: %d, %s timeout, %llu bytes)\n",
+           c->fd, timeout_names[kind], (unsigned long long)c->bytes_in);
+    if (use_uring) {
+        shutdown(c->fd, SHUT_RDWR);
+    } else {
+        reactor_close_conn(r, c);
+    }
+}
+
+/**
+ * @brief Advances a reactor's timer wheel to now and closes every connection that is due.
+ *
+ * Only the slots of the ticks that passed since the last call are visited, so
+ * the cost is independent of the number of open connections.
+ *
+ * @param r The reactor.
+ */
+void reactor_expire(reactor_t* r) {
+    unsigned long long before = r->expired[TIMEOUT_IDLE] + r->expired[TIMEOUT_READ] +
+                                r->expired[TIMEOUT_HANDSHAKE];
+    r->sweep_ms = conn_now_ms();
+    if (timer_wheel_advance(&r->timers, r->sweep_ms, reactor_conn_timer, r) == 0) {
+        return;
+    }
+    unsigned long long closed = r->expired[TIMEOUT_IDLE] + r->expired[TIMEOUT_READ] +
+                                r->expired[TIMEOUT_HANDSHAKE] - before;
+    if (closed > r->max_sweep) {
+        r->max_sweep = closed;
+    }
+}
+
+/**
+ * @brief Returns the poll timeout that wakes a reactor for its next timer tick.
+ *
+ * @param r       The reactor.
+ * @param timeout Timeout chosen for other reasons (-1 = none).
+ * @return The smaller of timeout and the time to the next occupied tick.
+ */
+int reactor_timer_timeout(const reactor_t* r, int timeout) {
+    if (!timeout_recheck_ms || timeout == 0) {
+        return timeout;
+    }
+    int next = timer_wheel_timeout(&r->timers, conn_now_ms());
+    if (next >= 0 && (timeout < 0 || next < timeout)) {
+        timeout = next;
+    }
+    return timeout;
+}
+
+/**
+ * @brief Prints the timeout counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_timeout_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d timeouts: %llu idle, %llu read, %llu handshake closed "
+                 "(at most %llu per sweep), %lu timers armed, %llu re-armed\n",
+                 r->id, r->expired[TIMEOUT_IDLE], r->expired[TIMEOUT_READ],
+                 r->expired[TIMEOUT_HANDSHAKE], r->max_sweep, r->timers.count, r->rearmed);
+}
+
+/**
+ * @brief Handles incoming data from a TCP client.
+ *
+ * Reads data from the client socket into pool buffers queued on the reactor's
+ * egress batch; the batch is forwarded to the UDP destination at the end of the
+ * event-loop iteration. If an error occurs or the client disconnects, returns
+ * -1 so the caller closes the connection.
+ *
+ * @param r The reactor owning the connection.
+ * @param c The connection that became readable.
+ * @return 0 on success, -1 on error.
+ */
+int handle_client_data(reactor_t* r, conn_t* c) {
+    egress_batch_t* b = &r->batch;
+    int client_fd = c->fd;
+    ssize_t bytes_read;
+
+    if (c->flags & (CONN_PAUSED | CONN_THROTTLED)) {
+        // A parked registration only reports EPOLLERR/EPOLLHUP, level-triggered: close it
+        return -1;
+    }
+    uint64_t now = conn_now_ms();
+    c->active_ms = (uint32_t)now;
+    sock_tune_after_read(r->tune, client_fd);
+    if (framing != FRAMING_RAW) {
+        return handle_client_records(r, c);
+    }
+    while (1) {
+        // Make room before reading so the data can go straight into a slot
+        if (r->congested || reactor_batch_full(r)) {
+            return reactor_pause_conn(r, c);
+        }
+        char* buf = buf_pool_get(&r->pool);
+        if (!buf) {
+            return -1;
+        }
+        bytes_read = recv(client_fd, buf, BUFFER_SIZE, 0);
+
+        if (bytes_read <= 0) {
+            buf_pool_put(&r->pool, buf);
+        }
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // We've read all available data
+                break;
+            } else {
+                // Actual error occurred
+                perror("recv from client");
+                return -1;
+            }
+        } else if (bytes_read == 0) {
+            // Client disconnected
+            printf("Client disconnected (fd: %d, %llu bytes in %llu datagrams, %llu ms)\n",
+                   client_fd, (unsigned long long)c->bytes_in,
+                   (unsigned long long)c->records_out,
+                   (unsigned long long)(c->active_ms - c->opened_ms));
+            return -1;
+        }
+
+        // Queue the exact received bytes as one datagram for the UDP server
+        struct iovec* slot = &b->iovs[b->count++];
+        slot->iov_base = buf;
+        slot->iov_len = (size_t)bytes_read;
+        c->bytes_in += (uint64_t)bytes_read;
+        c->records_out++;
+
+        // Over budget: leave the rest in the socket until the client's buckets refill
+        if (rate_limits) {
+            int wait = rate_limit_charge(&limiter, c->peer_addr, (uint64_t)bytes_read, 1, now);
+            if (wait > 0) {
+                return reactor_throttle_conn(r, c, wait);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Accepts and immediately closes one pending connection using the spare fd.
+ *
+ * Called when accept fails with EMFILE/ENFILE. Without this, the connection
+ * would stay in the queue and (with edge-triggered epoll) keep the listener
+ * stuck. The peer sees a clean close and can retry later.
+ *
+ * @param r The reactor whose listener is out of descriptors.
+ * @return 0 if a connection was shed, -1 if nothing could be done (errno is
+ *         that of the failed accept, EAGAIN meaning the queue is now empty).
+ */
+int shed_connection(reactor_t* r) {
+    if (r->spare_fd < 0) {
+        return -1;
+    }
+    close(r->spare_fd);
+    int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    int saved_errno = errno;
+    if (fd >= 0) {
+        close(fd);
+        r->shed++;
+    }
+    r->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    errno = saved_errno;
+    return fd >= 0 ? 0 : -1;
+}
+
+/**
+ * @brief Drains the reactor's accept queue, up to accept_budget connections.
+ *
+ * Loops accept4() until EAGAIN. If the budget runs out first, accept_pending is
+ * set so the event loop calls back in its next iteration without waiting.
+ *
+ * @param r The reactor that received the listen event.
+ */
+void handle_accept(reactor_t* r) {
+    r->accept_pending = 0;
+    for (int n = 0; n < accept_budget; n++) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(r->listen_fd, (struct sockaddr*)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;  // Queue drained
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                if (shed_connection(r) == 0) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;  // Shed everything that was queued
+                }
+            }
+            perror("accept");
+            return;
+        }
+
+        if (rate_limits &&
+            rate_limit_admit(&limiter, client_addr.sin_addr.s_addr, conn_now_ms()) != RATE_ADMIT) {
+            close(client_fd);
+            r->refused++;
+            continue;
+        }
+        conn_t* c = reactor_open_conn(r, client_fd, &client_addr);
+        if (!c) {
+            if (rate_limits) {
+                rate_limit_release(&limiter, client_addr.sin_addr.s_addr);
+            }
+            close(client_fd);
+            continue;
+        }
+        if (rate_limits) {
+            c->flags |= CONN_ADMITTED;
+        }
+
+        // Add client socket to epoll
+        if (set_busy_poll(client_fd) == -1 || sock_tune_accepted(r->tune, client_fd) == -1 ||
+            add_to_epoll(r->epoll_fd, client_fd) == -1) {
+            if (c->flags & CONN_ADMITTED) {
+                rate_limit_release(&limiter, c->peer_addr);
+            }
+            timer_wheel_del(&r->timers, &c->timer);
+            conn_release(&r->conns, c);
+            close(client_fd);
+            continue;
+        }
+
+        r->accepted++;
+        printf("New client connected (fd: %d, reactor: %d)\n", client_fd, r->id);
+    }
+
+    // Budget exhausted: there may be more, but let established clients run first
+    r->accept_pending = 1;
+    r->deferred++;
+}
+
+/**
+ * @brief Prints the accept-path counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_accept_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d accept: %llu accepted, %llu deferred at budget, %llu shed on EMFILE\n",
+            r->id, r->accepted, r->deferred, r->shed);
+}
+
+/**
+ * @brief Prints the rate limiter counters of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose counters are printed.
+ */
+void print_rate_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d rate limiting: %llu connections refused at accept, "
+                 "%llu throttled, %d parked now\n",
+            r->id, r->refused, r->throttles, r->nthrottled);
+}
+
+/**
+ * @brief Returns a free SQE, submitting queued ones first if the SQ is full.
+ *
+ * @param r The io_uring reactor.
+ * @return A zeroed SQE, or NULL if the ring stays full.
+ */
+struct io_uring_sqe* uring_reactor_sqe(reactor_t* r) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&r->ring);
+    if (!sqe) {
+        uring_submit_and_wait(&r->ring, 0, 0);
+        sqe = uring_get_sqe(&r->ring);
+    }
+    return sqe;
+}
+
+/**
+ * @brief Queues a multishot accept on the reactor's listening socket.
+ *
+ * @param r The io_uring reactor.
+ */
+void uring_arm_accept(reactor_t* r) {
+    struct io_uring_sqe* sqe = uring_reactor_sqe(r);
+    if (!sqe) {
+        fprintf(stderr, "Reactor %d: submission queue full, accept not armed\n", r->id);
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD_MAKE(UD_ACCEPT, r->listen_fd);
+}
+
+/**
+ * @brief Queues a multishot recv that picks its buffers from the reactor's buffer ring.
+ *
+ * @param r         The io_uring reactor.
+ * @param client_fd Connected TCP socket.
+ */
+void uring_arm_recv(reactor_t* r, int client_fd) {
+    struct io_uring_sqe* sqe = uring_reactor_sqe(r);
+    if (!sqe) {
+        fprintf(stderr, "Reactor %d: submission queue full, closing fd %d\n", r->id, client_fd);
+        reactor_close_fd(r, client_fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = r->bufs.bgid;
+    sqe->user_data = UD_MAKE(UD_RECV, client_fd);
+}
+
+/**
+ * @brief Records that buffer `bid` holds `len` received bytes to forward.
+ *
+ * The send itself is queued by uring_flush_sends() at the end of the iteration.
+ *
+ * @param r   The io_uring reactor.
+ * @param bid Buffer id holding the received data.
+ * @param len Number of bytes received into the buffer.
+ */
+void uring_queue_send(reactor_t* r, unsigned short bid, unsigned len) {
+    r->send_iovs[bid].iov_len = len;
+    r->pending[r->npending++] = bid;
+    r->inflight++;
+}
+
+/**
+ * @brief Queues this iteration's UDP sends as one linked chain.
+ *
+ * Links keep the datagrams in receive order even when the kernel has to punt a
+ * send to a worker. The chain has to be contiguous in the SQ (anything queued
+ * between two linked SQEs would join the chain), which is why the sends are
+ * collected first and emitted here in one go. Each buffer returns to the ring
+ * when its send completes.
+ *
+ * @param r The io_uring reactor.
+ */
+void uring_flush_sends(reactor_t* r) {
+    struct io_uring_sqe* prev = NULL;
+    for (int i = 0; i < r->npending; i++) {
+        unsigned short bid = r->pending[i];
+        struct io_uring_sqe* sqe = uring_get_sqe(&r->ring);
+        if (!sqe) {
+            // SQ full: end the chain here, submit it and start a new one
+            if (prev) {
+                prev->flags &= ~IOSQE_IO_LINK;
+                prev = NULL;
+            }
+            uring_submit_and_wait(&r->ring, 0, 0);
+            sqe = uring_get_sqe(&r->ring);
+        }
+        if (!sqe) {
+            // Drop the datagram; the buffer goes straight back to the ring
+            r->send_errors++;
+            r->inflight--;
+            uring_buf_ring_add(&r->bufs, bid);
+            continue;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = r->udp_socket;
+        sqe->addr = (unsigned long long)(uintptr_t)&r->send_msgs[bid];
+        sqe->len = 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = UD_MAKE(UD_SEND, bid);
+        prev = sqe;
+    }
+    if (prev) {
+        prev->flags &= ~IOSQE_IO_LINK;
+    }
+    r->npending = 0;
+}
+
+/**
+ * @brief Remembers a connection whose multishot recv stopped for lack of buffers.
+ *
+ * @param r         The io_uring reactor.
+ * @param client_fd Connection to re-arm once buffers are returned.
+ */
+void uring_add_starved(reactor_t* r, int client_fd) {
+    if (r->nstarved == r->starved_cap) {
+        int cap = r->starved_cap ? r->starved_cap * 2 : 64;
+        int* grown = realloc(r->starved, sizeof(int) * cap);
+        if (!grown) {
+            perror("realloc starved list");
+            reactor_close_fd(r, client_fd);
+            return;
+        }
+        r->starved = grown;
+        r->starved_cap = cap;
+    }
+    r->starved[r->nstarved++] = client_fd;
+}
+
+/**
+ * @brief Handles one completion of the io_uring backend.
+ *
+ * @param r   The io_uring reactor.
+ * @param cqe The completion (consumed by the caller afterwards).
+ * @return Number of receive buffers handed back to the ring.
+ */
+int uring_handle_cqe(reactor_t* r, const struct io_uring_cqe* cqe) {
+    unsigned long long op = cqe->user_data >> 32;
+    int val = (int)(cqe->user_data & 0xffffffffu);
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (op == UD_ACCEPT) {
+        if (cqe->res >= 0) {
+            sock_tune_accepted(r->tune, cqe->res);  // No per-read hook here: quickack=on acts once
+            if (reactor_open_conn(r, cqe->res, NULL)) {
+                r->accepted++;
+                printf("New client connected (fd: %d, reactor: %d)\n", cqe->res, r->id);
+                uring_arm_recv(r, cqe->res);
+            } else {
+                close(cqe->res);
+            }
+        } else if ((cqe->res == -EMFILE || cqe->res == -ENFILE) && shed_connection(r) == 0) {
+            // Out of descriptors: shed one so the queue keeps moving
+        } else {
+            errno = -cqe->res;
+            perror("accept (io_uring)");
+        }
+        if (!more && running) {
+            uring_arm_accept(r);
+        }
+        return 0;
+    }
+
+    if (op == UD_RECV) {
+        if (cqe->res > 0) {
+            unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            conn_t* c = conn_lookup(&r->conns, val);
+            if (c) {
+                c->bytes_in += (uint64_t)cqe->res;
+                c->records_out++;
+                c->active_ms = conn_now_ms();
+            }
+            r->recvs++;
+            uring_queue_send(r, bid, (unsigned)cqe->res);
+            if (!more) {
+                uring_arm_recv(r, val);
+            }
+        } else if (cqe->res == -ENOBUFS) {
+            // Every buffer is waiting on a send; resume once some come back
+            uring_add_starved(r, val);
+        } else {
+            if (cqe->res == 0) {
+                printf("Client disconnected (fd: %d)\n", val);
+            } else {
+                errno = -cqe->res;
+                perror("recv from client (io_uring)");
+            }
+            if (!more) {
+                reactor_close_fd(r, val);
+            }
+        }
+        return 0;
+    }
+
+    // UD_SEND: the datagram left (or failed); recycle its buffer either way
+    if (cqe->res >= 0) {
+        r->sends++;
+    } else {
+        r->send_errors++;
+        if (cqe->res != -ECANCELED) {
+            errno = -cqe->res;
+            perror("sendmsg (UDP forward, io_uring)");
+        }
+    }
+    r->inflight--;
+    uring_buf_ring_add(&r->bufs, (unsigned short)val);
+    return 1;
+}
+
+/**
+ * @brief Prints the io_uring statistics of one reactor.
+ *
+ * @param out Stream to print to.
+ * @param r   Reactor whose statistics are printed.
+ */
+void print_uring_stats(FILE* out, const reactor_t* r) {
+    fprintf(out, "Reactor %d io_uring: %llu receives, %llu sends (%llu failed) in %llu io_uring_enter calls "
+                 "(%.2f messages per call)\n",
+                 r->id, r->recvs, r->sends, r->send_errors, r->ring.enters,
+                 r->ring.enters ? (double)(r->recvs + r->sends) / r->ring.enters : 0.0);
+}
+
+/**
+ * @brief Prints the statistics of every reactor.
+ *
+ * Counters of other reactors are read without synchronisation, so a snapshot
+ * taken while the server runs is approximate.
+ *
+ * @param out Stream to print to.
+ */
+void print_all_stats(FILE* out) {
+    for (int i = 0; i < num_reactors; i++) {
+        print_accept_stats(out, &reactors[i]);
+        print_conn_stats(out, &reactors[i]);
+        if (rate_limits) {
+            print_rate_stats(out, &reactors[i]);
+        }
+        if (timeout_recheck_ms) {
+            print_timeout_stats(out, &reactors[i]);
+        }
+        if (use_uring) {
+            print_uring_stats(out, &reactors[i]);
+        } else {
+            print_batch_stats(out, &reactors[i]);
+            if (backpressure) {
+                print_backpressure_stats(out, &reactors[i]);
+            }
+            if (spin_us) {
+                print_spin_stats(out, &reactors[i]);
+            }
+            if (framing != FRAMING_RAW) {
+                print_framing_stats(out, &reactors[i]);
+            }
+        }
+    }
+    if (rate_limits) {
+        rate_limit_print(&limiter, out);
+    }
+}
+
+/**
+ * @brief Stops every reactor: clears the running flag and signals the shutdown eventfd.
+ *
+ * The eventfd is never read, so it stays readable and wakes each reactor once.
+ */
+void request_shutdown(void) {
+    if (!running) {
+        return;
+    }
+    running = 0;
+    printf("Shutting down epoll TCP server...\n");
+    uint64_t one = 1;
+    if (write(shutdown_fd, &one, sizeof(one)) < 0) {
+        perror("write shutdown eventfd");
+    }
+}
+
+/**
+ * @brief Starts watching a control descriptor in a reactor's event loop.
+ *
+ * epoll watches it level-triggered; io_uring uses a multishot poll.
+ *
+ * @param r  Reactor whose loop should report the descriptor.
+ * @param fd Descriptor to watch.
+ * @return 0 on success, -1 on error.
+ */
+int control_watch(reactor_t* r, int fd) {
+    if (use_uring) {
+        struct io_uring_sqe* sqe = uring_reactor_sqe(r);
+        if (!sqe) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = UD_MAKE(UD_CONTROL, fd);
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;  // Level-triggered: handlers may leave data for the next round
+    ev.data.fd = fd;
+    return epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * @brief Stops watching a control descriptor (call before closing it).
+ *
+ * @param r  Reactor that watches the descriptor.
+ * @param fd Descriptor to forget.
+ */
+void control_unwatch(reactor_t* r, int fd) {
+    if (use_uring) {
+        struct io_uring_sqe* sqe = uring_reactor_sqe(r);
+        if (sqe) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->addr = UD_MAKE(UD_CONTROL, fd);
+            sqe->user_data = 0;  // Completion of the removal itself is ignored
+        }
+        return;
+    }
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**
+ * @brief Returns non-zero if fd belongs to the control channel.
+ *
+ * @param fd Descriptor reported by the event loop.
+ */
+int control_owns(int fd) {
+    if (fd == control.signal_fd || fd == control.admin_fd ||
+        (fd == STDIN_FILENO && control.stdin_watched)) {
+        return 1;
+    }
+    for (int i = 0; i < MAX_ADMIN_CLIENTS; i++) {
+        if (control.admin_clients[i] == fd) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the listener a reactor inherited from the old process, or a new one.
+ *
+ * Either way it gets the reactor's socket profile, so an upgrade can change it.
+ *
+ * @param id        Reactor index.
+ * @param port      TCP listen port in network byte order.
+ * @param reuseport Non-zero when several reactors share the port.
+ * @return The listening socket, or -1 on error.
+ */
+int upgrade_take_listener(int id, in_port_t port, int reuseport) {
+    const sock_tune_t* tune = sock_tune_for(&tunes, id);
+    if (upgrade.sock >= 0 && upgrade.listeners[id] >= 0) {
+        int fd = upgrade.listeners[id];
+        upgrade.listeners[id] = -1;
+        sock_tune_listener(tune, fd);
+        return fd;
+    }
+    return create_listener(port, reuseport, tune);
+}
+
+/**
+ * @brief Returns the egress socket a slot inherited from the old process, or a new one.
+ *
+ * Inherited sockets keep their source port, so the collector sees the same
+ * flows before and after the upgrade. They are only reused if both processes
+ * agree on --shared-udp.
+ *
+ * @param id Reactor index (0 for the shared socket).
+ * @return The socket, or -1 on error.
+ */
+int upgrade_take_udp(int id) {
+    int fd = upgrade.sock >= 0 && upgrade.udp_shared == shared_udp ? upgrade.udp[id] : -1;
+    if (fd < 0) {
+        return open_udp_egress();
+    }
+    upgrade.udp[id] = -1;
+    if (udp_sndbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &udp_sndbuf, sizeof(udp_sndbuf)) == -1) {
+        perror("setsockopt SO_SNDBUF");
+    }
+    return fd;
+}
+
+/**
+ * @brief New process: receives the old process's listening and UDP sockets.
+ *
+ * @return 0 on success, -1 if the conversation failed (received sockets are kept).
+ */
+int upgrade_receive_sockets(void) {
+    while (1) {
+        handoff_msg_t m;
+        int fds[FD_HANDOFF_MAX_FDS];
+        if (fd_handoff_recv(upgrade.sock, &m, NULL, 0, fds, HANDOFF_TIMEOUT_MS) == -1) {
+            return -1;
+        }
+        if (m.type == HANDOFF_SOCKETS_END) {
+            return 0;
+        }
+        if ((m.type != HANDOFF_LISTENER && m.type != HANDOFF_UDP) || m.nfds != 1 ||
+            m.index >= MAX_REACTORS) {
+            for (int i = 0; i < m.nfds; i++) {
+                close(fds[i]);
+            }
+            continue;
+        }
+        int* slot = m.type == HANDOFF_LISTENER ? &upgrade.listeners[m.index] : &upgrade.udp[m.index];
+        if (*slot >= 0) {
+            close(*slot);
+        }
+        *slot = fds[0];
+        if (m.type == HANDOFF_UDP) {
+            upgrade.udp_shared = (m.flags & HANDOFF_F_SHARED) != 0;
+        }
+    }
+}
+
+/**
+ * @brief New process: closes inherited sockets that no reactor took over.
+ *
+ * Happens when the new command line runs fewer reactors; connections queued
+ * on a listener closed here are reset once the old process closes it too.
+ */
+void upgrade_close_unused(void) {
+    for (int i = 0; i < MAX_REACTORS; i++) {
+        if (upgrade.listeners[i] >= 0) {
+            close(upgrade.listeners[i]);
+            upgrade.listeners[i] = -1;
+        }
+        if (upgrade.udp[i] >= 0) {
+            close(upgrade.udp[i]);
+            upgrade.udp[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief New process: registers a connection handed over by the old process.
+ *
+ * The connection keeps its counters, timestamps and unforwarded partial
+ * record. Adding it to epoll reports any data already queued on the socket,
+ * so nothing waits for the next packet.
+ *
+ * @param r    Reactor that takes the connection (its thread must not run yet).
+ * @param fd   Connected socket.
+ * @param m    HANDOFF_CLIENT header.
+ * @param data Partial record of m->data_len bytes.
+ * @return 0 on success, -1 if the connection was closed instead.
+ */
+int reactor_adopt_conn(reactor_t* r, int fd, const handoff_msg_t* m, const char* data) {
+    if (m->data_len > BUFFER_SIZE || set_busy_poll(fd) == -1 || add_to_epoll(r->epoll_fd, fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (rate_limits && rate_limit_admit(&limiter, m->peer_addr, conn_now_ms()) != RATE_ADMIT) {
+        r->refused++;
+        close(fd);
+        return -1;
+    }
+    conn_t* c = conn_open(&r->conns, fd);
+    if (!c) {
+        if (rate_limits) {
+            rate_limit_release(&limiter, m->peer_addr);
+        }
+        close(fd);
+        return -1;
+    }
+    c->peer_addr = m->peer_addr;
+    c->peer_port = m->peer_port;
+    c->flags = m->conn_flags | (rate_limits ? CONN_ADMITTED : 0);
+    c->opened_ms = m->opened_ms;
+    c->active_ms = m->active_ms;
+    c->partial_ms = m->partial_ms;
+    c->records_out = m->records_out;
+    c->bytes_in = m->bytes_in;
+    if (m->data_len > 0) {
+        c->rx = buf_pool_get(&r->pool);
+        if (!c->rx) {
+            reactor_close_conn(r, c);
+            return -1;
+        }
+        memcpy(c->rx, data, m->data_len);
+        c->rx_len = m->data_len;
+    }
+    if (timeout_recheck_ms) {
+        uint64_t now = conn_now_ms();
+        timeout_kind_t kind;
+        reactor_arm_timer(r, c, now, conn_time_left(c, (uint32_t)now, &kind));
+    }
+    return 0;
+}
+
+/**
+ * @brief New process: takes over the connections the old process sends, until HANDOFF_DONE.
+ *
+ * Connections are dealt round-robin to the reactors, whose threads have not
+ * been started yet.
+ */
+void upgrade_receive_clients(void) {
+    char data[BUFFER_SIZE];
+    unsigned long long adopted = 0;
+    int next = 0;
+    while (1) {
+        handoff_msg_t m;
+        int fds[FD_HANDOFF_MAX_FDS];
+        if (fd_handoff_recv(upgrade.sock, &m, data, sizeof(data), fds, HANDOFF_TIMEOUT_MS) == -1) {
+            fprintf(stderr, "Upgrade: lost the old process, continuing without its connections\n");
+            break;
+        }
+        if (m.type == HANDOFF_DONE) {
+            break;
+        }
+        if (m.type != HANDOFF_CLIENT || m.nfds != 1) {
+            for (int i = 0; i < m.nfds; i++) {
+                close(fds[i]);
+            }
+            continue;
+        }
+        reactor_t* r = &reactors[next++ % num_reactors];
+        if (reactor_adopt_conn(r, fds[0], &m, data) == 0) {
+            adopted++;
+        }
+    }
+    printf("Upgrade: took over %llu connections from the old process\n", adopted);
+}
+
+/**
+ * @brief Old process: starts the new binary and hands it the listening and UDP sockets.
+ *
+ * Blocks reactor 0 until the new process reports that it is accepting (or
+ * HANDOFF_TIMEOUT_MS passes, in which case it is killed and nothing
+ * changes). Then either every reactor starts draining, or, with
+ * with_clients, the server shuts down and main() passes the connections on.
+ *
+ * @param with_clients Also hand over established connections.
+ * @param out          Where to report progress.
+ */
+void upgrade_start(int with_clients, FILE* out) {
+    if (use_uring) {
+        fprintf(out, "upgrade requires the epoll backend\n");
+        return;
+    }
+    if (upgrade.sock >= 0 || upgrade.draining || !running) {
+        fprintf(out, "upgrade already in progress\n");
+        return;
+    }
+    int sock;
+    pid_t pid = fd_handoff_spawn(upgrade.argv, &sock);
+    if (pid < 0) {
+        fprintf(out, "upgrade failed: cannot start %s\n", upgrade.argv[0]);
+        return;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < num_reactors && ok; i++) {
+        handoff_msg_t m;
+        memset(&m, 0, sizeof(m));
+        m.type = HANDOFF_LISTENER;
+        m.index = (uint32_t)i;
+        ok = fd_handoff_send(sock, &m, NULL, 0, &reactors[i].listen_fd, 1) == 0;
+        if (ok && (!shared_udp || i == 0)) {
+            m.type = HANDOFF_UDP;
+            m.flags = shared_udp ? HANDOFF_F_SHARED : 0;
+            ok = fd_handoff_send(sock, &m, NULL, 0, &reactors[i].udp_socket, 1) == 0;
+        }
+    }
+    handoff_msg_t reply;
+    int fds[FD_HANDOFF_MAX_FDS];
+    if (!ok || fd_handoff_signal(sock, HANDOFF_SOCKETS_END) == -1 ||
+        fd_handoff_recv(sock, &reply, NULL, 0, fds, HANDOFF_TIMEOUT_MS) == -1 ||
+        reply.type != HANDOFF_READY) {
+        fprintf(out, "upgrade failed: the new process did not come up, still serving\n");
+        close(sock);
+        fd_handoff_abort(pid);
+        return;
+    }
+    fprintf(out, "upgrade: process %d is accepting, %s\n", (int)pid,
+            with_clients ? "handing over connections" : "draining");
+
+    // The new process owns the console and the admin socket path from now on
+    if (control.stdin_watched) {
+        control_unwatch(&reactors[0], STDIN_FILENO);
+        control.stdin_watched = 0;
+    }
+    if (control.admin_fd >= 0) {
+        control_unwatch(&reactors[0], control.admin_fd);
+        close(control.admin_fd);
+        control.admin_fd = -1;  // Also keeps control_close() from unlinking the new socket
+    }
+
+    if (with_clients) {
+        upgrade.sock = sock;
+        upgrade.send_clients = 1;
+        request_shutdown();
+        return;
+    }
+    fd_handoff_signal(sock, HANDOFF_DONE);
+    close(sock);
+    upgrade.drain_deadline_ms = conn_now_ms() + (uint64_t)upgrade.drain_timeout_ms;
+    upgrade.draining = 1;
+    uint64_t one = 1;
+    if (write(upgrade.drain_fd, &one, sizeof(one)) < 0) {
+        perror("write drain eventfd");
+    }
+}
+
+/**
+ * @brief Old process: passes every open connection to the new process, then HANDOFF_DONE.
+ *
+ * Runs after all reactors have stopped. Each connection goes with its
+ * counters and any partial record; the local descriptors are closed by
+ * reactor_close() afterwards.
+ */
+void upgrade_send_clients(void) {
+    unsigned long long sent = 0;
+    for (int i = 0; i < num_reactors; i++) {
+        reactor_t* r = &reactors[i];
+        reactor_flush(r);  // Datagrams of the last iteration still waiting for egress
+        for (int fd = 0; fd < r->conns.by_fd_len; fd++) {
+            conn_t* c = r->conns.by_fd[fd];
+            if (!c) {
+                continue;
+            }
+            handoff_msg_t m;
+            memset(&m, 0, sizeof(m));
+            m.type = HANDOFF_CLIENT;
+            m.peer_addr = c->peer_addr;
+            m.peer_port = c->peer_port;
+            m.conn_flags = c->flags & ~(CONN_PAUSED | CONN_THROTTLED | CONN_ADMITTED);
+            m.opened_ms = c->opened_ms;
+            m.active_ms = c->active_ms;
+            m.partial_ms = c->partial_ms;
+            m.records_out = c->records_out;
+            m.bytes_in = c->bytes_in;
+            if (fd_handoff_send(upgrade.sock, &m, c->rx, c->rx ? c->rx_len : 0, &fd, 1) == 0) {
+                sent++;
+            }
+        }
+    }
+    fd_handoff_signal(upgrade.sock, HANDOFF_DONE);
+    close(upgrade.sock);
+    upgrade.sock = -1;
+    printf("Upgrade: handed %llu connections to the new process\n", sent);
+}
+
+/**
+ * @brief Executes one control command: quit, stats, upgrade [clients] or help.
+ *
+ * @param line     Command line without the trailing newline.
+ * @param reply_fd Admin session to answer on, or -1 to answer on stdout.
+ */
+void control_command(const char* line, int reply_fd) {
+    char* reply = NULL;
+    size_t reply_len = 0;
+    FILE* out = open_memstream(&reply, &reply_len);
+    if (!out) {
+        perror("open_memstream");
+        return;
+    }
+
+    if (strncmp(line, "quit", 4) == 0) {
+        if (reply_fd >= 0) {
+            fprintf(out, "shutting down\n");
+        }
+        request_shutdown();
+    } else if (strncmp(line, "stats", 5) == 0) {
+        print_all_stats(out);
+    } else if (strncmp(line, "upgrade", 7) == 0) {
+        upgrade_start(strstr(line + 7, "clients") != NULL, out);
+    } else if (strncmp(line, "help", 4) == 0) {
+        fprintf(out, "commands: quit, stats, upgrade [clients], help\n");
+    } else if (line[0] != '\0') {
+        fprintf(out, "unknown command: %s\n", line);
+    }
+    fclose(out);
+
+    if (reply_len > 0) {
+        if (reply_fd < 0) {
+            fputs(reply, stdout);
+        } else if (send(reply_fd, reply, reply_len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            perror("send admin reply");
+        }
+    }
+    free(reply);
+}
+
+/**
+ * @brief Runs every complete line in a buffer and keeps the unfinished rest.
+ *
+ * @param buf      Buffer of CONTROL_LINE bytes holding *len bytes of input.
+ * @param len      In/out: bytes in buf.
+ * @param reply_fd Where replies go (see control_command()).
+ */
+void control_run_lines(char* buf, size_t* len, int reply_fd) {
+    size_t start = 0;
+    for (size_t i = 0; i < *len; i++) {
+        if (buf[i] == '\n') {
+            buf[i] = '\0';
+            if (i > start && buf[i - 1] == '\r') {
+                buf[i - 1] = '\0';
+            }
+            control_command(buf + start, reply_fd);
+            start = i + 1;
+        }
+    }
+    memmove(buf, buf + start, *len - start);
+    *len -= start;
+    if (*len == CONTROL_LINE) {
+        *len = 0;  // No newline in a full buffer: discard the overlong line
+    }
+}
+
+/**
+ * @brief Closes one admin session.
+ *
+ * @param r  Reactor 0.
+ * @param fd Session descriptor.
+ */
+void control_drop_admin(reactor_t* r, int fd) {
+    for (int i = 0; i < MAX_ADMIN_CLIENTS; i++) {
+        if (control.admin_clients[i] == fd) {
+            control.admin_clients[i] = -1;
+        }
+    }
+    control_unwatch(r, fd);
+    close(fd);
+}
+
+/**
+ * @brief Handles one readiness event on a control descriptor of reactor 0.
+ *
+ * @param r  Reactor 0.
+ * @param fd The ready descriptor (control_owns(fd) must be true).
+ */
+void control_handle(reactor_t* r, int fd) {
+    if (fd == control.signal_fd) {
+        struct signalfd_siginfo si;
+        while (read(control.signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+            printf("Received signal %u\n", si.ssi_signo);
+            if (si.ssi_signo == SIGUSR2) {
+                upgrade_start(0, stdout);
+            } else {
+                request_shutdown();
+            }
+        }
+        return;
+    }
+
+    if (fd == control.admin_fd) {
+        int client;
+        while ((client = accept4(control.admin_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            int slot = -1;
+            for (int i = 0; i < MAX_ADMIN_CLIENTS && slot < 0; i++) {
+                if (control.admin_clients[i] < 0) {
+                    slot = i;
+                }
+            }
+            if (slot < 0 || control_watch(r, client) == -1) {
+                close(client);
+                continue;
+            }
+            control.admin_clients[slot] = client;
+        }
+        return;
+    }
+
+    if (fd == STDIN_FILENO) {
+        ssize_t n = read(STDIN_FILENO, control.stdin_line + control.stdin_len,
+                         CONTROL_LINE - control.stdin_len);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (n <= 0) {
+            // Console closed: stop watching it, signals and the admin socket still work
+            control_unwatch(r, STDIN_FILENO);
+            control.stdin_watched = 0;
+            return;
+        }
+        control.stdin_len += (size_t)n;
+        control_run_lines(control.stdin_line, &control.stdin_len, -1);
+        return;
+    }
+
+    // Admin session: commands are short, so each read is expected to hold whole lines
+    char buf[CONTROL_LINE];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        control_drop_admin(r, fd);
+        return;
+    }
+    size_t len = (size_t)n;
+    if (buf[len - 1] != '\n' && len < sizeof(buf)) {
+        buf[len++] = '\n';  // Accept a final command without newline
+    }
+    control_run_lines(buf, &len, fd);
+}
+
+/**
+ * @brief Opens the control descriptors and registers them with reactor 0.
+ *
+ * SIGINT, SIGTERM and SIGUSR2 must already be blocked in every thread.
+ *
+ * @param r Reactor 0.
+ * @return 0 on success, -1 on error.
+ */
+int control_init(reactor_t* r) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    control.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (control.signal_fd < 0 || control_watch(r, control.signal_fd) == -1) {
+        perror("signalfd");
+        return -1;
+    }
+
+    // epoll refuses regular files such as /dev/null; the console is simply off then
+    if (control_watch(r, STDIN_FILENO) == 0) {
+        control.stdin_watched = 1;
+    }
+
+    if (control.admin_path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(control.admin_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Admin socket path too long\n");
+            return -1;
+        }
+        strcpy(addr.sun_path, control.admin_path);
+        unlink(control.admin_path);  // Left over from a previous run
+
+        control.admin_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (control.admin_fd < 0) {
+            perror("admin socket");
+            return -1;
+        }
+        if (bind(control.admin_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(control.admin_fd, MAX_ADMIN_CLIENTS) < 0) {
+            perror("admin bind/listen");
+            return -1;
+        }
+        if (control_watch(r, control.admin_fd) == -1) {
+            perror("watch admin socket");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes every control descriptor and removes the admin socket file.
+ */
+void control_close(void) {
+    if (control.signal_fd >= 0) {
+        close(control.signal_fd);
+    }
+    for (int i = 0; i < MAX_ADMIN_CLIENTS; i++) {
+        if (control.admin_clients[i] >= 0) {
+            close(control.admin_clients[i]);
+        }
+    }
+    if (control.admin_fd >= 0) {
+        close(control.admin_fd);
+        unlink(control.admin_path);
+    }
+}
+
+/**
+ * @brief io_uring event loop of one reactor.
+ *
+ * Each iteration makes a single io_uring_enter() call that both submits the
+ * sends and re-arms queued by the previous iteration and waits for new
+ * completions.
+ *
+ * @param r The reactor to run.
+ */
+void reactor_loop_uring(reactor_t* r) {
+    uring_arm_accept(r);
+    control_watch(r, shutdown_fd);
+
+    while (running) {
+        // Submit everything queued so far and block until something completes
+        if (uring_submit_and_wait(&r->ring, 1, reactor_timer_timeout(r, -1)) < 0) {
+            perror("io_uring_enter");
+            request_shutdown();
+            break;
+        }
+
+        int returned = 0;
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&r->ring)) != NULL) {
+            unsigned long long op = cqe->user_data >> 32;
+            int fd = (int)(cqe->user_data & 0xffffffffu);
+            if (op == UD_CONTROL) {
+                // shutdown_fd needs no handling: running is already clear
+                if (fd != shutdown_fd && r->id == 0 && control_owns(fd)) {
+                    control_handle(r, fd);
+                    // Re-arm a poll that ended while the descriptor is still in use
+                    if (!(cqe->flags & IORING_CQE_F_MORE) && control_owns(fd)) {
+                        control_watch(r, fd);
+                    }
+                }
+            } else if (op != 0) {
+                returned += uring_handle_cqe(r, cqe);
+            }
+            uring_cqe_seen(&r->ring);
+        }
+
+        // Everything received in this iteration leaves as one ordered chain
+        uring_flush_sends(r);
+
+        if (returned) {
+            uring_buf_ring_advance(&r->bufs);
+        }
+
+        // Restart receives that ran dry as soon as any buffer is free again
+        if (r->nstarved && r->inflight < URING_BUFFERS) {
+            int n = r->nstarved;
+            r->nstarved = 0;
+            for (int i = 0; i < n; i++) {
+                uring_arm_recv(r, r->starved[i]);
+            }
+        }
+
+        if (timeout_recheck_ms) {
+            reactor_expire(r);
+        }
+    }
+
+    // Push out the sends queued by the last iteration
+    uring_submit_and_wait(&r->ring, 0, 0);
+}
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in microseconds.
+ *
+ * The coarse clock used for connection timestamps ticks in milliseconds, far
+ * too slowly to measure a spin budget.
+ */
+static uint64_t spin_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief epoll_wait() that spins for up to spin_us before it blocks.
+ *
+ * A wait that would sleep first polls with a zero timeout until events show
+ * up or the spin budget (capped by the timeout itself) runs out.
+ *
+ * @param r       The reactor.
+ * @param events  Output array of MAX_EVENTS entries.
+ * @param timeout Blocking timeout in milliseconds (-1 = none, 0 = don't wait).
+ * @return Number of events, or -1 on error (errno set by epoll_wait()).
+ */
+int reactor_wait(reactor_t* r, struct epoll_event* events, int timeout) {
+    if (spin_us > 0 && timeout != 0) {
+        uint64_t budget = (uint64_t)spin_us;
+        int expire = 0;
+        if (timeout > 0 && (uint64_t)timeout * 1000 <= budget) {
+            budget = (uint64_t)timeout * 1000;
+            expire = 1;  // The whole timeout is spent spinning
+        }
+        uint64_t deadline = spin_now_us() + budget;
+        do {
+            int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, 0);
+            if (n != 0) {
+                if (n > 0) {
+                    r->spin_hits++;
+                }
+                return n;
+            }
+            r->spin_polls++;
+        } while (running && spin_now_us() < deadline);
+        if (expire || !running) {
+            return 0;
+        }
+        r->blocks++;
+    }
+    return epoll_wait(r->epoll_fd, events, MAX_EVENTS, timeout);
+}
+
+/**
+ * @brief Old process: stops accepting once an upgrade has handed the listeners over.
+ *
+ * Closing this process's copy of the listener leaves the new process as the
+ * only one accepting; the established connections stay until they end.
+ *
+ * @param r The reactor.
+ */
+void reactor_start_drain(reactor_t* r) {
+    if (r->draining) {
+        return;
+    }
+    r->draining = 1;
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, upgrade.drain_fd, NULL);
+    remove_from_epoll(r->epoll_fd, r->listen_fd);
+    close(r->listen_fd);
+    r->listen_fd = -1;
+    r->accept_pending = 0;
+    printf("Reactor %d: draining %llu connections\n", r->id, (unsigned long long)r->conns.live);
+}
+
+/**
+ * @brief Old process: shuts down once every reactor has drained, or at the drain deadline.
+ *
+ * @param r The reactor (reactor 0 also enforces the deadline).
+ */
+void reactor_check_drain(reactor_t* r) {
+    if (!r->drained && r->conns.live == 0) {
+        r->drained = 1;
+        if (__atomic_add_fetch(&upgrade.drained_reactors, 1, __ATOMIC_SEQ_CST) == num_reactors) {
+            printf("Drain complete\n");
+            request_shutdown();
+        }
+    }
+    if (r->id == 0 && running && conn_now_ms() >= upgrade.drain_deadline_ms) {
+        printf("Drain timeout: closing the remaining connections\n");
+        request_shutdown();
+    }
+}
+
+/**
+ * @brief Event loop of one reactor: accepts clients and forwards their data.
+ *
+ * @param arg Pointer to the reactor_t to run.
+ * @return NULL (thread exit value unused).
+ */
+void* reactor_loop(void* arg) {
+    reactor_t* r = (reactor_t*)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    if (use_uring) {
+        reactor_loop_uring(r);
+        return NULL;
+    }
+
+    while (running) {
+        // Block until there is work; don't sleep while accepts are still queued
+        int timeout = -1;
+        if (r->accept_pending) {
+            timeout = 0;
+        } else if (r->congested == ENOBUFS) {
+            timeout = 1;  // No wake-up exists for ENOBUFS; retry shortly
+        }
+        timeout = reactor_timer_timeout(r, timeout);
+        if (r->nthrottled > 0 && timeout != 0) {
+            // Wake up for the first throttled connection that may read again
+            uint64_t now = conn_now_ms();
+            int left = now >= r->throttle_next_ms ? 0 : (int)(r->throttle_next_ms - now);
+            if (timeout < 0 || left < timeout) {
+                timeout = left;
+            }
+        }
+        if (r->draining && r->id == 0) {
+            // Wake up for the drain deadline
+            uint64_t now = conn_now_ms();
+            int left = now >= upgrade.drain_deadline_ms ? 0 : (int)(upgrade.drain_deadline_ms - now);
+            if (timeout < 0 || left < timeout) {
+                timeout = left;
+            }
+        }
+        int nfds = reactor_wait(r, events, timeout);
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;  // Signal interrupted, continue loop
+            }
+            perror("epoll_wait");
+            request_shutdown();
+            break;
+        }
+
+        // No new edge will arrive for connections left over from the last budget
+        if (r->accept_pending) {
+            handle_accept(r);
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.fd == r->listen_fd) {
+                // New connections
+                if (!r->accept_pending) {
+                    handle_accept(r);
+                }
+            } else if (events[i].data.fd == shutdown_fd) {
+                // running is already clear; the loop ends after this batch
+            } else if (events[i].data.fd == upgrade.drain_fd) {
+                reactor_start_drain(r);
+            } else if (events[i].data.fd == r->udp_socket) {
+                // Egress has room again: retry the stalled batch (resumes readers if it drains)
+                reactor_flush(r);
+            } else if (r->id == 0 && control_owns(events[i].data.fd)) {
+                control_handle(r, events[i].data.fd);
+            } else {
+                // Data from existing client
+                conn_t* c = conn_lookup(&r->conns, events[i].data.fd);
+                if (c && handle_client_data(r, c) == -1) {
+                    // Client disconnected or error occurred, remove from epoll and close
+                    reactor_close_conn(r, c);
+                }
+            }
+        }
+
+        // One sendmmsg() for everything read during this iteration
+        if (!r->out_watched) {
+            reactor_flush(r);
+        }
+
+        // Close whatever timed out, all in one pass over the due wheel slots
+        if (timeout_recheck_ms) {
+            reactor_expire(r);
+        }
+
+        if (r->nthrottled > 0) {
+            reactor_unthrottle(r, conn_now_ms());
+        }
+
+        if (r->draining) {
+            reactor_check_drain(r);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Closes every socket owned by a reactor.
+ *
+ * @param r The reactor to tear down. Descriptors set to -1 are skipped.
+ */
+void reactor_close(reactor_t* r) {
+    if (r->listen_fd >= 0) {
+        close(r->listen_fd);
+    }
+    if (r->udp_socket >= 0 && r->udp_socket != shared_udp_fd) {
+        close(r->udp_socket);
+    }
+    if (r->epoll_fd >= 0) {
+        close(r->epoll_fd);
+    }
+    if (r->spare_fd >= 0) {
+        close(r->spare_fd);
+    }
+    // Clients still connected at shutdown
+    for (int fd = 0; fd < r->conns.by_fd_len; fd++) {
+        if (r->conns.by_fd[fd]) {
+            close(fd);
+        }
+    }
+    conn_table_free(&r->conns);
+    timer_wheel_free(&r->timers);
+    batch_free(&r->batch);
+    buf_pool_free(&r->pool);
+    free(r->paused);
+    free(r->throttled);
+    if (use_uring) {
+        // Tearing down the ring cancels every pending accept, recv and send
+        uring_buf_ring_free(&r->ring, &r->bufs);
+        uring_exit(&r->ring);
+        free(r->send_msgs);
+        free(r->send_iovs);
+        free(r->pending);
+        free(r->starved);
+    }
+}
+
+/**
+ * @brief Creates the io_uring instance, buffer ring and per-buffer send headers.
+ *
+ * @param r Reactor to initialise.
+ * @return 0 on success, -1 on error.
+ */
+int reactor_init_uring(reactor_t* r) {
+    if (uring_init(&r->ring, URING_ENTRIES) == -1) {
+        return -1;
+    }
+    if (uring_buf_ring_init(&r->ring, &r->bufs, 0, URING_BUFFERS, BUFFER_SIZE) == -1) {
+        return -1;
+    }
+
+    // One sendmsg() header per buffer id, so a send never needs its own allocation
+    r->send_msgs = calloc(URING_BUFFERS, sizeof(struct msghdr));
+    r->send_iovs = calloc(URING_BUFFERS, sizeof(struct iovec));
+    r->pending = calloc(URING_BUFFERS, sizeof(unsigned short));
+    if (!r->send_msgs || !r->send_iovs || !r->pending) {
+        perror("calloc send headers");
+        return -1;
+    }
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        r->send_iovs[i].iov_base = uring_buf_ring_addr(&r->bufs, (unsigned short)i);
+        r->send_msgs[i].msg_name = shared_udp ? &udp_addr : NULL;
+        r->send_msgs[i].msg_namelen = shared_udp ? sizeof(udp_addr) : 0;
+        r->send_msgs[i].msg_iov = &r->send_iovs[i];
+        r->send_msgs[i].msg_iovlen = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates the listening socket, epoll instance and UDP socket of a reactor.
+ *
+ * @param r         Reactor to initialise (id must already be set).
+ * @param port      TCP listen port in network byte order.
+ * @param reuseport Non-zero when several reactors share the port.
+ * @return 0 on success, -1 on error (partially created sockets are closed).
+ */
+int reactor_init(reactor_t* r, in_port_t port, int reuseport) {
+    r->listen_fd = -1;
+    r->tune = sock_tune_for(&tunes, r->id);
+    r->epoll_fd = -1;
+    r->ring.ring_fd = -1;
+    conn_table_init(&r->conns);
+    buf_pool_init(&r->pool, BUFFER_SIZE, POOL_SLAB);
+    if (timeout_recheck_ms &&
+        timer_wheel_init(&r->timers, TIMER_SLOTS, TIMER_TICK_MS, conn_now_ms()) == -1) {
+        return -1;
+    }
+
+    // Keep one descriptor in reserve for shedding connections on EMFILE
+    r->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (r->spare_fd < 0) {
+        perror("open spare fd");
+        return -1;
+    }
+
+    // === Step 1: Set up UDP forwarding socket (own and connected, unless shared) ===
+    r->udp_socket = shared_udp ? shared_udp_fd : upgrade_take_udp(r->id);
+    if (r->udp_socket < 0) {
+        reactor_close(r);
+        return -1;
+    }
+
+    if (use_uring) {
+        // === Step 2 (io_uring): ring, buffers and listener; accept is armed by the loop ===
+        r->listen_fd = upgrade_take_listener(r->id, port, reuseport);
+        if (r->listen_fd < 0 || reactor_init_uring(r) == -1) {
+            reactor_close(r);
+            return -1;
+        }
+        return 0;
+    }
+
+    // A stalled send must return EAGAIN instead of blocking the whole reactor
+    if ((backpressure && set_nonblocking(r->udp_socket) == -1) ||
+        set_busy_poll(r->udp_socket) == -1) {
+        reactor_close(r);
+        return -1;
+    }
+
+    if (batch_init(&r->batch, batch_size, &r->pool) == -1) {
+        reactor_close(r);
+        return -1;
+    }
+
+    // === Step 2: Create epoll instance ===
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd == -1) {
+        perror("epoll_create1");
+        reactor_close(r);
+        return -1;
+    }
+
+    // === Step 3: Create and configure TCP listening socket (or take over the old one's) ===
+    r->listen_fd = upgrade_take_listener(r->id, port, reuseport);
+    if (r->listen_fd < 0) {
+        reactor_close(r);
+        return -1;
+    }
+
+    // Add listening socket to epoll
+    if (add_to_epoll(r->epoll_fd, r->listen_fd) == -1) {
+        reactor_close(r);
+        return -1;
+    }
+
+    // Level-triggered and never read: stays ready once shutdown is requested
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = shutdown_fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, shutdown_fd, &ev) == -1) {
+        perror("epoll_ctl: add shutdown eventfd");
+        reactor_close(r);
+        return -1;
+    }
+
+    // Same for the drain eventfd, which the reactor removes once it has reacted
+    ev.data.fd = upgrade.drain_fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, upgrade.drain_fd, &ev) == -1) {
+        perror("epoll_ctl: add drain eventfd");
+        reactor_close(r);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <tcp_port> <udp_host> <udp_port>\n"
+            "Options:\n"
+            "  -t, --threads N   Run N reactors with SO_REUSEPORT listeners (default 1)\n"
+            "  -b, --batch N     Datagrams per sendmmsg() call, 1-%d (default %d)\n"
+            "  -B, --backend B   Event loop backend: epoll (default) or uring\n"
+            "  -l, --backlog N   listen() backlog (default %d)\n"
+            "  -a, --accept-budget N  Connections accepted per loop iteration (default %d)\n"
+            "  -A, --admin PATH  Unix-domain admin socket accepting quit, stats and help\n"
+            "  -f, --framing F   raw (default, one datagram per recv), line or len (4-byte BE prefix)\n"
+            "  -m, --mtu N       Pack whole records into datagrams of at most N bytes, %d-%d (default %d)\n"
+            "  -P, --backpressure  Stop reading clients while UDP egress is congested instead of\n"
+            "                    dropping datagrams (io_uring always waits for its sends)\n"
+            "  -I, --idle-timeout S       Close clients that send nothing for S seconds\n"
+            "  -R, --read-timeout S       Close clients that leave a record unfinished for S seconds\n"
+            "                             (line and len framing only)\n"
+            "  -H, --handshake-timeout S  Close clients that send nothing within S seconds of connecting\n"
+            "  -S, --busy-poll US  Set SO_BUSY_POLL (US microseconds) and SO_PREFER_BUSY_POLL on all sockets\n"
+            "  -s, --spin US     Poll for US microseconds before blocking in epoll_wait (epoll only)\n"
+            "  -U, --shared-udp  Send through one unconnected UDP socket shared by all reactors\n"
+            "                    instead of a connected socket per reactor\n"
+            "  -o, --sndbuf N    SO_SNDBUF of each UDP egress socket in bytes (default: system)\n"
+            "  -C, --cpus LIST   Pin reactor i to the i-th CPU of LIST (e.g. 0-3,8), or 'auto'\n"
+            "                    / 'auto:IFNAME' for the CPUs of the network card's NUMA node\n"
+            "  -D, --drain-timeout S  After 'upgrade', close the clients still connected after S\n"
+            "                    seconds (default %d)\n"
+            "  -c, --conn-limit N  Refuse connections beyond N open at once\n"
+            "  -i, --ip-conns N  Refuse connections beyond N open from one client address\n"
+            "  -r, --ip-bytes RATE[:BURST]    Per-address byte budget in bytes/s (burst defaults to RATE);\n"
+            "                    a client over it has its reads paused until the budget refills\n"
+            "  -n, --ip-records RATE[:BURST]  Per-address record budget in records/s, likewise\n"
+            "  -T, --tune SPEC   Socket profile of the listeners: default, devices and/or\n"
+            "                    defer=S,lowat=B,rcvbuf=B,sndbuf=B,quickack=on|off; repeat to give\n"
+            "                    reactor i the i-th profile (the last one applies to the rest);\n"
+            "                    lowat delays a record shorter than B until more data or the close\n"
+            "Control (console, -A socket): quit, stats, upgrade, upgrade clients, help;\n"
+            "SIGUSR2 = upgrade (epoll backend only)\n",
+            prog, MAX_BATCH, DEFAULT_BATCH, SOMAXCONN, DEFAULT_ACCEPT_BUDGET,
+            LEN_PREFIX + 1, BUFFER_SIZE, DEFAULT_MTU, DEFAULT_DRAIN_TIMEOUT_MS / 1000);
+}
+
+/**
+ * @brief Main function: sets up UDP target, starts TCP listeners using epoll, handles clients.
+ *
+ * Usage: ./epoll_server [-t N] <tcp_listen_port> <udp_target_host> <udp_target_port>
+ *
+ * @param argc Argument count.
+ * @param argv [prog, options..., tcp_port, udp_host, udp_port]
+ * @return Exit status.
+ */
+int main(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"batch",   required_argument, NULL, 'b'},
+        {"backend", required_argument, NULL, 'B'},
+        {"backlog", required_argument, NULL, 'l'},
+        {"accept-budget", required_argument, NULL, 'a'},
+        {"admin",   required_argument, NULL, 'A'},
+        {"framing", required_argument, NULL, 'f'},
+        {"mtu",     required_argument, NULL, 'm'},
+        {"backpressure", no_argument, NULL, 'P'},
+        {"idle-timeout", required_argument, NULL, 'I'},
+        {"read-timeout", required_argument, NULL, 'R'},
+        {"handshake-timeout", required_argument, NULL, 'H'},
+        {"busy-poll", required_argument, NULL, 'S'},
+        {"spin",    required_argument, NULL, 's'},
+        {"shared-udp", no_argument, NULL, 'U'},
+        {"sndbuf",  required_argument, NULL, 'o'},
+        {"cpus",    required_argument, NULL, 'C'},
+        {"drain-timeout", required_argument, NULL, 'D'},
+        {"conn-limit", required_argument, NULL, 'c'},
+        {"ip-conns", required_argument, NULL, 'i'},
+        {"ip-bytes", required_argument, NULL, 'r'},
+        {"ip-records", required_argument, NULL, 'n'},
+        {"tune",    required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* cpu_spec = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "t:b:B:l:a:A:f:m:PI:R:H:S:s:Uo:C:D:c:i:r:n:T:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 't':
+            num_reactors = atoi(optarg);
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'l':
+            listen_backlog = atoi(optarg);
+            break;
+        case 'a':
+            accept_budget = atoi(optarg);
+            break;
+        case 'A':
+            control.admin_path = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "line") == 0) {
+                framing = FRAMING_LINE;
+            } else if (strcmp(optarg, "len") == 0) {
+                framing = FRAMING_LEN;
+            } else if (strcmp(optarg, "raw") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            mtu = atoi(optarg);
+            break;
+        case 'P':
+            backpressure = 1;
+            break;
+        case 'I':
+            idle_timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'R':
+            read_timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'H':
+            handshake_timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'S':
+            busy_poll_us = atoi(optarg);
+            break;
+        case 's':
+            spin_us = atoi(optarg);
+            break;
+        case 'U':
+            shared_udp = 1;
+            break;
+        case 'o':
+            udp_sndbuf = atoi(optarg);
+            break;
+        case 'C':
+            cpu_spec = optarg;
+            break;
+        case 'D':
+            upgrade.drain_timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'c':
+            limiter.max_total = atoi(optarg);
+            break;
+        case 'i':
+            limiter.max_per_ip = atoi(optarg);
+            break;
+        case 'r':
+            if (rate_limit_parse_bucket(&limiter.bytes, optarg) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            if (rate_limit_parse_bucket(&limiter.records, optarg) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            if (sock_tune_add(&tunes, optarg) == -1) {
+                return 1;
+            }
+            break;
+        case 'B':
+            if (strcmp(optarg, "uring") == 0) {
+                use_uring = 1;
+            } else if (strcmp(optarg, "epoll") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 3 || num_reactors < 1 || num_reactors > MAX_REACTORS ||
+        batch_size < 1 || batch_size > MAX_BATCH || listen_backlog < 1 || accept_budget < 1 ||
+        mtu <= LEN_PREFIX || mtu > BUFFER_SIZE ||
+        idle_timeout_ms < 0 || read_timeout_ms < 0 || handshake_timeout_ms < 0 ||
+        busy_poll_us < 0 || spin_us < 0 || udp_sndbuf < 0 || upgrade.drain_timeout_ms < 0 ||
+        limiter.max_total < 0 || limiter.max_per_ip < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    timeout_recheck_ms = idle_timeout_ms;
+    if (read_timeout_ms > timeout_recheck_ms) {
+        timeout_recheck_ms = read_timeout_ms;
+    }
+    if (handshake_timeout_ms > timeout_recheck_ms) {
+        timeout_recheck_ms = handshake_timeout_ms;
+    }
+    if (use_uring && framing != FRAMING_RAW) {
+        // io_uring sends each provided buffer as it was received; there is no repacking step
+        fprintf(stderr, "--framing line|len requires the epoll backend\n");
+        return 1;
+    }
+    if (use_uring && spin_us) {
+        // io_uring_enter() has no zero-timeout poll loop to spin on here
+        fprintf(stderr, "--spin requires the epoll backend\n");
+        return 1;
+    }
+    rate_limits = rate_limit_enabled(&limiter);
+    if (use_uring && rate_limits) {
+        // Multishot receives keep completing without a per-connection read to withhold
+        fprintf(stderr, "--conn-limit, --ip-conns, --ip-bytes and --ip-records require the epoll backend\n");
+        return 1;
+    }
+    if (rate_limits && rate_limit_init(&limiter, RATE_LIMIT_DEFAULT_SLOTS) == -1) {
+        return 1;
+    }
+    if (cpu_plan_parse(&cpu_plan, cpu_spec) == -1) {
+        return 1;
+    }
+    const char* tcp_port = argv[optind];
+    const char* udp_host = argv[optind + 1];
+    const char* udp_port = argv[optind + 2];
+
+    memset(&udp_addr, 0, sizeof(udp_addr));
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_port = htons(atoi(udp_port));
+    if (inet_pton(AF_INET, udp_host, &udp_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid UDP host\n");
+        return 1;
+    }
+
+    in_port_t port = htons(atoi(tcp_port));
+    if (port == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Signals are consumed through reactor 0's signalfd, so no thread may take them
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    upgrade.drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_fd < 0 || upgrade.drain_fd < 0) {
+        perror("eventfd");
+        return 1;
+    }
+
+    // === Step 3a: When started by an upgrade, take over the old process's sockets ===
+    upgrade.argv = argv;
+    for (int i = 0; i < MAX_REACTORS; i++) {
+        upgrade.listeners[i] = -1;
+        upgrade.udp[i] = -1;
+    }
+    upgrade.sock = fd_handoff_inherited();
+    if (upgrade.sock >= 0 && upgrade_receive_sockets() == -1) {
+        fprintf(stderr, "Upgrade: incomplete hand-off from the old process\n");
+        upgrade_close_unused();
+        close(upgrade.sock);
+        upgrade.sock = -1;
+    }
+
+    if (shared_udp) {
+        shared_udp_fd = upgrade_take_udp(0);
+        if (shared_udp_fd < 0) {
+            close(shutdown_fd);
+            close(upgrade.drain_fd);
+            return 1;
+        }
+    }
+
+    reactors = calloc(num_reactors, sizeof(reactor_t));
+    if (!reactors) {
+        perror("calloc");
+        close(shutdown_fd);
+        close(upgrade.drain_fd);
+        return 1;
+    }
+
+    // Set up every reactor before starting any thread so a bind failure aborts cleanly
+    int reuseport = num_reactors > 1;
+    for (int i = 0; i < num_reactors; i++) {
+        reactors[i].id = i;
+        if (cpu_plan_pin(&cpu_plan, i) == -1 || reactor_init(&reactors[i], port, reuseport) == -1) {
+            for (int j = 0; j < i; j++) {
+                reactor_close(&reactors[j]);
+            }
+            free(reactors);
+            close(shutdown_fd);
+            close(upgrade.drain_fd);
+            return 1;
+        }
+    }
+    upgrade_close_unused();
+
+    // === Step 3b: Control channel (signals, console, admin socket) on reactor 0 ===
+    if (control_init(&reactors[0]) == -1) {
+        control_close();
+        for (int i = 0; i < num_reactors; i++) {
+            reactor_close(&reactors[i]);
+        }
+        free(reactors);
+        close(shutdown_fd);
+        close(upgrade.drain_fd);
+        return 1;
+    }
+
+    printf("Epoll-based TCP server listening on port %s, forwarding to UDP %s:%s (%d %s reactor%s)\n",
+           tcp_port, udp_host, udp_port, num_reactors, use_uring ? "io_uring" : "epoll",
+           num_reactors > 1 ? "s" : "");
+    printf("Type 'quit' and press Enter (or send SIGTERM) to exit the server gracefully.\n");
+    if (control.admin_path) {
+        printf("Admin socket: %s (commands: quit, stats, upgrade [clients], help)\n",
+               control.admin_path);
+    }
+    cpu_plan_print(&cpu_plan);
+    for (int i = 0; i < num_reactors && tunes.count > 0; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "Reactor %d", i);
+        sock_tune_print(reactors[i].tune, label, stdout);
+    }
+
+    // Tell the old process it can let go, then adopt the connections it passes on
+    if (upgrade.sock >= 0) {
+        if (fd_handoff_signal(upgrade.sock, HANDOFF_READY) == 0) {
+            upgrade_receive_clients();
+        }
+        close(upgrade.sock);
+        upgrade.sock = -1;
+    }
+
+    // === Step 4: Start reactors 1..N-1, run reactor 0 on this thread ===
+    int started = 1;
+    for (; started < num_reactors; started++) {
+        // The new thread inherits this CPU (pinning already succeeded once during setup)
+        cpu_plan_pin(&cpu_plan, started);
+        if (pthread_create(&reactors[started].tid, NULL, reactor_loop, &reactors[started]) != 0) {
+            fprintf(stderr, "Failed to create reactor thread %d\n", started);
+            request_shutdown();
+            break;
+        }
+    }
+
+    cpu_plan_pin(&cpu_plan, 0);
+    reactor_loop(&reactors[0]);
+
+    // Wait for the other reactors to wake up on the shutdown eventfd
+    for (int i = 1; i < started; i++) {
+        pthread_join(reactors[i].tid, NULL);
+    }
+
+    // Cleanup
+    print_all_stats(stdout);
+    if (upgrade.send_clients) {
+        upgrade_send_clients();
+    }
+    control_close();
+    for (int i = 0; i < num_reactors; i++) {
+        reactor_close(&reactors[i]);
+    }
+    free(reactors);
+    close(shutdown_fd);
+    close(upgrade.drain_fd);
+    if (shared_udp_fd >= 0) {
+        close(shared_udp_fd);
+    }
+
+    cpu_plan_free(&cpu_plan);
+    rate_limit_free(&limiter);
 
     printf("Epoll-based TCP server stopped.\n");
     return 0;
-}
\ No newline at end of file
+}
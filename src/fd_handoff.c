@@ -0,0 +1,218 @@
+/**
+ * @file fd_handoff.c
+ * @brief Implementation of the socket hand-off declared in `fd_handoff.h`.
+ */
+
+#define _GNU_SOURCE
+
+#include "fd_handoff.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+/**
+ * @brief Resolves a command name the way execvp() would: as is if it has a slash, else in PATH.
+ *
+ * @return 0 with the path in out, or -1 if no executable was found (an error is printed).
+ */
+static int resolve_exec(const char* name, char* out, size_t len) {
+    if (strchr(name, '/')) {
+        snprintf(out, len, "%s", name);
+        return 0;
+    }
+    const char* path = getenv("PATH");
+    if (!path || !*path) {
+        path = "/bin:/usr/bin";
+    }
+    while (*path) {
+        const char* end = strchr(path, ':');
+        size_t dirlen = end ? (size_t)(end - path) : strlen(path);
+        // An empty entry means the current directory
+        if ((size_t)snprintf(out, len, "%.*s%s%s", (int)dirlen, path, dirlen ? "/" : "", name) < len &&
+            access(out, X_OK) == 0) {
+            return 0;
+        }
+        path += dirlen + (end ? 1 : 0);
+    }
+    fprintf(stderr, "Upgrade: %s not found in PATH\n", name);
+    return -1;
+}
+
+pid_t fd_handoff_spawn(char* const argv[], int* sock) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+
+    // Resolve the binary and build the child's environment now: in a multi-threaded process only
+    // async-signal-safe calls are allowed after fork(), and execvpe() (PATH search) is not one
+    char exe[4096];
+    if (resolve_exec(argv[0], exe, sizeof(exe)) == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    size_t n = 0;
+    while (environ[n]) {
+        n++;
+    }
+    char** envp = malloc(sizeof(char*) * (n + 2));
+    char var[64];
+    if (!envp) {
+        perror("malloc environment");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    snprintf(var, sizeof(var), "%s=%d", FD_HANDOFF_ENV, sv[1]);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp(environ[i], FD_HANDOFF_ENV "=", sizeof(FD_HANDOFF_ENV)) != 0) {
+            envp[k++] = environ[i];
+        }
+    }
+    envp[k++] = var;
+    envp[k] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child: keep only its end across exec and unblock what the parent blocked
+        sigset_t none;
+        sigemptyset(&none);
+        pthread_sigmask(SIG_SETMASK, &none, NULL);
+        close(sv[0]);
+        fcntl(sv[1], F_SETFD, 0);
+        execve(exe, argv, envp);
+        _exit(127);
+    }
+    free(envp);
+    close(sv[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        return -1;
+    }
+    *sock = sv[0];
+    return pid;
+}
+
+int fd_handoff_inherited(void) {
+    const char* v = getenv(FD_HANDOFF_ENV);
+    if (!v) {
+        return -1;
+    }
+    int fd = atoi(v);
+    unsetenv(FD_HANDOFF_ENV);
+    if (fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        fprintf(stderr, "Ignoring invalid %s\n", FD_HANDOFF_ENV);
+        return -1;
+    }
+    return fd;
+}
+
+int fd_handoff_send(int sock, handoff_msg_t* hdr, const void* data, size_t len,
+                    const int* fds, int nfds) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * FD_HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    hdr->magic = FD_HANDOFF_MAGIC;
+    hdr->nfds = (uint16_t)nfds;
+    hdr->data_len = (uint32_t)len;
+
+    struct iovec iov[2] = {{hdr, sizeof(*hdr)}, {(void*)data, len}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+        if (errno != EINTR) {
+            perror("sendmsg (hand-off)");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int fd_handoff_recv(int sock, handoff_msg_t* hdr, void* data, size_t cap, int* fds, int timeout_ms) {
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR) {
+    }
+    if (ready <= 0) {
+        fprintf(stderr, ready == 0 ? "Hand-off peer timed out\n" : "poll (hand-off) failed\n");
+        return -1;
+    }
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * FD_HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov[2] = {{hdr, sizeof(*hdr)}, {data, cap}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cap ? 2 : 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+    }
+    if (n <= 0) {
+        if (n < 0) {
+            perror("recvmsg (hand-off)");
+        }
+        return -1;
+    }
+
+    int nfds = 0;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            nfds = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(cm), sizeof(int) * (size_t)nfds);
+        }
+    }
+    if ((size_t)n < sizeof(*hdr) || hdr->magic != FD_HANDOFF_MAGIC || (msg.msg_flags & MSG_TRUNC) ||
+        hdr->data_len != (size_t)n - sizeof(*hdr) || hdr->nfds != nfds) {
+        fprintf(stderr, "Malformed hand-off message\n");
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int fd_handoff_signal(int sock, handoff_type_t type) {
+    handoff_msg_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = (uint16_t)type;
+    return fd_handoff_send(sock, &hdr, NULL, 0, NULL, 0);
+}
+
+void fd_handoff_abort(pid_t pid) {
+    kill(pid, SIGTERM);
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+    }
+}
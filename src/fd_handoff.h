@@ -0,0 +1,130 @@
+/**
+ * @file fd_handoff.h
+ * @brief Passing sockets to a freshly exec'd binary for zero-downtime upgrades.
+ *
+ * The running process (the old one) starts the new binary with
+ * fd_handoff_spawn(). The two ends of a Unix SOCK_SEQPACKET socket pair
+ * connect them; the child finds its end through the FD_HANDOFF_ENV
+ * environment variable. The conversation is a sequence of fixed-size
+ * `handoff_msg_t` headers, each optionally carrying descriptors (SCM_RIGHTS)
+ * and a small payload:
+ *
+ *   old -> new   HANDOFF_LISTENER / HANDOFF_UDP (one socket each), HANDOFF_SOCKETS_END
+ *   new -> old   HANDOFF_READY once the new process is set up and accepting
+ *   old -> new   HANDOFF_CLIENT (one connection each, only when clients move), HANDOFF_DONE
+ *
+ * A listening socket passed this way is the same kernel object in both
+ * processes, so connections queued on it are never refused: whichever
+ * process accepts first gets them, and once the old one closes its copy the
+ * new one gets everything.
+ */
+
+#ifndef FD_HANDOFF_H
+#define FD_HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FD_HANDOFF_ENV "FORWARDER_HANDOFF_FD"  ///< Environment variable naming the child's end
+#define FD_HANDOFF_MAGIC 0x46444831u           ///< "FDH1": rejects stray or mismatched peers
+#define FD_HANDOFF_MAX_FDS 4                   ///< Descriptors one message may carry
+
+/**
+ * @brief Message types, in the order they are exchanged.
+ */
+typedef enum {
+    HANDOFF_LISTENER = 1,  ///< A listening socket; index = reactor/listener number
+    HANDOFF_UDP,           ///< A UDP egress socket; index = egress slot, flags = HANDOFF_F_SHARED
+    HANDOFF_SOCKETS_END,   ///< No more listeners or UDP sockets follow
+    HANDOFF_READY,         ///< Sent by the new process: set up and accepting
+    HANDOFF_CLIENT,        ///< An established connection plus its unforwarded bytes
+    HANDOFF_DONE           ///< Sent by the old process: nothing more follows
+} handoff_type_t;
+
+#define HANDOFF_F_SHARED 1u  ///< HANDOFF_UDP: the one unconnected socket of --shared-udp
+
+/**
+ * @brief Fixed header of every message; a HANDOFF_CLIENT payload follows it.
+ */
+typedef struct {
+    uint32_t magic;        ///< FD_HANDOFF_MAGIC
+    uint16_t type;         ///< handoff_type_t
+    uint16_t nfds;         ///< Descriptors attached (set by fd_handoff_recv())
+    uint32_t index;        ///< Listener or egress slot number
+    uint32_t flags;        ///< HANDOFF_F_* bits
+    uint32_t data_len;     ///< Payload bytes after the header
+    uint32_t peer_addr;    ///< HANDOFF_CLIENT: peer IPv4 address, network byte order
+    uint16_t peer_port;    ///< HANDOFF_CLIENT: peer port, network byte order
+    uint16_t conn_flags;   ///< HANDOFF_CLIENT: conn_t flags
+    uint32_t opened_ms;    ///< HANDOFF_CLIENT: conn_t timestamps (CLOCK_MONOTONIC_COARSE is system-wide)
+    uint32_t active_ms;
+    uint32_t partial_ms;
+    uint32_t records_out;  ///< HANDOFF_CLIENT: records forwarded so far
+    uint64_t bytes_in;     ///< HANDOFF_CLIENT: bytes received so far
+} handoff_msg_t;
+
+/**
+ * @brief Starts argv[0] (looked up in PATH) with argv and a hand-off socket.
+ *
+ * The child gets its end of the socket pair as an inherited descriptor named
+ * in FD_HANDOFF_ENV; everything else it inherits is close-on-exec as usual.
+ *
+ * @param argv Command line of the new binary (usually the old one's own).
+ * @param sock Receives the parent's end of the socket pair.
+ * @return Child pid, or -1 on error.
+ */
+pid_t fd_handoff_spawn(char* const argv[], int* sock);
+
+/**
+ * @brief Returns the hand-off socket this process was started with, or -1.
+ *
+ * The environment variable is removed and the descriptor made close-on-exec,
+ * so it does not leak into a later upgrade.
+ */
+int fd_handoff_inherited(void);
+
+/**
+ * @brief Sends one message.
+ *
+ * @param sock  Hand-off socket.
+ * @param hdr   Header; magic, nfds and data_len are filled in here.
+ * @param data  Payload, or NULL.
+ * @param len   Payload bytes.
+ * @param fds   Descriptors to pass (duplicated into the peer; still open here).
+ * @param nfds  Number of descriptors, at most FD_HANDOFF_MAX_FDS.
+ * @return 0 on success, -1 on error.
+ */
+int fd_handoff_send(int sock, handoff_msg_t* hdr, const void* data, size_t len,
+                    const int* fds, int nfds);
+
+/**
+ * @brief Receives one message, waiting at most timeout_ms.
+ *
+ * @param sock       Hand-off socket.
+ * @param hdr        Receives the header.
+ * @param data       Receives the payload (may be NULL if cap is 0).
+ * @param cap        Size of data.
+ * @param fds        Receives up to FD_HANDOFF_MAX_FDS descriptors (close-on-exec).
+ * @param timeout_ms Longest wait, -1 for none.
+ * @return 0 on success, -1 on timeout, end of file, error or a malformed message.
+ */
+int fd_handoff_recv(int sock, handoff_msg_t* hdr, void* data, size_t cap, int* fds, int timeout_ms);
+
+/**
+ * @brief Sends a message that carries nothing but its type.
+ *
+ * @param sock Hand-off socket.
+ * @param type handoff_type_t to send.
+ * @return 0 on success, -1 on error.
+ */
+int fd_handoff_signal(int sock, handoff_type_t type);
+
+/**
+ * @brief Stops and reaps a child whose upgrade failed.
+ *
+ * @param pid Child returned by fd_handoff_spawn().
+ */
+void fd_handoff_abort(pid_t pid);
+
+#endif // FD_HANDOFF_H
@@ -0,0 +1,163 @@
+/**
+ * @file log_convert.c
+ * @brief Converts a framed udp_server log back into the plain log format.
+ *
+ * Reads records in the format of log_record.h and writes their payloads
+ * verbatim, one after the other, which is exactly what `udp_server -f raw`
+ * would have written. With `--headers` every payload is preceded by a line
+ * giving its receive time (UTC), sender and length, for reading binary logs.
+ *
+ * Usage:
+ *   ./log_convert [-H] [framed_log]     (standard input if omitted or "-")
+ *
+ * A record with a bad magic or a file that ends in the middle of a record
+ * stops the conversion with its byte offset; everything before it has been
+ * written.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "log_record.h"
+
+#define MAX_PAYLOAD (64u << 20)  ///< Longer lengths are taken as corruption
+
+/**
+ * @brief Prints the header line of a record for --headers.
+ *
+ * @param h   Decoded header.
+ * @param out Stream to print to.
+ */
+static void print_header(const log_record_t* h, FILE* out) {
+    time_t secs = (time_t)(h->time_ns / 1000000000);
+    struct tm tm;
+    char when[32];
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in = {h->addr};
+    gmtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    fprintf(out, "# %s.%09lluZ %s:%u %u bytes%s\n", when,
+            (unsigned long long)(h->time_ns % 1000000000), addr, ntohs(h->port), h->len,
+            (h->flags & LOG_RECORD_TRUNCATED) ? " (truncated)" : "");
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] [framed_log]\n"
+            "Writes the payloads of a 'udp_server -f framed' log to standard output in the\n"
+            "plain log format. Reads standard input if framed_log is omitted or '-'.\n"
+            "Options:\n"
+            "  -H, --headers  Precede each payload with a '# time sender length' line\n",
+            prog);
+}
+
+/**
+ * @brief Main entry point: converts records until end of input or an error.
+ *
+ * @param argc Argument count.
+ * @param argv Arguments: [program_name, options..., framed_log]
+ * @return 0 if the whole input was converted, 1 otherwise.
+ */
+int main(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"headers", no_argument, NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    int headers = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "H", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'H':
+            headers = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* in = stdin;
+    const char* path = argc - optind == 1 ? argv[optind] : "-";
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (!in) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    char* payload = NULL;
+    size_t cap = 0;
+    unsigned long long offset = 0;
+    unsigned long long records = 0;
+    int status = 0;
+    while (1) {
+        char raw[sizeof(log_record_t)];
+        size_t got = fread(raw, 1, sizeof(raw), in);
+        if (got == 0 && feof(in)) {
+            break;
+        }
+        log_record_t h;
+        if (got < sizeof(raw)) {
+            fprintf(stderr, "%s: incomplete record header at offset %llu\n", path, offset);
+            status = 1;
+            break;
+        }
+        if (log_record_decode(&h, raw) == -1 || h.len > MAX_PAYLOAD) {
+            fprintf(stderr, "%s: not a framed record at offset %llu\n", path, offset);
+            status = 1;
+            break;
+        }
+        if (h.len > cap) {
+            char* bigger = realloc(payload, h.len);
+            if (!bigger) {
+                perror("realloc");
+                status = 1;
+                break;
+            }
+            payload = bigger;
+            cap = h.len;
+        }
+        if (fread(payload, 1, h.len, in) != h.len) {
+            fprintf(stderr, "%s: record at offset %llu ends early\n", path, offset);
+            status = 1;
+            break;
+        }
+        if (headers) {
+            print_header(&h, stdout);
+        }
+        fwrite(payload, 1, h.len, stdout);
+        offset += sizeof(raw) + h.len;
+        records++;
+    }
+    if (ferror(in)) {
+        perror("fread");
+        status = 1;
+    }
+    if (fflush(stdout) == EOF) {
+        perror("write");
+        status = 1;
+    }
+
+    fprintf(stderr, "%llu records, %llu bytes read\n", records, offset);
+    free(payload);
+    if (in != stdin) {
+        fclose(in);
+    }
+    return status;
+}
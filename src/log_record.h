@@ -0,0 +1,83 @@
+/**
+ * @file log_record.h
+ * @brief On-disk record header of udp_server's framed log format.
+ *
+ * The plain log is the datagrams concatenated, which loses their boundaries,
+ * sender and arrival time and cannot be split again if the payloads are
+ * binary. In the framed format (`udp_server -f framed`) every datagram is
+ * preceded by a fixed 24-byte header:
+ *
+ *   offset  size  field
+ *        0     4  magic    "UDL1" (LOG_RECORD_MAGIC, little-endian)
+ *        4     4  len      payload bytes that follow, little-endian
+ *        8     8  time_ns  receive time in ns since the epoch, little-endian
+ *       16     4  addr     source IPv4 address, network byte order
+ *       20     2  port     source port, network byte order
+ *       22     2  flags    LOG_RECORD_TRUNCATED, little-endian
+ *
+ * Records follow each other with no padding; a file is a sequence of
+ * records and nothing else, so logs can be appended to and concatenated. The
+ * per-record magic lets a reader tell a framed log from a plain one and
+ * notice corruption. `log_convert` turns a framed log back into the plain
+ * format.
+ */
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <endian.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_RECORD_MAGIC 0x314c4455u  ///< "UDL1" when stored little-endian
+#define LOG_RECORD_TRUNCATED 0x1      ///< The datagram was longer than the receive buffer
+
+/**
+ * @brief A record header as stored on disk (24 bytes, no padding).
+ */
+typedef struct {
+    uint32_t magic;    ///< LOG_RECORD_MAGIC, little-endian
+    uint32_t len;      ///< Payload length, little-endian
+    uint64_t time_ns;  ///< Receive time (CLOCK_REALTIME), little-endian
+    uint32_t addr;     ///< Source address, network byte order
+    uint16_t port;     ///< Source port, network byte order
+    uint16_t flags;    ///< LOG_RECORD_* flags, little-endian
+} log_record_t;
+
+/**
+ * @brief Fills a header in its on-disk byte order.
+ *
+ * @param h       Header to fill.
+ * @param len     Payload length.
+ * @param time_ns Receive time in nanoseconds since the epoch.
+ * @param src     Sender.
+ * @param flags   LOG_RECORD_* flags.
+ */
+static inline void log_record_encode(log_record_t* h, uint32_t len, uint64_t time_ns,
+                                     const struct sockaddr_in* src, uint16_t flags) {
+    h->magic = htole32(LOG_RECORD_MAGIC);
+    h->len = htole32(len);
+    h->time_ns = htole64(time_ns);
+    h->addr = src->sin_addr.s_addr;
+    h->port = src->sin_port;
+    h->flags = htole16(flags);
+}
+
+/**
+ * @brief Reads a header from disk bytes into host byte order (addr and port stay in network order).
+ *
+ * @param h   Decoded header.
+ * @param buf sizeof(log_record_t) bytes read from the log.
+ * @return 0 on success, -1 if the magic does not match.
+ */
+static inline int log_record_decode(log_record_t* h, const void* buf) {
+    memcpy(h, buf, sizeof(*h));
+    h->magic = le32toh(h->magic);
+    h->len = le32toh(h->len);
+    h->time_ns = le64toh(h->time_ns);
+    h->flags = le16toh(h->flags);
+    return h->magic == LOG_RECORD_MAGIC ? 0 : -1;
+}
+
+#endif // LOG_RECORD_H
@@ -0,0 +1,317 @@
+/**
+ * @file log_rotate.c
+ * @brief Implementation of the log rotation declared in `log_rotate.h`.
+ *
+ * The background thread publishes a prepared segment in next and remembers
+ * that it did; finding next empty again means the writer has switched to it.
+ * The renames for that switch always come before the following segment is
+ * prepared, because preparing truncates `<log>.next`, which until the
+ * rename is the file being written.
+ */
+
+#define _GNU_SOURCE
+
+#include "log_rotate.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PREPARE_RETRY_US 1000000  ///< Wait before preparing again after a failure
+
+/**
+ * @brief Returns the monotonic clock in microseconds.
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Builds `<log>.YYYYmmdd-HHMMSS` for the current local time, with `.N` added if taken.
+ */
+static void archive_name(const log_rotator_t* r, char* out, size_t len) {
+    time_t t = time(NULL);
+    struct tm tm;
+    char stamp[16];  // YYYYmmdd-HHMMSS
+    localtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(out, len, "%s.%s", r->path, stamp);
+    for (int n = 1; access(out, F_OK) == 0; n++) {
+        snprintf(out, len, "%s.%s.%d", r->path, stamp, n);
+    }
+}
+
+/**
+ * @brief Opens a segment and preallocates it (plain files) or maps it (mmap sink).
+ *
+ * @param fresh Non-zero to truncate the file and forget its tail.
+ * @return The segment, or NULL on error (an error is printed).
+ */
+static log_segment_t* open_segment(log_rotator_t* r, const char* path, int fresh) {
+    uint64_t begin = now_us();
+    log_segment_t* seg = calloc(1, sizeof(*seg));
+    if (!seg) {
+        perror("malloc log segment");
+        return NULL;
+    }
+    seg->fd = open(path, r->open_flags | O_CREAT | O_CLOEXEC | (fresh ? O_TRUNC : 0), 0644);
+    struct stat st;
+    if (seg->fd < 0 || fstat(seg->fd, &st) == -1) {
+        perror("open log segment");
+        if (seg->fd >= 0) {
+            close(seg->fd);
+        }
+        free(seg);
+        return NULL;
+    }
+    seg->size = (uint64_t)st.st_size;
+
+    if (r->extent > 0) {
+        char tail_path[LOG_ROTATE_PATH_MAX + 8];
+        snprintf(tail_path, sizeof(tail_path), "%s.tail", path);
+        if (fresh) {
+            unlink(tail_path);  // Its length belongs to the file just truncated
+        }
+        seg->map = malloc(sizeof(mmap_log_t));
+        if (!seg->map || mmap_log_open(seg->map, seg->fd, tail_path, r->extent, r->sync_ms) == -1) {
+            if (!seg->map) {
+                perror("malloc log mapping");
+            }
+            free(seg->map);
+            close(seg->fd);
+            free(seg);
+            return NULL;
+        }
+    } else if (r->max_bytes > seg->size &&
+               fallocate(seg->fd, FALLOC_FL_KEEP_SIZE, (off_t)seg->size,
+                         (off_t)(r->max_bytes - seg->size)) == -1 &&
+               errno != EOPNOTSUPP) {
+        // Not fatal: the segment then grows block by block as it is written
+        perror("fallocate log segment");
+    }
+
+    r->prepared++;
+    uint64_t took = now_us() - begin;
+    if (took > r->max_prepare_us) {
+        r->max_prepare_us = took;
+    }
+    return seg;
+}
+
+/**
+ * @brief Gives back unused preallocation, fdatasync()s and closes a segment, and frees it.
+ */
+static void close_segment(log_rotator_t* r, log_segment_t* seg) {
+    uint64_t begin = now_us();
+    if (seg->map) {
+        mmap_log_close(seg->map);  // Truncates to its tail
+        free(seg->map);
+    } else {
+        // Blocks preallocated past the end stay allocated until the file is truncated
+        struct stat st;
+        if (fstat(seg->fd, &st) == 0 && ftruncate(seg->fd, st.st_size) == -1) {
+            perror("truncate log segment");
+        }
+    }
+    if (fdatasync(seg->fd) == -1) {
+        perror("fdatasync log segment");
+    }
+    close(seg->fd);
+    free(seg);
+    uint64_t took = now_us() - begin;
+    if (took > r->max_retire_us) {
+        r->max_retire_us = took;
+    }
+}
+
+/**
+ * @brief Renames a file and, with the mmap sink, its tail side file.
+ */
+static void rename_log(const log_rotator_t* r, const char* from, const char* to) {
+    if (rename(from, to) == -1) {
+        perror("rename log segment");
+        return;
+    }
+    if (r->extent > 0) {
+        char from_tail[LOG_ROTATE_PATH_MAX + 8];
+        char to_tail[LOG_ROTATE_PATH_MAX + 40];
+        snprintf(from_tail, sizeof(from_tail), "%s.tail", from);
+        snprintf(to_tail, sizeof(to_tail), "%s.tail", to);
+        if (rename(from_tail, to_tail) == -1) {
+            perror("rename log tail file");
+        }
+    }
+}
+
+/**
+ * @brief Background thread: renames after a switch, prepares the next segment, closes old ones.
+ */
+static void* rotator_main(void* arg) {
+    log_rotator_t* r = arg;
+    int published = 0;  // next was set, so finding it empty means the writer took it
+    uint64_t retry_at = 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        if (published && !__atomic_load_n(&r->next, __ATOMIC_ACQUIRE)) {
+            char archive[LOG_ROTATE_PATH_MAX + 32];
+            pthread_mutex_unlock(&r->lock);
+            archive_name(r, archive, sizeof(archive));
+            // The old segment's tail file is simply replaced: it is truncated to its data on close
+            if (rename(r->path, archive) == -1) {
+                perror("rename rotated log");
+            }
+            rename_log(r, r->next_path, r->path);
+            pthread_mutex_lock(&r->lock);
+            published = 0;
+            continue;
+        }
+        if (!published && !r->stop && now_us() >= retry_at) {
+            pthread_mutex_unlock(&r->lock);
+            log_segment_t* seg = open_segment(r, r->next_path, 1);
+            pthread_mutex_lock(&r->lock);
+            if (seg) {
+                __atomic_store_n(&r->next, seg, __ATOMIC_RELEASE);
+                published = 1;
+            } else {
+                retry_at = now_us() + PREPARE_RETRY_US;
+            }
+            continue;
+        }
+        if (r->nretired > 0) {
+            log_segment_t* seg = r->retired[0];
+            r->nretired--;
+            memmove(&r->retired[0], &r->retired[1], sizeof(seg) * (size_t)r->nretired);
+            pthread_mutex_unlock(&r->lock);
+            close_segment(r, seg);
+            pthread_mutex_lock(&r->lock);
+            continue;
+        }
+        if (r->stop) {
+            break;
+        }
+        if (published) {
+            pthread_cond_wait(&r->wake, &r->lock);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(retry_at / 1000000);
+            ts.tv_nsec = (long)(retry_at % 1000000) * 1000;
+            pthread_cond_timedwait(&r->wake, &r->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+int log_rotator_start(log_rotator_t* r, const char* path, log_segment_t** first) {
+    snprintf(r->path, sizeof(r->path), "%s", path);
+    snprintf(r->next_path, sizeof(r->next_path), "%s.next", path);
+    r->next = NULL;
+    r->nretired = 0;
+    r->stop = 0;
+
+    // A segment switched to but never renamed holds the newest data: keep it
+    struct stat st;
+    if (stat(r->next_path, &st) == 0) {
+        // Closing trims its preallocation (with the mmap sink, down to the published tail)
+        log_segment_t* left = open_segment(r, r->next_path, 0);
+        if (left) {
+            close_segment(r, left);
+        }
+        char tail_path[LOG_ROTATE_PATH_MAX + 8];
+        snprintf(tail_path, sizeof(tail_path), "%s.tail", r->next_path);
+        unlink(tail_path);
+        if (stat(r->next_path, &st) == 0 && st.st_size > 0) {
+            char archive[LOG_ROTATE_PATH_MAX + 32];
+            archive_name(r, archive, sizeof(archive));
+            if (rename(r->next_path, archive) == -1) {
+                perror("rename left-over log segment");
+            }
+        }
+    }
+    r->prepared = 0;
+    r->max_prepare_us = 0;
+    r->max_retire_us = 0;
+
+    *first = open_segment(r, r->path, 0);
+    if (!*first) {
+        return -1;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&r->lock, NULL);
+    if (pthread_create(&r->thread, NULL, rotator_main, r) != 0) {
+        fprintf(stderr, "Failed to start the log rotation thread\n");
+        pthread_cond_destroy(&r->wake);
+        pthread_mutex_destroy(&r->lock);
+        close_segment(r, *first);
+        *first = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+log_segment_t* log_rotator_take(log_rotator_t* r) {
+    log_segment_t* seg = __atomic_exchange_n(&r->next, NULL, __ATOMIC_ACQ_REL);
+    if (!seg) {
+        r->waits++;
+        return NULL;
+    }
+    r->rotations++;
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    return seg;
+}
+
+void log_rotator_retire(log_rotator_t* r, log_segment_t* seg) {
+    pthread_mutex_lock(&r->lock);
+    if (r->nretired < LOG_ROTATE_MAX_RETIRED) {
+        r->retired[r->nretired++] = seg;
+        seg = NULL;
+        pthread_cond_signal(&r->wake);
+    }
+    pthread_mutex_unlock(&r->lock);
+    if (seg) {
+        // The thread is far behind; closing here is slow but bounded
+        close_segment(r, seg);
+    }
+}
+
+void log_rotator_stop(log_rotator_t* r, log_segment_t* current) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+
+    if (r->next) {
+        close_segment(r, r->next);
+        r->next = NULL;
+        unlink(r->next_path);
+        if (r->extent > 0) {
+            char tail_path[LOG_ROTATE_PATH_MAX + 8];
+            snprintf(tail_path, sizeof(tail_path), "%s.tail", r->next_path);
+            unlink(tail_path);
+        }
+    }
+    close_segment(r, current);
+}
+
+void log_rotator_print(const log_rotator_t* r, FILE* out) {
+    fprintf(out, "Log rotation: at %llu bytes or %d s (0 = off), %llu rotations, %llu flushes found "
+                 "the next segment not ready; %llu segments prepared, slowest %llu us; slowest "
+                 "close %llu us\n",
+            (unsigned long long)r->max_bytes, r->max_secs, r->rotations, r->waits, r->prepared,
+            (unsigned long long)r->max_prepare_us, (unsigned long long)r->max_retire_us);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file log_rotate.h
+ * @brief Size- and time-based log rotation with segments prepared and retired off the write path.
+ *
+ * Rotating by renaming the log from outside (logrotate) or copying and
+ * truncating it races with the writer; doing it inline costs the writer an
+ * open(), a preallocation, an fsync() and a close() per rotation. Here a
+ * background thread does all of that:
+ *
+ *   - it keeps the next segment ready: opened as `<log>.next`, preallocated
+ *     to max_bytes (or, for the mmap sink, with mmap_log's first extent
+ *     mapped) and published as a pointer;
+ *   - the writer, at a flush boundary once the current segment holds
+ *     max_bytes or is max_secs old, takes that pointer and writes on into the
+ *     new file (if it is not ready yet, the writer carries on with the old
+ *     one and tries again at the next flush);
+ *   - the thread then renames `<log>` to `<log>.YYYYmmdd-HHMMSS` and
+ *     `<log>.next` to `<log>`, prepares the following segment, and once the
+ *     writer hands the old segment back (when its last write has completed)
+ *     gives back unused preallocation, fdatasync()s and closes it.
+ *
+ * So `<log>` is always the segment being written, apart from the moment
+ * between a switch and the renames, and rotated segments hold whole flushes,
+ * never part of a record. A segment that is rotated by time only rotates when
+ * there is something to write. A non-empty `<log>.next` found at start (a
+ * crash between a switch and the renames) is archived first.
+ */
+
+#ifndef LOG_ROTATE_H
+#define LOG_ROTATE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "mmap_log.h"
+
+#define LOG_ROTATE_MAX_RETIRED 8  ///< Segments waiting to be closed
+#define LOG_ROTATE_PATH_MAX 4096  ///< Longest log path
+
+/**
+ * @brief One file of the log.
+ */
+typedef struct {
+    int fd;            ///< The file
+    mmap_log_t* map;   ///< Its mapping with the mmap sink, else NULL
+    uint64_t size;     ///< Bytes it held when it was opened
+} log_segment_t;
+
+/**
+ * @brief The rotation settings, the background thread and its statistics.
+ */
+typedef struct {
+    // Settings, filled in before log_rotator_start()
+    uint64_t max_bytes;    ///< Rotate once a segment holds this many bytes (0 = never)
+    int max_secs;          ///< Rotate once a segment is this old (0 = never)
+    int open_flags;        ///< open() access flags of every segment (O_CREAT, O_CLOEXEC added)
+    size_t extent;         ///< mmap sink: extent of each segment's mmap_log, 0 = plain files
+    int sync_ms;           ///< mmap sink: msync() interval of each segment
+
+    char path[LOG_ROTATE_PATH_MAX];        ///< The log
+    char next_path[LOG_ROTATE_PATH_MAX];   ///< Where the next segment is prepared
+    log_segment_t* next;   ///< Prepared segment; the writer takes it with an atomic exchange
+    pthread_t thread;      ///< Background thread
+    pthread_mutex_t lock;  ///< Protects retired, nretired, stop
+    pthread_cond_t wake;   ///< Signalled by the writer and by log_rotator_stop()
+    log_segment_t* retired[LOG_ROTATE_MAX_RETIRED];  ///< Segments to close
+    int nretired;          ///< Entries in retired
+    int stop;              ///< Set by log_rotator_stop()
+
+    // Statistics
+    unsigned long long rotations;  ///< Segments switched to (writer)
+    unsigned long long waits;      ///< Rotations postponed because the next segment was not ready (writer)
+    unsigned long long prepared;   ///< Segments prepared
+    uint64_t max_prepare_us;       ///< Slowest open + preallocation
+    uint64_t max_retire_us;        ///< Slowest fdatasync + close of an old segment
+} log_rotator_t;
+
+/**
+ * @brief Opens the log as the first segment and starts preparing the next one.
+ *
+ * @param r     Rotator with its settings filled in.
+ * @param path  The log file.
+ * @param first Set to the first segment, for the writer.
+ * @return 0 on success, -1 on error (an error is printed).
+ */
+int log_rotator_start(log_rotator_t* r, const char* path, log_segment_t** first);
+
+/**
+ * @brief Takes the prepared segment (writer thread).
+ *
+ * @param r The rotator.
+ * @return The segment to switch to, or NULL if it is not ready yet.
+ */
+log_segment_t* log_rotator_take(log_rotator_t* r);
+
+/**
+ * @brief Peeks at the prepared segment without taking it (writer thread).
+ *
+ * @param r The rotator.
+ * @return The segment log_rotator_take() would return, or NULL.
+ */
+static inline log_segment_t* log_rotator_peek(log_rotator_t* r) {
+    return __atomic_load_n(&r->next, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Hands a segment that will not be written any more to the background thread to close.
+ *
+ * @param r   The rotator.
+ * @param seg Segment switched away from, with no write to it still in flight.
+ */
+void log_rotator_retire(log_rotator_t* r, log_segment_t* seg);
+
+/**
+ * @brief Closes the current segment where it is, discards the prepared one and joins the thread.
+ *
+ * @param r       The rotator.
+ * @param current Segment the writer was writing when it stopped.
+ */
+void log_rotator_stop(log_rotator_t* r, log_segment_t* current);
+
+/**
+ * @brief Prints the settings and the counters on one line.
+ *
+ * @param r   The rotator.
+ * @param out Stream to print to.
+ */
+void log_rotator_print(const log_rotator_t* r, FILE* out);
+
+#endif // LOG_ROTATE_H
@@ -0,0 +1,743 @@
+/**
+ * @file log_writer.c
+ * @brief Implementation of the group-commit writer declared in `log_writer.h`.
+ *
+ * head and tail are byte counters that only grow; `head - tail` is the fill
+ * of a lane and `counter & mask` the position in its ring. The writer's
+ * sleep state says what it is waiting for: WAIT_DATA (all lanes empty, any
+ * record should wake it) or WAIT_DEADLINE (data is pending but young, only
+ * a lane reaching flush_bytes should wake it early). The writer sets it and
+ * re-reads every head, a producer publishes its head and then reads it, both
+ * sequentially consistent, so at least one of them sees the other and no
+ * wake-up is lost.
+ *
+ * With io_uring, `sent` sits between tail and head: bytes up to it are
+ * submitted, and tail only catches up as the writes complete. While writes
+ * are in flight the writer waits on the completion queue (bounded by the
+ * flush deadline) instead of the condition variable, so producers never need
+ * to wake it then.
+ */
+
+#define _GNU_SOURCE
+
+#include "log_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SYNC_TAG UINT64_MAX  ///< user_data of the io_uring fdatasync
+
+enum { AWAKE = 0, WAIT_DATA, WAIT_DEADLINE };
+
+/**
+ * @brief Returns the monotonic clock in microseconds.
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Snapshots every lane's head into w->heads.
+ *
+ * @return Bytes pending in all lanes together.
+ */
+static uint64_t load_heads(log_writer_t* w) {
+    uint64_t pending = 0;
+    for (int i = 0; i < w->nlanes; i++) {
+        w->heads[i] = __atomic_load_n(&w->lanes[i].head, __ATOMIC_SEQ_CST);
+        pending += w->heads[i] - (w->sent ? w->sent[i] : w->lanes[i].tail);
+    }
+    return pending;
+}
+
+/**
+ * @brief Returns non-zero if a lane's head has moved since load_heads().
+ */
+static int heads_moved(log_writer_t* w) {
+    for (int i = 0; i < w->nlanes; i++) {
+        if (__atomic_load_n(&w->lanes[i].head, __ATOMIC_SEQ_CST) != w->heads[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues the io_uring write of inflight[slot] (submitted by the caller).
+ */
+static void uring_queue_write(log_writer_t* w, int slot) {
+    log_uring_write_t* wr = &w->inflight[slot];
+    struct io_uring_sqe* sqe = uring_get_sqe(&w->ring);
+    // The queue has room for every slot and the fdatasync, and is submitted right away
+    sqe->opcode = w->fixed_bufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = wr->file;
+    sqe->off = wr->offset;
+    sqe->addr = (unsigned long long)(uintptr_t)wr->buf;
+    sqe->len = wr->len;
+    sqe->buf_index = (uint16_t)wr->lane;
+    sqe->user_data = (uint64_t)slot;
+    wr->submitted_us = now_us();
+}
+
+/**
+ * @brief Submits the queued SQEs and records how long the system call took.
+ */
+static void uring_submit(log_writer_t* w) {
+    uint64_t start = now_us();
+    if (uring_submit_and_wait(&w->ring, 0, 0) == -1) {
+        perror("io_uring_enter log");
+    }
+    uint64_t took = now_us() - start;
+    w->submits++;
+    w->submit_us += took;
+    if (took > w->max_submit_us) {
+        w->max_submit_us = took;
+    }
+}
+
+/**
+ * @brief Submits writes of every lane from sent up to the snapshot head, as far as slots allow.
+ */
+static void uring_write_pending(log_writer_t* w) {
+    uint64_t size = w->mask + 1;
+    if (w->failed) {
+        // Nothing reaches the file any more; once nothing is in flight, tail can simply follow head
+        if (w->ninflight == 0) {
+            for (int i = 0; i < w->nlanes; i++) {
+                w->lost += w->heads[i] - w->sent[i];
+                w->sent[i] = w->heads[i];
+                __atomic_store_n(&w->lanes[i].tail, w->heads[i], __ATOMIC_RELEASE);
+            }
+        }
+        return;
+    }
+    for (int i = 0; i < w->nlanes; i++) {
+        while (w->sent[i] < w->heads[i] && w->ninflight < w->uring_depth) {
+            uint64_t off = w->sent[i] & w->mask;
+            uint64_t len = w->heads[i] - w->sent[i];
+            if (off + len > size) {
+                len = size - off;  // Wrapped: the rest is the next write
+            }
+            if (len > 1u << 30) {
+                len = 1u << 30;
+            }
+            int slot = (w->inflight_first + w->ninflight) % w->uring_depth;
+            log_uring_write_t* wr = &w->inflight[slot];
+            wr->buf = w->lanes[i].buf + off;
+            wr->len = (uint32_t)len;
+            wr->lane = i;
+            wr->file = w->file_slot;
+            wr->offset = w->offset;
+            wr->end = w->sent[i] + len;
+            wr->retries = 0;
+            wr->done = 0;
+            uring_queue_write(w, slot);
+            w->sent[i] += len;
+            w->offset += len;
+            w->seg_bytes += len;
+            w->ninflight++;
+            w->writes++;
+        }
+    }
+    if (w->ninflight > w->peak_inflight) {
+        w->peak_inflight = w->ninflight;
+    }
+    uring_submit(w);
+}
+
+/**
+ * @brief Truncates the file a write failed for good in at the failed offset.
+ *
+ * Called once every write to that file has completed; whatever they put
+ * after the failed offset is cut off and counted as lost instead of written.
+ */
+static void uring_truncate_failed(log_writer_t* w, int fd, uint64_t end) {
+    uint64_t cut = end - w->fail_offset;
+    if (ftruncate(fd, (off_t)w->fail_offset) == -1) {
+        perror("truncate log after failed write");
+    }
+    w->written -= cut - w->fail_lost;  // The failed writes themselves were never counted
+    w->lost += cut;
+    w->truncated = 1;
+}
+
+/**
+ * @brief Consumes completions, resubmits short and failed writes, and releases ring space in order.
+ */
+static void uring_reap(log_writer_t* w) {
+    struct io_uring_cqe* cqe;
+    int resubmit = 0;
+    while ((cqe = uring_peek_cqe(&w->ring)) != NULL) {
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        uring_cqe_seen(&w->ring);
+        uint64_t took = now_us();
+        if (tag == SYNC_TAG) {
+            took -= w->sync_started;
+            if (res < 0) {
+                fprintf(stderr, "fdatasync log: %s\n", strerror(-res));
+            }
+            if (took > w->max_sync_us) {
+                w->max_sync_us = took;
+            }
+            w->sync_inflight = 0;
+            continue;
+        }
+        log_uring_write_t* wr = &w->inflight[tag];
+        took -= wr->submitted_us;
+        w->completions++;
+        w->complete_us += took;
+        if (took > w->max_write_us) {
+            w->max_write_us = took;
+        }
+        if (res <= 0 && !w->failed && wr->retries < LOG_WRITER_URING_RETRIES) {
+            // Skipping it would leave a hole before the writes that follow it
+            wr->retries++;
+            w->retried++;
+            uring_queue_write(w, (int)tag);
+            resubmit = 1;
+        } else if (res <= 0) {
+            if (!w->failed) {
+                fprintf(stderr, "write log at offset %llu: %s; giving up after %d retries, "
+                                "the log is truncated there and nothing more is written\n",
+                        (unsigned long long)wr->offset, res < 0 ? strerror(-res) : "no progress",
+                        wr->retries);
+                w->failed = 1;
+                w->fail_slot = wr->file;
+                w->fail_offset = wr->offset;
+            }
+            if (wr->file == w->fail_slot && wr->offset >= w->fail_offset) {
+                w->fail_lost += wr->len;  // Cut off with the rest by uring_truncate_failed()
+            } else {
+                w->lost += wr->len;
+            }
+            wr->done = 1;
+        } else if ((uint32_t)res < wr->len) {
+            w->written += (unsigned long long)res;
+            w->short_writes++;
+            wr->buf += res;
+            wr->len -= (uint32_t)res;
+            wr->offset += (uint64_t)res;
+            uring_queue_write(w, (int)tag);
+            resubmit = 1;
+        } else {
+            w->written += (unsigned long long)res;
+            wr->done = 1;
+        }
+    }
+    if (resubmit) {
+        uring_submit(w);
+    }
+    while (w->ninflight > 0 && w->inflight[w->inflight_first].done) {
+        log_uring_write_t* wr = &w->inflight[w->inflight_first];
+        __atomic_store_n(&w->lanes[wr->lane].tail, wr->end, __ATOMIC_RELEASE);
+        w->inflight_first = (w->inflight_first + 1) % w->uring_depth;
+        w->ninflight--;
+        if (w->draining && --w->drain_left == 0) {
+            if (w->failed && !w->truncated && w->fail_slot != w->file_slot) {
+                uring_truncate_failed(w, w->draining->fd, w->drain_end);
+            }
+            log_rotator_retire(w->rotator, w->draining);
+            w->draining = NULL;
+        }
+    }
+    if (w->failed && !w->truncated && w->ninflight == 0) {
+        uring_truncate_failed(w, w->fd, w->offset);
+    }
+}
+
+/**
+ * @brief Submits an fdatasync that starts once every write submitted before it has completed.
+ */
+static void uring_sync(log_writer_t* w) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&w->ring);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_DRAIN;
+    sqe->fd = w->file_slot;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = SYNC_TAG;
+    w->sync_inflight = 1;
+    w->sync_started = now_us();
+    w->syncs++;
+    uring_submit(w);
+}
+
+/**
+ * @brief Writes every lane from its tail up to the snapshot head, then releases that space.
+ */
+static void write_pending(log_writer_t* w) {
+    if (w->uring_depth > 0) {
+        uring_write_pending(w);
+        return;
+    }
+    uint64_t size = w->mask + 1;
+    int n = 0;
+    for (int i = 0; i < w->nlanes; i++) {
+        log_lane_t* lane = &w->lanes[i];
+        uint64_t off = lane->tail & w->mask;
+        uint64_t len = w->heads[i] - lane->tail;
+        if (len == 0) {
+            continue;
+        }
+        w->iov[n].iov_base = lane->buf + off;
+        w->iov[n].iov_len = len;
+        if (off + len > size) {
+            // Wrapped: the rest starts at the beginning of the ring
+            w->iov[n].iov_len = size - off;
+            n++;
+            w->iov[n].iov_base = lane->buf;
+            w->iov[n].iov_len = len - (size - off);
+        }
+        n++;
+    }
+
+    uint64_t start = now_us();
+    struct iovec* v = w->iov;
+    if (w->map) {
+        uint64_t pending = 0;
+        for (int i = 0; i < n; i++) {
+            pending += v[i].iov_len;
+        }
+        uint64_t done = mmap_log_append(w->map, v, n);
+        w->writes++;
+        w->written += done;
+        w->seg_bytes += done;
+        w->lost += pending - done;
+        n = 0;
+    }
+    while (n > 0) {
+        ssize_t done = writev(w->fd, v, n);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Retrying would stall the rings behind a full or failing disk
+            perror("writev log");
+            while (n > 0) {
+                w->lost += v->iov_len;
+                v++;
+                n--;
+            }
+            break;
+        }
+        w->writes++;
+        w->written += (unsigned long long)done;
+        w->seg_bytes += (uint64_t)done;
+        while (n > 0 && (size_t)done >= v->iov_len) {
+            done -= (ssize_t)v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (char*)v->iov_base + done;
+            v->iov_len -= (size_t)done;
+        }
+    }
+    uint64_t took = now_us() - start;
+    if (took > w->max_write_us) {
+        w->max_write_us = took;
+    }
+    for (int i = 0; i < w->nlanes; i++) {
+        __atomic_store_n(&w->lanes[i].tail, w->heads[i], __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief fdatasync()s the log and records how long it took.
+ */
+static void sync_log(log_writer_t* w) {
+    if (w->uring_depth > 0) {
+        uring_sync(w);
+        return;
+    }
+    uint64_t start = now_us();
+    if (fdatasync(w->fd) == -1) {
+        perror("fdatasync log");
+    }
+    uint64_t took = now_us() - start;
+    if (took > w->max_sync_us) {
+        w->max_sync_us = took;
+    }
+    w->syncs++;
+}
+
+/**
+ * @brief Switches to the prepared segment if the current one is due for rotation.
+ *
+ * Called before a flush, so every flush lands whole in one segment. With
+ * io_uring the prepared segment is registered in the spare file slot as soon
+ * as it is published, and the old segment is only handed back once the
+ * writes still in flight to it have completed.
+ */
+static void maybe_rotate(log_writer_t* w, uint64_t now) {
+    log_rotator_t* r = w->rotator;
+    int uring = w->uring_depth > 0;
+    if (w->failed) {
+        return;  // Its file is truncated where the writes stopped; a new one would not follow on
+    }
+    if (uring && !w->draining) {
+        log_segment_t* next = log_rotator_peek(r);
+        if (next && next != w->staged &&
+            uring_update_file(&w->ring, (unsigned)(w->file_slot ^ 1), next->fd) == 0) {
+            w->staged = next;
+        }
+    }
+    int due = (r->max_bytes > 0 && w->seg_bytes >= r->max_bytes) ||
+              (r->max_secs > 0 && now - w->seg_started >= (uint64_t)r->max_secs * 1000000);
+    if (!due || w->draining || (uring && !w->staged)) {
+        // Writes to the previous segment still in flight, or nothing registered to switch to yet
+        if (due && (w->draining || uring)) {
+            r->waits++;
+        }
+        return;
+    }
+    log_segment_t* next = log_rotator_take(r);
+    if (!next) {
+        return;
+    }
+    log_segment_t* old = w->segment;
+    w->segment = next;
+    w->fd = next->fd;
+    w->map = next->map;
+    w->seg_bytes = next->map ? next->map->tail : next->size;
+    w->seg_started = now;
+    uint64_t old_offset = w->offset;
+    if (uring) {
+        w->staged = NULL;
+        w->file_slot ^= 1;
+        w->offset = w->seg_bytes;
+        if (w->ninflight > 0) {
+            w->draining = old;
+            w->drain_left = w->ninflight;
+            w->drain_end = old_offset;
+            return;
+        }
+    }
+    log_rotator_retire(r, old);
+}
+
+/**
+ * @brief Writer thread: waits until a flush condition holds, writes, syncs, repeats.
+ */
+static void* writer_main(void* arg) {
+    log_writer_t* w = arg;
+    uint64_t flush_after = (uint64_t)w->flush_us;
+    uint64_t sync_every = w->map ? 0 : (uint64_t)w->sync_ms * 1000;
+    uint64_t since = 0;          // When the writer first saw the pending data
+    uint64_t last_sync = now_us();
+    int dirty = 0;               // Written since the last fdatasync()
+    int uring = w->uring_depth > 0;
+
+    while (1) {
+        if (uring) {
+            uring_reap(w);
+        }
+        uint64_t pending = load_heads(w);
+        int stopping = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+        uint64_t now = now_us();
+        if (pending == 0) {
+            since = 0;
+        } else if (since == 0) {
+            since = now;
+        }
+
+        // After a failed io_uring write the rings are only emptied once nothing is in flight
+        int room = !uring || (w->ninflight < w->uring_depth && (!w->failed || w->ninflight == 0));
+        if (pending > 0 && room && (stopping || pending >= w->flush_bytes || now - since >= flush_after)) {
+            if (pending >= w->flush_bytes) {
+                w->size_triggered++;
+            }
+            if (w->rotator) {
+                maybe_rotate(w, now);
+            }
+            write_pending(w);
+            since = 0;
+            dirty = 1;
+            continue;
+        }
+        if (dirty && sync_every > 0 && !w->sync_inflight && (pending == 0 || !stopping) &&
+            (stopping || now - last_sync >= sync_every)) {
+            sync_log(w);
+            last_sync = now_us();
+            dirty = 0;
+            continue;
+        }
+        if (stopping && (!uring || (pending == 0 && w->ninflight == 0 && !w->sync_inflight))) {
+            break;
+        }
+
+        // Sleep until the oldest pending byte is due, the next sync is due, or a producer calls
+        uint64_t deadline = 0;
+        if (pending > 0) {
+            deadline = since + flush_after;
+        }
+        if (dirty && sync_every > 0 && (deadline == 0 || last_sync + sync_every < deadline)) {
+            deadline = last_sync + sync_every;
+        }
+        if (uring && (w->ninflight > 0 || w->sync_inflight)) {
+            // Wait for a completion; new records are picked up by the deadline at the latest
+            uint64_t wait_us = deadline > now ? deadline - now : deadline ? 0 : flush_after;
+            int timeout_ms = stopping ? -1 : (int)((wait_us + 999) / 1000);
+            uring_submit_and_wait(&w->ring, 1, timeout_ms > 0 ? timeout_ms : 1);
+            continue;
+        }
+        pthread_mutex_lock(&w->lock);
+        __atomic_store_n(&w->waiting, pending > 0 ? WAIT_DEADLINE : WAIT_DATA, __ATOMIC_SEQ_CST);
+        if (!heads_moved(w) && !w->stop) {
+            if (deadline == 0) {
+                pthread_cond_wait(&w->wake, &w->lock);
+            } else {
+                struct timespec ts;
+                ts.tv_sec = (time_t)(deadline / 1000000);
+                ts.tv_nsec = (long)(deadline % 1000000) * 1000;
+                pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+            }
+        }
+        __atomic_store_n(&w->waiting, AWAKE, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sets up the io_uring sink: non-appending fd, ring, registered file and buffers, slots.
+ *
+ * @return 0 on success, -1 on error (an error is printed).
+ */
+static int uring_setup(log_writer_t* w) {
+    int flags = fcntl(w->fd, F_GETFL);
+    struct stat st;
+    if (flags == -1 || ((flags & O_APPEND) && fcntl(w->fd, F_SETFL, flags & ~O_APPEND) == -1) ||
+        fstat(w->fd, &st) == -1) {
+        perror("prepare log for io_uring");
+        return -1;
+    }
+    w->offset = (uint64_t)st.st_size;
+    w->file_slot = 0;
+    w->staged = NULL;
+    w->draining = NULL;
+    w->inflight_first = 0;
+    w->ninflight = 0;
+    w->sync_inflight = 0;
+    w->failed = 0;
+    w->truncated = 0;
+    w->fail_lost = 0;
+    w->inflight = calloc((size_t)w->uring_depth, sizeof(log_uring_write_t));
+    w->sent = calloc((size_t)w->nlanes, sizeof(uint64_t));
+    if (!w->inflight || !w->sent) {
+        perror("malloc log io_uring slots");
+        return -1;
+    }
+    // One SQE per slot plus the fdatasync; with rotation a second, spare file slot
+    int files[2] = {w->fd, -1};
+    if (uring_init(&w->ring, (unsigned)w->uring_depth + 1) == -1) {
+        return -1;
+    }
+    if (!(w->ring.features & IORING_FEAT_EXT_ARG)) {
+        // Waiting for completions with a deadline would fail every time and the writer would spin
+        fprintf(stderr, "Log writer: io_uring without IORING_FEAT_EXT_ARG (Linux 5.11 or later "
+                        "needed for timed waits); use another sink\n");
+        return -1;
+    }
+    if (uring_register_files(&w->ring, files, w->rotator ? 2 : 1) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < w->nlanes; i++) {
+        w->iov[i].iov_base = w->lanes[i].buf;
+        w->iov[i].iov_len = w->mask + 1;
+    }
+    w->fixed_bufs = uring_register_buffers(&w->ring, w->iov, (unsigned)w->nlanes) == 0;
+    if (!w->fixed_bufs) {
+        // Usually RLIMIT_MEMLOCK: the writes still work, only without pinned buffers
+        fprintf(stderr, "Log writer: writing from unregistered rings\n");
+    }
+    return 0;
+}
+
+int log_writer_start(log_writer_t* w, int fd, size_t ring_bytes, int nlanes) {
+    uint64_t size = 4096;
+    while (size < ring_bytes) {
+        size <<= 1;
+    }
+    w->mask = size - 1;
+    if (w->flush_bytes > size / 2) {
+        // Otherwise a full ring would only ever be written by the timer
+        w->flush_bytes = size / 2;
+    }
+    w->fd = fd;
+    w->stop = 0;
+    w->waiting = AWAKE;
+    w->nlanes = nlanes;
+    w->ring.ring_fd = -1;
+    w->inflight = NULL;
+    w->sent = NULL;
+    if (w->rotator) {
+        w->seg_bytes = w->map ? w->map->tail : w->segment->size;
+        w->seg_started = now_us();
+    }
+    w->lanes = aligned_alloc(LOG_WRITER_CACHE_LINE, sizeof(log_lane_t) * (size_t)nlanes);
+    w->heads = calloc((size_t)nlanes, sizeof(uint64_t));
+    w->iov = calloc((size_t)nlanes * 2, sizeof(struct iovec));
+    if (!w->lanes || !w->heads || !w->iov) {
+        perror("malloc log writer");
+        free(w->lanes);
+        w->lanes = NULL;
+        w->nlanes = 0;
+        log_writer_free(w);
+        return -1;
+    }
+    memset(w->lanes, 0, sizeof(log_lane_t) * (size_t)nlanes);
+    for (int i = 0; i < nlanes; i++) {
+        w->lanes[i].buf = malloc(size);
+        if (!w->lanes[i].buf) {
+            perror("malloc log ring");
+            log_writer_free(w);
+            return -1;
+        }
+        // Touch the ring now so its pages come from the NUMA node of the calling thread
+        memset(w->lanes[i].buf, 0, size);
+    }
+    if (w->uring_depth > 0 && uring_setup(w) == -1) {
+        log_writer_free(w);
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&w->lock, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        fprintf(stderr, "Failed to start the log writer thread\n");
+        pthread_cond_destroy(&w->wake);
+        pthread_mutex_destroy(&w->lock);
+        log_writer_free(w);
+        return -1;
+    }
+    return 0;
+}
+
+int log_writer_append(log_writer_t* w, int lane_id, const struct iovec* iov, int n) {
+    log_lane_t* lane = &w->lanes[lane_id];
+    uint64_t size = w->mask + 1;
+    uint64_t head = lane->head;
+    uint64_t tail = __atomic_load_n(&lane->tail, __ATOMIC_ACQUIRE);
+    int appended = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t len = iov[i].iov_len;
+        if (head - tail + len > size) {
+            // Whole records only: a torn record would corrupt the log
+            lane->dropped++;
+            lane->dropped_bytes += len;
+            continue;
+        }
+        uint64_t off = head & w->mask;
+        uint64_t first = len < size - off ? len : size - off;
+        memcpy(lane->buf + off, iov[i].iov_base, first);
+        memcpy(lane->buf, (const char*)iov[i].iov_base + first, len - first);
+        head += len;
+        appended++;
+    }
+    if (appended == 0) {
+        return 0;
+    }
+    lane->records += (unsigned long long)appended;
+    __atomic_store_n(&lane->head, head, __ATOMIC_SEQ_CST);
+
+    // tail may be stale, so the fill can be overestimated: at worst a spurious wake-up
+    uint64_t fill = head - tail;
+    if (fill > lane->peak) {
+        lane->peak = fill;
+    }
+    int waiting = __atomic_load_n(&w->waiting, __ATOMIC_SEQ_CST);
+    if (waiting == WAIT_DATA || (waiting == WAIT_DEADLINE && fill >= w->flush_bytes)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return appended;
+}
+
+void log_writer_stop(log_writer_t* w) {
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->lock);
+}
+
+void log_writer_free(log_writer_t* w) {
+    for (int i = 0; i < w->nlanes; i++) {
+        free(w->lanes[i].buf);
+    }
+    free(w->lanes);
+    free(w->heads);
+    free(w->iov);
+    free(w->inflight);
+    free(w->sent);
+    uring_exit(&w->ring);
+    w->inflight = NULL;
+    w->sent = NULL;
+    w->lanes = NULL;
+    w->heads = NULL;
+    w->iov = NULL;
+    w->nlanes = 0;
+}
+
+void log_writer_print(const log_writer_t* w, FILE* out) {
+    unsigned long long records = 0;
+    unsigned long long dropped = 0;
+    unsigned long long dropped_bytes = 0;
+    uint64_t peak = 0;
+    for (int i = 0; i < w->nlanes; i++) {
+        records += w->lanes[i].records;
+        dropped += w->lanes[i].dropped;
+        dropped_bytes += w->lanes[i].dropped_bytes;
+        if (w->lanes[i].peak > peak) {
+            peak = w->lanes[i].peak;
+        }
+    }
+    fprintf(out, "Log writer: %d x %llu KiB ring, flush at %llu bytes or %d us, ", w->nlanes,
+            (unsigned long long)(w->mask + 1) >> 10, (unsigned long long)w->flush_bytes, w->flush_us);
+    if (w->uring_depth > 0) {
+        fprintf(out, "io_uring with up to %d writes in flight%s, ", w->uring_depth,
+                w->fixed_bufs ? " from registered rings" : "");
+    }
+    if (w->map) {
+        fprintf(out, "appending through a mapping\n");
+    } else if (w->sync_ms > 0) {
+        fprintf(out, "fdatasync every %d ms\n", w->sync_ms);
+    } else {
+        fprintf(out, "no fdatasync\n");
+    }
+    fprintf(out, "Log writer: %llu records, %llu bytes in %llu %s (%.0f bytes each, "
+                 "%llu started by size), slowest %llu us; %llu fdatasync calls, slowest %llu us; "
+                 "ring peak %llu bytes, %llu records (%llu bytes) dropped with a ring full, "
+                 "%llu bytes lost to write errors\n",
+            records, w->written, w->writes,
+            w->map ? "copies" : w->uring_depth > 0 ? "io_uring writes" : "writev calls",
+            w->writes ? (double)w->written / w->writes : 0.0,
+            w->size_triggered, (unsigned long long)w->max_write_us, w->syncs,
+            (unsigned long long)w->max_sync_us, (unsigned long long)peak, dropped, dropped_bytes,
+            w->lost);
+    if (w->uring_depth > 0) {
+        fprintf(out, "Log writer: %llu io_uring submissions, %.1f us each, slowest %llu us; "
+                     "writes complete %.1f us after submission on average; peak %d in flight, "
+                     "%llu short writes, %llu failed writes resubmitted%s\n",
+                w->submits, w->submits ? (double)w->submit_us / w->submits : 0.0,
+                (unsigned long long)w->max_submit_us,
+                w->completions ? (double)w->complete_us / w->completions : 0.0,
+                w->peak_inflight, w->short_writes, w->retried,
+                w->failed ? "; WRITING STOPPED after a write kept failing" : "");
+    }
+}
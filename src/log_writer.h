@@ -0,0 +1,242 @@
+/**
+ * @file log_writer.h
+ * @brief Group-commit log writer: a dedicated thread fed through single-producer byte rings.
+ *
+ * A receive thread must never wait for the disk: while it is blocked in
+ * write() the socket buffer fills and the kernel drops datagrams. Here it
+ * only copies each record into a ring of bytes and moves on. A writer thread
+ * takes everything that has accumulated and appends it with one writev()
+ * (two iovecs per ring when the data wraps around its end), so a slow write
+ * simply makes the next one larger.
+ *
+ * A writer has one ring ("lane") per producer thread, so several receive
+ * threads can share one writer and one file without a lock between them.
+ * Each lane holds whole records, and the writer only ever writes whole lane
+ * contents, so records from different lanes interleave but never mix.
+ *
+ * When data is written is a durability trade-off, set before starting:
+ *
+ *   - flush_bytes: write as soon as this many bytes are pending (at most
+ *     half the ring);
+ *   - flush_us: write once the oldest pending byte has waited this long
+ *     (0 writes whatever is there as soon as the writer sees it);
+ *   - sync_ms: fdatasync() the file at most this often while data is being
+ *     written (0 never syncs; written data then reaches the disk whenever
+ *     the kernel flushes it).
+ *
+ * With `map` set the writer copies into a memory-mapped log (mmap_log.h)
+ * instead of calling writev(), and the mapping's own thread does the
+ * syncing, so sync_ms is passed to mmap_log_open() rather than used here.
+ *
+ * With uring_depth set the writer submits the writes through io_uring
+ * instead (see uring.h): each lane's ring is a registered buffer and the
+ * file a registered file, so a write is an IORING_OP_WRITE_FIXED at an
+ * explicit offset, and up to uring_depth of them are in flight at once. The
+ * writer goes on collecting and submitting while the disk works, and only
+ * releases ring space as writes complete, in submission order. fdatasync()
+ * becomes an IORING_OP_FSYNC with IOSQE_IO_DRAIN, so it covers every write
+ * submitted before it. Offsets are assigned at submission, so the fd must
+ * not append: log_writer_start() clears O_APPEND and starts at the end of
+ * the file. The writer waits for completions with a timeout, which needs
+ * IORING_FEAT_EXT_ARG (Linux 5.11); on older kernels log_writer_start()
+ * refuses the io_uring sink. Until the writes in flight complete, a reader
+ * may see a hole before the last one.
+ *
+ * A failed writev() loses its bytes but the next one appends right after
+ * the previous data, so the file stays contiguous. An io_uring write that
+ * fails cannot simply be skipped: later writes already sit at higher
+ * offsets, and the gap would read as zeros (and end a framed log for
+ * log_convert). A failed write is therefore resubmitted at its offset, up
+ * to LOG_WRITER_URING_RETRIES times. If it still fails the writer stops
+ * writing for good: it says so on stderr, waits for the writes in flight,
+ * truncates the file at the failed offset and from then on counts
+ * everything as lost, so the log ends cleanly before the first missing
+ * byte.
+ *
+ * With rotator set the log is a sequence of segments (log_rotate.h). At a
+ * flush boundary, once the current segment is full or old enough, the writer
+ * takes the prepared segment and writes the flush into it: fd, map and
+ * segment are swapped and nothing is opened, synced or closed on this
+ * thread. The old segment goes back to the rotator at once, or with io_uring
+ * once its last write has completed. The two segments alternate between two
+ * registered file slots, and the next one is registered as soon as it is
+ * published, so the switch itself makes no system call either.
+ *
+ * If the ring is full, the record is dropped and counted rather than blocking
+ * the receive thread. The ring is then the buffer that absorbs disk stalls,
+ * and its size is how long a stall can be survived at a given rate.
+ *
+ * In each lane the producer owns head and the writer owns tail; each
+ * publishes its side with a release store. The writer sleeps on a condition
+ * variable and a producer only signals it when it is asleep and has
+ * something to do (the first record, or its lane reaching flush_bytes), so
+ * under load the rings cost no system call per record.
+ */
+
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "log_rotate.h"
+#include "mmap_log.h"
+#include "uring.h"
+
+#define LOG_WRITER_CACHE_LINE 64                 ///< Keeps head and tail off each other's cache line
+#define LOG_WRITER_DEFAULT_RING (8u << 20)       ///< Default ring size in bytes
+#define LOG_WRITER_DEFAULT_FLUSH_BYTES (64u << 10)  ///< Default flush_bytes
+#define LOG_WRITER_DEFAULT_FLUSH_US 1000         ///< Default flush_us
+#define LOG_WRITER_DEFAULT_URING_DEPTH 8         ///< Default uring_depth when io_uring is chosen
+#define LOG_WRITER_MAX_URING_DEPTH 256           ///< Upper bound for uring_depth
+#define LOG_WRITER_URING_RETRIES 3               ///< Resubmissions of a failed io_uring write
+
+/**
+ * @brief One producer's ring and counters, on their own cache lines.
+ */
+typedef struct {
+    char* buf;             ///< Ring storage (size is the writer's mask + 1)
+    uint64_t head __attribute__((aligned(LOG_WRITER_CACHE_LINE)));  ///< Bytes appended (producer)
+    unsigned long long records;        ///< Records appended
+    unsigned long long dropped;        ///< Records dropped because the ring was full
+    unsigned long long dropped_bytes;  ///< Their bytes
+    uint64_t peak;                     ///< Highest ring fill seen by the producer, bytes
+    uint64_t tail __attribute__((aligned(LOG_WRITER_CACHE_LINE)));  ///< Bytes written (writer)
+} __attribute__((aligned(LOG_WRITER_CACHE_LINE))) log_lane_t;
+
+/**
+ * @brief A write submitted through io_uring and not yet released.
+ */
+typedef struct {
+    char* buf;             ///< Next byte to write (in the lane's ring)
+    uint32_t len;          ///< Bytes still to write
+    int lane;              ///< Lane (and registered buffer) the bytes belong to
+    int file;              ///< Registered file slot of the segment written
+    uint64_t offset;       ///< File offset of buf
+    uint64_t end;          ///< Lane tail once this write is released
+    uint64_t submitted_us; ///< When it was submitted
+    int retries;           ///< Times it failed and was resubmitted
+    int done;              ///< Completed (written or given up)
+} log_uring_write_t;
+
+/**
+ * @brief The lanes, the writer thread and their statistics.
+ */
+typedef struct {
+    // Settings, filled in before log_writer_start()
+    uint64_t flush_bytes;  ///< Write once this many bytes are pending
+    int flush_us;          ///< Write once the oldest pending byte is this old
+    int sync_ms;           ///< fdatasync() interval, 0 = never
+    mmap_log_t* map;       ///< Append through this mapped log instead of writev(), or NULL
+    int uring_depth;       ///< Writes in flight through io_uring instead of writev(), 0 = off
+    log_rotator_t* rotator;  ///< Rotate the log through this rotator, or NULL
+    log_segment_t* segment;  ///< With rotator: the first segment, then the current one (fd and map follow it)
+
+    log_lane_t* lanes;     ///< One ring per producer
+    int nlanes;            ///< Number of lanes
+    uint64_t mask;         ///< Ring size - 1 (the size is a power of two)
+    int fd;                ///< Log file, opened by the caller with O_APPEND (unused with map)
+    uint64_t seg_bytes;    ///< With rotator: bytes in the current segment
+    uint64_t seg_started;  ///< With rotator: when the writer switched to it
+    pthread_t thread;      ///< The writer
+    pthread_mutex_t lock;  ///< Protects the sleep/wake-up hand-shake
+    pthread_cond_t wake;   ///< Signalled by the producers and by log_writer_stop()
+    int stop;              ///< Set by log_writer_stop(): drain and exit
+    uint64_t* heads;       ///< Writer's snapshot of every lane's head
+    struct iovec* iov;     ///< Writer's iovecs, two per lane
+
+    // io_uring sink (uring_depth > 0), writer thread only
+    uring_t ring;                ///< Lanes registered as buffers, fd as file 0 (0 or 1 with rotator)
+    int file_slot;               ///< Registered file slot of fd
+    log_segment_t* staged;       ///< Prepared segment registered in the other slot
+    log_segment_t* draining;     ///< Segment switched away from with writes still in flight
+    int drain_left;              ///< Those writes (the oldest entries of inflight)
+    uint64_t drain_end;          ///< File offset the draining segment's writes end at
+    int failed;                  ///< A write failed for good: nothing more is submitted
+    int fail_slot;               ///< Registered file slot it was written to
+    uint64_t fail_offset;        ///< Its offset: the file is truncated there
+    uint64_t fail_lost;          ///< Bytes of failed writes to that file at or after it
+    int truncated;               ///< The file has been truncated at fail_offset
+    int fixed_bufs;              ///< The lanes are registered (else plain IORING_OP_WRITE)
+    log_uring_write_t* inflight; ///< Submitted writes in submission order (circular, uring_depth)
+    int inflight_first;          ///< Oldest entry of inflight
+    int ninflight;               ///< Writes submitted and not yet released
+    uint64_t* sent;              ///< Per lane: bytes submitted (tail follows on completion)
+    uint64_t offset;             ///< File offset of the next write
+    int sync_inflight;           ///< An fdatasync is in flight
+    uint64_t sync_started;       ///< When it was submitted
+
+    int waiting __attribute__((aligned(LOG_WRITER_CACHE_LINE)));  ///< Writer is asleep and wants a signal
+
+    // Writer statistics
+    unsigned long long written __attribute__((aligned(LOG_WRITER_CACHE_LINE)));  ///< Bytes written
+    unsigned long long writes;         ///< writev() calls (copies into the map, io_uring writes)
+    unsigned long long size_triggered; ///< Writes started because flush_bytes were pending
+    unsigned long long syncs;          ///< fdatasync() calls
+    unsigned long long lost;           ///< Bytes given up after a write error
+    uint64_t max_write_us;             ///< Slowest writev() (io_uring write, submission to completion)
+    uint64_t max_sync_us;              ///< Slowest fdatasync()
+    unsigned long long submits;        ///< io_uring_enter() calls that submitted writes
+    uint64_t submit_us;                ///< Time spent in them
+    uint64_t max_submit_us;            ///< Slowest of them
+    unsigned long long completions;    ///< Write completions
+    uint64_t complete_us;              ///< Submission-to-completion time, summed
+    unsigned long long short_writes;   ///< Completions that wrote less and were resubmitted
+    unsigned long long retried;        ///< Failed writes resubmitted
+    int peak_inflight;                 ///< Most writes in flight at once
+} log_writer_t;
+
+/**
+ * @brief Allocates the rings and starts the writer thread.
+ *
+ * The thread inherits the CPU affinity of the caller.
+ *
+ * @param w          Writer with flush_bytes, flush_us, sync_ms, map, uring_depth, rotator and
+ *                   segment filled in (map and fd being the segment's with rotator).
+ * @param fd         Log file descriptor; it stays owned by the caller.
+ * @param ring_bytes Size of each lane's ring, rounded up to a power of two.
+ * @param nlanes     Number of producer threads.
+ * @return 0 on success, -1 on error (an error is printed).
+ */
+int log_writer_start(log_writer_t* w, int fd, size_t ring_bytes, int nlanes);
+
+/**
+ * @brief Copies records into a lane and wakes the writer if needed.
+ *
+ * Each lane must only ever be used by one thread. Each iovec is one record;
+ * a record that does not fit in the free space is dropped whole, never split.
+ *
+ * @param w    The writer.
+ * @param lane Lane of the calling thread.
+ * @param iov  Records to append.
+ * @param n    Number of records.
+ * @return Number of records appended.
+ */
+int log_writer_append(log_writer_t* w, int lane, const struct iovec* iov, int n);
+
+/**
+ * @brief Writes out everything still in the ring, syncs if configured, and joins the thread.
+ *
+ * Must be called after the last log_writer_append().
+ *
+ * @param w The writer.
+ */
+void log_writer_stop(log_writer_t* w);
+
+/**
+ * @brief Releases the rings of a stopped writer.
+ *
+ * @param w The writer.
+ */
+void log_writer_free(log_writer_t* w);
+
+/**
+ * @brief Prints the settings and the counters on two lines (three with io_uring).
+ *
+ * @param w   The writer, after log_writer_stop().
+ * @param out Stream to print to.
+ */
+void log_writer_print(const log_writer_t* w, FILE* out);
+
+#endif // LOG_WRITER_H
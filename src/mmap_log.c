@@ -0,0 +1,372 @@
+/**
+ * @file mmap_log.c
+ * @brief Implementation of the memory-mapped append log declared in `mmap_log.h`.
+ *
+ * Window k covers file offsets [k * extent, (k + 1) * extent). The appender
+ * owns cur and tail; next, retired and failed are handed over under the lock.
+ * Only the background thread unmaps, so the window it reads from cur for a
+ * periodic msync() stays mapped while it syncs, even if the appender has
+ * retired it in the meantime.
+ */
+
+#define _GNU_SOURCE
+
+#include "mmap_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Returns the monotonic clock in microseconds.
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Allocates the extent at start and maps it with its pages populated.
+ *
+ * @return 0 on success, -1 on error (an error is printed).
+ */
+static int map_window(mmap_log_t* m, uint64_t start, mmap_window_t* win) {
+    uint64_t begin = now_us();
+    // Recorded first: a crash right after fallocate() must not make the file look grown by someone else
+    if (start + m->extent > __atomic_load_n(&m->shared->size, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&m->shared->size, start + m->extent, __ATOMIC_RELEASE);
+    }
+    if (fallocate(m->fd, 0, (off_t)start, (off_t)m->extent) == -1) {
+        // Not every file system can preallocate; growing the file still gives a mappable range
+        struct stat st;
+        if (errno != EOPNOTSUPP || fstat(m->fd, &st) == -1 ||
+            ((uint64_t)st.st_size < start + m->extent &&
+             ftruncate(m->fd, (off_t)(start + m->extent)) == -1)) {
+            perror("fallocate log extent");
+            return -1;
+        }
+    }
+    void* base = mmap(NULL, m->extent, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m->fd,
+                      (off_t)start);
+    if (base == MAP_FAILED) {
+        perror("mmap log extent");
+        return -1;
+    }
+    madvise(base, m->extent, MADV_SEQUENTIAL);
+    win->base = base;
+    win->start = start;
+    m->windows++;
+    uint64_t took = now_us() - begin;
+    if (took > m->max_prepare_us) {
+        m->max_prepare_us = took;
+    }
+    return 0;
+}
+
+/**
+ * @brief msync()s [from, to) of a window (MS_SYNC) and records how long it took.
+ */
+static void sync_range(mmap_log_t* m, const mmap_window_t* win, uint64_t from, uint64_t to) {
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t off = (from - win->start) & ~(page - 1);
+    uint64_t begin = now_us();
+    if (msync(win->base + off, to - win->start - off, MS_SYNC) == -1) {
+        perror("msync log");
+    }
+    msync(m->shared, sizeof(*m->shared), MS_SYNC);
+    uint64_t took = now_us() - begin;
+    if (took > m->max_sync_us) {
+        m->max_sync_us = took;
+    }
+    m->syncs++;
+}
+
+/**
+ * @brief Background thread: prepares the next window, unmaps retired ones, syncs periodically.
+ */
+static void* mmap_log_main(void* arg) {
+    mmap_log_t* m = arg;
+    uint64_t sync_every = (uint64_t)m->sync_ms * 1000;
+    uint64_t last_sync = now_us();
+    uint64_t synced = __atomic_load_n(&m->shared->tail, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&m->lock);
+    while (1) {
+        // The appender may be waiting for the next window, so it comes first
+        if (!m->stop && !m->next.base && !m->failed) {
+            uint64_t start = m->next.start;
+            mmap_window_t win;
+            pthread_mutex_unlock(&m->lock);
+            int status = map_window(m, start, &win);
+            pthread_mutex_lock(&m->lock);
+            if (status == 0 && start != m->next.start) {
+                // The appender rewound to an earlier window meanwhile; this one is not next any more
+                pthread_mutex_unlock(&m->lock);
+                munmap(win.base, m->extent);
+                pthread_mutex_lock(&m->lock);
+            } else if (status == 0) {
+                m->next = win;
+            } else {
+                m->failed = 1;
+            }
+            pthread_cond_signal(&m->ready);
+            continue;
+        }
+        if (m->nretired > 0) {
+            mmap_window_t win = m->retired[0];
+            m->nretired--;
+            memmove(&m->retired[0], &m->retired[1], sizeof(win) * (size_t)m->nretired);
+            pthread_cond_signal(&m->ready);
+            pthread_mutex_unlock(&m->lock);
+            if (sync_every > 0 && synced < win.start + m->extent) {
+                sync_range(m, &win, synced > win.start ? synced : win.start, win.start + m->extent);
+                synced = win.start + m->extent;
+            }
+            munmap(win.base, m->extent);
+            pthread_mutex_lock(&m->lock);
+            continue;
+        }
+        if (m->stop) {
+            break;
+        }
+        if (sync_every == 0) {
+            pthread_cond_wait(&m->wake, &m->lock);
+            continue;
+        }
+
+        uint64_t now = now_us();
+        if (now - last_sync >= sync_every) {
+            mmap_window_t win = m->cur;
+            pthread_mutex_unlock(&m->lock);
+            uint64_t tail = __atomic_load_n(&m->shared->tail, __ATOMIC_ACQUIRE);
+            uint64_t end = win.start + m->extent;
+            if (tail > end) {
+                tail = end;  // The rest is in a window that has since been retired or is current
+            }
+            if (tail > synced && tail > win.start) {
+                sync_range(m, &win, synced > win.start ? synced : win.start, tail);
+                synced = tail;
+            }
+            last_sync = now_us();
+            pthread_mutex_lock(&m->lock);
+            continue;
+        }
+        uint64_t deadline = last_sync + sync_every;
+        struct timespec ts;
+        ts.tv_sec = (time_t)(deadline / 1000000);
+        ts.tv_nsec = (long)(deadline % 1000000) * 1000;
+        pthread_cond_timedwait(&m->wake, &m->lock, &ts);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+int mmap_log_open(mmap_log_t* m, int fd, const char* tail_path, size_t extent, int sync_ms) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    memset(m, 0, sizeof(*m));
+    m->fd = fd;
+    m->extent = (extent + page - 1) / page * page;
+    m->sync_ms = sync_ms;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat log");
+        return -1;
+    }
+    int tail_fd = open(tail_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (tail_fd < 0) {
+        perror("open log tail file");
+        return -1;
+    }
+    struct stat tail_st;
+    if (fstat(tail_fd, &tail_st) == -1 ||
+        ((size_t)tail_st.st_size < sizeof(mmap_log_tail_t) &&
+         ftruncate(tail_fd, sizeof(mmap_log_tail_t)) == -1)) {
+        perror("size log tail file");
+        close(tail_fd);
+        return -1;
+    }
+    void* shared = mmap(NULL, sizeof(mmap_log_tail_t), PROT_READ | PROT_WRITE, MAP_SHARED, tail_fd, 0);
+    close(tail_fd);
+    if (shared == MAP_FAILED) {
+        perror("mmap log tail file");
+        return -1;
+    }
+    m->shared = shared;
+
+    // A valid side file marks the end of the data, unless the file grew past the preallocation since
+    m->tail = (uint64_t)st.st_size;
+    if (m->shared->magic == MMAP_LOG_TAIL_MAGIC && m->shared->tail <= m->tail &&
+        m->tail <= m->shared->size) {
+        m->tail = m->shared->tail;
+    }
+    m->shared->magic = MMAP_LOG_TAIL_MAGIC;
+    m->shared->size = (uint64_t)st.st_size;
+    __atomic_store_n(&m->shared->tail, m->tail, __ATOMIC_RELEASE);
+
+    if (map_window(m, m->tail - m->tail % m->extent, &m->cur) == -1) {
+        munmap(m->shared, sizeof(*m->shared));
+        return -1;
+    }
+    m->next.start = m->cur.start + m->extent;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&m->ready, NULL);
+    pthread_mutex_init(&m->lock, NULL);
+    if (pthread_create(&m->thread, NULL, mmap_log_main, m) != 0) {
+        fprintf(stderr, "Failed to start the log mapping thread\n");
+        pthread_cond_destroy(&m->wake);
+        pthread_cond_destroy(&m->ready);
+        pthread_mutex_destroy(&m->lock);
+        munmap(m->cur.base, m->extent);
+        munmap(m->shared, sizeof(*m->shared));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Retires the full current window and moves to the prepared one, waiting if needed.
+ *
+ * @return 0 on success, -1 if the next window could not be prepared (it is retried).
+ */
+static int next_window(mmap_log_t* m) {
+    pthread_mutex_lock(&m->lock);
+    if ((!m->next.base && !m->failed) || m->nretired == MMAP_LOG_MAX_RETIRED) {
+        uint64_t begin = now_us();
+        m->stalls++;
+        while ((!m->next.base && !m->failed) || m->nretired == MMAP_LOG_MAX_RETIRED) {
+            pthread_cond_wait(&m->ready, &m->lock);
+        }
+        m->stall_us += now_us() - begin;
+    }
+    if (!m->next.base) {
+        // Let the background thread try again for the next append
+        m->failed = 0;
+        pthread_cond_signal(&m->wake);
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+    m->retired[m->nretired++] = m->cur;
+    m->cur = m->next;
+    m->next.base = NULL;
+    m->next.start = m->cur.start + m->extent;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+/**
+ * @brief Moves the tail back to an earlier offset after a failed append.
+ *
+ * If that offset lies in a window already retired, the window is mapped
+ * again and becomes current; the windows after it are retired, and the next
+ * one is prepared afresh.
+ */
+static void rewind_tail(mmap_log_t* m, uint64_t tail) {
+    if (tail >= m->cur.start) {
+        m->tail = tail;
+        return;
+    }
+    uint64_t start = tail - tail % m->extent;
+    // The extent is allocated already, so this needs no space on a full disk
+    void* base = mmap(NULL, m->extent, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, (off_t)start);
+    if (base == MAP_FAILED) {
+        perror("mmap log extent to rewind");  // Nothing better left: the partial append stays
+        return;
+    }
+    pthread_mutex_lock(&m->lock);
+    while (m->nretired > MMAP_LOG_MAX_RETIRED - 2) {
+        pthread_cond_wait(&m->ready, &m->lock);
+    }
+    m->retired[m->nretired++] = m->cur;
+    if (m->next.base) {
+        m->retired[m->nretired++] = m->next;
+        m->next.base = NULL;
+    }
+    m->cur.base = base;
+    m->cur.start = start;
+    m->next.start = start + m->extent;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    m->tail = tail;
+}
+
+uint64_t mmap_log_append(mmap_log_t* m, const struct iovec* iov, int n) {
+    uint64_t start = m->tail;
+    uint64_t appended = 0;
+    for (int i = 0; i < n; i++) {
+        const char* p = iov[i].iov_base;
+        uint64_t len = iov[i].iov_len;
+        while (len > 0) {
+            uint64_t off = m->tail - m->cur.start;
+            if (off == m->extent) {
+                if (next_window(m) == -1) {
+                    // The caller's records would end part-way: drop the whole append instead
+                    rewind_tail(m, start);
+                    appended = 0;
+                    goto publish;
+                }
+                off = 0;
+            }
+            uint64_t chunk = len < m->extent - off ? len : m->extent - off;
+            memcpy(m->cur.base + off, p, chunk);
+            m->tail += chunk;
+            appended += chunk;
+            p += chunk;
+            len -= chunk;
+        }
+    }
+publish:
+    __atomic_store_n(&m->shared->tail, m->tail, __ATOMIC_RELEASE);
+    return appended;
+}
+
+void mmap_log_close(mmap_log_t* m) {
+    pthread_mutex_lock(&m->lock);
+    m->stop = 1;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+    pthread_cond_destroy(&m->wake);
+    pthread_cond_destroy(&m->ready);
+    pthread_mutex_destroy(&m->lock);
+
+    if (m->next.base) {
+        munmap(m->next.base, m->extent);
+    }
+    if (m->sync_ms > 0 && m->tail > m->cur.start) {
+        sync_range(m, &m->cur, m->cur.start, m->tail);
+    }
+    munmap(m->cur.base, m->extent);
+    // Give back the unused part of the preallocated extents
+    if (ftruncate(m->fd, (off_t)m->tail) == -1) {
+        perror("truncate log");
+    } else {
+        if (m->sync_ms > 0 && fdatasync(m->fd) == -1) {
+            perror("fdatasync log");
+        }
+        // The file's length is the end of the data now; a tail kept here could only go stale
+        m->shared->magic = 0;
+        if (m->sync_ms > 0) {
+            msync(m->shared, sizeof(*m->shared), MS_SYNC);
+        }
+    }
+    munmap(m->shared, sizeof(*m->shared));
+    m->shared = NULL;
+}
+
+void mmap_log_print(const mmap_log_t* m, FILE* out) {
+    fprintf(out, "Log mapping: %llu KiB extents, %llu mapped, slowest fallocate+mmap %llu us; "
+                 "appender stalled %llu times for %llu us; %llu msync calls, slowest %llu us\n",
+            (unsigned long long)m->extent >> 10, m->windows, (unsigned long long)m->max_prepare_us,
+            m->stalls, (unsigned long long)m->stall_us, m->syncs, (unsigned long long)m->max_sync_us);
+}
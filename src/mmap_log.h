@@ -0,0 +1,147 @@
+/**
+ * @file mmap_log.h
+ * @brief Append-only log file written through preallocated, memory-mapped extents.
+ *
+ * write() costs a system call per flush and allocates page cache and disk
+ * blocks on the caller's thread as the file grows. Here the file is grown
+ * in large extents instead: a background thread fallocate()s the next
+ * extent, maps it with MAP_POPULATE (so its page-cache pages exist before
+ * they are needed) and hands it to the appender ready to use. Appending is
+ * then a memcpy() into the current window; when a window is full the
+ * appender swaps in the prepared one and passes the old one back, and the
+ * background thread msync()s and unmaps it. The appender only waits when it
+ * outruns the preparation of the next extent, which is counted as a stall.
+ *
+ * The end of valid data is published in a side file, `<log>.tail`, mapped
+ * shared: a 24-byte mmap_log_tail_t whose tail is stored with release
+ * semantics after the bytes before it have been copied. A reader that maps
+ * the side file, loads tail with acquire semantics and reads the log up to
+ * that offset never sees a partial record and never takes a lock; the
+ * zeros of the preallocated extent beyond it are not data. An append is all
+ * or nothing, so a record is never published in part, even when the disk
+ * fills up in the middle of one. On a clean close the log is truncated to
+ * its tail, so it ends up byte-for-byte what the write() path would have
+ * produced, and the side file is invalidated (magic cleared): from then on
+ * the file's own length is the end of the data.
+ *
+ * After a crash the side file says where to resume, provided the log still
+ * looks as the mapping left it: no longer than the size its preallocation
+ * reached (recorded in the side file too). A log that has grown since, say
+ * appended by `-w write`, is resumed at its end instead, so a stale tail
+ * never rewinds it over newer data.
+ *
+ * With sync_ms set, the background thread also msync()s the written part of
+ * the current window at that interval; the appender never waits for it.
+ */
+
+#ifndef MMAP_LOG_H
+#define MMAP_LOG_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define MMAP_LOG_TAIL_MAGIC 0x4c494154474f4c55ull  ///< "ULOGTAIL" when stored little-endian
+#define MMAP_LOG_DEFAULT_EXTENT (64u << 20)          ///< Default extent (and window) size
+#define MMAP_LOG_MAX_RETIRED 8                        ///< Windows waiting to be unmapped
+
+/**
+ * @brief Contents of the `<log>.tail` side file.
+ */
+typedef struct {
+    uint64_t magic;  ///< MMAP_LOG_TAIL_MAGIC while the log is open, 0 after a clean close
+    uint64_t tail;   ///< Bytes of valid data at the start of the log (atomic)
+    uint64_t size;   ///< File size the preallocation may have reached (set before each fallocate)
+} mmap_log_tail_t;
+
+/**
+ * @brief A mapped extent of the log.
+ */
+typedef struct {
+    char* base;      ///< Mapping, extent bytes; NULL if none
+    uint64_t start;  ///< File offset of base
+} mmap_window_t;
+
+/**
+ * @brief A log being appended through mappings, and its background thread.
+ */
+typedef struct {
+    int fd;                    ///< Log file, opened O_RDWR
+    size_t extent;             ///< Extent and window size, a multiple of the page size
+    int sync_ms;               ///< Background msync() interval, 0 = never
+    mmap_log_tail_t* shared;   ///< The mapped side file
+
+    // Appender state (one thread)
+    mmap_window_t cur;         ///< Window being filled
+    uint64_t tail;             ///< Next file offset to write
+
+    // Hand-over with the background thread (under lock)
+    pthread_t thread;          ///< Background thread
+    pthread_mutex_t lock;      ///< Protects next, retired, cur.base for the syncer, stop
+    pthread_cond_t wake;       ///< Background thread has work
+    pthread_cond_t ready;      ///< A prepared window is available (or preparation failed)
+    mmap_window_t next;        ///< Prepared window, base NULL until ready
+    int failed;                ///< Preparing the next window failed
+    mmap_window_t retired[MMAP_LOG_MAX_RETIRED];  ///< Full windows to msync and unmap
+    int nretired;              ///< Entries in retired
+    int stop;                  ///< Set by mmap_log_close()
+
+    // Statistics
+    unsigned long long windows;    ///< Windows mapped
+    unsigned long long stalls;     ///< Times the appender waited for a window
+    unsigned long long syncs;      ///< msync() calls
+    uint64_t max_prepare_us;       ///< Slowest fallocate() + mmap()
+    uint64_t max_sync_us;          ///< Slowest msync()
+    uint64_t stall_us;             ///< Time the appender spent waiting
+} mmap_log_t;
+
+/**
+ * @brief Maps the log for appending and starts the background thread.
+ *
+ * Appending resumes at the tail recorded in the side file if it is valid and
+ * the file is no longer than its recorded size, otherwise at the end of the
+ * file.
+ *
+ * @param m         Log to set up.
+ * @param fd        Log file opened O_RDWR; it stays owned by the caller.
+ * @param tail_path Path of the side file (created if missing).
+ * @param extent    Extent size, rounded up to a multiple of the page size.
+ * @param sync_ms   Background msync() interval, 0 = never.
+ * @return 0 on success, -1 on error (an error is printed).
+ */
+int mmap_log_open(mmap_log_t* m, int fd, const char* tail_path, size_t extent, int sync_ms);
+
+/**
+ * @brief Copies data to the end of the log and publishes the new tail (appender thread only).
+ *
+ * All or nothing: if a new extent cannot be prepared part-way, the tail goes
+ * back to where it was, so a caller passing whole records never leaves part
+ * of one in the log.
+ *
+ * @param m   The log.
+ * @param iov Buffers to append, in order.
+ * @param n   Number of buffers.
+ * @return Bytes appended: all of them, or 0 if a new extent could not be prepared.
+ */
+uint64_t mmap_log_append(mmap_log_t* m, const struct iovec* iov, int n);
+
+/**
+ * @brief Stops the background thread, unmaps everything and truncates the log to its tail.
+ *
+ * With sync_ms set the data is made durable first. The side file is then
+ * invalidated, since the file's length now marks the end of the data.
+ *
+ * @param m The log.
+ */
+void mmap_log_close(mmap_log_t* m);
+
+/**
+ * @brief Prints the counters on one line.
+ *
+ * @param m   The log.
+ * @param out Stream to print to.
+ */
+void mmap_log_print(const mmap_log_t* m, FILE* out);
+
+#endif // MMAP_LOG_H
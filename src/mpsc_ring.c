@@ -0,0 +1,96 @@
+/**
+ * @file mpsc_ring.c
+ * @brief Implementation of the lock-free ring declared in `mpsc_ring.h`.
+ *
+ * Cell i starts with seq = i. A producer may fill the cell at position p when
+ * seq == p, and publishes it by setting seq = p + 1. The consumer may read it
+ * when seq == p + 1, and hands it back to the producer of the next lap by
+ * setting seq = p + nslots.
+ */
+
+#define _GNU_SOURCE
+
+#include "mpsc_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int mpsc_ring_init(mpsc_ring_t* r, unsigned nslots, uint32_t slot_size) {
+    memset(r, 0, sizeof(*r));
+    unsigned n = 1;
+    while (n < nslots) {
+        n <<= 1;
+    }
+    r->cells = malloc(sizeof(mpsc_cell_t) * n);
+    r->arena = aligned_alloc(MPSC_CACHE_LINE, (size_t)n * slot_size);
+    if (!r->cells || !r->arena) {
+        perror("malloc mpsc ring");
+        mpsc_ring_free(r);
+        return -1;
+    }
+    // Touch the arena now so its pages come from the NUMA node of the calling thread
+    memset(r->arena, 0, (size_t)n * slot_size);
+    for (unsigned i = 0; i < n; i++) {
+        r->cells[i].seq = i;
+        r->cells[i].len = 0;
+        r->cells[i].data = r->arena + (size_t)i * slot_size;
+    }
+    r->mask = n - 1;
+    r->slot_size = slot_size;
+    return 0;
+}
+
+void mpsc_ring_free(mpsc_ring_t* r) {
+    free(r->cells);
+    free(r->arena);
+    r->cells = NULL;
+    r->arena = NULL;
+}
+
+int mpsc_ring_push(mpsc_ring_t* r, const char* data, size_t len) {
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    mpsc_cell_t* cell;
+    while (1) {
+        cell = &r->cells[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            // Our turn: claim the position (pos is refreshed on failure)
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;  // The consumer has not released this cell from the last lap
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);  // Another producer won
+        }
+    }
+
+    memcpy(cell->data, data, len);
+    cell->len = (uint32_t)len;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+unsigned mpsc_ring_peek(mpsc_ring_t* r, mpsc_cell_t** cells, unsigned max) {
+    unsigned n = 0;
+    // Stop at the first cell still being filled, even if later ones are done
+    while (n < max) {
+        uint64_t pos = r->tail + n;
+        mpsc_cell_t* cell = &r->cells[pos & r->mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+        cells[n++] = cell;
+    }
+    return n;
+}
+
+void mpsc_ring_release(mpsc_ring_t* r, unsigned n) {
+    for (unsigned i = 0; i < n; i++) {
+        uint64_t pos = r->tail + i;
+        __atomic_store_n(&r->cells[pos & r->mask].seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    }
+    r->tail += n;
+}
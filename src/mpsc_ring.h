@@ -0,0 +1,115 @@
+/**
+ * @file mpsc_ring.h
+ * @brief Bounded lock-free multi-producer single-consumer ring of byte records.
+ *
+ * The ring follows Dmitry Vyukov's bounded queue: every cell carries a
+ * sequence number that tells producers and the consumer whose turn it is, so
+ * a producer claims a cell with one compare-and-swap on the head and publishes
+ * it with one release store, and nobody ever takes a lock. Only the consumer
+ * moves the tail, which is therefore a plain variable.
+ *
+ * Record payloads live in an arena allocated once with the ring: cell i owns
+ * the fixed-size slot i, so pushing copies into memory that is already there
+ * and nothing is allocated or freed per record. The consumer looks at a batch
+ * of published cells in place and only hands them back after it is done with
+ * the data, which lets it pass the slots straight to sendmmsg().
+ *
+ * Waking a sleeping consumer or a producer that found the ring full is left to
+ * the caller; the ring itself never blocks.
+ */
+
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPSC_CACHE_LINE 64  ///< Keeps head and tail off each other's cache line
+
+/**
+ * @brief One ring entry; `data` points at its slot in the arena.
+ */
+typedef struct {
+    uint64_t seq;             ///< Position this cell is waiting for (see mpsc_ring.c)
+    uint32_t len;             ///< Bytes of the record held in data
+    char* data;               ///< Slot of slot_size bytes in the arena
+} mpsc_cell_t;
+
+/**
+ * @brief The ring. Producers touch head, the consumer touches tail.
+ */
+typedef struct {
+    mpsc_cell_t* cells;       ///< nslots cells
+    char* arena;              ///< nslots * slot_size bytes of record storage
+    uint32_t mask;            ///< nslots - 1 (nslots is a power of two)
+    uint32_t slot_size;       ///< Largest record a cell can hold
+    uint64_t head __attribute__((aligned(MPSC_CACHE_LINE)));  ///< Next position to claim (producers)
+    uint64_t tail __attribute__((aligned(MPSC_CACHE_LINE)));  ///< Next position to consume (consumer only)
+} mpsc_ring_t;
+
+/**
+ * @brief Allocates the cells and the record arena of an empty ring.
+ *
+ * @param r         Ring to initialise.
+ * @param nslots    Capacity in records, rounded up to a power of two.
+ * @param slot_size Largest record that can be pushed.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int mpsc_ring_init(mpsc_ring_t* r, unsigned nslots, uint32_t slot_size);
+
+/**
+ * @brief Releases the cells and the arena. No thread may use the ring any more.
+ *
+ * @param r Ring to destroy.
+ */
+void mpsc_ring_free(mpsc_ring_t* r);
+
+/**
+ * @brief Copies one record into the ring. Safe to call from any number of threads.
+ *
+ * @param r    The ring.
+ * @param data Record to copy.
+ * @param len  Its length (at most slot_size).
+ * @return 0 on success, -1 if the ring is full.
+ */
+int mpsc_ring_push(mpsc_ring_t* r, const char* data, size_t len);
+
+/**
+ * @brief Collects published records at the tail without consuming them (consumer only).
+ *
+ * @param r     The ring.
+ * @param cells Receives pointers to up to max cells, oldest first.
+ * @param max   Size of cells.
+ * @return Number of cells returned; 0 if the ring is empty.
+ */
+unsigned mpsc_ring_peek(mpsc_ring_t* r, mpsc_cell_t** cells, unsigned max);
+
+/**
+ * @brief Gives the oldest n peeked cells back to the producers (consumer only).
+ *
+ * @param r The ring.
+ * @param n Cells to release, at most the count of the last mpsc_ring_peek().
+ */
+void mpsc_ring_release(mpsc_ring_t* r, unsigned n);
+
+/**
+ * @brief Returns the number of records claimed but not yet released.
+ *
+ * Exact when called by the consumer with no concurrent push; otherwise a snapshot.
+ *
+ * @param r The ring.
+ */
+static inline uint64_t mpsc_ring_depth(const mpsc_ring_t* r) {
+    return __atomic_load_n(&r->head, __ATOMIC_RELAXED) - r->tail;
+}
+
+/**
+ * @brief Capacity of the ring in records.
+ *
+ * @param r The ring.
+ */
+static inline unsigned mpsc_ring_capacity(const mpsc_ring_t* r) {
+    return r->mask + 1;
+}
+
+#endif // MPSC_RING_H
@@ -0,0 +1,241 @@
+/**
+ * @file rate_limit.c
+ * @brief Implementation of the per-address limiter declared in `rate_limit.h`.
+ */
+
+#define _GNU_SOURCE
+
+#include "rate_limit.h"
+#include <stdlib.h>
+#include <string.h>
+
+int rate_limit_init(rate_limiter_t* rl, unsigned slots) {
+    unsigned per = 1;
+    while (per * RATE_LIMIT_STRIPES < slots) {
+        per <<= 1;
+    }
+    rl->slots_per_stripe = per;
+    rl->stripes = calloc(RATE_LIMIT_STRIPES, sizeof(rate_stripe_t));
+    if (!rl->stripes) {
+        perror("calloc rate limit stripes");
+        return -1;
+    }
+    for (int i = 0; i < RATE_LIMIT_STRIPES; i++) {
+        pthread_mutex_init(&rl->stripes[i].lock, NULL);
+        rl->stripes[i].entries = calloc(per, sizeof(rate_entry_t));
+        if (!rl->stripes[i].entries) {
+            perror("calloc rate limit table");
+            rate_limit_free(rl);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void rate_limit_free(rate_limiter_t* rl) {
+    if (!rl->stripes) {
+        return;
+    }
+    for (int i = 0; i < RATE_LIMIT_STRIPES; i++) {
+        free(rl->stripes[i].entries);
+        pthread_mutex_destroy(&rl->stripes[i].lock);
+    }
+    free(rl->stripes);
+    rl->stripes = NULL;
+}
+
+int rate_limit_parse_bucket(rate_bucket_t* b, const char* spec) {
+    char* end;
+    b->rate = strtod(spec, &end);
+    b->burst = b->rate;
+    if (*end == ':') {
+        const char* s = end + 1;
+        b->burst = strtod(s, &end);
+        if (end == s) {
+            return -1;
+        }
+    }
+    return (*end != '\0' || !(b->rate > 0) || !(b->burst > 0)) ? -1 : 0;
+}
+
+/**
+ * @brief Adds the tokens earned since the last refill, up to the burst size.
+ */
+static void refill(const rate_limiter_t* rl, rate_entry_t* e, uint64_t now_ms) {
+    if (now_ms <= e->refill_ms) {
+        return;
+    }
+    double secs = (double)(now_ms - e->refill_ms) / 1000.0;
+    e->refill_ms = now_ms;
+    e->bytes += rl->bytes.rate * secs;
+    if (e->bytes > rl->bytes.burst) {
+        e->bytes = rl->bytes.burst;
+    }
+    e->records += rl->records.rate * secs;
+    if (e->records > rl->records.burst) {
+        e->records = rl->records.burst;
+    }
+}
+
+/**
+ * @brief Starts an entry for a new address with full buckets.
+ */
+static void reset(const rate_limiter_t* rl, rate_entry_t* e, uint32_t addr, uint64_t now_ms) {
+    e->addr = addr;
+    e->conns = 0;
+    e->refill_ms = now_ms;
+    e->bytes = rl->bytes.burst;
+    e->records = rl->records.burst;
+}
+
+/**
+ * @brief Returns the stripe of an address and the slot its probe starts at.
+ */
+static rate_stripe_t* stripe_of(const rate_limiter_t* rl, uint32_t addr, unsigned* start) {
+    // murmur3 finaliser: every output bit depends on every octet of the address
+    uint32_t h = addr;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    *start = h & (rl->slots_per_stripe - 1);
+    return &rl->stripes[h >> (32 - RATE_LIMIT_STRIPE_BITS)];
+}
+
+/**
+ * @brief Finds the entry of addr in its stripe (locked by the caller).
+ *
+ * With create, a missing address takes the first never-used slot of its
+ * probe sequence or, failing that, the first idle entry.
+ *
+ * @return The entry, or NULL if it is absent (and could not be created).
+ */
+static rate_entry_t* find_entry(rate_limiter_t* rl, rate_stripe_t* s, unsigned start,
+                                uint32_t addr, uint64_t now_ms, int create) {
+    unsigned mask = rl->slots_per_stripe - 1;
+    rate_entry_t* idle = NULL;
+    for (unsigned i = 0; i < RATE_LIMIT_PROBES && i <= mask; i++) {
+        rate_entry_t* e = &s->entries[(start + i) & mask];
+        if (e->addr == addr) {
+            return e;
+        }
+        if (e->addr == 0) {
+            // Never used: the address is not further along either
+            if (!create) {
+                return NULL;
+            }
+            reset(rl, e, addr, now_ms);
+            __atomic_add_fetch(&rl->entries, 1, __ATOMIC_RELAXED);
+            return e;
+        }
+        if (create && !idle && e->conns == 0) {
+            // Recyclable once its buckets have refilled: nothing is forgotten then
+            refill(rl, e, now_ms);
+            if ((rl->bytes.rate <= 0 || e->bytes >= rl->bytes.burst) &&
+                (rl->records.rate <= 0 || e->records >= rl->records.burst)) {
+                idle = e;
+            }
+        }
+    }
+    if (idle) {
+        reset(rl, idle, addr, now_ms);
+        __atomic_add_fetch(&rl->recycled, 1, __ATOMIC_RELAXED);
+    }
+    return idle;
+}
+
+rate_verdict_t rate_limit_admit(rate_limiter_t* rl, uint32_t addr, uint64_t now_ms) {
+    int live = __atomic_add_fetch(&rl->live, 1, __ATOMIC_RELAXED);
+    rate_verdict_t verdict = RATE_ADMIT;
+    if (rl->max_total > 0 && live > rl->max_total) {
+        verdict = RATE_REJECT_TOTAL;
+    } else {
+        unsigned start;
+        rate_stripe_t* s = stripe_of(rl, addr, &start);
+        pthread_mutex_lock(&s->lock);
+        rate_entry_t* e = find_entry(rl, s, start, addr, now_ms, 1);
+        if (!e) {
+            verdict = RATE_REJECT_FULL;
+        } else if (rl->max_per_ip > 0 && e->conns >= (uint32_t)rl->max_per_ip) {
+            verdict = RATE_REJECT_IP;
+        } else {
+            e->conns++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (verdict != RATE_ADMIT) {
+        __atomic_sub_fetch(&rl->live, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rl->rejected[verdict], 1, __ATOMIC_RELAXED);
+    }
+    return verdict;
+}
+
+void rate_limit_release(rate_limiter_t* rl, uint32_t addr) {
+    unsigned start;
+    rate_stripe_t* s = stripe_of(rl, addr, &start);
+    pthread_mutex_lock(&s->lock);
+    rate_entry_t* e = find_entry(rl, s, start, addr, 0, 0);
+    if (e && e->conns > 0) {
+        e->conns--;
+    }
+    pthread_mutex_unlock(&s->lock);
+    __atomic_sub_fetch(&rl->live, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Milliseconds until a bucket in debt is back at zero, 0 if it is not in debt.
+ */
+static double debt_ms(const rate_bucket_t* b, double tokens) {
+    return (b->rate > 0 && tokens < 0) ? -tokens * 1000.0 / b->rate + 1.0 : 0.0;
+}
+
+int rate_limit_charge(rate_limiter_t* rl, uint32_t addr, uint64_t bytes, uint64_t records,
+                      uint64_t now_ms) {
+    if (rl->bytes.rate <= 0 && rl->records.rate <= 0) {
+        return 0;
+    }
+    unsigned start;
+    rate_stripe_t* s = stripe_of(rl, addr, &start);
+    pthread_mutex_lock(&s->lock);
+    rate_entry_t* e = find_entry(rl, s, start, addr, now_ms, 0);
+    double wait = 0;
+    if (e) {
+        refill(rl, e, now_ms);
+        if (rl->bytes.rate > 0) {
+            e->bytes -= (double)bytes;
+        }
+        if (rl->records.rate > 0) {
+            e->records -= (double)records;
+        }
+        wait = debt_ms(&rl->bytes, e->bytes);
+        double records_wait = debt_ms(&rl->records, e->records);
+        if (records_wait > wait) {
+            wait = records_wait;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (wait <= 0) {
+        return 0;
+    }
+    __atomic_add_fetch(&rl->throttled, 1, __ATOMIC_RELAXED);
+    return wait > 60000 ? 60000 : (int)wait;
+}
+
+void rate_limit_print(const rate_limiter_t* rl, FILE* out) {
+    fprintf(out, "Rate limits: %d connections total, %d per IP, %.0f B/s (burst %.0f) and "
+                 "%.0f records/s (burst %.0f) per IP (0 = unlimited)\n",
+            rl->max_total, rl->max_per_ip, rl->bytes.rate, rl->bytes.burst,
+            rl->records.rate, rl->records.burst);
+    fprintf(out, "Rate limiting: %d admitted connections open, refused %llu at the total cap, "
+                 "%llu at the per-IP cap, %llu with the table full; %llu throttles; "
+                 "%llu of %u addresses tracked (%llu recycled)\n",
+            __atomic_load_n(&rl->live, __ATOMIC_RELAXED),
+            __atomic_load_n(&rl->rejected[RATE_REJECT_TOTAL], __ATOMIC_RELAXED),
+            __atomic_load_n(&rl->rejected[RATE_REJECT_IP], __ATOMIC_RELAXED),
+            __atomic_load_n(&rl->rejected[RATE_REJECT_FULL], __ATOMIC_RELAXED),
+            __atomic_load_n(&rl->throttled, __ATOMIC_RELAXED),
+            __atomic_load_n(&rl->entries, __ATOMIC_RELAXED),
+            rl->slots_per_stripe * RATE_LIMIT_STRIPES,
+            __atomic_load_n(&rl->recycled, __ATOMIC_RELAXED));
+}
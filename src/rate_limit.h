@@ -0,0 +1,176 @@
+/**
+ * @file rate_limit.h
+ * @brief Per-source-IP admission control and token buckets shared by all server threads.
+ *
+ * Every client address has one entry in a fixed-size open-addressing hash
+ * table. The entry counts the address's open connections and holds two token
+ * buckets, one for bytes and one for records, refilled at a configured rate
+ * up to a burst size. The servers consult the table at two points:
+ *
+ *   - accept: rate_limit_admit() enforces the global connection cap, the
+ *     per-IP connection cap, and creates the entry;
+ *   - read: rate_limit_charge() takes what was just read out of the buckets
+ *     and says how long the address must wait once they run dry. The server
+ *     then stops reading that connection (its epoll registration loses
+ *     EPOLLIN) until the wait is over, so the kernel's receive buffer fills
+ *     and TCP flow control slows the client down instead of data being read
+ *     and dropped.
+ *
+ * Buckets are charged after a read, so a connection overshoots by at most
+ * one read before it is paused; the debt is paid back before it resumes.
+ *
+ * The table is split into stripes, each with its own lock and its own slots,
+ * so threads serving different addresses rarely meet on a lock. Memory is
+ * fixed at init: an address is probed for in at most RATE_LIMIT_PROBES slots
+ * of its stripe, and when none is free an idle entry (no connections, both
+ * buckets full again) is recycled in place. If even that fails the
+ * connection is refused and counted as "table full". Entries are never
+ * emptied, only recycled, so a probe sequence never has holes and lookups can
+ * stop at the first empty slot.
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RATE_LIMIT_STRIPE_BITS 6     ///< log2 of RATE_LIMIT_STRIPES
+#define RATE_LIMIT_STRIPES (1 << RATE_LIMIT_STRIPE_BITS)  ///< Locks (and slot groups) in a table
+#define RATE_LIMIT_PROBES 16         ///< Slots searched for one address
+#define RATE_LIMIT_DEFAULT_SLOTS 65536  ///< Addresses tracked by default
+
+/**
+ * @brief State of one client address.
+ */
+typedef struct {
+    uint32_t addr;       ///< IPv4 address, network byte order; 0 marks a never-used slot
+    uint32_t conns;      ///< Connections currently open from this address
+    uint64_t refill_ms;  ///< Time the buckets were last refilled
+    double bytes;        ///< Byte tokens; negative while paying off an overshoot
+    double records;      ///< Record tokens; negative while paying off an overshoot
+} rate_entry_t;
+
+/**
+ * @brief A lock and the slots it protects, on their own cache line.
+ */
+typedef struct {
+    pthread_mutex_t lock;   ///< Protects entries
+    rate_entry_t* entries;  ///< slots_per_stripe entries
+} __attribute__((aligned(64))) rate_stripe_t;
+
+/**
+ * @brief Token bucket parameters; a rate of 0 disables the bucket.
+ */
+typedef struct {
+    double rate;   ///< Tokens added per second
+    double burst;  ///< Bucket size
+} rate_bucket_t;
+
+/**
+ * @brief Outcome of rate_limit_admit().
+ */
+typedef enum {
+    RATE_ADMIT = 0,     ///< Connection accepted and counted
+    RATE_REJECT_TOTAL,  ///< The global connection cap is reached
+    RATE_REJECT_IP,     ///< The address is at its connection cap
+    RATE_REJECT_FULL,   ///< No slot can be found for a new address
+    RATE_REJECT_KINDS
+} rate_verdict_t;
+
+/**
+ * @brief The shared limiter.
+ */
+typedef struct {
+    rate_stripe_t* stripes;     ///< RATE_LIMIT_STRIPES stripes
+    unsigned slots_per_stripe;  ///< Power of two
+    rate_bucket_t bytes;        ///< Per-address byte bucket
+    rate_bucket_t records;      ///< Per-address record bucket
+    int max_total;              ///< Connections allowed in total, 0 = no cap
+    int max_per_ip;             ///< Connections allowed per address, 0 = no cap
+
+    // Counters (atomic builtins)
+    int live;                                       ///< Admitted connections still open
+    unsigned long long rejected[RATE_REJECT_KINDS]; ///< Refused connections by reason
+    unsigned long long throttled;                   ///< Charges that ran a bucket dry
+    unsigned long long entries;                     ///< Slots in use
+    unsigned long long recycled;                    ///< Idle entries reused for a new address
+} rate_limiter_t;
+
+/**
+ * @brief Allocates the table; bucket and cap fields must be set beforehand.
+ *
+ * @param rl    Limiter with bytes, records, max_total and max_per_ip filled in.
+ * @param slots Addresses to track (rounded up to a multiple of RATE_LIMIT_STRIPES
+ *              and a power of two).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int rate_limit_init(rate_limiter_t* rl, unsigned slots);
+
+/**
+ * @brief Releases the table.
+ *
+ * @param rl The limiter.
+ */
+void rate_limit_free(rate_limiter_t* rl);
+
+/**
+ * @brief Returns non-zero if any cap or bucket is configured.
+ *
+ * @param rl The limiter.
+ */
+static inline int rate_limit_enabled(const rate_limiter_t* rl) {
+    return rl->bytes.rate > 0 || rl->records.rate > 0 || rl->max_total > 0 || rl->max_per_ip > 0;
+}
+
+/**
+ * @brief Parses `RATE[:BURST]` into a bucket; the burst defaults to one second of rate.
+ *
+ * @param b    Bucket to fill.
+ * @param spec Specification, e.g. `1000000` or `1000000:4000000`.
+ * @return 0 on success, -1 if malformed.
+ */
+int rate_limit_parse_bucket(rate_bucket_t* b, const char* spec);
+
+/**
+ * @brief Admits a new connection from addr, counting it against both caps.
+ *
+ * @param rl     The limiter.
+ * @param addr   Peer IPv4 address, network byte order.
+ * @param now_ms Current monotonic time in milliseconds.
+ * @return RATE_ADMIT, or why the connection must be refused.
+ */
+rate_verdict_t rate_limit_admit(rate_limiter_t* rl, uint32_t addr, uint64_t now_ms);
+
+/**
+ * @brief Forgets one connection admitted by rate_limit_admit().
+ *
+ * @param rl   The limiter.
+ * @param addr Peer address passed to rate_limit_admit().
+ */
+void rate_limit_release(rate_limiter_t* rl, uint32_t addr);
+
+/**
+ * @brief Takes bytes and records read from addr out of its buckets.
+ *
+ * @param rl      The limiter.
+ * @param addr    Peer address of an admitted connection.
+ * @param bytes   Bytes just read.
+ * @param records Records just read.
+ * @param now_ms  Current monotonic time in milliseconds.
+ * @return 0 if the address may keep reading, else milliseconds until both
+ *         buckets are out of debt.
+ */
+int rate_limit_charge(rate_limiter_t* rl, uint32_t addr, uint64_t bytes, uint64_t records,
+                      uint64_t now_ms);
+
+/**
+ * @brief Prints the caps, buckets and counters on two lines.
+ *
+ * @param rl  The limiter.
+ * @param out Stream to print to.
+ */
+void rate_limit_print(const rate_limiter_t* rl, FILE* out);
+
+#endif // RATE_LIMIT_H
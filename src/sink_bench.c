@@ -0,0 +1,367 @@
+/**
+ * @file sink_bench.c
+ * @brief Burst benchmark of the ways udp_server can append to its log.
+ *
+ * One thread plays a receive thread: it appends bursts of fixed-size
+ * newline-terminated records to a log file, back to back, with a pause
+ * between bursts, through one of four sinks:
+ *
+ *   - stdio: fwrite() and fflush() per record, as udp_server originally did;
+ *   - write: a log writer ring drained with writev() (`udp_server -w write`);
+ *   - mmap:  a log writer ring drained into preallocated mapped extents
+ *            (`udp_server -w mmap`);
+ *   - uring: a log writer ring drained with io_uring writes, several in
+ *            flight (`udp_server -w uring`).
+ *
+ * The time every append takes is what a receive thread would lose per
+ * datagram, and is reported as p50/p99/p99.9/max in nanoseconds. The total
+ * time runs until everything is in the file (the writer stopped, or the
+ * stream closed), so it also counts whatever the sink deferred. Records a
+ * full ring had to drop are reported, and the file size is checked against
+ * what was accepted.
+ *
+ * With `-R` the writer sinks rotate the log every that many bytes, as
+ * `udp_server --rotate-bytes` does; the sizes of the rotated segments are
+ * then added up for the check.
+ *
+ * Usage:
+ *   ./sink_bench [options] <stdio|write|mmap|uring> <log_file>
+ *
+ * Example:
+ *   ./sink_bench -n 200000 -r 10 -z 256 mmap /tmp/sink.log
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "log_rotate.h"
+#include "log_writer.h"
+#include "mmap_log.h"
+
+#define DEFAULT_RECORDS 100000  ///< Records per burst
+#define DEFAULT_BURSTS 10       ///< Bursts per run
+#define DEFAULT_SIZE 256        ///< Bytes per record, newline included
+#define DEFAULT_GAP_MS 100      ///< Pause between bursts
+
+enum { SINK_STDIO, SINK_WRITE, SINK_MMAP, SINK_URING };
+
+/**
+ * @brief Returns the monotonic clock in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief qsort() comparator for append times.
+ */
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <stdio|write|mmap|uring> <log_file>\n"
+            "Appends bursts of records to log_file through one sink and reports the time per\n"
+            "append and the total time until the data is in the file.\n"
+            "Options:\n"
+            "  -n, --records N     Records per burst (default %d)\n"
+            "  -r, --bursts N      Number of bursts (default %d)\n"
+            "  -z, --size BYTES    Bytes per record, newline included (default %d)\n"
+            "  -g, --gap-ms MS     Pause between bursts (default %d)\n"
+            "  -q, --ring BYTES    Log writer ring size (write, mmap, uring; default %u)\n"
+            "  -F, --flush-bytes N Log writer flush_bytes (default %u)\n"
+            "  -u, --flush-us US   Log writer flush_us (default %d)\n"
+            "  -y, --sync-ms MS    fdatasync() or msync() interval (writer sinks; default off)\n"
+            "  -e, --extent BYTES  Preallocation step (mmap; default %u)\n"
+            "  -d, --depth N       Writes in flight (uring, 1-%d; default %d)\n"
+            "  -R, --rotate-bytes N\n"
+            "                      Rotate the log every N bytes (writer sinks; default off)\n",
+            prog, DEFAULT_RECORDS, DEFAULT_BURSTS, DEFAULT_SIZE, DEFAULT_GAP_MS,
+            LOG_WRITER_DEFAULT_RING, LOG_WRITER_DEFAULT_FLUSH_BYTES, LOG_WRITER_DEFAULT_FLUSH_US,
+            MMAP_LOG_DEFAULT_EXTENT, LOG_WRITER_MAX_URING_DEPTH, LOG_WRITER_DEFAULT_URING_DEPTH);
+}
+
+/**
+ * @brief Main entry point: runs the bursts and prints the report.
+ *
+ * @param argc Argument count.
+ * @param argv Arguments: [program_name, options..., sink, log_file]
+ * @return 0 on success, 1 on error or if the file does not hold what was accepted.
+ */
+int main(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"records",     required_argument, NULL, 'n'},
+        {"bursts",      required_argument, NULL, 'r'},
+        {"size",        required_argument, NULL, 'z'},
+        {"gap-ms",      required_argument, NULL, 'g'},
+        {"ring",        required_argument, NULL, 'q'},
+        {"flush-bytes", required_argument, NULL, 'F'},
+        {"flush-us",    required_argument, NULL, 'u'},
+        {"sync-ms",     required_argument, NULL, 'y'},
+        {"extent",      required_argument, NULL, 'e'},
+        {"depth",       required_argument, NULL, 'd'},
+        {"rotate-bytes", required_argument, NULL, 'R'},
+        {NULL, 0, NULL, 0}
+    };
+    int records = DEFAULT_RECORDS;
+    int bursts = DEFAULT_BURSTS;
+    int size = DEFAULT_SIZE;
+    int gap_ms = DEFAULT_GAP_MS;
+    size_t ring_bytes = LOG_WRITER_DEFAULT_RING;
+    size_t extent = MMAP_LOG_DEFAULT_EXTENT;
+    int depth = LOG_WRITER_DEFAULT_URING_DEPTH;
+    log_rotator_t rotator = {.max_bytes = 0};
+    log_writer_t writer = {
+        .flush_bytes = LOG_WRITER_DEFAULT_FLUSH_BYTES,
+        .flush_us = LOG_WRITER_DEFAULT_FLUSH_US,
+        .sync_ms = 0,
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "n:r:z:g:q:F:u:y:e:d:R:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'n':
+            records = atoi(optarg);
+            break;
+        case 'r':
+            bursts = atoi(optarg);
+            break;
+        case 'z':
+            size = atoi(optarg);
+            break;
+        case 'g':
+            gap_ms = atoi(optarg);
+            break;
+        case 'q':
+            ring_bytes = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'F':
+            writer.flush_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'u':
+            writer.flush_us = atoi(optarg);
+            break;
+        case 'y':
+            writer.sync_ms = atoi(optarg);
+            break;
+        case 'e':
+            extent = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'R':
+            rotator.max_bytes = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    int sink = -1;
+    if (argc - optind == 2) {
+        if (strcmp(argv[optind], "stdio") == 0) {
+            sink = SINK_STDIO;
+        } else if (strcmp(argv[optind], "write") == 0) {
+            sink = SINK_WRITE;
+        } else if (strcmp(argv[optind], "mmap") == 0) {
+            sink = SINK_MMAP;
+        } else if (strcmp(argv[optind], "uring") == 0) {
+            sink = SINK_URING;
+        }
+    }
+    if (sink == -1 || records < 1 || bursts < 1 || size < 2 || size > 65536 || gap_ms < 0 ||
+        ring_bytes < (size_t)size || writer.flush_bytes < 1 || writer.flush_us < 0 ||
+        writer.sync_ms < 0 || extent < 1 || depth < 1 || depth > LOG_WRITER_MAX_URING_DEPTH ||
+        (rotator.max_bytes > 0 && sink == SINK_STDIO)) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* path = argv[optind + 1];
+
+    // Start from an empty file, and no segments of an earlier run, so the size can be checked
+    unlink(path);
+    char tail_path[4096];
+    snprintf(tail_path, sizeof(tail_path), "%s.tail", path);
+    unlink(tail_path);
+    char pattern[4096];
+    snprintf(pattern, sizeof(pattern), "%s.[0-9]*-[0-9]*", path);
+    glob_t old;
+    if (glob(pattern, 0, NULL, &old) == 0) {
+        for (size_t i = 0; i < old.gl_pathc; i++) {
+            unlink(old.gl_pathv[i]);
+        }
+        globfree(&old);
+    }
+
+    FILE* fp = NULL;
+    int fd = -1;
+    mmap_log_t map;
+    if (sink == SINK_STDIO) {
+        fp = fopen(path, "a");
+        if (!fp) {
+            perror("fopen");
+            return 1;
+        }
+    } else if (rotator.max_bytes > 0) {
+        rotator.open_flags = sink == SINK_MMAP ? O_RDWR : sink == SINK_URING ? O_WRONLY : O_WRONLY | O_APPEND;
+        rotator.extent = sink == SINK_MMAP ? extent : 0;
+        rotator.sync_ms = writer.sync_ms;
+        if (log_rotator_start(&rotator, path, &writer.segment) == -1) {
+            return 1;
+        }
+        writer.rotator = &rotator;
+        writer.map = writer.segment->map;
+        fd = writer.segment->fd;
+    } else {
+        fd = open(path, (sink == SINK_MMAP ? O_RDWR : O_WRONLY | O_APPEND) | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("open");
+            return 1;
+        }
+        if (sink == SINK_MMAP) {
+            if (mmap_log_open(&map, fd, tail_path, extent, writer.sync_ms) == -1) {
+                close(fd);
+                return 1;
+            }
+            writer.map = &map;
+        }
+    }
+    if (sink == SINK_URING) {
+        writer.uring_depth = depth;
+    }
+    if (sink != SINK_STDIO && log_writer_start(&writer, fd, ring_bytes, 1) == -1) {
+        if (writer.rotator) {
+            log_rotator_stop(writer.rotator, writer.segment);
+            return 1;
+        }
+        if (writer.map) {
+            mmap_log_close(writer.map);
+        }
+        close(fd);
+        return 1;
+    }
+
+    size_t total = (size_t)records * (size_t)bursts;
+    uint32_t* took = malloc(sizeof(uint32_t) * total);
+    char* line = malloc((size_t)size);
+    if (!took || !line) {
+        perror("malloc");
+        return 1;
+    }
+    memset(line, 'x', (size_t)size);
+    line[size - 1] = '\n';
+
+    unsigned long long accepted = 0;
+    uint64_t busy_ns = 0;
+    uint64_t start = now_ns();
+    size_t k = 0;
+    for (int b = 0; b < bursts; b++) {
+        uint64_t burst_start = now_ns();
+        for (int i = 0; i < records; i++, k++) {
+            // A sequence number at the start of every record, like a real log line
+            int len = snprintf(line, (size_t)size, "%012zu ", k);
+            line[len < size - 1 ? len : size - 2] = ' ';
+            uint64_t t0 = now_ns();
+            if (sink == SINK_STDIO) {
+                if (fwrite(line, 1, (size_t)size, fp) == (size_t)size && fflush(fp) == 0) {
+                    accepted++;
+                }
+            } else {
+                struct iovec iov = {line, (size_t)size};
+                accepted += (unsigned long long)log_writer_append(&writer, 0, &iov, 1);
+            }
+            uint64_t t1 = now_ns();
+            took[k] = t1 - t0 > UINT32_MAX ? UINT32_MAX : (uint32_t)(t1 - t0);
+        }
+        busy_ns += now_ns() - burst_start;
+        if (b + 1 < bursts && gap_ms > 0) {
+            struct timespec gap = {gap_ms / 1000, (long)(gap_ms % 1000) * 1000000};
+            nanosleep(&gap, NULL);
+        }
+    }
+
+    // Everything accepted must be in the file before the clock stops
+    if (sink == SINK_STDIO) {
+        if (writer.sync_ms > 0) {
+            fsync(fileno(fp));
+        }
+        fclose(fp);
+    } else {
+        log_writer_stop(&writer);
+        if (writer.rotator) {
+            log_rotator_stop(writer.rotator, writer.segment);
+        } else {
+            if (writer.map) {
+                mmap_log_close(writer.map);
+            }
+            close(fd);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    qsort(took, total, sizeof(uint32_t), cmp_u32);
+    double mb = (double)accepted * size / 1e6;
+    printf("Sink %s: %d bursts of %d records of %d bytes, %d ms apart\n", argv[optind], bursts,
+           records, size, gap_ms);
+    printf("Append time (ns): p50 %u, p99 %u, p99.9 %u, max %u; %.1f MB/s while appending\n",
+           took[total / 2], took[total * 99 / 100], took[total * 999 / 1000], took[total - 1],
+           busy_ns ? mb / ((double)busy_ns / 1e9) : 0.0);
+    printf("Total: %llu of %zu records accepted, %.1f MB in %.3f s until in the file "
+           "(%.3f s of it between bursts)\n",
+           accepted, total, mb, (double)elapsed / 1e9,
+           (double)gap_ms * (bursts - 1) / 1000);
+    if (sink != SINK_STDIO) {
+        log_writer_print(&writer, stdout);
+        if (writer.rotator) {
+            log_rotator_print(writer.rotator, stdout);
+        } else if (writer.map) {
+            mmap_log_print(writer.map, stdout);
+        }
+        log_writer_free(&writer);
+    }
+
+    int status = 0;
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        perror("stat");
+        status = 1;
+    } else {
+        unsigned long long bytes = (unsigned long long)st.st_size;
+        glob_t rotated;
+        if (glob(pattern, 0, NULL, &rotated) == 0) {
+            for (size_t i = 0; i < rotated.gl_pathc; i++) {
+                if (stat(rotated.gl_pathv[i], &st) == 0) {
+                    bytes += (unsigned long long)st.st_size;
+                }
+            }
+            globfree(&rotated);
+        }
+        if (bytes != accepted * (unsigned long long)size) {
+            fprintf(stderr, "Log holds %llu bytes, expected %llu\n", bytes,
+                    accepted * (unsigned long long)size);
+            status = 1;
+        }
+    }
+    free(took);
+    free(line);
+    return status;
+}
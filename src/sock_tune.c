@@ -0,0 +1,158 @@
+/**
+ * @file sock_tune.c
+ * @brief Implementation of the socket-tuning profiles declared in `sock_tune.h`.
+ */
+
+#define _GNU_SOURCE
+
+#include "sock_tune.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Parses a non-negative integer that must fill the whole string.
+ */
+static int parse_count(const char* s, int* value) {
+    char* end;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < 0 || v > 0x7fffffff) {
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+int sock_tune_parse(sock_tune_t* t, const char* spec) {
+    memset(t, 0, sizeof(*t));
+    t->quickack = -1;
+
+    char* copy = strdup(spec);
+    if (!copy) {
+        perror("strdup");
+        return -1;
+    }
+    int ok = 1;
+    int first = 1;
+    char* save = NULL;
+    for (char* item = strtok_r(copy, ",", &save); item && ok; item = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(item, '=');
+        if (!value) {
+            // Presets only make sense before the keys that refine them
+            if (first && strcmp(item, "default") == 0) {
+                // Nothing changed
+            } else if (first && strcmp(item, "devices") == 0) {
+                // No lowat: it must fit the clients' smallest record, so it is only set explicitly
+                t->defer_accept_s = 10;
+                t->rcvbuf = 16384;
+                t->sndbuf = 16384;
+                t->quickack = 0;
+            } else {
+                ok = 0;
+            }
+        } else {
+            *value++ = '\0';
+            if (strcmp(item, "defer") == 0) {
+                ok = parse_count(value, &t->defer_accept_s) == 0;
+            } else if (strcmp(item, "lowat") == 0) {
+                ok = parse_count(value, &t->rcvlowat) == 0;
+            } else if (strcmp(item, "rcvbuf") == 0) {
+                ok = parse_count(value, &t->rcvbuf) == 0;
+            } else if (strcmp(item, "sndbuf") == 0) {
+                ok = parse_count(value, &t->sndbuf) == 0;
+            } else if (strcmp(item, "quickack") == 0) {
+                if (strcmp(value, "on") == 0) {
+                    t->quickack = 1;
+                } else if (strcmp(value, "off") == 0) {
+                    t->quickack = 0;
+                } else {
+                    ok = 0;
+                }
+            } else {
+                ok = 0;
+            }
+        }
+        first = 0;
+    }
+    free(copy);
+    if (!ok) {
+        fprintf(stderr, "Invalid socket profile '%s' (expected default|devices and/or "
+                        "defer=S,lowat=B,rcvbuf=B,sndbuf=B,quickack=on|off)\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+int sock_tune_add(sock_tune_set_t* set, const char* spec) {
+    if (set->count == SOCK_TUNE_MAX_PROFILES) {
+        fprintf(stderr, "At most %d socket profiles\n", SOCK_TUNE_MAX_PROFILES);
+        return -1;
+    }
+    if (sock_tune_parse(&set->profiles[set->count], spec) == -1) {
+        return -1;
+    }
+    set->count++;
+    return 0;
+}
+
+const sock_tune_t* sock_tune_for(const sock_tune_set_t* set, int listener) {
+    if (set->count == 0) {
+        return NULL;
+    }
+    return &set->profiles[listener < set->count ? listener : set->count - 1];
+}
+
+/**
+ * @brief setsockopt() for an int option, reporting failures by name.
+ */
+static int set_int(int fd, int level, int name, int value, const char* what) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        perror(what);
+        return -1;
+    }
+    return 0;
+}
+
+int sock_tune_listener(const sock_tune_t* t, int fd) {
+    if (!t) {
+        return 0;
+    }
+    if (t->rcvbuf > 0 && set_int(fd, SOL_SOCKET, SO_RCVBUF, t->rcvbuf, "setsockopt SO_RCVBUF") == -1) {
+        return -1;
+    }
+    if (t->sndbuf > 0 && set_int(fd, SOL_SOCKET, SO_SNDBUF, t->sndbuf, "setsockopt SO_SNDBUF") == -1) {
+        return -1;
+    }
+    // Cloned into every accepted socket along with the buffer sizes
+    if (t->rcvlowat > 0 &&
+        set_int(fd, SOL_SOCKET, SO_RCVLOWAT, t->rcvlowat, "setsockopt SO_RCVLOWAT") == -1) {
+        return -1;
+    }
+    if (t->defer_accept_s > 0 &&
+        set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, t->defer_accept_s,
+                "setsockopt TCP_DEFER_ACCEPT") == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int sock_tune_accepted(const sock_tune_t* t, int fd) {
+    if (!t || t->quickack < 0) {
+        return 0;
+    }
+    return set_int(fd, IPPROTO_TCP, TCP_QUICKACK, t->quickack, "setsockopt TCP_QUICKACK");
+}
+
+void sock_tune_print(const sock_tune_t* t, const char* label, FILE* out) {
+    if (!t) {
+        fprintf(out, "%s socket profile: default\n", label);
+        return;
+    }
+    fprintf(out, "%s socket profile: defer=%d,lowat=%d,rcvbuf=%d,sndbuf=%d,quickack=%s "
+                 "(0 = kernel default)\n",
+            label, t->defer_accept_s, t->rcvlowat, t->rcvbuf, t->sndbuf,
+            t->quickack < 0 ? "default" : t->quickack ? "on" : "off");
+    if (t->rcvlowat > 1) {
+        fprintf(out, "%s socket profile: a connection is only read once %d bytes are queued; a "
+                     "shorter record waits for more data or the close\n", label, t->rcvlowat);
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * @file sock_tune.h
+ * @brief Socket-tuning profiles that let the kernel absorb wake-ups for slow clients.
+ *
+ * A typical device connects, sits silent for seconds, then sends a short
+ * line, often in several small segments. Untuned, that costs the server one
+ * wake-up for the accept, another when the first segment arrives, and one
+ * more per further segment. A profile moves that work into the kernel:
+ *
+ *   - `defer=S` sets TCP_DEFER_ACCEPT on the listener. The kernel completes
+ *     the handshake but keeps the connection out of the accept queue until
+ *     data arrives (or S seconds pass), so the accept and the first read
+ *     happen in one wake-up.
+ *   - `lowat=B` sets SO_RCVLOWAT. Readiness (and therefore epoll) is only
+ *     signalled once B bytes are queued, so a record split into small
+ *     segments wakes the server once. It is set on the listener and
+ *     inherited by accepted sockets. A connection that stops with fewer than
+ *     B bytes pending is not reported until it sends more or closes, so B
+ *     should be at most the smallest record the clients send.
+ *   - `rcvbuf=B` and `sndbuf=B` set SO_RCVBUF/SO_SNDBUF on the listener
+ *     before listen(), so every accepted socket inherits them and the
+ *     receive window scale is chosen from the configured size.
+ *   - `quickack=on|off` controls TCP_QUICKACK on accepted sockets. Off puts
+ *     the connection in delayed-ACK mode once at accept, so fewer pure ACKs
+ *     are sent. On re-enables quick ACKs after every readable wake-up (the
+ *     kernel clears the flag on its own), which keeps clients with small
+ *     send windows moving at the cost of one setsockopt() per wake-up.
+ *
+ * A specification is a comma-separated list of these keys, optionally
+ * starting with a preset: `default` (nothing changed) or `devices`
+ * (`defer=10,rcvbuf=16384,sndbuf=16384,quickack=off`, for many mostly idle
+ * connections sending short lines). Later keys override or extend the
+ * preset, e.g. `devices,lowat=32`. The preset leaves lowat alone because
+ * only the operator knows the smallest record size.
+ */
+
+#ifndef SOCK_TUNE_H
+#define SOCK_TUNE_H
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define SOCK_TUNE_MAX_PROFILES 64  ///< Listeners that can be given their own profile
+
+/**
+ * @brief One socket-tuning profile; zero/-1 fields leave the kernel default.
+ */
+typedef struct {
+    int defer_accept_s;  ///< TCP_DEFER_ACCEPT on the listener in seconds, 0 = off
+    int rcvlowat;        ///< SO_RCVLOWAT in bytes, 0 = default (1)
+    int rcvbuf;          ///< SO_RCVBUF of the listener and its connections, 0 = system
+    int sndbuf;          ///< SO_SNDBUF of the listener and its connections, 0 = system
+    int quickack;        ///< TCP_QUICKACK: -1 untouched, 0 delayed ACKs, 1 quick ACK after every read
+} sock_tune_t;
+
+/**
+ * @brief Profiles given on the command line, one per listener.
+ *
+ * Listener i uses profile i; listeners beyond the last profile use the last
+ * one, and with no profile at all nothing is tuned.
+ */
+typedef struct {
+    sock_tune_t profiles[SOCK_TUNE_MAX_PROFILES];  ///< In command-line order
+    int count;                                     ///< Profiles given
+} sock_tune_set_t;
+
+/**
+ * @brief Parses a specification (see the file comment) into a profile.
+ *
+ * @param t    Profile to fill.
+ * @param spec Specification, e.g. `devices` or `defer=5,lowat=128,quickack=off`.
+ * @return 0 on success, -1 if malformed (an error is printed).
+ */
+int sock_tune_parse(sock_tune_t* t, const char* spec);
+
+/**
+ * @brief Parses one more command-line profile into a set.
+ *
+ * @param set  The set; the new profile applies to listener set->count.
+ * @param spec Specification.
+ * @return 0 on success, -1 if malformed or there are too many profiles.
+ */
+int sock_tune_add(sock_tune_set_t* set, const char* spec);
+
+/**
+ * @brief Returns the profile of a listener, or NULL if nothing is tuned.
+ *
+ * @param set      The set.
+ * @param listener Listener (reactor) number.
+ */
+const sock_tune_t* sock_tune_for(const sock_tune_set_t* set, int listener);
+
+/**
+ * @brief Applies the listener-side options (defer, lowat, buffers).
+ *
+ * Called before listen() so the buffer sizes shape the window scale; it also
+ * works on a listener inherited from an upgrade, where only new connections
+ * see the change.
+ *
+ * @param t  Profile, or NULL to do nothing.
+ * @param fd TCP listening socket.
+ * @return 0 on success, -1 on error (perror() called).
+ */
+int sock_tune_listener(const sock_tune_t* t, int fd);
+
+/**
+ * @brief Applies the per-connection options (TCP_QUICKACK) to an accepted socket.
+ *
+ * @param t  Profile, or NULL to do nothing.
+ * @param fd Accepted TCP socket.
+ * @return 0 on success, -1 on error (perror() called).
+ */
+int sock_tune_accepted(const sock_tune_t* t, int fd);
+
+/**
+ * @brief Re-arms TCP_QUICKACK after a read when the profile asks for quick ACKs.
+ *
+ * @param t  Profile, or NULL.
+ * @param fd Connection that was just read.
+ */
+static inline void sock_tune_after_read(const sock_tune_t* t, int fd) {
+    if (t && t->quickack == 1) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+}
+
+/**
+ * @brief Prints a profile as a one-line specification.
+ *
+ * @param t     Profile, or NULL for an untuned listener.
+ * @param label Text printed before it, e.g. "Listener 0".
+ * @param out   Stream to print to.
+ */
+void sock_tune_print(const sock_tune_t* t, const char* label, FILE* out);
+
+#endif // SOCK_TUNE_H
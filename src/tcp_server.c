@@ -4,13 +4,73 @@
  *
  * This program acts as a bridge:
  *   - Listens for incoming TCP connections on a specified port.
- *   - For each client, spawns a worker thread.
- *   - Each thread reads data from the TCP client and forwards it unchanged to a preconfigured UDP server.
+ *   - Hands each client to one of a fixed pool of worker threads.
+ *   - Each worker multiplexes its clients with its own epoll instance and forwards
+ *     every chunk it reads unchanged to a preconfigured UDP server.
  *   - Supports graceful shutdown by typing 'quit' in the console.
  *
  * Useful for scenarios where legacy TCP clients need to send data to a UDP-only logging service.
+ *
+ * The accept thread picks the least loaded worker for every new connection,
+ * pushes the descriptor onto that worker's locked hand-off queue and signals
+ * the worker's eventfd. The pool size (`-w`) and the number of connections a
+ * worker may own (`-m`) are fixed at startup; a connection arriving while
+ * every worker is full is closed right away. A client therefore costs one
+ * 64-byte table entry (see conn_table.h) instead of a thread and its stack,
+ * and reconnects never create threads.
+ *
+ * Every worker sends through its own UDP socket connect()ed to the target, so
+ * workers never contend for one socket and sends skip the per-datagram route
+ * lookup. `-U` (--shared-udp) restores the single unconnected socket shared by
+ * all workers as a baseline; `-o` sets SO_SNDBUF on the egress sockets.
+ *
+ * Nothing polls for the shutdown flag: the accept thread and every worker
+ * block without a timeout, and a shared eventfd that is in each of their wait
+ * sets is written once on 'quit', which wakes them all at the same time. An
+ * idle server therefore does not wake up at all, however many clients it
+ * holds.
+ *
+ * With `-E N` workers no longer send at all: they push each chunk into the
+ * lock-free ring (mpsc_ring.h) of one of N egress threads, and each egress
+ * thread drains its ring with sendmmsg(), batching datagrams across all the
+ * connections that feed it. Reading and sending then run in parallel, and the
+ * rings are the one place where queued-up egress can be measured. A full ring
+ * drops the chunk, or with `-P` makes the worker wait for room.
+ *
+ * `-C LIST|auto` pins every thread: worker i to the i-th CPU of the list,
+ * then the egress threads, then the accept thread (see cpu_affinity.h). Each
+ * thread's queues and rings are set up while the main thread runs on that
+ * CPU, so their memory is placed on the same NUMA node.
+ *
+ * `upgrade` on the console (or SIGUSR2) replaces the running binary without
+ * refusing a connection: the server re-executes its own command line and
+ * passes the listening socket and the UDP egress sockets to the new process
+ * over a Unix socket (see fd_handoff.h). Once the new process is accepting,
+ * this one closes its listener and serves its remaining clients until they
+ * disconnect or `-D` (--drain-timeout) expires. `upgrade clients` hands the
+ * established connections over too and exits right away.
+ *
+ * `-c`, `-i`, `-r` and `-n` limit clients by source address (see
+ * rate_limit.h): the accept thread refuses connections over the global or
+ * per-IP cap, and a worker stops reading a client that has used up its byte
+ * or record budget. Such a connection loses EPOLLIN until its buckets refill;
+ * its data waits in the kernel and TCP flow control slows it down, while the
+ * worker keeps serving everyone else.
+ *
+ * `-T SPEC` applies a socket-tuning profile (see sock_tune.h) to the
+ * listener and its connections: TCP_DEFER_ACCEPT keeps silent connections
+ * from waking the accept thread, SO_RCVLOWAT keeps a record arriving in small
+ * segments from waking a worker once per segment, and the buffer sizes and
+ * TCP_QUICKACK can be set explicitly.
+ *
+ * By default a datagram the kernel refuses (e.g. ENOBUFS) is dropped and
+ * counted. With `-P` (backpressure) a worker whose send is refused parks in
+ * poll() until the UDP socket is writable again and retries, so it stops
+ * reading its TCP connection and TCP flow control throttles that client.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,259 +82,1615 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <fcntl.h>
+#include "conn_table.h"
+#include "mpsc_ring.h"
+#include "cpu_affinity.h"
+#include "fd_handoff.h"
+#include "rate_limit.h"
+#include "sock_tune.h"
 
-#define BUFFER_SIZE 4096  ///< Size of the per-client receive buffer
+#define BUFFER_SIZE 4096  ///< Size of each worker's receive buffer
+#define MAX_EVENTS 64     ///< Maximum number of events to return from epoll_wait
+#define MAX_WORKERS 256   ///< Upper bound for the -w option
+#define DEFAULT_MAX_CONNS 4096  ///< Default connections per worker (-m)
+#define MAX_EGRESS 64     ///< Upper bound for the -E option
+#define EGRESS_BATCH 64   ///< Datagrams per sendmmsg() call of an egress thread
+#define DEFAULT_EGRESS_QUEUE 1024  ///< Default ring slots per egress thread (-q)
+#define DEFAULT_DRAIN_TIMEOUT_MS 30000  ///< Default --drain-timeout after an upgrade
+#define HANDOFF_TIMEOUT_MS 10000  ///< Longest wait for the other process during an upgrade
+
+#define CONN_THROTTLED 0x1  ///< conn_t.flags: reads parked until the client's token buckets refill
+#define CONN_ADMITTED 0x2   ///< conn_t.flags: counted by the rate limiter
 
 // Global variables for thread communication
 static volatile int running = 1;  ///< Flag to control server shutdown
 static int listen_fd = -1;  ///< Listening socket file descriptor
+static int shutdown_fd = -1;  ///< eventfd watched by every thread, written once on shutdown
 
 // Global UDP forwarding destination (set once at startup)
-static int udp_socket;
+static int udp_socket = -1;  ///< Unconnected socket shared by all workers with --shared-udp
 static struct sockaddr_in udp_addr;
+static int shared_udp = 0;  ///< Send through udp_socket instead of per-worker connected sockets (-U)
+static int udp_sndbuf = 0;  ///< SO_SNDBUF of each egress socket (-o), 0 = system default
+
+static int backpressure = 0;  ///< Park workers instead of dropping refused datagrams (-P)
 
-// Structure to pass data to the client thread
+// Egress counters, updated by all workers with atomic builtins
+static unsigned long long egress_sent = 0;      ///< Datagrams handed to the kernel
+static unsigned long long egress_dropped = 0;   ///< Datagrams lost to send errors
+static unsigned long long egress_stalls = 0;    ///< Sends that had to wait for the socket
+static unsigned long long egress_stall_ms = 0;  ///< Total time workers spent parked
+
+/**
+ * @brief An accepted connection waiting in a worker's hand-off queue.
+ */
 typedef struct {
-    int client_fd;
-} client_thread_data_t;
+    int fd;         ///< Connected, non-blocking client socket
+    uint32_t addr;  ///< Peer IPv4 address, network byte order
+} pending_conn_t;
 
 /**
- * @brief Worker thread function: handles data from one TCP client.
+ * @brief A connection parked by the rate limiter and when it may read again.
+ */
+typedef struct {
+    int fd;             ///< The connection
+    uint64_t until_ms;  ///< Monotonic time its client's buckets are out of debt
+} throttle_t;
+
+/**
+ * @brief One thread of the worker pool and the connections it owns.
  *
- * Reads data in a loop from the connected TCP socket.
- * Immediately forwards each received chunk to the global UDP destination.
- * Exits when the client disconnects, an error occurs, or shutdown is requested.
+ * Only the hand-off queue (under lock) and load are touched by the accept
+ * thread; everything else belongs to the worker.
+ */
+typedef struct {
+    int id;                      ///< Worker index
+    int epoll_fd;                ///< Epoll instance for this worker's clients
+    int wake_fd;                 ///< eventfd signalled after a hand-off and at shutdown
+    int udp_socket;              ///< Connected egress socket (the shared one with -U), -1 with -E
+    struct egress* egress;       ///< Egress thread this worker queues to with -E, else NULL
+    pthread_t tid;               ///< Thread running this worker
+
+    // Hand-off queue from the accept thread
+    pthread_mutex_t lock;        ///< Protects queue, qhead and qlen
+    pending_conn_t* queue;       ///< Ring of accepted connections, max_conns entries
+    int qhead;                   ///< Index of the oldest queued descriptor
+    int qlen;                    ///< Descriptors queued
+    int load;                    ///< Connections owned or queued (atomic builtins)
+
+    // Worker-only state
+    conn_table_t conns;          ///< Open connections, indexed by fd
+    unsigned long long handled;  ///< Connections taken over since startup
+    throttle_t* throttled;       ///< Connections parked until their client's buckets refill
+    int nthrottled;              ///< Entries used in throttled
+    int throttled_cap;           ///< Capacity of throttled
+    uint64_t throttle_next_ms;   ///< Earliest until_ms in throttled
+    unsigned long long throttles;  ///< Connections parked by the rate limiter
+} worker_t;
+
+/**
+ * @brief State of one egress thread and the ring that feeds it.
+ */
+typedef struct egress {
+    int id;                      ///< Egress thread index
+    int udp_socket;              ///< Connected egress socket (the shared one with -U)
+    int wake_fd;                 ///< eventfd written by a producer that finds the thread asleep
+    int space_fd;                ///< eventfd written after releasing cells while producers wait
+    int sleeping;                ///< Set while the thread blocks on wake_fd (atomic)
+    int waiters;                 ///< Producers waiting for room (atomic)
+    pthread_t tid;               ///< Thread running this egress
+    mpsc_ring_t ring;            ///< Records pushed by the workers
+
+    // Statistics (written by the egress thread, read after it has been joined)
+    unsigned long long batches;  ///< Batches taken from the ring
+    unsigned long long calls;    ///< sendmmsg() calls
+    unsigned long long sent;     ///< Datagrams sent
+    unsigned long long wakeups;  ///< Times the thread went to sleep on an empty ring
+    unsigned long long depth_sum;  ///< Sum of the queue depths seen before each batch
+    unsigned long long depth_max;  ///< Deepest queue seen before a batch
+    unsigned long long full;     ///< Pushes that found the ring full (atomic)
+} egress_t;
+
+static egress_t* egress = NULL;   ///< Egress threads (-E), NULL when workers send themselves
+static int num_egress = 0;        ///< Number of egress threads
+static int egress_queue = DEFAULT_EGRESS_QUEUE;  ///< Ring slots per egress thread (-q)
+static volatile int egress_running = 1;  ///< Cleared once every worker has stopped pushing
+
+static cpu_plan_t cpu_plan;  ///< CPU of each thread (-C), empty = not pinned
+
+static worker_t* workers = NULL;  ///< The pool
+static int num_workers = 0;       ///< Pool size (-w, default one per online CPU)
+static int max_conns = DEFAULT_MAX_CONNS;  ///< Connections per worker (-m)
+static unsigned long long rejected = 0;    ///< Connections closed because every worker was full
+
+static rate_limiter_t limiter;  ///< Per-client caps and token buckets (-c, -i, -r, -n)
+static int rate_limits = 0;     ///< Non-zero when any of them is configured
+
+static sock_tune_t listener_tune;          ///< Socket profile (-T)
+static const sock_tune_t* tune = NULL;     ///< &listener_tune when -T was given, else NULL
+
+// Upgrade state (see fd_handoff.h)
+static char** upgrade_argv = NULL;  ///< Command line the upgrade re-executes
+static int handoff_sock = -1;       ///< Hand-off socket while talking to the other process, else -1
+static int send_clients = 0;        ///< Old side: pass connections to the new process at exit
+static int drain_fd = -1;           ///< eventfd in the accept thread's poll set, written when draining starts
+static volatile int draining = 0;   ///< Old side: listener handed over, waiting for clients to leave
+static int drain_done = 0;          ///< Set once by whoever ends the drain (atomic)
+static int drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT_MS;  ///< --drain-timeout
+static int inherited_listener = -1;         ///< New side: the old process's listener, -1 if none
+static int inherited_udp[MAX_WORKERS];      ///< New side: egress socket per worker/egress slot, -1 if none
+static int inherited_shared = 0;            ///< New side: the old process ran with --shared-udp
+
+/**
+ * @brief Stops every thread: clears the running flag and signals the shutdown eventfd.
  *
- * @param arg Pointer to malloc'd struct containing the client socket fd.
- * @return NULL (thread exit value unused).
+ * The eventfd is never read, so it stays readable and wakes every waiter.
+ */
+void request_shutdown(void) {
+    running = 0;
+    uint64_t one = 1;
+    if (write(shutdown_fd, &one, sizeof(one)) < 0) {
+        perror("write shutdown eventfd");
+    }
+}
+
+/**
+ * @brief Picks the least loaded worker with room for another connection.
+ *
+ * @return The worker, or NULL if all of them are at max_conns.
+ */
+worker_t* pick_worker(void) {
+    worker_t* best = NULL;
+    int best_load = max_conns;
+    for (int i = 0; i < num_workers; i++) {
+        int load = __atomic_load_n(&workers[i].load, __ATOMIC_RELAXED);
+        if (load < best_load) {
+            best = &workers[i];
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Queues an accepted descriptor for a worker and wakes it up.
+ *
+ * The queue holds max_conns entries and load (which counts queued descriptors
+ * too) is checked before every hand-off, so it cannot overflow.
+ *
+ * @param w    The worker returned by pick_worker().
+ * @param fd   Connected, non-blocking client socket.
+ * @param addr Peer IPv4 address, network byte order.
  */
-void* client_thread(void* arg);
+void hand_off(worker_t* w, int fd, uint32_t addr) {
+    __atomic_add_fetch(&w->load, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&w->lock);
+    pending_conn_t* p = &w->queue[(w->qhead + w->qlen) % max_conns];
+    p->fd = fd;
+    p->addr = addr;
+    w->qlen++;
+    pthread_mutex_unlock(&w->lock);
+
+    uint64_t one = 1;
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+        perror("write wake eventfd");
+    }
+}
 
 /**
  * @brief Accept thread function: handles accepting new TCP connections.
  *
- * Accepts new client connections in a loop.
- * Spawns a worker thread for each connected client.
- * Exits when shutdown is requested.
+ * Sleeps in poll() on the (non-blocking) listening socket and the shutdown
+ * eventfd, then drains the accept queue and hands each client to the least
+ * loaded worker, or closes it if the whole pool is at capacity or the rate
+ * limiter refuses it.
+ * Exits when shutdown is requested, or when an upgrade starts draining.
  *
  * @param arg Unused.
  * @return NULL (thread exit value unused).
  */
 void* accept_thread_func(void* arg) {
+    (void)arg;
+    struct pollfd pfds[3] = {{listen_fd, POLLIN, 0}, {shutdown_fd, POLLIN, 0}, {drain_fd, POLLIN, 0}};
+
     while (running) {
+        // Block with no timeout: shutdown arrives as an event, not by polling a flag
+        if (poll(pfds, 3, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll (accept)");
+            break;
+        }
+        if (pfds[1].revents || !running) {
+            break;
+        }
+        if (pfds[2].revents) {
+            // An upgrade handed the listener over: the new process is the only one accepting now
+            close(listen_fd);
+            listen_fd = -1;
+            break;
+        }
+
         struct sockaddr_in client_addr;
         socklen_t len = sizeof(client_addr);
-
-        // Set timeout on accept to allow checking running flag periodically
-        struct timeval tv;
-        tv.tv_sec = 1;  // 1 second timeout
-        tv.tv_usec = 0;
-        if (setsockopt(listen_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-            perror("setsockopt failed in accept thread");
+        int client_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            // EAGAIN: the queue is drained (or the client gave up); wait for the next one
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
         }
 
-        // Allocate memory to pass client_fd to thread (avoids race condition)
-        client_thread_data_t* client_data = malloc(sizeof(client_thread_data_t));
-        if (!client_data) {
-            perror("malloc");
+        sock_tune_accepted(tune, client_fd);
+        uint32_t addr = client_addr.sin_addr.s_addr;
+        if (rate_limits && rate_limit_admit(&limiter, addr, conn_now_ms()) != RATE_ADMIT) {
+            close(client_fd);  // Counted by the limiter
             continue;
         }
+        worker_t* w = pick_worker();
+        if (!w) {
+            // Every worker is full: refuse rather than queue without bound
+            if (rate_limits) {
+                rate_limit_release(&limiter, addr);
+            }
+            close(client_fd);
+            rejected++;
+            continue;
+        }
+        hand_off(w, client_fd, addr);
+    }
+    return NULL;
+}
 
-        client_data->client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &len);
+/**
+ * @brief Returns CLOCK_MONOTONIC time in milliseconds.
+ */
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
 
-        // Check for timeout specifically (would return -1 with errno = EAGAIN/EWOULDBLOCK)
-        if (client_data->client_fd < 0) {
-            // errno == EAGAIN/EWOULDBLOCK indicates timeout
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                free(client_data);  // Free the malloc'd memory
-                continue; // Go back to check running flag
+/**
+ * @brief Creates a UDP egress socket for udp_addr.
+ *
+ * Unless --shared-udp is set the socket is connected, which fixes its route
+ * and peer once so that every send skips the lookup and needs no address.
+ *
+ * @return The socket, or -1 on error.
+ */
+int open_udp_egress(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("UDP socket");
+        return -1;
+    }
+    if (udp_sndbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &udp_sndbuf, sizeof(udp_sndbuf)) == -1) {
+        perror("setsockopt SO_SNDBUF");
+        close(fd);
+        return -1;
+    }
+    if (!shared_udp && connect(fd, (struct sockaddr*)&udp_addr, sizeof(udp_addr)) == -1) {
+        perror("connect UDP");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Creates the non-blocking TCP listening socket.
+ *
+ * @param port Port in network byte order.
+ * @return The socket, or -1 on error.
+ */
+int open_listener(in_port_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("TCP socket");
+        return -1;
+    }
+
+    struct sockaddr_in serv_addr = {0};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = port;
+
+    // Allow reuse of local address (prevents "Address already in use" on restart)
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (sock_tune_listener(tune, fd) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // A single accept thread feeds the whole pool: give reconnect bursts room to queue
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+
+    // Non-blocking so the accept thread can drain the queue after each poll() wake-up
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl == -1 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) == -1) {
+        perror("fcntl O_NONBLOCK");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Returns the egress socket of a slot inherited from the old process, or a new one.
+ *
+ * Inherited sockets keep their source port, so the collector sees the same
+ * flows across an upgrade. They are only reused if both processes agree on
+ * --shared-udp.
+ *
+ * @param slot Worker index, egress thread index with -E, or 0 for the shared socket.
+ * @return The socket, or -1 on error.
+ */
+int upgrade_take_udp(int slot) {
+    int fd = inherited_shared == shared_udp ? inherited_udp[slot] : -1;
+    if (fd < 0) {
+        return open_udp_egress();
+    }
+    inherited_udp[slot] = -1;
+    if (udp_sndbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &udp_sndbuf, sizeof(udp_sndbuf)) == -1) {
+        perror("setsockopt SO_SNDBUF");
+    }
+    return fd;
+}
+
+/**
+ * @brief New process: receives the old process's listener and UDP sockets.
+ *
+ * @return 0 on success, -1 if the conversation failed (received sockets are kept).
+ */
+int upgrade_receive_sockets(void) {
+    while (1) {
+        handoff_msg_t m;
+        int fds[FD_HANDOFF_MAX_FDS];
+        if (fd_handoff_recv(handoff_sock, &m, NULL, 0, fds, HANDOFF_TIMEOUT_MS) == -1) {
+            return -1;
+        }
+        if (m.type == HANDOFF_SOCKETS_END) {
+            return 0;
+        }
+        int* slot = NULL;
+        if (m.type == HANDOFF_LISTENER && m.nfds == 1 && m.index == 0) {
+            slot = &inherited_listener;
+        } else if (m.type == HANDOFF_UDP && m.nfds == 1 && m.index < MAX_WORKERS) {
+            slot = &inherited_udp[m.index];
+            inherited_shared = (m.flags & HANDOFF_F_SHARED) != 0;
+        }
+        if (!slot) {
+            for (int i = 0; i < m.nfds; i++) {
+                close(fds[i]);
             }
-            // Only print error if we're still running to avoid error on shutdown
-            if (running) {
-                perror("accept");
+            continue;
+        }
+        if (*slot >= 0) {
+            close(*slot);
+        }
+        *slot = fds[0];
+    }
+}
+
+/**
+ * @brief New process: closes inherited UDP sockets that no thread took over.
+ */
+void upgrade_close_unused(void) {
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (inherited_udp[i] >= 0) {
+            close(inherited_udp[i]);
+            inherited_udp[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Forwards one chunk to the UDP destination.
+ *
+ * In backpressure mode EAGAIN and ENOBUFS park the calling worker: it waits
+ * for POLLOUT or shutdown (EAGAIN means the socket buffer is full) or simply
+ * retries after a millisecond (ENOBUFS comes from the device queue and has no
+ * wake-up).
+ * Any other error, or either error without -P, drops the datagram.
+ *
+ * @param sock Egress socket of the calling worker.
+ * @param buf  Data to send.
+ * @param len  Number of bytes.
+ */
+void forward_datagram(int sock, const char* buf, size_t len) {
+    uint64_t stall_start = 0;
+    while (1) {
+        // A connected socket takes no address, which saves the route lookup
+        if (sendto(sock, buf, len, backpressure ? MSG_DONTWAIT : 0,
+                   shared_udp ? (struct sockaddr*)&udp_addr : NULL,
+                   shared_udp ? sizeof(udp_addr) : 0) >= 0) {
+            __atomic_add_fetch(&egress_sent, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        int err = errno;
+        if (err == EINTR) {
+            continue;
+        }
+        if (!backpressure || !running || (err != EAGAIN && err != EWOULDBLOCK && err != ENOBUFS)) {
+            perror("sendto (UDP forward)");
+            // Continue anyway; don't break TCP connection due to UDP issue
+            __atomic_add_fetch(&egress_dropped, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // Congested: park this worker, and with it the TCP reader, until egress has room
+        if (stall_start == 0) {
+            stall_start = monotonic_ms();
+            __atomic_add_fetch(&egress_stalls, 1, __ATOMIC_RELAXED);
+        }
+        if (err == ENOBUFS) {
+            poll(NULL, 0, 1);
+        } else {
+            struct pollfd pfds[2] = {{sock, POLLOUT, 0}, {shutdown_fd, POLLIN, 0}};
+            poll(pfds, 2, -1);
+        }
+    }
+    if (stall_start != 0) {
+        __atomic_add_fetch(&egress_stall_ms, monotonic_ms() - stall_start, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Wakes an egress thread if it is asleep on its wake eventfd.
+ *
+ * @param e The egress thread.
+ */
+void egress_wake(egress_t* e) {
+    // Pairs with the fence in egress_thread(): either we see it asleep or it sees our record
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&e->sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&e->sleeping, 0, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        if (write(e->wake_fd, &one, sizeof(one)) < 0) {
+            perror("write egress eventfd");
+        }
+    }
+}
+
+/**
+ * @brief Queues one chunk for an egress thread instead of sending it.
+ *
+ * A full ring drops the chunk unless backpressure is on, in which case the
+ * calling worker sleeps on the ring's space eventfd until the egress thread
+ * has released cells, so the worker stops reading just as it would on a
+ * congested socket.
+ *
+ * @param e   Egress thread serving the calling worker.
+ * @param buf Data to queue.
+ * @param len Number of bytes (at most BUFFER_SIZE).
+ */
+void egress_enqueue(egress_t* e, const char* buf, size_t len) {
+    if (mpsc_ring_push(&e->ring, buf, len) == 0) {
+        egress_wake(e);
+        return;
+    }
+    __atomic_add_fetch(&e->full, 1, __ATOMIC_RELAXED);
+    if (!backpressure) {
+        __atomic_add_fetch(&egress_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t stall_start = monotonic_ms();
+    __atomic_add_fetch(&egress_stalls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&e->waiters, 1, __ATOMIC_SEQ_CST);
+    while (mpsc_ring_push(&e->ring, buf, len) == -1) {
+        // The egress thread keeps draining until every worker has stopped, so room always comes
+        struct pollfd pfd = {e->space_fd, POLLIN, 0};
+        if (poll(&pfd, 1, -1) > 0) {
+            uint64_t count;
+            if (read(e->space_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("read egress space eventfd");
             }
-            free(client_data);
+        }
+    }
+    __atomic_sub_fetch(&e->waiters, 1, __ATOMIC_SEQ_CST);
+    egress_wake(e);
+    __atomic_add_fetch(&egress_stall_ms, monotonic_ms() - stall_start, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sends a batch of ring cells with as few sendmmsg() calls as the kernel allows.
+ *
+ * Datagrams refused with EAGAIN/ENOBUFS are retried after the socket becomes
+ * writable (or after a millisecond) in backpressure mode, like
+ * forward_datagram(); any other failure drops the datagram at the head of the
+ * batch and goes on with the rest.
+ *
+ * @param e     The egress thread.
+ * @param msgs  Message headers, one per cell.
+ * @param n     Number of messages.
+ * @return Number of datagrams the kernel accepted (n minus the dropped ones).
+ */
+unsigned egress_send_batch(egress_t* e, struct mmsghdr* msgs, unsigned n) {
+    unsigned done = 0;
+    unsigned dropped = 0;
+    uint64_t stall_start = 0;
+    while (done < n) {
+        int sent = sendmmsg(e->udp_socket, msgs + done, n - done, backpressure ? MSG_DONTWAIT : 0);
+        if (sent > 0) {
+            e->calls++;
+            done += (unsigned)sent;
             continue;
         }
+        int err = errno;
+        if (err == EINTR) {
+            continue;
+        }
+        if (!backpressure || !egress_running || (err != EAGAIN && err != EWOULDBLOCK && err != ENOBUFS)) {
+            perror("sendmmsg (UDP forward)");
+            __atomic_add_fetch(&egress_dropped, 1, __ATOMIC_RELAXED);
+            dropped++;
+            done++;
+            continue;
+        }
+        if (stall_start == 0) {
+            stall_start = monotonic_ms();
+            __atomic_add_fetch(&egress_stalls, 1, __ATOMIC_RELAXED);
+        }
+        if (err == ENOBUFS) {
+            poll(NULL, 0, 1);
+        } else {
+            struct pollfd pfd = {e->udp_socket, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+        }
+    }
+    if (stall_start != 0) {
+        __atomic_add_fetch(&egress_stall_ms, monotonic_ms() - stall_start, __ATOMIC_RELAXED);
+    }
+    return n - dropped;
+}
+
+/**
+ * @brief Egress thread function: drains one ring with sendmmsg().
+ *
+ * Takes every published record up to EGRESS_BATCH at a time, sends them in
+ * one call and only then releases their cells, so the datagrams are sent
+ * straight from the ring's arena. With nothing queued the thread sleeps on
+ * its eventfd. It exits once egress_running is cleared and the ring is empty.
+ *
+ * @param arg Pointer to this thread's egress_t.
+ * @return NULL (thread exit value unused).
+ */
+void* egress_thread(void* arg) {
+    egress_t* e = (egress_t*)arg;
+    mpsc_cell_t* cells[EGRESS_BATCH];
+    struct mmsghdr msgs[EGRESS_BATCH];
+    struct iovec iov[EGRESS_BATCH];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < EGRESS_BATCH; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = shared_udp ? &udp_addr : NULL;
+        msgs[i].msg_hdr.msg_namelen = shared_udp ? sizeof(udp_addr) : 0;
+    }
 
-        // Spawn a new thread to handle this client
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_thread, client_data) != 0) {
-            // Thread creation failed: clean up
-            close(client_data->client_fd);
-            free(client_data);
-            fprintf(stderr, "Failed to create client thread\n");
+    while (1) {
+        uint64_t depth = mpsc_ring_depth(&e->ring);
+        unsigned n = mpsc_ring_peek(&e->ring, cells, EGRESS_BATCH);
+        if (n == 0) {
+            if (!egress_running) {
+                break;
+            }
+            // Announce the nap, then look once more so a concurrent push is not missed
+            __atomic_store_n(&e->sleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (mpsc_ring_peek(&e->ring, cells, 1) == 0 && egress_running) {
+                e->wakeups++;
+                struct pollfd pfd = {e->wake_fd, POLLIN, 0};
+                poll(&pfd, 1, -1);
+                uint64_t count;
+                if (read(e->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    perror("read egress eventfd");
+                }
+            }
+            __atomic_store_n(&e->sleeping, 0, __ATOMIC_RELAXED);
             continue;
         }
 
-        // Detach thread so its resources are auto-reclaimed on exit
-        pthread_detach(tid);
+        e->batches++;
+        e->depth_sum += depth;
+        if (depth > e->depth_max) {
+            e->depth_max = depth;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            iov[i].iov_base = cells[i]->data;
+            iov[i].iov_len = cells[i]->len;
+        }
+        unsigned sent = egress_send_batch(e, msgs, n);
+        e->sent += sent;
+        __atomic_add_fetch(&egress_sent, sent, __ATOMIC_RELAXED);
+        mpsc_ring_release(&e->ring, n);
+
+        // Pairs with the waiters increment in egress_enqueue()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&e->waiters, __ATOMIC_RELAXED) > 0) {
+            uint64_t one = 1;
+            if (write(e->space_fd, &one, sizeof(one)) < 0) {
+                perror("write egress space eventfd");
+            }
+        }
     }
     return NULL;
 }
 
 /**
- * @brief Worker thread function: handles data from one TCP client.
+ * @brief Creates the ring, eventfds and UDP socket of an egress thread.
+ *
+ * @param e  Egress thread to initialise.
+ * @param id Egress thread index.
+ * @return 0 on success, -1 on error.
+ */
+int egress_init(egress_t* e, int id) {
+    e->id = id;
+    if (mpsc_ring_init(&e->ring, (unsigned)egress_queue, BUFFER_SIZE) == -1) {
+        return -1;
+    }
+    e->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    e->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (e->wake_fd == -1 || e->space_fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    e->udp_socket = shared_udp ? udp_socket : upgrade_take_udp(id);
+    return e->udp_socket < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Prints batching and queue-depth statistics of every egress thread.
+ */
+void print_egress_stats(void) {
+    for (int i = 0; i < num_egress; i++) {
+        egress_t* e = &egress[i];
+        printf("Egress thread %d: %llu datagrams in %llu sendmmsg calls (%.2f per call), "
+               "queue depth avg %.1f max %llu of %u, %llu pushes found it full, %llu sleeps\n",
+               e->id, e->sent, e->calls, e->calls ? (double)e->sent / (double)e->calls : 0.0,
+               e->batches ? (double)e->depth_sum / (double)e->batches : 0.0, e->depth_max,
+               mpsc_ring_capacity(&e->ring), e->full, e->wakeups);
+    }
+}
+
+/**
+ * @brief Closes a client and gives its slot back to the pool.
  *
- * Reads data in a loop from the connected TCP socket.
- * Immediately forwards each received chunk to the global UDP destination.
- * Exits when the client disconnects, an error occurs, or shutdown is requested.
+ * @param w The worker owning the connection.
+ * @param c The connection.
+ */
+void worker_close_conn(worker_t* w, conn_t* c) {
+    int fd = c->fd;
+    if (c->flags & CONN_ADMITTED) {
+        rate_limit_release(&limiter, c->peer_addr);
+    }
+    conn_release(&w->conns, c);
+    close(fd);  // Also removes fd from the epoll set
+    __atomic_sub_fetch(&w->load, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Registers every descriptor the accept thread queued for this worker.
  *
- * @param arg Pointer to malloc'd struct containing the client socket fd.
- * @return NULL (thread exit value unused).
+ * @param w The worker whose eventfd fired.
  */
-void* client_thread(void* arg) {
-    client_thread_data_t* data = (client_thread_data_t*)arg;
-    int client_fd = data->client_fd;
-    free(data); // Free the malloc'd memory
+void worker_take_handoffs(worker_t* w) {
+    uint64_t count;
+    if (read(w->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read wake eventfd");
+    }
 
-    char buffer[BUFFER_SIZE];
+    pthread_mutex_lock(&w->lock);
+    while (w->qlen > 0) {
+        pending_conn_t p = w->queue[w->qhead];
+        int fd = p.fd;
+        w->qhead = (w->qhead + 1) % max_conns;
+        w->qlen--;
+
+        conn_t* c = conn_open(&w->conns, fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;  // Edge-triggered read events
+        ev.data.fd = fd;
+        if (!c || epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            if (c) {
+                perror("epoll_ctl: add client");
+                conn_release(&w->conns, c);
+            }
+            if (rate_limits) {
+                rate_limit_release(&limiter, p.addr);
+            }
+            close(fd);
+            __atomic_sub_fetch(&w->load, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        c->peer_addr = p.addr;
+        c->flags = rate_limits ? CONN_ADMITTED : 0;
+        w->handled++;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
 
-    // Set socket timeout to periodically check the running flag
-    struct timeval tv;
-    tv.tv_sec = 1;  // 1 second timeout
-    tv.tv_usec = 0;
-    if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-        perror("setsockopt failed in client thread");
+/**
+ * @brief Stops reading a client that has used up its token buckets.
+ *
+ * The registration keeps no events (only EPOLLERR/EPOLLHUP are reported)
+ * until worker_unthrottle() restores it.
+ *
+ * @param w       The worker owning the connection.
+ * @param c       The connection to park.
+ * @param wait_ms Time until the client's buckets are out of debt.
+ * @return 0 on success, -1 if the connection could not be parked.
+ */
+int worker_throttle_conn(worker_t* w, conn_t* c, int wait_ms) {
+    if (w->nthrottled == w->throttled_cap) {
+        int cap = w->throttled_cap ? w->throttled_cap * 2 : 64;
+        throttle_t* grown = realloc(w->throttled, sizeof(throttle_t) * cap);
+        if (!grown) {
+            perror("realloc throttled list");
+            return -1;
+        }
+        w->throttled = grown;
+        w->throttled_cap = cap;
+    }
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.fd = c->fd;
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+        perror("epoll_ctl: throttle client");
+        return -1;
     }
+    uint64_t until = conn_now_ms() + (uint64_t)wait_ms;
+    c->flags |= CONN_THROTTLED;
+    w->throttled[w->nthrottled].fd = c->fd;
+    w->throttled[w->nthrottled].until_ms = until;
+    if (w->nthrottled++ == 0 || until < w->throttle_next_ms) {
+        w->throttle_next_ms = until;
+    }
+    w->throttles++;
+    return 0;
+}
 
-    // Continuously read from TCP client
-    while (running) {
-        ssize_t n = recv(client_fd, buffer, sizeof(buffer), 0);
+/**
+ * @brief Re-enables every throttled connection whose wait is over.
+ *
+ * An entry whose connection was closed, or closed and its fd reused, at worst
+ * resumes the new connection early; it is charged and parked again after its
+ * first read.
+ *
+ * @param w   The worker.
+ * @param now Current time.
+ */
+void worker_unthrottle(worker_t* w, uint64_t now) {
+    if (now < w->throttle_next_ms) {
+        return;
+    }
+    uint64_t next = UINT64_MAX;
+    int kept = 0;
+    for (int i = 0; i < w->nthrottled; i++) {
+        throttle_t t = w->throttled[i];
+        conn_t* c = conn_lookup(&w->conns, t.fd);
+        if (!c || !(c->flags & CONN_THROTTLED)) {
+            continue;
+        }
+        if (t.until_ms > now) {
+            w->throttled[kept++] = t;
+            if (t.until_ms < next) {
+                next = t.until_ms;
+            }
+            continue;
+        }
+        c->flags &= ~CONN_THROTTLED;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = c->fd;
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+            perror("epoll_ctl: unthrottle client");
+        }
+    }
+    w->nthrottled = kept;
+    w->throttle_next_ms = next;
+}
 
-        // Check for timeout specifically (would return -1 with errno = EAGAIN/EWOULDBLOCK)
+/**
+ * @brief Reads everything a client has sent and forwards it chunk by chunk.
+ *
+ * With per-address budgets every chunk is charged to the client, and the
+ * connection is parked as soon as a bucket runs dry; the rest stays in the
+ * socket.
+ *
+ * @param w      The worker owning the connection.
+ * @param c      The connection that became readable.
+ * @param buffer Worker's receive buffer of BUFFER_SIZE bytes.
+ * @return 0 on success, -1 if the client disconnected or failed.
+ */
+int worker_read_client(worker_t* w, conn_t* c, char* buffer) {
+    if (c->flags & CONN_THROTTLED) {
+        return -1;  // A parked registration only reports EPOLLERR/EPOLLHUP
+    }
+    uint64_t now = conn_now_ms();
+    c->active_ms = (uint32_t)now;
+    sock_tune_after_read(tune, c->fd);
+    while (1) {
+        ssize_t n = recv(c->fd, buffer, BUFFER_SIZE, 0);
         if (n < 0) {
-            // errno == EAGAIN/EWOULDBLOCK indicates timeout
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                continue; // Go back to check running flag
+                return 0;  // Drained
             }
-            // For other errors, exit the loop
-            break;
+            return -1;
         }
-
         // Connection closed by client
         if (n == 0) {
-            break;
+            return -1;
         }
 
-        // Forward the exact received bytes to the UDP server
-        if (sendto(udp_socket, buffer, n, 0,
-                   (struct sockaddr*)&udp_addr, sizeof(udp_addr)) < 0) {
-            perror("sendto (UDP forward)");
-            // Continue anyway; don't break TCP connection due to UDP issue
+        // Forward the exact received bytes to the UDP server, or queue them for egress
+        if (w->egress) {
+            egress_enqueue(w->egress, buffer, (size_t)n);
+        } else {
+            forward_datagram(w->udp_socket, buffer, (size_t)n);
+        }
+        c->bytes_in += (uint64_t)n;
+        c->records_out++;
+
+        if (rate_limits) {
+            int wait = rate_limit_charge(&limiter, c->peer_addr, (uint64_t)n, 1, now);
+            if (wait > 0) {
+                return worker_throttle_conn(w, c, wait);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Ends a drain once no worker owns or has queued a connection.
+ *
+ * Called by the main thread when the drain starts and by a worker after each
+ * close. The fence pairs the load decrement of worker_close_conn() with the
+ * draining flag, so the last close and the start of the drain cannot both
+ * miss each other.
+ */
+void check_drain(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!draining) {
+        return;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (__atomic_load_n(&workers[i].load, __ATOMIC_RELAXED) > 0) {
+            return;
         }
     }
+    if (__atomic_exchange_n(&drain_done, 1, __ATOMIC_SEQ_CST) == 0) {
+        printf("Drain complete\n");
+        request_shutdown();
+    }
+}
+
+/**
+ * @brief Worker thread function: serves every connection handed to this worker.
+ *
+ * Blocks in epoll_wait() until a client has data, the accept thread signals
+ * the worker's eventfd or the shared shutdown eventfd fires. Exits when
+ * shutdown is requested, closing the connections it still owns unless an
+ * upgrade passes them on.
+ *
+ * @param arg Pointer to this thread's worker_t.
+ * @return NULL (thread exit value unused).
+ */
+void* worker_thread(void* arg) {
+    worker_t* w = (worker_t*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    char buffer[BUFFER_SIZE];
 
-    // Clean up client socket
-    close(client_fd);
+    while (running) {
+        // No timeout unless a throttled client is waiting for its buckets to refill
+        int timeout = -1;
+        if (w->nthrottled > 0) {
+            uint64_t now = conn_now_ms();
+            timeout = now >= w->throttle_next_ms ? 0 : (int)(w->throttle_next_ms - now);
+        }
+        int nfds = epoll_wait(w->epoll_fd, events, MAX_EVENTS, timeout);
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            int fd = events[i].data.fd;
+            if (fd == shutdown_fd) {
+                continue;  // running is already clear; the loop ends after this batch
+            }
+            if (fd == w->wake_fd) {
+                worker_take_handoffs(w);
+                continue;
+            }
+            conn_t* c = conn_lookup(&w->conns, fd);
+            if (c && worker_read_client(w, c, buffer) == -1) {
+                worker_close_conn(w, c);
+                check_drain();
+            }
+        }
+        if (w->nthrottled > 0) {
+            worker_unthrottle(w, conn_now_ms());
+        }
+    }
+
+    // Clients still connected at shutdown (main() sends them to the new process instead)
+    for (int fd = 0; fd < w->conns.by_fd_len && !send_clients; fd++) {
+        if (w->conns.by_fd[fd]) {
+            worker_close_conn(w, w->conns.by_fd[fd]);
+        }
+    }
     return NULL;
 }
 
+/**
+ * @brief Creates the epoll instance, eventfd and hand-off queue of a worker.
+ *
+ * @param w  Worker to initialise.
+ * @param id Worker index.
+ * @return 0 on success, -1 on error.
+ */
+int worker_init(worker_t* w, int id) {
+    w->id = id;
+    conn_table_init(&w->conns);
+    pthread_mutex_init(&w->lock, NULL);
+    w->queue = malloc(sizeof(pending_conn_t) * (size_t)max_conns);
+    if (!w->queue) {
+        perror("malloc hand-off queue");
+        return -1;
+    }
+    w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->wake_fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    if (num_egress > 0) {
+        w->egress = &egress[id % num_egress];
+        w->udp_socket = -1;
+    } else {
+        w->udp_socket = shared_udp ? udp_socket : upgrade_take_udp(id);
+        if (w->udp_socket < 0) {
+            return -1;
+        }
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = w->wake_fd;
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev) == -1) {
+        perror("epoll_ctl: add wake eventfd");
+        return -1;
+    }
+
+    // Level-triggered and never read: stays ready once shutdown is requested
+    ev.data.fd = shutdown_fd;
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, shutdown_fd, &ev) == -1) {
+        perror("epoll_ctl: add shutdown eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints how many connections each worker served and what they cost in memory.
+ *
+ * The per-connection figure is the worker's connection table (entries and fd
+ * index) divided by its peak number of connections; receive buffers are per
+ * worker, not per connection.
+ */
+void print_worker_stats(void) {
+    size_t total_mem = 0;
+    unsigned long long total_peak = 0;
+    for (int i = 0; i < num_workers; i++) {
+        worker_t* w = &workers[i];
+        size_t mem = conn_table_memory(&w->conns);
+        printf("Worker %d: %llu connections handled, peak %llu open, table %zu KB "
+               "(%zu bytes per connection at peak)\n",
+               w->id, w->handled, w->conns.peak, mem / 1024,
+               w->conns.peak ? mem / (size_t)w->conns.peak : (size_t)0);
+        total_mem += mem;
+        total_peak += w->conns.peak;
+    }
+    printf("Pool: %d workers x %d connections, %llu rejected at capacity; "
+           "%zu KB of connection state plus a %d-byte buffer per worker\n",
+           num_workers, max_conns, rejected, total_mem / 1024, BUFFER_SIZE);
+    if (total_peak > 0) {
+        printf("Memory per connection: %zu bytes of user-space state\n",
+               total_mem / (size_t)total_peak);
+    }
+    if (rate_limits) {
+        for (int i = 0; i < num_workers; i++) {
+            printf("Worker %d rate limiting: %llu throttled, %d parked now\n",
+                   workers[i].id, workers[i].throttles, workers[i].nthrottled);
+        }
+        rate_limit_print(&limiter, stdout);
+    }
+}
+
+/**
+ * @brief Old process: starts the new binary and hands it the listener and UDP sockets.
+ *
+ * Blocks the main thread until the new process reports that it is accepting
+ * (or HANDOFF_TIMEOUT_MS passes, in which case it is killed and nothing
+ * changes). Then the accept thread is told to let go of the listener and the
+ * server drains, or, with with_clients, main() shuts down and passes the
+ * connections on.
+ *
+ * @param with_clients Also hand over established connections.
+ * @return 0 once the new process has taken over, -1 if this one keeps serving.
+ */
+int upgrade_start(int with_clients) {
+    if (handoff_sock >= 0 || draining) {
+        printf("Upgrade already in progress\n");
+        return -1;
+    }
+    int sock;
+    pid_t pid = fd_handoff_spawn(upgrade_argv, &sock);
+    if (pid < 0) {
+        printf("Upgrade failed: cannot start %s\n", upgrade_argv[0]);
+        return -1;
+    }
+
+    handoff_msg_t m;
+    memset(&m, 0, sizeof(m));
+    m.type = HANDOFF_LISTENER;
+    int ok = fd_handoff_send(sock, &m, NULL, 0, &listen_fd, 1) == 0;
+    // The sockets that send: one per egress thread with -E, else one per worker, or the shared one
+    int slots = shared_udp ? 1 : num_egress > 0 ? num_egress : num_workers;
+    for (int i = 0; i < slots && ok; i++) {
+        int fd = shared_udp ? udp_socket : num_egress > 0 ? egress[i].udp_socket : workers[i].udp_socket;
+        m.type = HANDOFF_UDP;
+        m.index = (uint32_t)i;
+        m.flags = shared_udp ? HANDOFF_F_SHARED : 0;
+        ok = fd_handoff_send(sock, &m, NULL, 0, &fd, 1) == 0;
+    }
+    handoff_msg_t reply;
+    int fds[FD_HANDOFF_MAX_FDS];
+    if (!ok || fd_handoff_signal(sock, HANDOFF_SOCKETS_END) == -1 ||
+        fd_handoff_recv(sock, &reply, NULL, 0, fds, HANDOFF_TIMEOUT_MS) == -1 ||
+        reply.type != HANDOFF_READY) {
+        printf("Upgrade failed: the new process did not come up, still serving\n");
+        close(sock);
+        fd_handoff_abort(pid);
+        return -1;
+    }
+    printf("Upgrade: process %d is accepting, %s\n", (int)pid,
+           with_clients ? "handing over connections" : "draining");
+
+    if (with_clients) {
+        handoff_sock = sock;
+        send_clients = 1;
+        return 0;
+    }
+    fd_handoff_signal(sock, HANDOFF_DONE);
+    close(sock);
+    draining = 1;
+    uint64_t one = 1;
+    if (write(drain_fd, &one, sizeof(one)) < 0) {
+        perror("write drain eventfd");
+    }
+    check_drain();
+    return 0;
+}
+
+/**
+ * @brief Old process: passes one connection to the new process and closes it here.
+ *
+ * @param fd   The connection.
+ * @param addr Its peer address, so the new process can count it against the rate limits.
+ * @return 1 if it was sent, 0 otherwise.
+ */
+int upgrade_send_client(int fd, uint32_t addr) {
+    handoff_msg_t m;
+    memset(&m, 0, sizeof(m));
+    m.type = HANDOFF_CLIENT;
+    m.peer_addr = addr;
+    int sent = fd_handoff_send(handoff_sock, &m, NULL, 0, &fd, 1) == 0;
+    close(fd);
+    return sent;
+}
+
+/**
+ * @brief Old process: passes every open or queued connection on, then HANDOFF_DONE.
+ *
+ * Runs after the workers and egress threads have stopped, so whatever a
+ * client sent before this point has been forwarded and the rest is still in
+ * its socket.
+ */
+void upgrade_send_clients(void) {
+    unsigned long long sent = 0;
+    for (int i = 0; i < num_workers; i++) {
+        worker_t* w = &workers[i];
+        for (int fd = 0; fd < w->conns.by_fd_len; fd++) {
+            conn_t* c = w->conns.by_fd[fd];
+            if (c) {
+                uint32_t addr = c->peer_addr;
+                conn_release(&w->conns, c);
+                sent += (unsigned long long)upgrade_send_client(fd, addr);
+            }
+        }
+        for (; w->qlen > 0; w->qlen--) {
+            pending_conn_t* p = &w->queue[w->qhead];
+            sent += (unsigned long long)upgrade_send_client(p->fd, p->addr);
+            w->qhead = (w->qhead + 1) % max_conns;
+        }
+    }
+    fd_handoff_signal(handoff_sock, HANDOFF_DONE);
+    close(handoff_sock);
+    handoff_sock = -1;
+    printf("Upgrade: handed %llu connections to the new process\n", sent);
+}
+
+/**
+ * @brief New process: takes over the connections the old process sends, until HANDOFF_DONE.
+ *
+ * They go through the same admission check and least-loaded hand-off as
+ * freshly accepted clients.
+ */
+void upgrade_receive_clients(void) {
+    unsigned long long adopted = 0;
+    while (1) {
+        handoff_msg_t m;
+        int fds[FD_HANDOFF_MAX_FDS];
+        if (fd_handoff_recv(handoff_sock, &m, NULL, 0, fds, HANDOFF_TIMEOUT_MS) == -1) {
+            fprintf(stderr, "Upgrade: lost the old process, continuing without its connections\n");
+            break;
+        }
+        if (m.type == HANDOFF_DONE) {
+            break;
+        }
+        for (int i = 0; i < m.nfds; i++) {
+            if (m.type != HANDOFF_CLIENT ||
+                (rate_limits && rate_limit_admit(&limiter, m.peer_addr, conn_now_ms()) != RATE_ADMIT)) {
+                close(fds[i]);
+                continue;
+            }
+            worker_t* w = pick_worker();
+            if (!w) {
+                if (rate_limits) {
+                    rate_limit_release(&limiter, m.peer_addr);
+                }
+                close(fds[i]);
+                continue;
+            }
+            hand_off(w, fds[i], m.peer_addr);
+            adopted++;
+        }
+    }
+    printf("Upgrade: took over %llu connections from the old process\n", adopted);
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <tcp_port> <udp_host> <udp_port>\n"
+            "Options:\n"
+            "  -w, --workers N     Worker threads, 1-%d (default: one per online CPU)\n"
+            "  -m, --max-conns N   Connections per worker (default %d); beyond that clients are refused\n"
+            "  -U, --shared-udp    Send through one unconnected UDP socket shared by all workers\n"
+            "                      instead of a connected socket per worker\n"
+            "  -o, --sndbuf N      SO_SNDBUF of each UDP egress socket in bytes (default: system)\n"
+            "  -E, --egress-threads N  Queue chunks to N egress threads (1-%d) that send them with\n"
+            "                      sendmmsg() instead of sending from the workers (default 0)\n"
+            "  -q, --egress-queue N  Ring slots per egress thread (default %d)\n"
+            "  -C, --cpus LIST     Pin workers, then egress threads, then the accept thread to\n"
+            "                      successive CPUs of LIST (e.g. 0-3,8), or 'auto' / 'auto:IFNAME'\n"
+            "                      for the CPUs of the network card's NUMA node\n"
+            "  -P, --backpressure  Park a worker while UDP egress is congested instead of\n"
+            "                      dropping its data (and reading its other clients)\n"
+            "  -D, --drain-timeout S  After 'upgrade', close the clients still connected after S\n"
+            "                      seconds (default %d)\n"
+            "  -c, --conn-limit N  Refuse connections beyond N open at once\n"
+            "  -i, --ip-conns N    Refuse connections beyond N open from one client address\n"
+            "  -r, --ip-bytes RATE[:BURST]    Per-address byte budget in bytes/s (burst defaults to\n"
+            "                      RATE); a client over it has its reads paused until it refills\n"
+            "  -n, --ip-records RATE[:BURST]  Per-address budget in reads/s, likewise\n"
+            "  -T, --tune SPEC     Socket profile of the listener: default, devices and/or\n"
+            "                      defer=S,lowat=B,rcvbuf=B,sndbuf=B,quickack=on|off (lowat\n"
+            "                      delays a record shorter than B until more data or the close)\n"
+            "Console: quit, upgrade (hand the listener to a re-executed binary and drain),\n"
+            "         upgrade clients (hand the connections over too); SIGUSR2 = upgrade\n",
+            prog, MAX_WORKERS, DEFAULT_MAX_CONNS, MAX_EGRESS, DEFAULT_EGRESS_QUEUE,
+            DEFAULT_DRAIN_TIMEOUT_MS / 1000);
+}
+
 /**
  * @brief Main function: sets up UDP target, starts TCP listener, accepts clients.
  *
- * Usage: ./tcp_server <tcp_listen_port> <udp_target_host> <udp_target_port>
+ * Usage: ./tcp_server [-w N] [-m N] [-U] [-o bytes] [-E N] [-q slots] [-C cpus] [-P] [-D drain_s] [-c N] [-i N] [-r rate] [-n rate] [-T profile] <tcp_listen_port> <udp_target_host> <udp_target_port>
  *
- * @param argc Must be 4.
- * @param argv [prog, tcp_port, udp_host, udp_port]
+ * @param argc Argument count.
+ * @param argv [prog, options..., tcp_port, udp_host, udp_port]
  * @return Exit status.
  */
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <tcp_port> <udp_host> <udp_port>\n", argv[0]);
+    static const struct option long_opts[] = {
+        {"workers",   required_argument, NULL, 'w'},
+        {"max-conns", required_argument, NULL, 'm'},
+        {"shared-udp", no_argument,    NULL, 'U'},
+        {"sndbuf",    required_argument, NULL, 'o'},
+        {"egress-threads", required_argument, NULL, 'E'},
+        {"egress-queue", required_argument, NULL, 'q'},
+        {"cpus",      required_argument, NULL, 'C'},
+        {"backpressure", no_argument, NULL, 'P'},
+        {"drain-timeout", required_argument, NULL, 'D'},
+        {"conn-limit", required_argument, NULL, 'c'},
+        {"ip-conns",  required_argument, NULL, 'i'},
+        {"ip-bytes",  required_argument, NULL, 'r'},
+        {"ip-records", required_argument, NULL, 'n'},
+        {"tune",      required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* cpu_spec = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "w:m:Uo:E:q:C:PD:c:i:r:n:T:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'w':
+            num_workers = atoi(optarg);
+            break;
+        case 'm':
+            max_conns = atoi(optarg);
+            break;
+        case 'U':
+            shared_udp = 1;
+            break;
+        case 'o':
+            udp_sndbuf = atoi(optarg);
+            break;
+        case 'E':
+            num_egress = atoi(optarg);
+            break;
+        case 'q':
+            egress_queue = atoi(optarg);
+            break;
+        case 'C':
+            cpu_spec = optarg;
+            break;
+        case 'P':
+            backpressure = 1;
+            break;
+        case 'D':
+            drain_timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'c':
+            limiter.max_total = atoi(optarg);
+            break;
+        case 'i':
+            limiter.max_per_ip = atoi(optarg);
+            break;
+        case 'r':
+            if (rate_limit_parse_bucket(&limiter.bytes, optarg) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            if (rate_limit_parse_bucket(&limiter.records, optarg) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            if (sock_tune_parse(&listener_tune, optarg) == -1) {
+                return 1;
+            }
+            tune = &listener_tune;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (num_workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (int)(cpus < MAX_WORKERS ? cpus : MAX_WORKERS) : 1;
+    }
+    if (argc - optind != 3 || num_workers < 1 || num_workers > MAX_WORKERS || max_conns < 1 ||
+        udp_sndbuf < 0 || num_egress < 0 || num_egress > MAX_EGRESS || egress_queue < 1 ||
+        drain_timeout_ms < 0 || limiter.max_total < 0 || limiter.max_per_ip < 0) {
+        usage(argv[0]);
         return 1;
     }
-
-    // === Step 1: Set up UDP forwarding socket ===
-    udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_socket < 0) {
-        perror("UDP socket");
+    if (cpu_plan_parse(&cpu_plan, cpu_spec) == -1) {
         return 1;
     }
+    rate_limits = rate_limit_enabled(&limiter);
+    if (rate_limits && rate_limit_init(&limiter, RATE_LIMIT_DEFAULT_SLOTS) == -1) {
+        return 1;
+    }
+    const char* tcp_port = argv[optind];
+    const char* udp_host = argv[optind + 1];
+    const char* udp_port = argv[optind + 2];
 
+    // === Step 1: When started by an upgrade, take over the old process's sockets ===
+    upgrade_argv = argv;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        inherited_udp[i] = -1;
+    }
+    handoff_sock = fd_handoff_inherited();
+    if (handoff_sock >= 0 && upgrade_receive_sockets() == -1) {
+        fprintf(stderr, "Upgrade: incomplete hand-off from the old process\n");
+        close(handoff_sock);
+        handoff_sock = -1;
+    }
+
+    // === Step 2: Set up UDP forwarding destination (and the shared socket with -U) ===
     memset(&udp_addr, 0, sizeof(udp_addr));
     udp_addr.sin_family = AF_INET;
-    udp_addr.sin_port = htons(atoi(argv[3]));
-    if (inet_pton(AF_INET, argv[2], &udp_addr.sin_addr) <= 0) {
+    udp_addr.sin_port = htons(atoi(udp_port));
+    if (inet_pton(AF_INET, udp_host, &udp_addr.sin_addr) <= 0) {
         fprintf(stderr, "Invalid UDP host\n");
-        close(udp_socket);
+        return 1;
+    }
+    udp_socket = shared_udp ? upgrade_take_udp(0) : -1;
+    if (shared_udp && udp_socket < 0) {
         return 1;
     }
 
-    // === Step 2: Create and configure TCP listening socket ===
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("TCP socket");
+    // === Step 3: Create the TCP listening socket (or take over the old process's) ===
+    in_port_t port = htons(atoi(tcp_port));
+    if (port == 0) {
+        usage(argv[0]);
         close(udp_socket);
         return 1;
     }
-
-    struct sockaddr_in serv_addr = {0};
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(atoi(argv[1]));
-
-    if (serv_addr.sin_port == 0) {
-        fprintf(stderr, "Usage: %s <tcp_port> <udp_host> <udp_port>\n", argv[0]);
+    listen_fd = inherited_listener >= 0 ? inherited_listener : open_listener(port);
+    if (listen_fd >= 0 && listen_fd == inherited_listener) {
+        sock_tune_listener(tune, listen_fd);  // This binary's profile applies to new connections
+    }
+    if (listen_fd < 0) {
         close(udp_socket);
-        close(listen_fd);
         return 1;
     }
 
-    // Allow reuse of local address (prevents "Address already in use" on restart)
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    if (bind(listen_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("bind");
+    shutdown_fd = eventfd(0, EFD_CLOEXEC);
+    drain_fd = eventfd(0, EFD_CLOEXEC);
+    if (shutdown_fd < 0 || drain_fd < 0) {
+        perror("eventfd");
         close(udp_socket);
         close(listen_fd);
         return 1;
     }
 
-    if (listen(listen_fd, 10) < 0) {
-        perror("listen");
+    // Threads inherit the mask, so only the main thread's signalfd sees these
+    sigset_t control_signals;
+    sigemptyset(&control_signals);
+    sigaddset(&control_signals, SIGINT);
+    sigaddset(&control_signals, SIGTERM);
+    sigaddset(&control_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &control_signals, NULL);
+
+    // === Step 4: Start the egress threads (if any) and the worker pool ===
+    if (num_egress > 0) {
+        egress = calloc((size_t)num_egress, sizeof(egress_t));
+        if (!egress) {
+            perror("calloc egress");
+            close(udp_socket);
+            close(listen_fd);
+            return 1;
+        }
+        for (int i = 0; i < num_egress; i++) {
+            if (cpu_plan_pin(&cpu_plan, num_workers + i) == -1 || egress_init(&egress[i], i) == -1 ||
+                pthread_create(&egress[i].tid, NULL, egress_thread, &egress[i]) != 0) {
+                fprintf(stderr, "Failed to start egress thread %d\n", i);
+                return 1;
+            }
+        }
+    }
+    workers = calloc((size_t)num_workers, sizeof(worker_t));
+    if (!workers) {
+        perror("calloc workers");
         close(udp_socket);
         close(listen_fd);
         return 1;
     }
+    for (int i = 0; i < num_workers; i++) {
+        if (cpu_plan_pin(&cpu_plan, i) == -1 || worker_init(&workers[i], i) == -1 ||
+            pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker %d\n", i);
+            return 1;
+        }
+    }
+    upgrade_close_unused();
 
-    printf("TCP server listening on port %s, forwarding to UDP %s:%s\n",
-           argv[1], argv[2], argv[3]);
-    printf("Type 'quit' and press Enter to exit the server gracefully.\n");
+    printf("TCP server listening on port %s, forwarding to UDP %s:%s (%d workers, %d connections each)\n",
+           tcp_port, udp_host, udp_port, num_workers, max_conns);
+    printf("Type 'quit' and press Enter (or send SIGTERM) to exit the server gracefully.\n");
+    cpu_plan_print(&cpu_plan);
+    if (tune) {
+        sock_tune_print(tune, "Listener", stdout);
+    }
 
-    // === Step 3: Start accept thread ===
+    // === Step 5: Start accept thread ===
     pthread_t accept_thread;
+    cpu_plan_pin(&cpu_plan, num_workers + num_egress);
     if (pthread_create(&accept_thread, NULL, accept_thread_func, NULL) != 0) {
         perror("pthread_create for accept thread");
         close(udp_socket);
         close(listen_fd);
         return 1;
     }
+    cpu_plan_restore(&cpu_plan);  // The main thread only waits for 'quit'
 
-    // === Step 4: Main thread waits for user input to quit ===
-    char input[10];
+    // Tell the old process it can let go, then adopt the connections it passes on
+    if (handoff_sock >= 0) {
+        if (fd_handoff_signal(handoff_sock, HANDOFF_READY) == 0) {
+            upgrade_receive_clients();
+        }
+        close(handoff_sock);
+        handoff_sock = -1;
+    }
+
+    // === Step 6: Main thread sleeps until 'quit', a signal, 'upgrade' or the end of a drain ===
+    int signal_fd = signalfd(-1, &control_signals, SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+    }
+    struct pollfd pfds[3] = {{STDIN_FILENO, POLLIN, 0}, {signal_fd, POLLIN, 0}, {shutdown_fd, POLLIN, 0}};
+    char input[32];
+    uint64_t drain_deadline = 0;
     while (running) {
-        if (fgets(input, sizeof(input), stdin)) {
-            if (strncmp(input, "quit", 4) == 0) {
-                // Set running flag to 0 to signal other threads to stop
-                running = 0;
-                printf("Shutting down TCP server...\n");
+        int timeout = -1;
+        if (draining) {
+            uint64_t now = monotonic_ms();
+            if (now >= drain_deadline) {
+                printf("Drain timeout: closing the remaining connections\n");
                 break;
             }
+            timeout = (int)(drain_deadline - now);
+        }
+        if (poll(pfds, 3, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll (console)");
+            break;
+        }
+        int upgrade = -1;  // -1 none, 0 drain, 1 with clients
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                printf("Received signal %u\n", si.ssi_signo);
+                if (si.ssi_signo != SIGUSR2) {
+                    break;
+                }
+                upgrade = 0;
+            }
+        }
+        if (pfds[0].revents) {
+            if (!fgets(input, sizeof(input), stdin)) {
+                pfds[0].fd = -1;  // EOF: stop watching the console, signals still work
+            } else if (strncmp(input, "quit", 4) == 0) {
+                break;
+            } else if (strncmp(input, "upgrade", 7) == 0) {
+                upgrade = strstr(input + 7, "clients") != NULL;
+            }
+        }
+        if (upgrade >= 0 && upgrade_start(upgrade) == 0) {
+            if (send_clients) {
+                break;
+            }
+            // The new process owns the console from now on
+            pfds[0].fd = -1;
+            drain_deadline = monotonic_ms() + (uint64_t)drain_timeout_ms;
         }
     }
+    // Clear the running flag and wake every thread
+    request_shutdown();
+    printf("Shutting down TCP server...\n");
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
 
     // Wait for the accept thread to finish
     pthread_join(accept_thread, NULL);
 
-    // Close listening socket to unblock any pending accept calls
+    // The shutdown eventfd has woken every worker as well
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    print_worker_stats();
+
+    // Nobody pushes any more: let the egress threads drain their rings and stop
+    egress_running = 0;
+    for (int i = 0; i < num_egress; i++) {
+        uint64_t one = 1;
+        if (write(egress[i].wake_fd, &one, sizeof(one)) < 0) {
+            perror("write egress eventfd");
+        }
+        pthread_join(egress[i].tid, NULL);
+    }
+    print_egress_stats();
+
+    // Only now: the new process must not forward a client's data before the rings have sent its older data
+    if (send_clients) {
+        upgrade_send_clients();
+    }
+    for (int i = 0; i < num_egress; i++) {
+        close(egress[i].wake_fd);
+        close(egress[i].space_fd);
+        if (egress[i].udp_socket != udp_socket) {
+            close(egress[i].udp_socket);
+        }
+        mpsc_ring_free(&egress[i].ring);
+    }
+    free(egress);
+    for (int i = 0; i < num_workers; i++) {
+        // Descriptors handed off after the worker's last look at its queue
+        for (; workers[i].qlen > 0; workers[i].qlen--) {
+            close(workers[i].queue[workers[i].qhead].fd);
+            workers[i].qhead = (workers[i].qhead + 1) % max_conns;
+        }
+        close(workers[i].epoll_fd);
+        close(workers[i].wake_fd);
+        if (workers[i].udp_socket >= 0 && workers[i].udp_socket != udp_socket) {
+            close(workers[i].udp_socket);
+        }
+        conn_table_free(&workers[i].conns);
+        pthread_mutex_destroy(&workers[i].lock);
+        free(workers[i].queue);
+        free(workers[i].throttled);
+    }
+    free(workers);
+
+    // Close listening socket and the shutdown eventfd
     if (listen_fd >= 0) {
         close(listen_fd);
     }
+    close(shutdown_fd);
+    close(drain_fd);
+
+    // Close the shared UDP socket
+    if (udp_socket >= 0) {
+        close(udp_socket);
+    }
+
+    printf("Egress: %llu datagrams sent, %llu dropped, %llu stalls (%llu ms parked)\n",
+           __atomic_load_n(&egress_sent, __ATOMIC_RELAXED),
+           __atomic_load_n(&egress_dropped, __ATOMIC_RELAXED),
+           __atomic_load_n(&egress_stalls, __ATOMIC_RELAXED),
+           __atomic_load_n(&egress_stall_ms, __ATOMIC_RELAXED));
 
-    // Close UDP socket
-    close(udp_socket);
+    cpu_plan_free(&cpu_plan);
+    rate_limit_free(&limiter);
 
     printf("TCP server stopped.\n");
     return 0;
@@ -0,0 +1,118 @@
+/**
+ * @file timer_wheel.c
+ * @brief Implementation of the hashed timer wheel declared in `timer_wheel.h`.
+ */
+
+#include "timer_wheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int timer_wheel_init(timer_wheel_t* tw, unsigned nslots, unsigned tick_ms, uint64_t now_ms) {
+    unsigned n = 1;
+    while (n < nslots) {
+        n <<= 1;
+    }
+    tw->slots = malloc(sizeof(timer_node_t) * n);
+    if (!tw->slots) {
+        perror("malloc timer wheel");
+        return -1;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        tw->slots[i].next = &tw->slots[i];
+        tw->slots[i].prev = &tw->slots[i];
+    }
+    tw->nslots = n;
+    tw->tick_ms = tick_ms ? tick_ms : 1;
+    tw->base_ms = now_ms;
+    tw->tick = 0;
+    tw->count = 0;
+    return 0;
+}
+
+void timer_wheel_free(timer_wheel_t* tw) {
+    free(tw->slots);
+    tw->slots = NULL;
+    tw->count = 0;
+}
+
+void timer_wheel_del(timer_wheel_t* tw, timer_node_t* node) {
+    if (!node->next) {
+        return;
+    }
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+    tw->count--;
+}
+
+void timer_wheel_add(timer_wheel_t* tw, timer_node_t* node, uint64_t deadline_ms) {
+    timer_wheel_del(tw, node);
+
+    // Round up so a timer never fires before its deadline
+    uint64_t tick = deadline_ms > tw->base_ms
+                        ? (deadline_ms - tw->base_ms + tw->tick_ms - 1) / tw->tick_ms
+                        : 0;
+    if (tick <= tw->tick) {
+        tick = tw->tick + 1;
+    }
+    timer_node_t* head = &tw->slots[tick & (tw->nslots - 1)];
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+    tw->count++;
+}
+
+unsigned long timer_wheel_advance(timer_wheel_t* tw, uint64_t now_ms, timer_fn fn, void* ctx) {
+    uint64_t now_tick = now_ms > tw->base_ms ? (now_ms - tw->base_ms) / tw->tick_ms : 0;
+    if (now_tick <= tw->tick) {
+        return 0;
+    }
+
+    // After a long pause one full revolution covers every slot
+    uint64_t first = tw->tick + 1;
+    if (now_tick - first >= tw->nslots) {
+        first = now_tick - tw->nslots + 1;
+    }
+    tw->tick = now_tick;  // Re-added timers land after now, never in a slot being run
+
+    unsigned long fired = 0;
+    for (uint64_t t = first; t <= now_tick; t++) {
+        timer_node_t* head = &tw->slots[t & (tw->nslots - 1)];
+        if (head->next == head) {
+            continue;
+        }
+
+        // Detach the whole slot first so callbacks can re-add into any slot
+        timer_node_t* node = head->next;
+        head->prev->next = NULL;
+        head->next = head;
+        head->prev = head;
+        while (node) {
+            timer_node_t* next = node->next;
+            node->next = NULL;
+            node->prev = NULL;
+            tw->count--;
+            fired++;
+            fn(node, ctx);
+            node = next;
+        }
+    }
+    return fired;
+}
+
+int timer_wheel_timeout(const timer_wheel_t* tw, uint64_t now_ms) {
+    if (tw->count == 0) {
+        return -1;
+    }
+    for (unsigned i = 1; i <= tw->nslots; i++) {
+        uint64_t t = tw->tick + i;
+        const timer_node_t* head = &tw->slots[t & (tw->nslots - 1)];
+        if (head->next != head) {
+            uint64_t due = tw->base_ms + t * tw->tick_ms;
+            return due > now_ms ? (int)(due - now_ms) : 0;
+        }
+    }
+    return 0;
+}
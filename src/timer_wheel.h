@@ -0,0 +1,103 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hashed timer wheel with O(1) insert and removal, driven by an event loop.
+ *
+ * Time is divided into ticks of `tick_ms`; slot i holds every timer whose
+ * deadline falls in a tick congruent to i modulo the number of slots. Timers
+ * further away than one revolution simply fire early, and the owner
+ * re-inserts them with their real deadline. The same trick makes rescheduling
+ * lazy: the owner never touches the wheel when a deadline moves later (e.g. on
+ * every received byte), it only recomputes the deadline when the old one fires.
+ *
+ * Timer nodes are intrusive, so a wheel never allocates per timer. A wheel is
+ * not thread-safe; each event loop owns its own.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/**
+ * @brief Intrusive list node; embed one per timer in the owning structure.
+ */
+typedef struct timer_node {
+    struct timer_node* next;  ///< Next node in the slot, NULL while not scheduled
+    struct timer_node* prev;  ///< Previous node in the slot
+} timer_node_t;
+
+/**
+ * @brief A wheel of `nslots` circular lists, one per tick.
+ */
+typedef struct {
+    timer_node_t* slots;      ///< Sentinel list heads
+    unsigned nslots;          ///< Number of slots (power of two)
+    unsigned tick_ms;         ///< Length of one tick
+    uint64_t base_ms;         ///< Time of tick 0
+    uint64_t tick;            ///< Last tick processed by timer_wheel_advance()
+    unsigned long count;      ///< Timers currently scheduled
+} timer_wheel_t;
+
+/**
+ * @brief Called for each timer whose slot comes due; the node is already unlinked.
+ *
+ * The callback may re-add the node or free its owner.
+ */
+typedef void (*timer_fn)(timer_node_t* node, void* ctx);
+
+/**
+ * @brief Creates an empty wheel.
+ *
+ * @param tw      Wheel to initialise.
+ * @param nslots  Number of slots (rounded up to a power of two).
+ * @param tick_ms Tick length in milliseconds.
+ * @param now_ms  Current time (any monotonic millisecond clock).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int timer_wheel_init(timer_wheel_t* tw, unsigned nslots, unsigned tick_ms, uint64_t now_ms);
+
+/**
+ * @brief Frees the slot array. Scheduled nodes are simply forgotten.
+ *
+ * @param tw The wheel.
+ */
+void timer_wheel_free(timer_wheel_t* tw);
+
+/**
+ * @brief Schedules (or reschedules) a timer. O(1).
+ *
+ * @param tw          The wheel.
+ * @param node        Timer node; unlinked first if already scheduled.
+ * @param deadline_ms Absolute deadline; past deadlines fire on the next tick.
+ */
+void timer_wheel_add(timer_wheel_t* tw, timer_node_t* node, uint64_t deadline_ms);
+
+/**
+ * @brief Cancels a timer. O(1); a no-op if the node is not scheduled.
+ *
+ * @param tw   The wheel.
+ * @param node Timer node.
+ */
+void timer_wheel_del(timer_wheel_t* tw, timer_node_t* node);
+
+/**
+ * @brief Runs every slot between the last processed tick and now.
+ *
+ * @param tw     The wheel.
+ * @param now_ms Current time.
+ * @param fn     Called once for every node found in a due slot.
+ * @param ctx    Passed to fn.
+ * @return Number of nodes handed to fn.
+ */
+unsigned long timer_wheel_advance(timer_wheel_t* tw, uint64_t now_ms, timer_fn fn, void* ctx);
+
+/**
+ * @brief Milliseconds until the next non-empty slot comes due, for use as a poll timeout.
+ *
+ * @param tw     The wheel.
+ * @param now_ms Current time.
+ * @return Timeout in milliseconds (0 if a slot is already due), or -1 if the wheel is empty.
+ */
+int timer_wheel_timeout(const timer_wheel_t* tw, uint64_t now_ms);
+
+#endif // TIMER_WHEEL_H
@@ -5,8 +5,60 @@
  * This program binds to a UDP port, receives datagrams from any client,
  * and writes them verbatim to a specified log file in append mode.
  * It supports graceful shutdown by typing 'quit' in the console.
+ *
+ * Datagrams are received in batches: one recvmmsg() call fills up to `-b`
+ * preallocated buffers (MSG_WAITFORONE: it blocks for the first datagram and
+ * then takes whatever else is already queued). Under load one system call
+ * then moves a batch instead of a datagram; when traffic is light a batch
+ * holds one datagram and nothing waits for it to fill. Batch sizes are
+ * printed on exit so the fill can be checked against `-b`.
+ *
+ * The receive thread never writes to the file itself. It copies each batch
+ * into the ring of a log writer thread (see log_writer.h), which appends
+ * whatever has accumulated with one writev() once `--flush-bytes` are
+ * pending or the oldest record is `--flush-us` old, and fdatasync()s every
+ * `--sync-ms` if asked to. A slow disk then delays the writer, not the
+ * socket, and datagrams are only lost if the ring (`--ring`) fills up.
+ *
+ * Each datagram is carried with the length recvmmsg() reported, from the
+ * receive buffer to the disk, so payloads containing NUL bytes are logged
+ * whole. `-f framed` additionally precedes every datagram with a header
+ * holding its length, kernel receive time and sender (see log_record.h),
+ * so binary payloads can be told apart again; `log_convert` turns such a
+ * log back into the plain format.
+ *
+ * `-t N` splits receiving into N shards. Each shard has its own socket bound
+ * to the port with SO_REUSEPORT, its own receive thread and its own slots;
+ * the kernel spreads senders over the sockets by a hash of their address and
+ * port, so one sender always lands on the same shard. With `-O shared` (the
+ * default) all shards queue to one log writer, each through its own lane,
+ * and the log stays one file; with `-O split` shard i has a writer of its
+ * own and writes `<log_file>.<i>`, so no two shards share anything.
+ *
+ * `-w mmap` replaces the writer's writev() with copies into a preallocated,
+ * memory-mapped log (see mmap_log.h): the file grows in `--extent` steps
+ * prepared by a background thread, which also does the msync()s, and the end
+ * of the data is published in `<log_file>.tail` for readers that follow the
+ * log. On exit the log is truncated to that length. `-w uring` submits the
+ * writer's writes (and fdatasync()s) through io_uring from registered rings,
+ * with up to `--depth` of them in flight.
+ *
+ * `--rotate-bytes` and `--rotate-secs` rotate the log (see log_rotate.h):
+ * once it holds that many bytes or is that old, the writer switches to a
+ * segment a background thread has already opened and preallocated, and the
+ * same thread renames the old one to `<log_file>.YYYYmmdd-HHMMSS`, syncs and
+ * closes it. With `-O split` every shard's log rotates on its own.
+ *
+ * `--busy-poll US` sets SO_BUSY_POLL and SO_PREFER_BUSY_POLL on the sockets, and
+ * `--spin US` makes the receive threads retry non-blocking receives for that
+ * long after each batch before they go back to a blocking receive.
+ *
+ * `--cpus LIST|auto` pins shard i to the CPU of slot i in the list and the
+ * log writers to the slots after the shards (see cpu_affinity.h).
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,41 +69,325 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "cpu_affinity.h"
+#include "log_rotate.h"
+#include "log_record.h"
+#include "log_writer.h"
+#include "mmap_log.h"
 
 #define BUFFER_SIZE 4096  ///< Maximum size of a UDP datagram we can receive
+#define DEFAULT_BATCH 64  ///< Default number of datagrams per recvmmsg() call
+#define MAX_BATCH 1024    ///< Upper bound for the -b option (UIO_MAXIOV, one writev())
+#define BATCH_HIST 11     ///< Histogram buckets: 1, 2-3, 4-7, ... , 1024
+#define SLOT_SIZE (sizeof(log_record_t) + BUFFER_SIZE)  ///< Receive slot: header room + datagram
+#define CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))  ///< Ancillary data of one slot
 
 // Global variable for thread communication
 static volatile int running = 1;  ///< Flag to control server shutdown
+static int busy_poll_us = 0;      ///< SO_BUSY_POLL value (--busy-poll), 0 = off
+static int spin_us = 0;           ///< Time to poll before blocking (--spin), 0 = never
+static cpu_plan_t cpu_plan;       ///< CPUs of the receive and writer threads (--cpus), empty = not pinned
+static int batch_size = DEFAULT_BATCH;  ///< Datagrams per recvmmsg() call (-b)
+static int framed = 0;            ///< Write log_record_t headers (-f framed)
+static int nshards = 1;           ///< Receive shards (-t)
+static int split_output = 0;      ///< One log file per shard (-O split)
+static size_t ring_bytes = LOG_WRITER_DEFAULT_RING;  ///< Ring size of each writer lane (--ring)
+static int mmap_sink = 0;         ///< Append through mmap_log (-w mmap)
+static int uring_sink = 0;        ///< Write through io_uring (-w uring)
+static int uring_depth = LOG_WRITER_DEFAULT_URING_DEPTH;  ///< Writes in flight with -w uring (--depth)
+static size_t extent_bytes = MMAP_LOG_DEFAULT_EXTENT;  ///< Preallocation step with -w mmap (--extent)
+static unsigned long long rotate_bytes = 0;  ///< Rotate the log at this size (--rotate-bytes), 0 = never
+static int rotate_secs = 0;       ///< Rotate the log at this age (--rotate-secs), 0 = never
+static log_writer_t writer_conf = {  ///< Flush settings from --flush-bytes/-us, --sync-ms
+    .flush_bytes = LOG_WRITER_DEFAULT_FLUSH_BYTES,
+    .flush_us = LOG_WRITER_DEFAULT_FLUSH_US,
+    .sync_ms = 0,
+};
 
-// Structure to pass data to the thread
+/**
+ * @brief Preallocated receive slots and what one recvmmsg() call filled.
+ *
+ * Slot i is buffers + i * SLOT_SIZE: room for a record header, then the
+ * BUFFER_SIZE bytes the datagram is received into, so a framed record is
+ * built in place and handed on as one contiguous piece. The batch is queued
+ * before the next call, so the same buffers serve every batch.
+ */
 typedef struct {
-    int sock_fd;
-    FILE* fp;
-} thread_data_t;
+    struct mmsghdr* msgs;  ///< recvmmsg() descriptors, one per slot
+    struct iovec* iovs;    ///< Receive iovec of each slot (the datagram part)
+    struct iovec* out;     ///< The record of each filled slot, for the log writer
+    char* buffers;         ///< capacity * SLOT_SIZE bytes
+    struct sockaddr_in* senders;  ///< Source address of each slot (framed only)
+    char* control;         ///< capacity * CONTROL_SIZE bytes for SCM_TIMESTAMPNS (framed only)
+    int capacity;          ///< Number of slots (-b)
+
+    // Statistics (owned by the receive thread, read after it is joined)
+    unsigned long long calls;      ///< recvmmsg() calls that returned datagrams
+    unsigned long long full;       ///< Calls that filled every slot
+    unsigned long long truncated;  ///< Datagrams longer than BUFFER_SIZE (cut)
+    unsigned long long hist[BATCH_HIST];  ///< Batch sizes, log2 buckets
+    int max_fill;                  ///< Largest batch received
+} rx_batch_t;
 
 /**
- * @brief Worker thread function: handles receiving UDP datagrams and writing to log file.
+ * @brief One receive shard: a SO_REUSEPORT socket and the thread that drains it.
+ */
+typedef struct {
+    int id;                  ///< Shard number: CPU slot, and file suffix with -O split
+    int sock_fd;             ///< This shard's socket
+    rx_batch_t batch;        ///< Receive slots and batch statistics
+    log_writer_t* writer;    ///< Writer the shard queues to
+    int lane;                ///< The shard's lane in that writer
+    pthread_t thread;        ///< Receive thread
+    unsigned long long received;   ///< Datagrams received
+    unsigned long long spin_hits;  ///< Datagrams picked up while spinning
+} shard_t;
+
+static shard_t* shards;         ///< nshards shards
+static log_writer_t* writers;   ///< One writer (shared) or one per shard (split)
+static int* log_fds;            ///< Their log files
+static mmap_log_t* maps;        ///< Their mappings with -w mmap
+static log_rotator_t* rotators; ///< Their rotators with --rotate-bytes/--rotate-secs
+static int nwriters;            ///< Writers started
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in microseconds.
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Resets the in/out lengths recvmmsg() changed in the first n descriptors.
  *
- * @param arg Pointer to malloc'd struct containing socket fd and log file pointer.
- * @return NULL (thread exit value unused).
+ * @param b The batch.
+ * @param n Slots filled by the last call.
  */
-void* udp_receive_thread(void* arg) {
-    // Extract socket fd and file pointer from argument
-    thread_data_t* data = (thread_data_t*)arg;
-    int sock_fd = data->sock_fd;
-    FILE* fp = data->fp;
-    free(data); // Free the malloc'd memory
+static void rx_batch_rearm(rx_batch_t* b, int n) {
+    if (!framed) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        b->msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+}
 
-    // Set socket timeout to periodically check the running flag
-    struct timeval tv;
-    tv.tv_sec = 1;  // 1 second timeout
-    tv.tv_usec = 0;
-    if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-        perror("setsockopt failed");
-        return NULL;
+/**
+ * @brief Returns the kernel receive timestamp of a slot, or fallback_ns if it has none.
+ *
+ * @param m           Descriptor filled by recvmmsg().
+ * @param fallback_ns Time to use without SCM_TIMESTAMPNS.
+ */
+static uint64_t rx_timestamp(struct mmsghdr* m, uint64_t fallback_ns) {
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&m->msg_hdr); cm; cm = CMSG_NXTHDR(&m->msg_hdr, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+        }
     }
+    return fallback_ns;
+}
 
-    char buffer[BUFFER_SIZE];
+/**
+ * @brief Allocates the slots and points each descriptor at its buffer.
+ *
+ * @param b        Batch to set up.
+ * @param capacity Number of slots.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int rx_batch_init(rx_batch_t* b, int capacity) {
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity;
+    b->msgs = calloc((size_t)capacity, sizeof(struct mmsghdr));
+    b->iovs = calloc((size_t)capacity, sizeof(struct iovec));
+    b->out = calloc((size_t)capacity, sizeof(struct iovec));
+    b->buffers = malloc((size_t)capacity * SLOT_SIZE);
+    if (framed) {
+        b->senders = calloc((size_t)capacity, sizeof(struct sockaddr_in));
+        b->control = calloc((size_t)capacity, CONTROL_SIZE);
+    }
+    if (!b->msgs || !b->iovs || !b->out || !b->buffers || (framed && (!b->senders || !b->control))) {
+        perror("malloc receive batch");
+        return -1;
+    }
+    for (int i = 0; i < capacity; i++) {
+        b->iovs[i].iov_base = b->buffers + (size_t)i * SLOT_SIZE + sizeof(log_record_t);
+        b->iovs[i].iov_len = BUFFER_SIZE;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        if (framed) {
+            b->msgs[i].msg_hdr.msg_name = &b->senders[i];
+            b->msgs[i].msg_hdr.msg_control = b->control + (size_t)i * CONTROL_SIZE;
+        }
+    }
+    rx_batch_rearm(b, capacity);
+    return 0;
+}
+
+/**
+ * @brief Releases the slots.
+ *
+ * @param b The batch.
+ */
+void rx_batch_free(rx_batch_t* b) {
+    free(b->msgs);
+    free(b->iovs);
+    free(b->out);
+    free(b->buffers);
+    free(b->senders);
+    free(b->control);
+}
+
+/**
+ * @brief Receives a batch, spinning with MSG_DONTWAIT for up to spin_us first.
+ *
+ * @param sh Shard whose socket (blocking, with a receive timeout) and slots are used.
+ * @return Same as recvmmsg(): datagrams received, or -1 with errno set.
+ */
+int spin_receive(shard_t* sh) {
+    int sock_fd = sh->sock_fd;
+    rx_batch_t* b = &sh->batch;
+    if (spin_us > 0) {
+        uint64_t deadline = now_us() + (uint64_t)spin_us;
+        do {
+            int n = recvmmsg(sock_fd, b->msgs, (unsigned)b->capacity, MSG_DONTWAIT, NULL);
+            if (n >= 0) {
+                sh->spin_hits += (unsigned long long)n;
+                return n;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return n;
+            }
+        } while (running && now_us() < deadline);
+    }
+    // Block for the first datagram only, then take what is already queued
+    return recvmmsg(sock_fd, b->msgs, (unsigned)b->capacity, MSG_WAITFORONE, NULL);
+}
+
+/**
+ * @brief Hands the n datagrams of a batch to the log writer, verbatim or framed.
+ *
+ * Lengths come from recvmmsg(); payloads are never scanned.
+ *
+ * @param sh Shard that just received a batch.
+ * @param n  Slots filled.
+ */
+void rx_batch_queue(shard_t* sh, int n) {
+    rx_batch_t* b = &sh->batch;
+    uint64_t batch_ns = 0;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        struct mmsghdr* m = &b->msgs[i];
+        unsigned len = m->msg_len;
+        uint16_t flags = 0;
+        if (m->msg_hdr.msg_flags & MSG_TRUNC) {
+            b->truncated++;
+            flags |= LOG_RECORD_TRUNCATED;
+        }
+        if (framed) {
+            if (batch_ns == 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                batch_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+            }
+            // Empty datagrams are records too; the header goes in the room before the payload
+            log_record_t* h = (log_record_t*)((char*)b->iovs[i].iov_base - sizeof(log_record_t));
+            log_record_encode(h, len, rx_timestamp(m, batch_ns), &b->senders[i], flags);
+            b->out[count].iov_base = h;
+            b->out[count].iov_len = sizeof(log_record_t) + len;
+            count++;
+        } else if (len > 0) {
+            b->out[count].iov_base = b->iovs[i].iov_base;
+            b->out[count].iov_len = len;
+            count++;
+        }
+    }
+    log_writer_append(sh->writer, sh->lane, b->out, count);
+    rx_batch_rearm(b, n);
+}
+
+/**
+ * @brief Counts one batch in the fill statistics.
+ *
+ * @param b The batch.
+ * @param n Slots filled.
+ */
+void rx_batch_account(rx_batch_t* b, int n) {
+    int bucket = 0;
+    while ((2 << bucket) <= n && bucket < BATCH_HIST - 1) {
+        bucket++;
+    }
+    b->hist[bucket]++;
+    b->calls++;
+    if (n == b->capacity) {
+        b->full++;
+    }
+    if (n > b->max_fill) {
+        b->max_fill = n;
+    }
+}
+
+/**
+ * @brief Prints how full the receive batches were, over all shards.
+ */
+void print_batch_stats(void) {
+    rx_batch_t total;
+    unsigned long long received = 0;
+    unsigned long long spin_hits = 0;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < nshards; i++) {
+        const rx_batch_t* b = &shards[i].batch;
+        received += shards[i].received;
+        spin_hits += shards[i].spin_hits;
+        total.calls += b->calls;
+        total.full += b->full;
+        total.truncated += b->truncated;
+        for (int k = 0; k < BATCH_HIST; k++) {
+            total.hist[k] += b->hist[k];
+        }
+        if (b->max_fill > total.max_fill) {
+            total.max_fill = b->max_fill;
+        }
+    }
+    printf("Receive: %llu datagrams in %llu recvmmsg calls (%.2f per call, max %d of %d, "
+           "%llu full batches), %llu truncated\n",
+           received, total.calls, total.calls ? (double)received / total.calls : 0.0,
+           total.max_fill, batch_size, total.full, total.truncated);
+    printf("Receive batch sizes:");
+    for (int i = 0; i < BATCH_HIST; i++) {
+        if (total.hist[i]) {
+            printf(" [%d-%d]=%llu", 1 << i, (2 << i) - 1, total.hist[i]);
+        }
+    }
+    printf("\n");
+    if (nshards > 1) {
+        printf("Datagrams per shard:");
+        for (int i = 0; i < nshards; i++) {
+            printf(" %d=%llu", i, shards[i].received);
+        }
+        printf("\n");
+    }
+    if (spin_us > 0) {
+        printf("Busy-poll: %llu of %llu datagrams picked up while spinning\n", spin_hits, received);
+    }
+}
+
+/**
+ * @brief Worker thread function: receives one shard's datagrams and queues them for its writer.
+ *
+ * @param arg The shard_t to serve.
+ * @return NULL (thread exit value unused).
+ */
+void* udp_receive_thread(void* arg) {
+    shard_t* sh = (shard_t*)arg;
 
     while (1) {
         // Check if we should stop
@@ -59,126 +395,452 @@ void* udp_receive_thread(void* arg) {
             break;
         }
 
-        // Receive a datagram (ignore sender address since we don't need it)
-        ssize_t n = recvfrom(sock_fd, buffer, sizeof(buffer) - 1, 0, NULL, NULL);
+        // Receive a batch (ignore sender addresses since we don't need them)
+        int n = spin_receive(sh);
 
         // Check for timeout specifically (would return -1 with errno = EAGAIN/EWOULDBLOCK)
-        if (n < 0) {
+        if (n <= 0) {
             // errno == EAGAIN/EWOULDBLOCK indicates timeout
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                continue; // Go back to check running flag
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvmmsg");
             }
-            perror("recvfrom");
-            continue; // Continue on other transient errors
+            continue; // Go back to check running flag
         }
+        sh->received += (unsigned long long)n;
+        rx_batch_account(&sh->batch, n);
 
-        // Check running flag again before writing to file
-        if (!running) {
-            break;
+        // Queue the whole batch for the log writer
+        rx_batch_queue(sh, n);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Creates one shard's socket, bound to the port (with SO_REUSEPORT when sharded).
+ *
+ * @param port Port in network byte order.
+ * @return The socket, or -1 on error (perror() called).
+ */
+int open_shard_socket(in_port_t port) {
+    // Create a UDP socket (SOCK_DGRAM = connectionless datagram socket)
+    int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // Every shard binds the same port; the kernel spreads senders over the sockets
+    int one = 1;
+    if (nshards > 1 && setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(sock_fd);
+        return -1;
+    }
+
+    // Busy polling: spin on the device queue instead of sleeping until an interrupt
+    if (busy_poll_us > 0) {
+        if (setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0 ||
+            setsockopt(sock_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0) {
+            perror("setsockopt busy poll");
+            close(sock_fd);
+            return -1;
         }
+    }
 
-        // Null-terminate for safety (though not strictly needed for binary-safe logs)
-        buffer[n] = '\0';
+    // Framed records carry the kernel's receive time of each datagram
+    if (framed && setsockopt(sock_fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+        perror("setsockopt SO_TIMESTAMPNS");
+        close(sock_fd);
+        return -1;
+    }
 
-        // Write the received message to the log file
-        fprintf(fp, "%s", buffer);
-        fflush(fp); // Ensure data is written immediately
+    // Set socket timeout to periodically check the running flag
+    struct timeval tv;
+    tv.tv_sec = 1;  // 1 second timeout
+    tv.tv_usec = 0;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
+        perror("setsockopt SO_RCVTIMEO");
+        close(sock_fd);
+        return -1;
     }
 
-    return NULL;
+    // Bind the socket to the specified port on any interface
+    struct sockaddr_in serv_addr = {0};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = port;
+    if (bind(sock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        perror("bind");
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+/**
+ * @brief Stops the threads that were started and releases everything main() set up.
+ *
+ * @param threads Shard threads started (they are joined after running is cleared).
+ * @param report  Non-zero to print the statistics once everything has stopped.
+ */
+void teardown(int threads, int report) {
+    running = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(shards[i].thread, NULL);
+    }
+    // Write out what is still queued, then close files and sockets
+    for (int j = 0; j < nwriters; j++) {
+        log_writer_stop(&writers[j]);
+        if (writers[j].rotator) {
+            // Closes the current segment, and its mapping with -w mmap
+            log_rotator_stop(writers[j].rotator, writers[j].segment);
+        } else if (writers[j].map) {
+            mmap_log_close(writers[j].map);
+        }
+    }
+    for (int j = 0; j < (split_output ? nshards : 1); j++) {
+        if (log_fds[j] >= 0) {
+            close(log_fds[j]);
+        }
+    }
+    for (int i = 0; i < nshards; i++) {
+        if (shards[i].sock_fd >= 0) {
+            close(shards[i].sock_fd);
+        }
+    }
+
+    if (report) {
+        print_batch_stats();
+        for (int j = 0; j < nwriters; j++) {
+            if (split_output) {
+                printf("Shard %d:\n", j);
+            }
+            log_writer_print(&writers[j], stdout);
+            if (writers[j].rotator) {
+                log_rotator_print(writers[j].rotator, stdout);
+            } else if (writers[j].map) {
+                mmap_log_print(writers[j].map, stdout);
+            }
+        }
+    }
+    for (int j = 0; j < nwriters; j++) {
+        log_writer_free(&writers[j]);
+    }
+    for (int i = 0; i < nshards; i++) {
+        rx_batch_free(&shards[i].batch);
+    }
+    free(writers);
+    free(log_fds);
+    free(maps);
+    free(rotators);
+    free(shards);
+    cpu_plan_free(&cpu_plan);
+}
+
+/**
+ * @brief Prints command-line usage.
+ *
+ * @param prog Program name (argv[0]).
+ */
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <udp_port> <log_file>\n"
+            "Options:\n"
+            "  -t, --threads N     Receive shards: N SO_REUSEPORT sockets, one thread each (default 1)\n"
+            "  -O, --output MODE   shared: all shards write one log (default); split: shard i\n"
+            "                      writes <log_file>.<i> with a writer of its own\n"
+            "  -b, --batch N       Datagrams per recvmmsg() call, 1-%d (default %d)\n"
+            "  -f, --format FMT    Log format: raw (datagrams only, default) or framed\n"
+            "                      (length, receive time and sender before each; see log_convert)\n"
+            "  -q, --ring BYTES    Log writer ring size per shard (default %u)\n"
+            "  -F, --flush-bytes N Write the log once N bytes are pending (default %u)\n"
+            "  -u, --flush-us US   ... or once the oldest pending record is US old (default %d)\n"
+            "  -y, --sync-ms MS    fdatasync() the log at most every MS milliseconds (default off)\n"
+            "  -w, --sink SINK     How the writer appends: write (writev(), default), mmap\n"
+            "                      (copies into preallocated mapped extents; see <log_file>.tail)\n"
+            "                      or uring (io_uring writes from registered rings)\n"
+            "  -e, --extent BYTES  Preallocation and mapping step with -w mmap (default %u)\n"
+            "  -d, --depth N       Writes in flight with -w uring, 1-%d (default %d)\n"
+            "  -R, --rotate-bytes N\n"
+            "                      Rotate the log once it holds N bytes (default off)\n"
+            "  -T, --rotate-secs S ... or once it is S seconds old (default off); rotated logs\n"
+            "                      are renamed <log_file>.YYYYmmdd-HHMMSS\n"
+            "  -S, --busy-poll US  Set SO_BUSY_POLL (US microseconds) and SO_PREFER_BUSY_POLL\n"
+            "  -s, --spin US       Poll for US microseconds before each blocking receive\n"
+            "  -C, --cpus LIST     Pin shard i to the i-th CPU of LIST and the log writers to the\n"
+            "                      CPUs after the shards, or 'auto' / 'auto:IFNAME' for CPUs of\n"
+            "                      the network card's NUMA node\n",
+            prog, MAX_BATCH, DEFAULT_BATCH, LOG_WRITER_DEFAULT_RING, LOG_WRITER_DEFAULT_FLUSH_BYTES,
+            LOG_WRITER_DEFAULT_FLUSH_US, MMAP_LOG_DEFAULT_EXTENT, LOG_WRITER_MAX_URING_DEPTH,
+            LOG_WRITER_DEFAULT_URING_DEPTH);
 }
 
 /**
  * @brief Main entry point for the UDP logging server.
  *
- * Usage: ./udp_server <udp_port> <log_file>
+ * Usage: ./udp_server [-t shards] [-O shared|split] [-b batch] [-f raw|framed] [-q ring]
+ *                     [-F bytes] [-u us] [-y ms] [-w write|mmap|uring] [-e bytes] [-d depth]
+ *                     [-R bytes] [-T secs] [-S us] [-s us] [-C cpus] <udp_port> <log_file>
  *
  * The server:
- *   - Creates a UDP socket.
- *   - Binds it to INADDR_ANY on the given port.
- *   - Opens the log file in append mode with buffering disabled.
- *   - Starts a thread to receive datagrams and write them to the file.
+ *   - Creates one UDP socket per shard, bound to INADDR_ANY on the given port.
+ *   - Opens the log file(s) in append mode and starts the log writer thread(s).
+ *   - Starts a thread per shard to receive datagrams in batches and queue them for its writer.
  *   - Main thread waits for user input to shutdown gracefully.
  *
- * @param argc Argument count (must be 3).
- * @param argv Arguments: [program_name, udp_port, log_file]
+ * @param argc Argument count.
+ * @param argv Arguments: [program_name, options..., udp_port, log_file]
  * @return Exit status (0 on normal operation, 1 on error).
  */
 int main(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"threads",     required_argument, NULL, 't'},
+        {"output",      required_argument, NULL, 'O'},
+        {"batch",       required_argument, NULL, 'b'},
+        {"format",      required_argument, NULL, 'f'},
+        {"ring",        required_argument, NULL, 'q'},
+        {"flush-bytes", required_argument, NULL, 'F'},
+        {"flush-us",    required_argument, NULL, 'u'},
+        {"sync-ms",     required_argument, NULL, 'y'},
+        {"sink",        required_argument, NULL, 'w'},
+        {"extent",      required_argument, NULL, 'e'},
+        {"depth",       required_argument, NULL, 'd'},
+        {"rotate-bytes", required_argument, NULL, 'R'},
+        {"rotate-secs", required_argument, NULL, 'T'},
+        {"busy-poll",   required_argument, NULL, 'S'},
+        {"spin",        required_argument, NULL, 's'},
+        {"cpus",        required_argument, NULL, 'C'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* cpu_spec = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "t:O:b:f:q:F:u:y:w:e:d:R:T:S:s:C:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 't':
+            nshards = atoi(optarg);
+            break;
+        case 'O':
+            if (strcmp(optarg, "split") == 0) {
+                split_output = 1;
+            } else if (strcmp(optarg, "shared") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "framed") == 0) {
+                framed = 1;
+            } else if (strcmp(optarg, "raw") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'q':
+            ring_bytes = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'F':
+            writer_conf.flush_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'u':
+            writer_conf.flush_us = atoi(optarg);
+            break;
+        case 'y':
+            writer_conf.sync_ms = atoi(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "mmap") == 0) {
+                mmap_sink = 1;
+            } else if (strcmp(optarg, "uring") == 0) {
+                uring_sink = 1;
+            } else if (strcmp(optarg, "write") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            extent_bytes = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            uring_depth = atoi(optarg);
+            break;
+        case 'R':
+            rotate_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'T':
+            rotate_secs = atoi(optarg);
+            break;
+        case 'S':
+            busy_poll_us = atoi(optarg);
+            break;
+        case 's':
+            spin_us = atoi(optarg);
+            break;
+        case 'C':
+            cpu_spec = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
     // Validate command-line arguments
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <udp_port> <log_file>\n", argv[0]);
+    if (argc - optind != 2 || busy_poll_us < 0 || spin_us < 0 || nshards < 1 ||
+        batch_size < 1 || batch_size > MAX_BATCH || ring_bytes < SLOT_SIZE ||
+        writer_conf.flush_bytes < 1 || writer_conf.flush_us < 0 || writer_conf.sync_ms < 0 ||
+        extent_bytes < 1 || uring_depth < 1 || uring_depth > LOG_WRITER_MAX_URING_DEPTH ||
+        rotate_secs < 0) {
+        usage(argv[0]);
         return 1;
     }
-
-    // Create a UDP socket (SOCK_DGRAM = connectionless datagram socket)
-    int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock_fd < 0) {
-        perror("socket");
+    if (cpu_plan_parse(&cpu_plan, cpu_spec) == -1) {
         return 1;
     }
-
-    // Prepare the server address structure
-    struct sockaddr_in serv_addr = {0};
-    serv_addr.sin_family = AF_INET;           // IPv4
-    serv_addr.sin_addr.s_addr = INADDR_ANY;   // Accept packets on any interface
-    serv_addr.sin_port = htons(atoi(argv[1])); // Convert port to network byte order
+    const char* udp_port = argv[optind];
+    const char* log_path = argv[optind + 1];
 
     // Basic validation: ensure port is non-zero
-    if (serv_addr.sin_port == 0) {
-        fprintf(stderr, "Usage: %s <udp_port> <log_file>\n", argv[0]);
-        close(sock_fd);
+    in_port_t port = htons(atoi(udp_port));
+    if (port == 0) {
+        usage(argv[0]);
         return 1;
     }
 
-    // Bind the socket to the specified port
-    if (bind(sock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("bind");
-        close(sock_fd);
+    int nlogs = split_output ? nshards : 1;
+    shards = calloc((size_t)nshards, sizeof(shard_t));
+    writers = calloc((size_t)nlogs, sizeof(log_writer_t));
+    log_fds = malloc(sizeof(int) * (size_t)nlogs);
+    maps = calloc((size_t)nlogs, sizeof(mmap_log_t));
+    rotators = calloc((size_t)nlogs, sizeof(log_rotator_t));
+    if (!shards || !writers || !log_fds || !maps || !rotators) {
+        perror("malloc");
         return 1;
     }
+    for (int i = 0; i < nshards; i++) {
+        shards[i].sock_fd = -1;
+    }
+    for (int j = 0; j < nlogs; j++) {
+        log_fds[j] = -1;
+    }
 
-    // Open log file in append mode
-    FILE* fp = fopen(argv[2], "a");
-    if (!fp) {
-        perror("fopen");
-        close(sock_fd);
-        return 1;
+    // Create and bind the shard sockets
+    for (int i = 0; i < nshards; i++) {
+        shards[i].id = i;
+        shards[i].sock_fd = open_shard_socket(port);
+        if (shards[i].sock_fd < 0 || rx_batch_init(&shards[i].batch, batch_size) == -1) {
+            teardown(0, 0);
+            return 1;
+        }
     }
 
-    // Disable buffering to ensure immediate writes (important for logs)
-    setbuf(fp, NULL);
+    // Open the log file(s) in append mode (read-write to map them); only the writer threads write.
+    // When rotating, the rotators open every segment instead.
+    int rotating = rotate_bytes > 0 || rotate_secs > 0;
+    for (int j = 0; j < nlogs && !rotating; j++) {
+        char path[4096];
+        if (split_output) {
+            snprintf(path, sizeof(path), "%s.%d", log_path, j);
+        } else {
+            snprintf(path, sizeof(path), "%s", log_path);
+        }
+        log_fds[j] = open(path, (mmap_sink ? O_RDWR : O_WRONLY | O_APPEND) | O_CREAT | O_CLOEXEC, 0644);
+        if (log_fds[j] < 0) {
+            perror("open log file");
+            teardown(0, 0);
+            return 1;
+        }
+    }
 
-    printf("UDP server listening on port %s, writing to %s\n", argv[1], argv[2]);
-    printf("Type 'quit' and press Enter to exit the server gracefully.\n");
+    // Start the log writers first; writer j (and its mapping thread) inherits the CPU of slot nshards + j
+    for (int j = 0; j < nlogs; j++) {
+        writers[j] = writer_conf;
+        if (cpu_plan_pin(&cpu_plan, nshards + j) == -1) {
+            teardown(0, 0);
+            return 1;
+        }
+        if (rotating) {
+            char path[4096];
+            if (split_output) {
+                snprintf(path, sizeof(path), "%s.%d", log_path, j);
+            } else {
+                snprintf(path, sizeof(path), "%s", log_path);
+            }
+            log_rotator_t* r = &rotators[j];
+            r->max_bytes = rotate_bytes;
+            r->max_secs = rotate_secs;
+            // io_uring writes at explicit offsets, so its segments must not append
+            r->open_flags = mmap_sink ? O_RDWR : uring_sink ? O_WRONLY : O_WRONLY | O_APPEND;
+            r->extent = mmap_sink ? extent_bytes : 0;
+            r->sync_ms = writer_conf.sync_ms;
+            if (log_rotator_start(r, path, &writers[j].segment) == -1) {
+                teardown(0, 0);
+                return 1;
+            }
+            writers[j].rotator = r;
+            writers[j].map = writers[j].segment->map;
+        } else if (mmap_sink) {
+            char tail_path[4096];
+            if (split_output) {
+                snprintf(tail_path, sizeof(tail_path), "%s.%d.tail", log_path, j);
+            } else {
+                snprintf(tail_path, sizeof(tail_path), "%s.tail", log_path);
+            }
+            if (mmap_log_open(&maps[j], log_fds[j], tail_path, extent_bytes, writer_conf.sync_ms) == -1) {
+                teardown(0, 0);
+                return 1;
+            }
+            writers[j].map = &maps[j];
+        }
+        writers[j].uring_depth = uring_sink ? uring_depth : 0;
+        int fd = writers[j].rotator ? writers[j].segment->fd : log_fds[j];
+        if (log_writer_start(&writers[j], fd, ring_bytes, split_output ? 1 : nshards) == -1) {
+            if (writers[j].rotator) {
+                log_rotator_stop(writers[j].rotator, writers[j].segment);
+            } else if (writers[j].map) {
+                mmap_log_close(writers[j].map);
+            }
+            teardown(0, 0);
+            return 1;
+        }
+        nwriters++;
+    }
+    cpu_plan_restore(&cpu_plan);
+    for (int i = 0; i < nshards; i++) {
+        shards[i].writer = &writers[split_output ? i : 0];
+        shards[i].lane = split_output ? 0 : i;
+    }
 
-    // Prepare arguments for the thread
-    thread_data_t* thread_data = malloc(sizeof(thread_data_t));
-    if (!thread_data) {
-        perror("malloc");
-        fclose(fp);
-        close(sock_fd);
-        return 1;
+    printf("UDP server listening on port %s, writing to %s%s\n", udp_port, log_path,
+           split_output ? ".<shard>" : "");
+    if (nshards > 1) {
+        printf("%d receive shards (SO_REUSEPORT), %s\n", nshards,
+               split_output ? "one log file and writer each" : "one shared log writer");
     }
-    thread_data->sock_fd = sock_fd;
-    thread_data->fp = fp;
+    printf("Type 'quit' and press Enter to exit the server gracefully.\n");
+    cpu_plan_print(&cpu_plan);
 
-    // Start the UDP receiving thread
-    pthread_t udp_thread;
-    if (pthread_create(&udp_thread, NULL, udp_receive_thread, thread_data) != 0) {
-        perror("pthread_create");
-        fclose(fp);
-        close(sock_fd);
-        free(thread_data);
-        return 1;
+    // Start the UDP receiving threads
+    // Each thread inherits the CPU it is created on
+    for (int i = 0; i < nshards; i++) {
+        if (cpu_plan_pin(&cpu_plan, i) == -1 ||
+            pthread_create(&shards[i].thread, NULL, udp_receive_thread, &shards[i]) != 0) {
+            fprintf(stderr, "Failed to start the receive thread\n");
+            teardown(i, 0);
+            return 1;
+        }
     }
+    cpu_plan_restore(&cpu_plan);
 
     // Main thread: wait for user input to quit
     char input[10];
     while (running) {
         if (fgets(input, sizeof(input), stdin)) {
             if (strncmp(input, "quit", 4) == 0) {
-                // Set running flag to 0 to signal other thread to stop
+                // Set running flag to 0 to signal the receive threads to stop
                 running = 0;
                 printf("Shutting down UDP server...\n");
                 break;
@@ -186,13 +848,9 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Wait for the UDP thread to finish
-    pthread_join(udp_thread, NULL);
-
-    // Close file and socket
-    fclose(fp);
-    close(sock_fd);
+    // Wait for the UDP threads to finish, drain the writers and report
+    teardown(nshards, 1);
 
     printf("UDP server stopped.\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,288 @@
+/**
+ * @file uring.c
+ * @brief Implementation of the minimal io_uring wrapper declared in `uring.h`.
+ *
+ * Only the raw io_uring_setup(), io_uring_enter() and io_uring_register()
+ * system calls are used, so no liburing is required at build or run time.
+ * Memory ordering follows the kernel's io_uring documentation: the kernel-owned
+ * indices (SQ head, CQ tail) are loaded with acquire semantics and the
+ * application-owned ones (SQ tail, CQ head, buffer ring tail) are stored with
+ * release semantics.
+ */
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+/**
+ * @brief Thin wrapper around the io_uring_setup system call.
+ */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+/**
+ * @brief Thin wrapper around the io_uring_enter system call.
+ */
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, const void* arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/**
+ * @brief Thin wrapper around the io_uring_register system call.
+ */
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t* ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->ring_fd = sys_io_uring_setup(entries, &p);
+    if (ring->ring_fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    ring->features = p.features;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        // Both rings live in one mapping; size it for the larger of the two
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        perror("mmap io_uring SQ ring");
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            perror("mmap io_uring CQ ring");
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(ring->ring_fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap io_uring SQEs");
+        if (ring->cq_ptr != ring->sq_ptr) {
+            munmap(ring->cq_ptr, ring->cq_len);
+        }
+        munmap(ring->sq_ptr, ring->sq_len);
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    char* sq = (char*)ring->sq_ptr;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char* cq = (char*)ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_exit(uring_t* ring) {
+    if (ring->ring_fd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->ring_fd);
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    unsigned idx = ring->sq_local_tail & ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t* ring, unsigned wait_nr, int timeout_ms) {
+    unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    const void* argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    ring->enters++;
+    int ret = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags, argp, argsz);
+    if (ret < 0) {
+        if (errno == ETIME || errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+    return ret;
+}
+
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, unsigned n) {
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov, n) < 0) {
+        perror("io_uring_register BUFFERS");
+        return -1;
+    }
+    return 0;
+}
+
+int uring_register_files(uring_t* ring, const int* fds, unsigned n) {
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES, fds, n) < 0) {
+        perror("io_uring_register FILES");
+        return -1;
+    }
+    return 0;
+}
+
+int uring_update_file(uring_t* ring, unsigned slot, int fd) {
+    struct io_uring_files_update up;
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.fds = (uint64_t)(uintptr_t)&fd;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES_UPDATE, &up, 1) < 0) {
+        perror("io_uring_register FILES_UPDATE");
+        return -1;
+    }
+    return 0;
+}
+
+int uring_buf_ring_init(uring_t* ring, uring_buf_ring_t* br, unsigned short bgid,
+                        unsigned entries, unsigned buf_size) {
+    memset(br, 0, sizeof(*br));
+    br->br_len = entries * sizeof(struct io_uring_buf);
+    br->br = mmap(NULL, br->br_len, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br->br == MAP_FAILED) {
+        perror("mmap buffer ring");
+        br->br = NULL;
+        return -1;
+    }
+    br->bufs = malloc((size_t)entries * buf_size);
+    if (!br->bufs) {
+        perror("malloc buffer ring storage");
+        munmap(br->br, br->br_len);
+        br->br = NULL;
+        return -1;
+    }
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)br->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register PBUF_RING");
+        free(br->bufs);
+        munmap(br->br, br->br_len);
+        br->br = NULL;
+        br->bufs = NULL;
+        return -1;
+    }
+
+    for (unsigned i = 0; i < entries; i++) {
+        uring_buf_ring_add(br, (unsigned short)i);
+    }
+    uring_buf_ring_advance(br);
+    return 0;
+}
+
+void uring_buf_ring_free(uring_t* ring, uring_buf_ring_t* br) {
+    if (!br->br) {
+        return;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(br->br, br->br_len);
+    free(br->bufs);
+    br->br = NULL;
+    br->bufs = NULL;
+}
+
+void uring_buf_ring_add(uring_buf_ring_t* br, unsigned short bid) {
+    struct io_uring_buf* buf = &br->br->bufs[br->tail & (br->entries - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)uring_buf_ring_addr(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    br->tail++;
+}
+
+void uring_buf_ring_advance(uring_buf_ring_t* br) {
+    __atomic_store_n(&br->br->tail, br->tail, __ATOMIC_RELEASE);
+}
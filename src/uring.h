@@ -0,0 +1,202 @@
+/**
+ * @file uring.h
+ * @brief Minimal io_uring wrapper built directly on the raw system calls.
+ *
+ * The project has no external dependencies, so instead of liburing this header
+ * declares just what the servers need: ring setup and teardown, SQE allocation,
+ * submission with an optional wait timeout, CQE iteration, provided buffer
+ * rings (IORING_REGISTER_PBUF_RING) for multishot receives, and registered
+ * buffers and files for fixed writes.
+ *
+ * A ring is not thread-safe; every thread that submits I/O owns its own ring.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * @brief One io_uring instance with its mapped submission and completion queues.
+ */
+typedef struct {
+    int ring_fd;                    ///< File descriptor returned by io_uring_setup()
+    unsigned features;              ///< IORING_FEAT_* flags reported by the kernel
+
+    // Submission queue (shared with the kernel)
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;         ///< SQEs handed out but not yet published
+    struct io_uring_sqe* sqes;
+
+    // Completion queue (shared with the kernel)
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Mappings, kept for munmap()
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+
+    unsigned long long enters;      ///< io_uring_enter() calls made through this ring
+} uring_t;
+
+/**
+ * @brief A provided buffer ring: equal-sized buffers the kernel picks from on receive.
+ */
+typedef struct {
+    struct io_uring_buf_ring* br;   ///< Shared ring of buffer descriptors
+    size_t br_len;                  ///< Size of the br mapping
+    char* bufs;                     ///< entries * buf_size bytes of buffer storage
+    unsigned entries;               ///< Number of buffers (power of two)
+    unsigned buf_size;              ///< Size of each buffer
+    unsigned short bgid;            ///< Buffer group id used in IOSQE_BUFFER_SELECT SQEs
+    unsigned short tail;            ///< Local tail, published by uring_buf_ring_advance()
+} uring_buf_ring_t;
+
+/**
+ * @brief Creates an io_uring instance and maps its queues.
+ *
+ * @param ring    Ring to initialise.
+ * @param entries Submission queue size (rounded up to a power of two by the kernel).
+ * @return 0 on success, -1 on error (errno set, message printed).
+ */
+int uring_init(uring_t* ring, unsigned entries);
+
+/**
+ * @brief Unmaps the queues and closes the ring.
+ *
+ * @param ring Ring to destroy.
+ */
+void uring_exit(uring_t* ring);
+
+/**
+ * @brief Returns a zeroed SQE, or NULL if the submission queue is full.
+ *
+ * The SQE becomes visible to the kernel on the next uring_submit_and_wait().
+ *
+ * @param ring The ring.
+ * @return Pointer to the SQE to fill in, or NULL.
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/**
+ * @brief Submits pending SQEs and optionally waits for completions.
+ *
+ * @param ring       The ring.
+ * @param wait_nr    Number of completions to wait for (0 = don't wait).
+ * @param timeout_ms Maximum wait in milliseconds, or -1 to wait indefinitely. A timeout
+ *                   uses IORING_ENTER_EXT_ARG, so it needs IORING_FEAT_EXT_ARG in
+ *                   ring->features (Linux 5.11); without it the call fails with EINVAL.
+ * @return Number of SQEs consumed, or -1 on error (errno set; ETIME and EINTR
+ *         are reported as 0 because they only mean the wait ended early).
+ */
+int uring_submit_and_wait(uring_t* ring, unsigned wait_nr, int timeout_ms);
+
+/**
+ * @brief Returns the oldest unconsumed CQE, or NULL if none is ready.
+ *
+ * @param ring The ring.
+ * @return Pointer to the CQE; release it with uring_cqe_seen().
+ */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring);
+
+/**
+ * @brief Marks the CQE returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring The ring.
+ */
+void uring_cqe_seen(uring_t* ring);
+
+/**
+ * @brief Registers buffers for IORING_OP_READ_FIXED / WRITE_FIXED (buf_index = position in iov).
+ *
+ * The kernel pins the pages for the lifetime of the ring, which counts
+ * against RLIMIT_MEMLOCK.
+ *
+ * @param ring The ring.
+ * @param iov  Buffers to register.
+ * @param n    Number of buffers.
+ * @return 0 on success, -1 on error (errno set, message printed).
+ */
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, unsigned n);
+
+/**
+ * @brief Registers files for IOSQE_FIXED_FILE SQEs (sqe->fd = position in fds).
+ *
+ * @param ring The ring.
+ * @param fds  File descriptors to register.
+ * @param n    Number of descriptors.
+ * @return 0 on success, -1 on error (errno set, message printed).
+ */
+int uring_register_files(uring_t* ring, const int* fds, unsigned n);
+
+/**
+ * @brief Replaces one registered file (-1 leaves the slot empty).
+ *
+ * SQEs already submitted against the slot keep the file they were submitted with.
+ *
+ * @param ring The ring.
+ * @param slot Position in the registered files.
+ * @param fd   New file descriptor, or -1.
+ * @return 0 on success, -1 on error (errno set, message printed).
+ */
+int uring_update_file(uring_t* ring, unsigned slot, int fd);
+
+/**
+ * @brief Allocates a provided buffer ring, registers it and fills it with all buffers.
+ *
+ * @param ring     The ring to register with.
+ * @param br       Buffer ring to initialise.
+ * @param bgid     Buffer group id.
+ * @param entries  Number of buffers (must be a power of two, at most 32768).
+ * @param buf_size Size of each buffer.
+ * @return 0 on success, -1 on error (message printed).
+ */
+int uring_buf_ring_init(uring_t* ring, uring_buf_ring_t* br, unsigned short bgid,
+                        unsigned entries, unsigned buf_size);
+
+/**
+ * @brief Unregisters and frees a provided buffer ring.
+ *
+ * @param ring The ring it was registered with.
+ * @param br   Buffer ring to destroy.
+ */
+void uring_buf_ring_free(uring_t* ring, uring_buf_ring_t* br);
+
+/**
+ * @brief Returns buffer `bid` to the ring (not visible until uring_buf_ring_advance()).
+ *
+ * @param br  Buffer ring.
+ * @param bid Buffer id taken from a CQE.
+ */
+void uring_buf_ring_add(uring_buf_ring_t* br, unsigned short bid);
+
+/**
+ * @brief Publishes every buffer added since the last call to the kernel.
+ *
+ * @param br Buffer ring.
+ */
+void uring_buf_ring_advance(uring_buf_ring_t* br);
+
+/**
+ * @brief Returns the address of buffer `bid`.
+ *
+ * @param br  Buffer ring.
+ * @param bid Buffer id.
+ * @return Pointer to the start of the buffer.
+ */
+static inline char* uring_buf_ring_addr(const uring_buf_ring_t* br, unsigned short bid) {
+    return br->bufs + (size_t)bid * br->buf_size;
+}
+
+#endif // URING_H